@@ -0,0 +1,295 @@
+#include "../src/cpu.h"
+#include "../src/graphics.h"
+#include "../src/timer.h"
+#include "../src/rom.h"
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/*
+ * Headless throughput benchmark.
+ *
+ *   bench/gbemu                              per-opcode and per-scanline numbers only
+ *   bench/gbemu <rom> [frames] [n] [worker]  the same + whole-frame throughput,
+ *                                            drawing one frame in n (default 1),
+ *                                            on a render worker thread if asked
+ *
+ * `make bench` builds several binaries from the same sources: bench/gbemu
+ * uses the defaults (threaded dispatch, lazy flags), bench/gbemu_switch is
+ * built with -DDISPATCH_SWITCH and bench/gbemu_eager with -DEAGER_FLAGS.
+ * bench/gbemu_flagstats is built with -DFLAG_STATS and also reports how many
+ * flag records were overwritten without anything reading them.
+ * bench/gbemu_jit is built with -DJIT and runs hot blocks as native code.
+ * bench/gbemu_fastmem is built with -DFASTMEM and reaches plain memory
+ * through the host-MMU window rather than the page table.
+ * bench/gbemu_aot (make aot AOT_ROM=<rom>) runs the blocks recomp/gbrecomp
+ * generated for that one ROM and only interprets the rest.
+ */
+
+#define STEPS_PER_OPCODE 200000
+#define RESET_INTERVAL 1024 // instructions between state resets
+#define SCANLINE_FRAMES 2000 // frames of lines for bench_scanlines()
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+#if defined(AOT)
+static const char *dispatch_name = "aot";
+#elif defined(JIT)
+static const char *dispatch_name = "jit";
+#elif defined(DISPATCH_SWITCH)
+static const char *dispatch_name = "switch";
+#else
+static const char *dispatch_name = "threaded";
+#endif
+
+#ifdef EAGER_FLAGS
+static const char *flags_name = "eager";
+#else
+static const char *flags_name = "lazy";
+#endif
+
+#ifdef FLAG_STATS
+static void print_flag_stats(const struct CPU *cpu) {
+    const struct flag_stats *stats = &cpu->flag_stats;
+    printf("flag records: %llu  never read: %llu (%.1f%%)  flag reads: %llu\n",
+           (unsigned long long)stats->writes, (unsigned long long)stats->unread,
+           stats->writes ? 100.0 * stats->unread / stats->writes : 0.0,
+           (unsigned long long)stats->reads);
+}
+#endif
+
+/* Fill the whole address space with `opcode` so every fetch, immediate and
+   jump target lands on the same instruction again. */
+static void reset_opcode_state(struct CPU *cpu, uint8_t opcode) {
+    memset(cpu->bus.rom0, opcode, 0x4000);
+    memset(cpu->bus.rom_banks, opcode, 0x4000);
+    memset(cpu->bus.vram, opcode, sizeof(cpu->bus.vram));
+    memset(cpu->bus.cart_ram, opcode, 0x2000);
+    memset(cpu->bus.wram, opcode, sizeof(cpu->bus.wram));
+    memset(cpu->bus.oam, opcode, sizeof(cpu->bus.oam));
+    memset(cpu->bus.high, opcode, sizeof(cpu->bus.high));
+    cpu->bus.io.stat = 0x80; // mode 0, VRAM/OAM readable
+    cpu->bus.io.iflag = 0xE0;
+    cpu->bus.ie = 0x00; // no interrupts
+    cpu->pc = 0xC000;
+    cpu->sp = 0xD000;
+    cpu->halted = false;
+    cpu->ime = false;
+    cpu->ime_pending = false;
+    cpu->bootrom_enabled = false;
+    memory_map_update(cpu);
+    icache_flush(cpu); // the code under every cached PC just changed
+#ifdef JIT
+    if (cpu->jit) {
+        jit_flush(cpu);
+    }
+#endif
+}
+
+static void bench_opcodes(void) {
+    struct CPU *cpu = cpu_alloc();
+    cpu_init(cpu);
+    cpu->bus.rom0 = malloc(0x4000);
+    cpu->bus.rom_banks = malloc(0x4000);
+    cpu->bus.cart_ram = malloc(0x2000);
+    cpu->bus.ram_size = 0x2000;
+    cpu->bus.mbc_type = 0;
+    cpu->bus.num_rom_banks = 2;
+    mbc_init(cpu);
+#ifdef FASTMEM
+    fastmem_init(cpu);
+#endif
+#ifdef JIT
+    jit_init(cpu);
+#endif
+
+    printf("Per-opcode throughput (%s dispatch, %s flags)\n", dispatch_name, flags_name);
+    printf("opcode  step ns/inst  block ns/inst\n");
+
+    double step_total = 0, block_total = 0;
+    int measured = 0;
+    for (int op = 0; op < 256; op++) {
+        if (op == 0x10 || op == 0x76) {
+            continue; // STOP/HALT never return to the dispatcher
+        }
+
+        // one instruction per step_cpu() call, state resets are not timed
+        uint64_t step_cycles = 0;
+        double step_time = 0;
+        for (int done = 0; done < STEPS_PER_OPCODE; done += RESET_INTERVAL) {
+            reset_opcode_state(cpu, op);
+            double start = now_ns();
+            for (int i = 0; i < RESET_INTERVAL; i++) {
+                step_cpu(cpu);
+                step_cycles += cpu->cycles;
+            }
+            step_time += now_ns() - start;
+        }
+        int steps = (STEPS_PER_OPCODE + RESET_INTERVAL - 1) / RESET_INTERVAL * RESET_INTERVAL;
+        double step_ns = step_time / steps;
+
+        // same amount of work chained through exec_block()
+        double cycles_per_inst = (double)step_cycles / steps;
+        uint64_t block_cycles = 0;
+        double block_time = 0;
+        while (block_cycles < step_cycles) {
+            reset_opcode_state(cpu, op);
+            double start = now_ns();
+            block_cycles += exec_block(cpu, RESET_INTERVAL * cycles_per_inst);
+            block_time += now_ns() - start;
+        }
+        double block_ns = block_time / (block_cycles / cycles_per_inst);
+
+        printf("  0x%02X  %12.2f  %13.2f\n", op, step_ns, block_ns);
+        step_total += step_ns;
+        block_total += block_ns;
+        measured++;
+    }
+    printf("average %12.2f  %13.2f\n\n", step_total / measured, block_total / measured);
+
+#ifdef JIT
+    jit_free(cpu);
+#endif
+#ifdef FASTMEM
+    fastmem_free(cpu);
+#endif
+    free(cpu->bus.rom0);
+    free(cpu->bus.rom_banks);
+    free(cpu->bus.cart_ram);
+    free(cpu);
+}
+
+static int bench_frames(const char *rom_path, int frames, uint32_t render_every, bool worker) {
+    struct CPU *cpu = cpu_alloc();
+    cpu_init(cpu);
+    if (load_rom(cpu, rom_path) != 0) {
+        fprintf(stderr, "Failed to load ROM\n");
+        return -1;
+    }
+    rtc_set_emulated(cpu, true); // runs time the same whatever the wall clock says
+#ifdef FASTMEM
+    fastmem_init(cpu);
+#endif
+#ifdef JIT
+    jit_init(cpu);
+#endif
+#ifdef AOT
+    if (aot_attach(cpu, &aot_image) != 0) {
+        fprintf(stderr, "Recompiled image is for %s, interpreting instead\n", aot_image.rom_name);
+    }
+#endif
+
+    struct GPU *gpu = calloc(1, sizeof(struct GPU));
+    gpu->bus = &cpu->bus;
+    if (render_every > 1) {
+        gpu_set_render_policy(gpu, RENDER_EVERY_NTH, render_every);
+    }
+    if (worker && gpu_start_worker(cpu, gpu) != 0) {
+        fprintf(stderr, "Render worker unavailable, drawing inline\n");
+        worker = false;
+    }
+
+    double start = now_ns();
+    for (int frame = 0; frame < frames; frame++) {
+        while (!gpu->should_render) {
+            cpu_run_cycles(cpu, gpu, CYCLES_PER_FRAME);
+        }
+        gpu->should_render = false;
+    }
+    double elapsed = now_ns() - start;
+    gpu_stop_worker(cpu, gpu);
+
+    printf("Whole-frame throughput (%s dispatch, %s flags, drawing 1 frame in %u%s)\n",
+           dispatch_name, flags_name, render_every > 1 ? render_every : 1, worker ? " on a worker" : "");
+    printf("frames: %d  total: %.1f ms  per frame: %.1f us  fps: %.1f\n",
+           frames, elapsed / 1e6, elapsed / 1e3 / frames, frames * 1e9 / elapsed);
+#ifdef FLAG_STATS
+    print_flag_stats(cpu);
+#endif
+
+#ifdef AOT
+    aot_detach(cpu);
+#endif
+#ifdef JIT
+    jit_free(cpu);
+#endif
+    unload_rom(cpu);
+#ifdef FASTMEM
+    fastmem_free(cpu);
+#endif
+    free(gpu);
+    free(cpu);
+    return 0;
+}
+
+/* Time render_scanline() on its own, on fixed VRAM and OAM contents, for a
+   few LCDC setups. The tile cache is warm after the first frame, as it is
+   in a game that isn't loading new tiles. */
+static void bench_scanlines(void) {
+    static const struct {
+        const char *name;
+        uint8_t lcdc;
+    } setups[] = {
+        { "bg", 0x91 },
+        { "bg+window", 0xB1 },
+        { "bg+sprites", 0x93 },
+        { "bg+window+8x16 sprites", 0xF7 },
+    };
+    struct CPU *cpu = cpu_alloc();
+    cpu_init(cpu);
+    struct GPU *gpu = calloc(1, sizeof(struct GPU));
+    gpu->bus = &cpu->bus;
+    uint32_t seed = 0x12345678;
+    for (size_t i = 0; i < sizeof(cpu->bus.vram); i++) {
+        seed = seed * 1103515245 + 12345;
+        cpu->bus.vram[i] = seed >> 16;
+    }
+    for (int sprite = 0; sprite < 40; sprite++) {
+        cpu->bus.oam[sprite * 4] = 16 + sprite * 144 / 40;       // a few on every line
+        cpu->bus.oam[sprite * 4 + 1] = 8 + (sprite * 37) % 160;
+        cpu->bus.oam[sprite * 4 + 2] = sprite * 3;
+        cpu->bus.oam[sprite * 4 + 3] = (sprite & 7) << 4;        // palettes, flips, priority
+    }
+    cpu->bus.io.scx = 3;
+    cpu->bus.io.scy = 5;
+    cpu->bus.io.wx = 87;
+    cpu->bus.io.wy = 40;
+
+    printf("Scanline rendering\n");
+    for (size_t i = 0; i < sizeof(setups) / sizeof(setups[0]); i++) {
+        cpu->bus.io.lcdc = setups[i].lcdc;
+        double start = now_ns();
+        for (int frame = 0; frame < SCANLINE_FRAMES; frame++) {
+            gpu->window_line = 0;
+            for (int line = 0; line < SCREEN_HEIGHT; line++) {
+                cpu->bus.io.ly = line;
+                render_scanline(gpu, line);
+            }
+        }
+        double elapsed = now_ns() - start;
+        printf("  %-24s %8.1f ns/line\n", setups[i].name, elapsed / SCANLINE_FRAMES / SCREEN_HEIGHT);
+    }
+    printf("\n");
+    free(gpu);
+    free(cpu);
+}
+
+int main(int argc, char *argv[]) {
+    bench_opcodes();
+    bench_scanlines();
+    if (argc >= 2) {
+        int frames = argc >= 3 ? atoi(argv[2]) : 600;
+        uint32_t render_every = argc >= 4 ? (uint32_t)atoi(argv[3]) : 1;
+        bool worker = argc >= 5 && strcmp(argv[4], "worker") == 0;
+        if (bench_frames(argv[1], frames, render_every, worker) != 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,1213 @@
+#include "../src/cpu.h"
+#include "../src/graphics.h"
+#include "../src/mbc.h"
+#include "../src/rom.h"
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * Headless checks of the parts the SM83 vectors don't reach.
+ *
+ *   checks/gbemu --fuse    copy and fill loops run fused and unfused
+ *   checks/gbemu --hle     library routines run natively and by exec_inst()
+ *   checks/gbemu --idle    polling loops run with and without idle skipping
+ *   checks/gbemu --rtc     MBC3 clock latch, rollover, day carry and .sav footers
+ *   checks/gbemu --mbc     MBC2 registers and RAM, the MBC5 9-bit ROM bank
+ *   checks/gbemu --memmap  the page table (and fastmem window) against the full decode
+ *   checks/gbemu --render  frames drawn inline, without SSSE3 and on the render worker
+ *
+ * Prints nothing and exits 0 when everything matches, otherwise reports
+ * each mismatch on stderr and exits 1. Built with the same flags as the
+ * emulator (make checks), so it sees what a game would; checks/gbemu_fastmem
+ * is built with -DFASTMEM and runs them through the host-MMU window.
+ */
+
+static int failures;
+
+static void fail(const char *check, const char *what, unsigned expected, unsigned got) {
+    fprintf(stderr, "%s: %s mismatch: expected 0x%X, got 0x%X\n", check, what, expected, got);
+    failures++;
+}
+
+// A CPU on a hand-built cartridge of `banks` 16KB ROM banks and `ram_size` bytes of RAM
+static struct CPU *check_cpu(uint8_t mbc_type, unsigned banks, size_t ram_size) {
+    struct CPU *cpu = cpu_alloc();
+    cpu_init(cpu);
+    cpu->bootrom_enabled = false;
+    cpu->bus.rom0 = calloc(1, 0x4000);
+    cpu->bus.rom_banks = calloc(banks - 1, 0x4000);
+    cpu->bus.cart_ram = ram_size ? calloc(1, ram_size) : NULL;
+    if (!cpu->bus.rom0 || !cpu->bus.rom_banks || (ram_size && !cpu->bus.cart_ram)) {
+        fprintf(stderr, "Failed to allocate the cartridge\n");
+        exit(1);
+    }
+    cpu->bus.mbc_type = mbc_type;
+    cpu->bus.num_rom_banks = banks;
+    cpu->bus.ram_size = ram_size;
+    mbc_init(cpu);
+    memory_map_update(cpu); // bank 0 is there now
+#ifdef FASTMEM
+    if (fastmem_init(cpu) != 0) {
+        fprintf(stderr, "Failed to map the fastmem window\n");
+        exit(1);
+    }
+#endif
+    return cpu;
+}
+
+static void free_cpu(struct CPU *cpu) {
+#ifdef FASTMEM
+    fastmem_free(cpu);
+#endif
+    free(cpu->bus.rom0);
+    free(cpu->bus.rom_banks);
+    free(cpu->bus.cart_ram);
+    free(cpu);
+}
+
+/* Fused against unfused loops
+   Only loops in ROM are fused (fuse.h), so each loop runs once from ROM and
+   once from WRAM, in the same chunks of cpu_run_cycles(), and has to leave
+   the same registers, flags, clock and memory behind. The code only uses
+   relative jumps, so it runs the same wherever it is put.
+*/
+#define FUSE_ROM_CODE 0x0200
+#define FUSE_RAM_CODE 0xD800 // up to 0xDFFF, code and stack, not compared
+#define FUSE_STACK 0xDFF0
+#define FUSE_MAX_CYCLES (60 * CYCLES_PER_FRAME) // a second, far longer than any of them takes
+
+struct fuse_case {
+    const char *name;
+    uint8_t code[40]; // setup, loop, then JR -2 at `spin`
+    uint8_t loop;     // offset of the loop's first instruction
+    uint8_t spin;     // offset of the final JR -2
+};
+
+static const struct fuse_case fuse_cases[] = {
+    { "copy BC ROM to WRAM",
+      { 0x21, 0x00, 0x20,                          // LD HL,0x2000
+        0x11, 0x00, 0xC0,                          // LD DE,0xC000
+        0x01, 0x00, 0x04,                          // LD BC,0x0400
+        0x2A, 0x12, 0x13, 0x0B, 0x78, 0xB1, 0x20, 0xF8, // LD A,(HL+) / LD (DE),A / INC DE / DEC BC / LD A,B / OR C / JR NZ
+        0x18, 0xFE },
+      9, 17 },
+    { "copy C (DE) to VRAM",
+      { 0x11, 0x00, 0x21,                          // LD DE,0x2100
+        0x21, 0x00, 0x80,                          // LD HL,0x8000
+        0x0E, 0x00,                                // LD C,0 (256 bytes)
+        0x1A, 0x22, 0x13, 0x0D, 0x20, 0xFA,        // LD A,(DE) / LD (HL+),A / INC DE / DEC C / JR NZ
+        0x18, 0xFE },
+      8, 14 },
+    { "copy B onto itself",
+      { 0x21, 0x00, 0xC0,                          // LD HL,0xC000
+        0x11, 0x01, 0xC0,                          // LD DE,0xC001
+        0x06, 0x80,                                // LD B,0x80
+        0x2A, 0x12, 0x13, 0x05, 0x20, 0xFA,        // LD A,(HL+) / LD (DE),A / INC DE / DEC B / JR NZ
+        0x18, 0xFE },
+      8, 14 },
+    { "fill B down",
+      { 0x21, 0xFF, 0xC7,                          // LD HL,0xC7FF
+        0x3E, 0x5A,                                // LD A,0x5A
+        0x06, 0x00,                                // LD B,0 (256 bytes)
+        0x32, 0x05, 0x20, 0xFC,                    // LD (HL-),A / DEC B / JR NZ
+        0x18, 0xFE },
+      7, 11 },
+    { "copy BC under timer interrupts",
+      { 0x3E, 0xC0, 0xE0, 0x06,                    // LD A,0xC0 / LDH (TMA),A
+        0x3E, 0x05, 0xE0, 0x07,                    // LD A,5 / LDH (TAC),A, an interrupt every 1024 cycles
+        0x3E, 0x04, 0xE0, 0xFF,                    // LD A,4 / LDH (IE),A
+        0xFB,                                      // EI
+        0x21, 0x00, 0x20,                          // LD HL,0x2000
+        0x11, 0x00, 0xC8,                          // LD DE,0xC800
+        0x01, 0x00, 0x08,                          // LD BC,0x0800
+        0x2A, 0x12, 0x13, 0x0B, 0x78, 0xB1, 0x20, 0xF8,
+        0x18, 0xFE },
+      22, 30 },
+};
+
+/* Timer handler, counts its calls at 0xC100 and folds the registers it
+   interrupted into a checksum at 0xC101, so a fused run that stops at an
+   event with anything off shows up even if the loop's end puts it right.
+   Unrolled, a loop here would be the last one fuse_visit() looked at. */
+static const uint8_t fuse_timer_handler[] = {
+    0xF5, 0xE5, 0xD5, 0xC5, // PUSH AF / PUSH HL / PUSH DE / PUSH BC
+    0x21, 0xE6, 0xDF,       // LD HL,0xDFE6 (FUSE_STACK - 10), the registers just pushed
+    0xFA, 0x01, 0xC1,       // LD A,(0xC101)
+    0x86, 0x07, 0x23,       // ADD A,(HL) / RLCA / INC HL, for each of the 8 bytes
+    0x86, 0x07, 0x23,
+    0x86, 0x07, 0x23,
+    0x86, 0x07, 0x23,
+    0x86, 0x07, 0x23,
+    0x86, 0x07, 0x23,
+    0x86, 0x07, 0x23,
+    0x86, 0x07, 0x23,
+    0xEA, 0x01, 0xC1,       // LD (0xC101),A
+    0x21, 0x00, 0xC1, 0x34, // LD HL,0xC100 / INC (HL)
+    0xC1, 0xD1, 0xE1, 0xF1, // POP BC / POP DE / POP HL / POP AF
+    0xD9,                   // RETI
+};
+
+// Run `test` from `base` in chunks of `chunk` cycles until it reaches its final JR
+static struct CPU *fuse_run_case(const struct fuse_case *test, uint16_t base, uint32_t chunk) {
+    struct CPU *cpu = check_cpu(0x00, 2, 0);
+    for (int i = 0x2000; i < 0x4000; i++) {
+        cpu->bus.rom0[i] = (uint8_t)(i * 7 + 3); // data to copy
+    }
+    memcpy(cpu->bus.rom0 + 0x50, fuse_timer_handler, sizeof(fuse_timer_handler));
+    if (base < 0x4000) {
+        memcpy(cpu->bus.rom0 + base, test->code, sizeof(test->code));
+    } else {
+        memcpy(cpu->bus.wram + (base - 0xC000), test->code, sizeof(test->code));
+    }
+    cpu->pc = base;
+    cpu->sp = FUSE_STACK;
+    cpu->ime = false;
+    cpu->bus.ie = 0;
+
+    struct GPU *gpu = calloc(1, sizeof(struct GPU));
+    gpu->bus = &cpu->bus;
+    while (cpu->pc != (uint16_t)(base + test->spin)) {
+        if (cpu->sched.now > FUSE_MAX_CYCLES) {
+            fprintf(stderr, "%s: never left the loop\n", test->name);
+            failures++;
+            break;
+        }
+        cpu_run_cycles(cpu, gpu, chunk);
+        gpu->should_render = false;
+    }
+    free(gpu);
+    return cpu;
+}
+
+static void check_fuse(void) {
+    static const uint32_t chunks[] = { CYCLES_PER_FRAME, 100 };
+    char name[96];
+    for (size_t i = 0; i < sizeof(fuse_cases) / sizeof(fuse_cases[0]); i++) {
+        for (size_t c = 0; c < sizeof(chunks) / sizeof(chunks[0]); c++) {
+            const struct fuse_case *test = &fuse_cases[i];
+            snprintf(name, sizeof(name), "fuse %s, chunks of %u", test->name, chunks[c]);
+            struct CPU *fused = fuse_run_case(test, FUSE_ROM_CODE, chunks[c]);
+            struct CPU *plain = fuse_run_case(test, FUSE_RAM_CODE, chunks[c]);
+
+#ifdef FUSE
+            if (fused->fuse.pc != FUSE_ROM_CODE + test->loop || fused->fuse.kind == FUSE_NONE) {
+                fprintf(stderr, "%s: loop was not recognized\n", name);
+                failures++;
+            }
+#endif
+            if (fused->sched.now != plain->sched.now) {
+                fail(name, "clock", (unsigned)plain->sched.now, (unsigned)fused->sched.now);
+            }
+            if (fused->pc - FUSE_ROM_CODE != plain->pc - FUSE_RAM_CODE) {
+                fail(name, "PC offset", plain->pc - FUSE_RAM_CODE, fused->pc - FUSE_ROM_CODE);
+            }
+            if (PACK_FLAGS(fused) != PACK_FLAGS(plain)) {
+                fail(name, "F", PACK_FLAGS(plain), PACK_FLAGS(fused));
+            }
+            if (fused->regs.a != plain->regs.a) {
+                fail(name, "A", plain->regs.a, fused->regs.a);
+            }
+            if (fused->regs.bc != plain->regs.bc) {
+                fail(name, "BC", plain->regs.bc, fused->regs.bc);
+            }
+            if (fused->regs.de != plain->regs.de) {
+                fail(name, "DE", plain->regs.de, fused->regs.de);
+            }
+            if (fused->regs.hl != plain->regs.hl) {
+                fail(name, "HL", plain->regs.hl, fused->regs.hl);
+            }
+            if (fused->sp != plain->sp) {
+                fail(name, "SP", plain->sp, fused->sp);
+            }
+            if (fused->ime != plain->ime || fused->bus.io.iflag != plain->bus.io.iflag) {
+                fail(name, "IME/IF", plain->ime << 8 | plain->bus.io.iflag, fused->ime << 8 | fused->bus.io.iflag);
+            }
+            for (int addr = 0xC000; addr < FUSE_RAM_CODE; addr++) {
+                if (fused->bus.wram[addr - 0xC000] != plain->bus.wram[addr - 0xC000]) {
+                    fprintf(stderr, "%s: WRAM differs from 0x%04X on\n", name, addr);
+                    failures++;
+                    break;
+                }
+            }
+            if (memcmp(fused->bus.vram, plain->bus.vram, sizeof(fused->bus.vram)) != 0) {
+                fprintf(stderr, "%s: VRAM differs\n", name);
+                failures++;
+            }
+            free_cpu(fused);
+            free_cpu(plain);
+        }
+    }
+}
+
+/* Library routines run natively against exec_inst()
+   Each routine of hle.c's table sits in ROM, found by hle_scan(), and is
+   called from 0x0200 once through cpu_run_cycles(), where the CALL hands
+   it to hle_visit(), and once an instruction at a time through
+   exec_inst(). Both have to leave the same registers, flags, clock and
+   memory behind. The cycles exec_inst() took are what cpu_run_cycles() is
+   given, so a native run that is short runs on into the NOPs after the
+   CALL and one that is long overshoots the clock. With the LCD on, events
+   fall inside the copies and fills and split them.
+*/
+#define HLE_CALLER 0x0200
+#define HLE_ENTRY_MEMCPY 0x1000
+#define HLE_ENTRY_MEMSET 0x1010
+#define HLE_ENTRY_MUL8 0x1020
+#define HLE_ENTRY_BANKED 0x4800 // memcpy in bank 2, memset in bank 3
+#define HLE_FOUND 5
+#define HLE_MAX_STEPS 1000000
+
+struct hle_case {
+    const char *name;
+    uint16_t entry;
+    uint8_t bank;  // ROM bank at 0x4000
+    bool lcd_off;  // so that VRAM is open and no event falls inside
+    bool native;   // expected to run natively
+    uint8_t a;
+    uint16_t bc, de, hl;
+};
+
+static const uint8_t hle_memcpy[] = { 0x2A, 0x12, 0x13, 0x0B, 0x78, 0xB1, 0x20, 0xF8, 0xC9 };
+static const uint8_t hle_memset[] = { 0x57, 0x7A, 0x22, 0x0B, 0x78, 0xB1, 0x20, 0xF9, 0xC9 };
+static const uint8_t hle_mul8[] = { 0x16, 0x00, 0x6A, 0x06, 0x08, 0x29, 0x30, 0x01, 0x19, 0x05, 0x20, 0xF9, 0xC9 };
+
+static const struct hle_case hle_cases[] = {
+    { "memcpy ROM to WRAM", HLE_ENTRY_MEMCPY, 1, false, true, 0x00, 0x0300, 0xC000, 0x2000 },
+    { "memcpy WRAM onto itself", HLE_ENTRY_MEMCPY, 1, false, true, 0x00, 0x0080, 0xC101, 0xC100 },
+    { "memcpy bank 2 to VRAM, LCD off", HLE_ENTRY_BANKED, 2, true, true, 0x00, 0x0200, 0x8800, 0x5000 },
+    { "memcpy to HRAM", HLE_ENTRY_MEMCPY, 1, false, false, 0x00, 0x0010, 0xFF90, 0x2000 },
+    { "memset WRAM", HLE_ENTRY_MEMSET, 1, false, true, 0x5A, 0x0234, 0x0000, 0xC400 },
+    { "memset bank 3 to VRAM, LCD off", HLE_ENTRY_BANKED, 3, true, true, 0xA5, 0x0400, 0x0000, 0x9800 },
+    { "memset of one byte", HLE_ENTRY_MEMSET, 1, true, true, 0x11, 0x0001, 0x0000, 0xC000 },
+    { "multiply", HLE_ENTRY_MUL8, 1, true, true, 0x00, 0x1234, 0x00D3, 0xB700 },
+    { "multiply 0xFF by 0xFF", HLE_ENTRY_MUL8, 1, true, true, 0x00, 0x0000, 0x00FF, 0xFF00 },
+    { "multiply by 0", HLE_ENTRY_MUL8, 1, true, true, 0x00, 0x0000, 0x0007, 0x0042 },
+};
+
+// A CPU about to call `test` from HLE_CALLER, the routines in ROM and scanned
+static struct CPU *hle_cpu(const struct hle_case *test) {
+    struct CPU *cpu = check_cpu(0x01, 4, 0);
+    for (int i = 0x2000; i < 0x4000; i++) {
+        cpu->bus.rom0[i] = (uint8_t)(i * 7 + 3); // data to copy
+    }
+    for (int i = 0; i < 3 * 0x4000; i++) {
+        cpu->bus.rom_banks[i] = (uint8_t)(i * 5 + 1);
+    }
+    memcpy(cpu->bus.rom0 + HLE_ENTRY_MEMCPY, hle_memcpy, sizeof(hle_memcpy));
+    memcpy(cpu->bus.rom0 + HLE_ENTRY_MEMSET, hle_memset, sizeof(hle_memset));
+    memcpy(cpu->bus.rom0 + HLE_ENTRY_MUL8, hle_mul8, sizeof(hle_mul8));
+    memcpy(cpu->bus.rom_banks + 1 * 0x4000 + (HLE_ENTRY_BANKED - 0x4000), hle_memcpy, sizeof(hle_memcpy));
+    memcpy(cpu->bus.rom_banks + 2 * 0x4000 + (HLE_ENTRY_BANKED - 0x4000), hle_memset, sizeof(hle_memset));
+    memset(cpu->bus.rom0 + HLE_CALLER, 0x00, 0x100); // NOPs after the call
+    cpu->bus.rom0[HLE_CALLER] = 0xCD; // CALL entry
+    cpu->bus.rom0[HLE_CALLER + 1] = test->entry & 0xFF;
+    cpu->bus.rom0[HLE_CALLER + 2] = test->entry >> 8;
+    for (int i = 0; i < 0x2000; i++) {
+        cpu->bus.wram[i] = (uint8_t)(i * 13 + 5);
+    }
+    WRITE_BYTE(cpu, 0x2000, test->bank);
+    if (test->lcd_off) {
+        WRITE_BYTE(cpu, 0xFF40, 0x00);
+    }
+#ifdef HLE
+    int found = hle_scan(cpu);
+    if (found != HLE_FOUND) {
+        fail("hle scan", "routines", HLE_FOUND, found);
+    }
+#endif
+    cpu->pc = HLE_CALLER;
+    cpu->sp = FUSE_STACK;
+    cpu->ime = false;
+    cpu->bus.ie = 0;
+    cpu->regs.a = test->a;
+    cpu->regs.bc = test->bc;
+    cpu->regs.de = test->de;
+    cpu->regs.hl = test->hl;
+    return cpu;
+}
+
+static void check_hle(void) {
+    static const uint32_t chunks[] = { CYCLES_PER_FRAME, 100 };
+    char name[96];
+    for (size_t i = 0; i < sizeof(hle_cases) / sizeof(hle_cases[0]); i++) {
+        const struct hle_case *test = &hle_cases[i];
+        struct CPU *stepped = hle_cpu(test);
+        uint64_t cycles = 0;
+        for (int step = 0; stepped->pc != HLE_CALLER + 3; step++) {
+            if (step == HLE_MAX_STEPS) {
+                fprintf(stderr, "hle %s: never returned\n", test->name);
+                failures++;
+                break;
+            }
+            stepped->cycles = 4;
+            uint8_t opcode = READ_BYTE(stepped, stepped->pc++);
+            exec_inst(stepped, opcode);
+            cycles += stepped->cycles;
+        }
+
+        for (size_t c = 0; c < sizeof(chunks) / sizeof(chunks[0]); c++) {
+            snprintf(name, sizeof(name), "hle %s, chunks of %u", test->name, chunks[c]);
+            struct CPU *native = hle_cpu(test);
+            struct GPU *gpu = calloc(1, sizeof(struct GPU));
+            gpu->bus = &native->bus;
+            while (native->sched.now < cycles) {
+                uint64_t left = cycles - native->sched.now;
+                cpu_run_cycles(native, gpu, left < chunks[c] ? (uint32_t)left : chunks[c]);
+                gpu->should_render = false;
+            }
+            free(gpu);
+
+#ifdef HLE
+            if (chunks[c] == CYCLES_PER_FRAME && (native->hle.runs != 0) != test->native) {
+                fprintf(stderr, "%s: %s natively\n", name, test->native ? "not run" : "run");
+                failures++;
+            }
+#endif
+            if (native->sched.now != cycles) {
+                fail(name, "clock", (unsigned)cycles, (unsigned)native->sched.now);
+            }
+            if (native->pc != stepped->pc) {
+                fail(name, "PC", stepped->pc, native->pc);
+            }
+            if (GET_AF(native) != GET_AF(stepped)) {
+                fail(name, "AF", GET_AF(stepped), GET_AF(native));
+            }
+            if (native->regs.bc != stepped->regs.bc) {
+                fail(name, "BC", stepped->regs.bc, native->regs.bc);
+            }
+            if (native->regs.de != stepped->regs.de) {
+                fail(name, "DE", stepped->regs.de, native->regs.de);
+            }
+            if (native->regs.hl != stepped->regs.hl) {
+                fail(name, "HL", stepped->regs.hl, native->regs.hl);
+            }
+            if (native->sp != stepped->sp) {
+                fail(name, "SP", stepped->sp, native->sp);
+            }
+            if (memcmp(native->bus.wram, stepped->bus.wram, sizeof(native->bus.wram)) != 0) {
+                fprintf(stderr, "%s: WRAM differs\n", name);
+                failures++;
+            }
+            if (memcmp(native->bus.vram, stepped->bus.vram, sizeof(native->bus.vram)) != 0) {
+                fprintf(stderr, "%s: VRAM differs\n", name);
+                failures++;
+            }
+            if (memcmp(native->bus.high + 0x80, stepped->bus.high + 0x80, 0x7F) != 0) {
+                fprintf(stderr, "%s: HRAM differs\n", name);
+                failures++;
+            }
+            free_cpu(native);
+        }
+        free_cpu(stepped);
+    }
+}
+
+/* Polling loops with and without idle skipping
+   Each loop waits on something only an event changes, with the timer
+   interrupt every 1024 cycles and VBlank's enabled, and runs once as
+   idle_skip() would have it and once with cpu->idle.off, in the same chunks
+   of cpu_run_cycles(). Both have to end on the same registers, clock, timer,
+   line and WRAM. The handlers count their calls in WRAM, the timer's with
+   the registers it interrupted folded in (fuse_timer_handler).
+*/
+#define IDLE_CODE 0x0200
+
+struct idle_case {
+    const char *name;
+    uint8_t code[24]; // after idle_prelude, ends in JR -2 at `spin`
+    uint8_t loop;     // offset of the polling loop to be watched
+    uint8_t spin;     // offset of the final JR -2
+    bool gives_up;    // the loop changes a register every iteration
+};
+
+static const uint8_t idle_prelude[] = {
+    0x3E, 0xC0, 0xE0, 0x06, // LD A,0xC0 / LDH (TMA),A
+    0x3E, 0x05, 0xE0, 0x07, // LD A,5 / LDH (TAC),A, an interrupt every 1024 cycles
+    0x3E, 0x05, 0xE0, 0xFF, // LD A,5 / LDH (IE),A, VBlank and timer
+    0xFB,                   // EI
+};
+
+// VBlank handler, counts its calls at 0xC102
+static const uint8_t idle_vblank_handler[] = {
+    0xF5,             // PUSH AF
+    0xFA, 0x02, 0xC1, // LD A,(0xC102)
+    0x3C,             // INC A
+    0xEA, 0x02, 0xC1, // LD (0xC102),A
+    0xF1, 0xD9,       // POP AF / RETI
+};
+
+static const struct idle_case idle_cases[] = {
+    { "LY",
+      { 0x06, 0x08,                                // LD B,8
+        0xF0, 0x44, 0xFE, 0x90, 0x20, 0xFA,        // LDH A,(LY) / CP 0x90 / JR NZ, until VBlank
+        0xF0, 0x44, 0xFE, 0x90, 0x28, 0xFA,        // and on past line 144
+        0x05, 0x20, 0xF1,                          // DEC B / JR NZ
+        0x18, 0xFE },
+      2, 17, false },
+    { "STAT mode",
+      { 0x06, 0x64,                                // LD B,100
+        0xF0, 0x41, 0xE6, 0x03, 0x20, 0xFA,        // LDH A,(STAT) / AND 3 / JR NZ, until HBlank
+        0xF0, 0x41, 0xE6, 0x03, 0x28, 0xFA,        // and out of it
+        0x05, 0x20, 0xF1,
+        0x18, 0xFE },
+      2, 17, false },
+    { "IF, interrupts off",
+      { 0xF3,                                      // DI
+        0x06, 0x04,                                // LD B,4
+        0xAF, 0xE0, 0x0F,                          // XOR A / LDH (IF),A
+        0xF0, 0x0F, 0xE6, 0x01, 0x28, 0xFA,        // LDH A,(IF) / AND 1 / JR Z, until VBlank is requested
+        0x05, 0x20, 0xF4,
+        0x18, 0xFE },
+      6, 15, false },
+    { "DIV",
+      { 0x06, 0x04,                                // LD B,4
+        0xF0, 0x04, 0xB7, 0x20, 0xFB,              // LDH A,(DIV) / OR A / JR NZ, until it wraps
+        0xF0, 0x04, 0xB7, 0x28, 0xFB,              // and on from 0
+        0x05, 0x20, 0xF3,
+        0x18, 0xFE },
+      2, 15, false },
+    { "TIMA",
+      { 0x3E, 0x04, 0xE0, 0x07,                    // LD A,4 / LDH (TAC),A, a tick every 1024 cycles
+        0x06, 0x64,                                // LD B,100
+        0xF0, 0x05, 0x4F,                          // LDH A,(TIMA) / LD C,A
+        0xF0, 0x05, 0xB9, 0x28, 0xFB,              // LDH A,(TIMA) / CP C / JR Z, until it ticks
+        0x05, 0x20, 0xF5,
+        0x18, 0xFE },
+      9, 17, false },
+    { "WRAM flag",
+      { 0x06, 0x08,                                // LD B,8
+        0xFA, 0x02, 0xC1, 0x4F,                    // LD A,(0xC102) / LD C,A
+        0xFA, 0x02, 0xC1, 0xB9, 0x28, 0xFA,        // LD A,(0xC102) / CP C / JR Z, until the VBlank handler counts
+        0x05, 0x20, 0xF3,
+        0x18, 0xFE },
+      6, 15, false },
+    { "LY, counting in C",
+      { 0x06, 0x04,                                // LD B,4
+        0x0C, 0xF0, 0x44, 0xFE, 0x90, 0x20, 0xF9,  // INC C / LDH A,(LY) / CP 0x90 / JR NZ
+        0xF0, 0x44, 0xFE, 0x90, 0x28, 0xFA,
+        0x05, 0x20, 0xF0,
+        0x18, 0xFE },
+      2, 18, true },
+};
+
+// How the watched loop was found at the end of a chunk
+struct idle_seen {
+    bool watched;  // being skipped from, or about to be
+    bool gave_up;  // IDLE_MAX_MISSES iterations changed registers
+};
+
+// Run `test` in chunks of `chunk` cycles until it reaches its final JR
+static struct CPU *idle_run_case(const struct idle_case *test, bool skip, uint32_t chunk,
+                                 struct idle_seen *seen) {
+    struct CPU *cpu = check_cpu(0x00, 2, 0);
+    memcpy(cpu->bus.rom0 + 0x40, idle_vblank_handler, sizeof(idle_vblank_handler));
+    memcpy(cpu->bus.rom0 + 0x50, fuse_timer_handler, sizeof(fuse_timer_handler));
+    memcpy(cpu->bus.rom0 + IDLE_CODE, idle_prelude, sizeof(idle_prelude));
+    memcpy(cpu->bus.rom0 + IDLE_CODE + sizeof(idle_prelude), test->code, sizeof(test->code));
+    uint16_t base = IDLE_CODE + sizeof(idle_prelude);
+    cpu->pc = IDLE_CODE;
+    cpu->sp = FUSE_STACK;
+    cpu->ime = false;
+    cpu->bus.ie = 0;
+#ifdef IDLE_SKIP
+    cpu->idle.off = !skip;
+#else
+    (void)skip;
+#endif
+    *seen = (struct idle_seen){ false, false };
+
+    struct GPU *gpu = calloc(1, sizeof(struct GPU));
+    gpu->bus = &cpu->bus;
+    while (cpu->pc != (uint16_t)(base + test->spin)) {
+        if (cpu->sched.now > FUSE_MAX_CYCLES) {
+            fprintf(stderr, "idle %s: never left the loop\n", test->name);
+            failures++;
+            break;
+        }
+        cpu_run_cycles(cpu, gpu, chunk);
+        gpu->should_render = false;
+#ifdef IDLE_SKIP
+        if (cpu->idle.pc == base + test->loop) {
+            seen->watched |= cpu->idle.cycles != 0;
+            seen->gave_up |= cpu->idle.cycles == 0 && cpu->idle.misses >= IDLE_MAX_MISSES;
+        }
+#endif
+    }
+    free(gpu);
+    return cpu;
+}
+
+static void check_idle(void) {
+    static const uint32_t chunks[] = { CYCLES_PER_FRAME, 100 };
+    char name[96];
+    for (size_t i = 0; i < sizeof(idle_cases) / sizeof(idle_cases[0]); i++) {
+        for (size_t c = 0; c < sizeof(chunks) / sizeof(chunks[0]); c++) {
+            const struct idle_case *test = &idle_cases[i];
+            struct idle_seen seen, unused;
+            snprintf(name, sizeof(name), "idle %s, chunks of %u", test->name, chunks[c]);
+            struct CPU *skipped = idle_run_case(test, true, chunks[c], &seen);
+            struct CPU *plain = idle_run_case(test, false, chunks[c], &unused);
+
+#ifdef IDLE_SKIP
+            // only short chunks are sure to end inside the loop now and then
+            if (chunks[c] < CYCLES_PER_FRAME && test->gives_up && !seen.gave_up) {
+                fprintf(stderr, "%s: loop was never given up on\n", name);
+                failures++;
+            }
+            if (chunks[c] < CYCLES_PER_FRAME && !test->gives_up && !seen.watched) {
+                fprintf(stderr, "%s: loop was not watched\n", name);
+                failures++;
+            }
+#endif
+            if (skipped->sched.now != plain->sched.now) {
+                fail(name, "clock", (unsigned)plain->sched.now, (unsigned)skipped->sched.now);
+            }
+            if (skipped->pc != plain->pc) {
+                fail(name, "PC", plain->pc, skipped->pc);
+            }
+            if (GET_AF(skipped) != GET_AF(plain)) {
+                fail(name, "AF", GET_AF(plain), GET_AF(skipped));
+            }
+            if (skipped->regs.bc != plain->regs.bc) {
+                fail(name, "BC", plain->regs.bc, skipped->regs.bc);
+            }
+            if (skipped->regs.de != plain->regs.de) {
+                fail(name, "DE", plain->regs.de, skipped->regs.de);
+            }
+            if (skipped->regs.hl != plain->regs.hl) {
+                fail(name, "HL", plain->regs.hl, skipped->regs.hl);
+            }
+            if (skipped->sp != plain->sp) {
+                fail(name, "SP", plain->sp, skipped->sp);
+            }
+            if (skipped->ime != plain->ime || skipped->bus.io.iflag != plain->bus.io.iflag) {
+                fail(name, "IME/IF", plain->ime << 8 | plain->bus.io.iflag, skipped->ime << 8 | skipped->bus.io.iflag);
+            }
+            if (skipped->bus.io.div != plain->bus.io.div || skipped->bus.io.tima != plain->bus.io.tima) {
+                fail(name, "DIV/TIMA", plain->bus.io.div << 8 | plain->bus.io.tima,
+                     skipped->bus.io.div << 8 | skipped->bus.io.tima);
+            }
+            if (skipped->bus.io.ly != plain->bus.io.ly || skipped->bus.io.stat != plain->bus.io.stat) {
+                fail(name, "LY/STAT", plain->bus.io.ly << 8 | plain->bus.io.stat,
+                     skipped->bus.io.ly << 8 | skipped->bus.io.stat);
+            }
+            for (int addr = 0xC000; addr < 0xE000; addr++) {
+                if (skipped->bus.wram[addr - 0xC000] != plain->bus.wram[addr - 0xC000]) {
+                    fprintf(stderr, "%s: WRAM differs from 0x%04X on\n", name, addr);
+                    failures++;
+                    break;
+                }
+            }
+            free_cpu(skipped);
+            free_cpu(plain);
+        }
+    }
+}
+
+/* MBC3 clock
+   Driven through the bus like a game would, in emulated time, with the
+   master clock moved on by hand between accesses.
+*/
+#define RTC_SECOND ((uint64_t)RTC_HZ)
+
+static struct CPU *rtc_cpu(bool emulated) {
+    struct CPU *cpu = check_cpu(3, 2, 0x2000);
+    cpu->bus.rom0[0x147] = MBC3_TIMER_RAM_BATTERY; // save_has_rtc()
+    rtc_set_emulated(cpu, emulated);
+    WRITE_BYTE(cpu, 0x0000, 0x0A); // RAM and clock on
+    return cpu;
+}
+
+static void rtc_set(struct CPU *cpu, enum rtc_register reg, uint8_t value) {
+    WRITE_BYTE(cpu, 0x4000, 0x08 + reg);
+    WRITE_BYTE(cpu, 0xA000, value);
+}
+
+static uint8_t rtc_get(struct CPU *cpu, enum rtc_register reg) {
+    WRITE_BYTE(cpu, 0x4000, 0x08 + reg);
+    return READ_BYTE(cpu, 0xA000);
+}
+
+static void rtc_latch_now(struct CPU *cpu) {
+    WRITE_BYTE(cpu, 0x6000, 0x00);
+    WRITE_BYTE(cpu, 0x6000, 0x01);
+}
+
+// Latched S, M, H, DL and DH against `expected`
+static void rtc_expect(struct CPU *cpu, const char *name, const uint8_t expected[RTC_REGISTERS]) {
+    static const char *const names[RTC_REGISTERS] = { "S", "M", "H", "DL", "DH" };
+    for (int i = 0; i < RTC_REGISTERS; i++) {
+        uint8_t got = rtc_get(cpu, i);
+        if (got != expected[i]) {
+            fail(name, names[i], expected[i], got);
+        }
+    }
+}
+
+// A new empty file to save to, to unlink() afterwards
+static const char *temp_save(void) {
+    static char path[32];
+    strcpy(path, "/tmp/gbemu-check-XXXXXX");
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        perror("mkstemp");
+        exit(1);
+    }
+    close(fd);
+    return path;
+}
+
+/* Write a .sav of the cartridge's RAM and a `footer`-byte clock footer,
+   with every register zero and the time `age` seconds ago
+   @return the file's path, to unlink()
+*/
+static const char *rtc_write_footer(struct CPU *cpu, size_t footer, uint64_t age) {
+    const char *path = temp_save();
+    uint8_t out[RTC_FOOTER_SIZE] = { 0 };
+    uint64_t saved = (uint64_t)time(NULL) - age;
+    for (size_t i = 0; i < footer - 40; i++) {
+        out[40 + i] = (uint8_t)(saved >> (8 * i));
+    }
+    FILE *file = fopen(path, "wb");
+    if (!file || fwrite(cpu->bus.cart_ram, 1, cpu->bus.ram_size, file) != cpu->bus.ram_size ||
+        fwrite(out, 1, footer, file) != footer) {
+        perror(path);
+        exit(1);
+    }
+    fclose(file);
+    return path;
+}
+
+static void check_rtc(void) {
+    // latched values only change on a 0 then 1
+    struct CPU *cpu = rtc_cpu(true);
+    rtc_set(cpu, RTC_S, 10);
+    cpu->sched.now += 5 * RTC_SECOND;
+    rtc_expect(cpu, "rtc before latching", (const uint8_t[]){ 10, 0, 0, 0, 0 });
+    rtc_latch_now(cpu);
+    rtc_expect(cpu, "rtc latch", (const uint8_t[]){ 15, 0, 0, 0, 0 });
+    cpu->sched.now += 5 * RTC_SECOND;
+    WRITE_BYTE(cpu, 0x6000, 0x01);
+    rtc_expect(cpu, "rtc 1 then 1", (const uint8_t[]){ 15, 0, 0, 0, 0 });
+    rtc_latch_now(cpu);
+    rtc_expect(cpu, "rtc 0 then 1", (const uint8_t[]){ 20, 0, 0, 0, 0 });
+
+    // the second in progress carries on over a latch
+    cpu->sched.now += RTC_SECOND * 3 / 4;
+    rtc_latch_now(cpu);
+    rtc_expect(cpu, "rtc 0.75 s", (const uint8_t[]){ 20, 0, 0, 0, 0 });
+    cpu->sched.now += RTC_SECOND * 3 / 4;
+    rtc_latch_now(cpu);
+    rtc_expect(cpu, "rtc 1.5 s", (const uint8_t[]){ 21, 0, 0, 0, 0 });
+    cpu->sched.now += RTC_SECOND * 3 / 4;
+    rtc_latch_now(cpu);
+    rtc_expect(cpu, "rtc 2.25 s", (const uint8_t[]){ 22, 0, 0, 0, 0 });
+
+    // every register rolls over at once, day 511 carries
+    rtc_set(cpu, RTC_DH, 0x01);
+    rtc_set(cpu, RTC_DL, 0xFF);
+    rtc_set(cpu, RTC_H, 23);
+    rtc_set(cpu, RTC_M, 59);
+    rtc_set(cpu, RTC_S, 58);
+    cpu->sched.now += 3 * RTC_SECOND;
+    rtc_latch_now(cpu);
+    rtc_expect(cpu, "rtc rollover", (const uint8_t[]){ 1, 0, 0, 0, 0x80 });
+    cpu->sched.now += 86400 * RTC_SECOND;
+    rtc_latch_now(cpu);
+    rtc_expect(cpu, "rtc carry stays", (const uint8_t[]){ 1, 0, 0, 1, 0x80 });
+    rtc_set(cpu, RTC_DH, 0x00);
+    rtc_latch_now(cpu);
+    rtc_expect(cpu, "rtc carry cleared", (const uint8_t[]){ 1, 0, 0, 1, 0x00 });
+
+    // halted, the clock doesn't move
+    rtc_set(cpu, RTC_DH, 0x40);
+    cpu->sched.now += 100 * RTC_SECOND;
+    rtc_latch_now(cpu);
+    rtc_expect(cpu, "rtc halted", (const uint8_t[]){ 1, 0, 0, 1, 0x40 });
+    rtc_set(cpu, RTC_DH, 0x00);
+    cpu->sched.now += 2 * RTC_SECOND;
+    rtc_latch_now(cpu);
+    rtc_expect(cpu, "rtc restarted", (const uint8_t[]){ 3, 0, 0, 1, 0x00 });
+
+    // 48-byte footer through write_save_file() and load_save_file()
+    rtc_set(cpu, RTC_S, 12);
+    rtc_set(cpu, RTC_M, 34);
+    rtc_set(cpu, RTC_H, 5);
+    rtc_set(cpu, RTC_DL, 0x89);
+    rtc_set(cpu, RTC_DH, 0x01);
+    WRITE_BYTE(cpu, 0x4000, 0x00);
+    WRITE_BYTE(cpu, 0xA123, 0x5A);
+    const char *path = temp_save();
+    if (write_save_file(cpu, path) != 0) {
+        fprintf(stderr, "rtc: write_save_file() failed\n");
+        failures++;
+    }
+    FILE *file = fopen(path, "rb");
+    if (file) {
+        fseek(file, 0, SEEK_END);
+        if (ftell(file) != 0x2000 + RTC_FOOTER_SIZE) {
+            fail("rtc footer", "file size", 0x2000 + RTC_FOOTER_SIZE, (unsigned)ftell(file));
+        }
+        fclose(file);
+    }
+    struct CPU *loaded = rtc_cpu(true);
+    if (load_save_file(loaded, path) != 0) {
+        fprintf(stderr, "rtc: load_save_file() failed\n");
+        failures++;
+    }
+    unlink(path);
+    if (loaded->bus.cart_ram[0x123] != 0x5A) {
+        fail("rtc footer", "RAM", 0x5A, loaded->bus.cart_ram[0x123]);
+    }
+    rtc_expect(loaded, "rtc footer latched", (const uint8_t[]){ 12, 34, 5, 0x89, 0x01 });
+    rtc_latch_now(loaded);
+    rtc_expect(loaded, "rtc footer", (const uint8_t[]){ 12, 34, 5, 0x89, 0x01 });
+    free_cpu(loaded);
+    free_cpu(cpu);
+
+    // 44 and 48-byte footers saved 90 seconds ago catch up in wall-clock time
+    static const size_t footers[] = { RTC_FOOTER_SIZE_32, RTC_FOOTER_SIZE };
+    for (size_t i = 0; i < sizeof(footers) / sizeof(footers[0]); i++) {
+        char name[48];
+        snprintf(name, sizeof(name), "rtc %zu-byte footer", footers[i]);
+        cpu = rtc_cpu(false);
+        path = rtc_write_footer(cpu, footers[i], 90);
+        if (load_save_file(cpu, path) != 0) {
+            fprintf(stderr, "%s: load_save_file() failed\n", name);
+            failures++;
+        }
+        unlink(path);
+        rtc_latch_now(cpu);
+        uint8_t s = rtc_get(cpu, RTC_S);
+        if (rtc_get(cpu, RTC_M) != 1 || s < 30 || s > 31) { // a second may tick over meanwhile
+            fail(name, "M:S", 0x0130, rtc_get(cpu, RTC_M) << 8 | s);
+        }
+        free_cpu(cpu);
+    }
+}
+
+/* Mappers
+   Each ROM bank starts with its own number, low byte then high byte, so
+   READ_BYTE(0x4000) tells which one is mapped.
+*/
+static struct CPU *mbc_cpu(uint8_t mbc_type, unsigned banks, size_t ram_size) {
+    struct CPU *cpu = check_cpu(mbc_type, banks, ram_size);
+    for (unsigned bank = 0; bank < banks; bank++) {
+        uint8_t *data = bank ? cpu->bus.rom_banks + (bank - 1) * 0x4000 : cpu->bus.rom0;
+        data[0] = bank & 0xFF;
+        data[1] = bank >> 8;
+    }
+    return cpu;
+}
+
+static void mbc_expect_bank(struct CPU *cpu, const char *name, unsigned bank) {
+    unsigned got = READ_BYTE(cpu, 0x4001) << 8 | READ_BYTE(cpu, 0x4000);
+    if (got != bank) {
+        fail(name, "ROM bank", bank, got);
+    }
+}
+
+static void mbc_expect_byte(struct CPU *cpu, const char *name, uint16_t addr, uint8_t expected) {
+    uint8_t got = READ_BYTE(cpu, addr);
+    if (got != expected) {
+        char what[16];
+        snprintf(what, sizeof(what), "0x%04X", addr);
+        fail(name, what, expected, got);
+    }
+}
+
+static void check_mbc(void) {
+    // MBC2: address bit 8 picks the register, 4-bit bank, 512 4-bit cells
+    struct CPU *cpu = mbc_cpu(2, 16, 0x200);
+    mbc_expect_bank(cpu, "mbc2 reset", 1);
+    WRITE_BYTE(cpu, 0x2100, 0x05);
+    mbc_expect_bank(cpu, "mbc2 bank", 5);
+    WRITE_BYTE(cpu, 0x3F00, 0x1F);
+    mbc_expect_bank(cpu, "mbc2 bank, upper bits", 15);
+    WRITE_BYTE(cpu, 0x0100, 0x00);
+    mbc_expect_bank(cpu, "mbc2 bank 0", 1);
+    WRITE_BYTE(cpu, 0x4100, 0x03);
+    mbc_expect_bank(cpu, "mbc2 write above 0x4000", 1);
+    WRITE_BYTE(cpu, 0xA000, 0x05);
+    mbc_expect_byte(cpu, "mbc2 RAM off", 0xA000, 0xFF);
+    WRITE_BYTE(cpu, 0x2000, 0x0A); // bit 8 clear, so RAM enable however high
+    mbc_expect_bank(cpu, "mbc2 RAM enable", 1);
+    WRITE_BYTE(cpu, 0xA000, 0xA5);
+    WRITE_BYTE(cpu, 0xA1FF, 0x3C);
+    mbc_expect_byte(cpu, "mbc2 RAM", 0xA000, 0xF5);
+    mbc_expect_byte(cpu, "mbc2 RAM", 0xA1FF, 0xFC);
+    mbc_expect_byte(cpu, "mbc2 RAM repeated", 0xA200, 0xF5);
+    mbc_expect_byte(cpu, "mbc2 RAM repeated", 0xBFFF, 0xFC);
+    WRITE_BYTE(cpu, 0xB000, 0x07);
+    mbc_expect_byte(cpu, "mbc2 RAM written repeated", 0xA000, 0xF7);
+    WRITE_BYTE(cpu, 0x0000, 0x00);
+    mbc_expect_byte(cpu, "mbc2 RAM off again", 0xA000, 0xFF);
+    free_cpu(cpu);
+
+    // MBC5: 8 low bank bits at 0x2000, bit 8 at 0x3000, bank 0 mappable
+    cpu = mbc_cpu(5, 512, 0x8000);
+    mbc_expect_bank(cpu, "mbc5 reset", 1);
+    WRITE_BYTE(cpu, 0x2000, 0xFF);
+    WRITE_BYTE(cpu, 0x3000, 0x01);
+    mbc_expect_bank(cpu, "mbc5 bank 0x1FF", 0x1FF);
+    WRITE_BYTE(cpu, 0x2FFF, 0x00);
+    mbc_expect_bank(cpu, "mbc5 bank 0x100", 0x100);
+    WRITE_BYTE(cpu, 0x3FFF, 0x02);
+    mbc_expect_bank(cpu, "mbc5 bank 0", 0);
+    WRITE_BYTE(cpu, 0x2000, 0x42);
+    WRITE_BYTE(cpu, 0x3000, 0xFF);
+    mbc_expect_bank(cpu, "mbc5 bank, upper bits", 0x142);
+    WRITE_BYTE(cpu, 0x0000, 0x0A);
+    for (int bank = 0; bank < 4; bank++) {
+        WRITE_BYTE(cpu, 0x4000, bank);
+        WRITE_BYTE(cpu, 0xA000, 0x70 + bank);
+    }
+    for (int bank = 3; bank >= 0; bank--) {
+        WRITE_BYTE(cpu, 0x4000, bank);
+        mbc_expect_byte(cpu, "mbc5 RAM bank", 0xA000, 0x70 + bank);
+    }
+    mbc_expect_bank(cpu, "mbc5 RAM bank switch", 0x142);
+    free_cpu(cpu);
+
+    // fewer banks than the registers reach wrap around
+    cpu = mbc_cpu(5, 64, 0);
+    WRITE_BYTE(cpu, 0x2000, 0x45);
+    WRITE_BYTE(cpu, 0x3000, 0x01);
+    mbc_expect_bank(cpu, "mbc5 bank wrap", 0x05);
+    free_cpu(cpu);
+}
+
+/* Page table and fastmem window
+   A ROM file loaded like a game's, where every byte tells its bank and
+   address apart, read through READ_BYTE and through read_byte_slow() in
+   each bus state that changes the mapping: boot ROM, ROM bank, cartridge
+   RAM and STAT mode.
+*/
+#define MEMMAP_BANKS 64
+
+static uint8_t memmap_rom_byte(unsigned bank, unsigned offset) {
+    return (uint8_t)(bank * 37 + offset * 7 + (offset >> 8));
+}
+
+static void memmap_expect(struct CPU *cpu, const char *name) {
+    for (unsigned addr = 0x0000; addr < 0xFF00; addr++) {
+        uint8_t expected = read_byte_slow(cpu, addr);
+        uint8_t got = READ_BYTE(cpu, addr);
+        if (got != expected) {
+            char what[16];
+            snprintf(what, sizeof(what), "0x%04X", addr);
+            fail(name, what, expected, got);
+            return; // one is enough to tell
+        }
+    }
+}
+
+static void check_memmap(void) {
+    static uint8_t rom[MEMMAP_BANKS * 0x4000];
+    for (unsigned bank = 0; bank < MEMMAP_BANKS; bank++) {
+        for (unsigned offset = 0; offset < 0x4000; offset++) {
+            rom[bank * 0x4000 + offset] = memmap_rom_byte(bank, offset);
+        }
+    }
+    rom[0x147] = MBC5_RAM_BATTERY;
+    rom[0x148] = SIZE_1MB;
+    rom[0x149] = 0x03; // 32KB
+    rom[0x14D] = 0x00; // wrong, the image gets it patched
+    const char *path = temp_save();
+    FILE *file = fopen(path, "wb");
+    if (!file || fwrite(rom, 1, sizeof(rom), file) != sizeof(rom)) {
+        perror(path);
+        exit(1);
+    }
+    fclose(file);
+
+    struct CPU *cpu = cpu_alloc();
+    cpu_init(cpu);
+    if (load_rom(cpu, path) != 0) {
+        fprintf(stderr, "memmap: load_rom() failed\n");
+        exit(1);
+    }
+    unlink(path);
+#ifdef FASTMEM
+    if (fastmem_init(cpu) != 0) {
+        fprintf(stderr, "Failed to map the fastmem window\n");
+        exit(1);
+    }
+#endif
+    for (unsigned i = 0; i < 0x2000; i++) {
+        cpu->bus.vram[i] = (uint8_t)(i * 13 + 1);
+        cpu->bus.wram[i] = (uint8_t)(i * 11 + 2);
+    }
+
+    memset(cpu->bootrom, 0xB0, sizeof(cpu->bootrom));
+    cpu->bootrom_enabled = true;
+    memory_map_update(cpu);
+    memmap_expect(cpu, "memmap boot ROM");
+    cpu->bootrom_enabled = false;
+    memory_map_update(cpu);
+    memmap_expect(cpu, "memmap boot ROM off");
+    if (READ_BYTE(cpu, 0x14D) != cpu->bus.image->data[0x14D]) {
+        fail("memmap", "patched header checksum", cpu->bus.image->data[0x14D], READ_BYTE(cpu, 0x14D));
+    }
+
+    static const unsigned banks[] = { 5, 0, MEMMAP_BANKS - 1, 1 };
+    for (size_t i = 0; i < sizeof(banks) / sizeof(banks[0]); i++) {
+        WRITE_BYTE(cpu, 0x2000, banks[i]);
+        if (READ_BYTE(cpu, 0x4123) != memmap_rom_byte(banks[i], 0x123)) {
+            fail("memmap bank switch", "0x4123", memmap_rom_byte(banks[i], 0x123), READ_BYTE(cpu, 0x4123));
+        }
+        memmap_expect(cpu, "memmap bank switch");
+#ifdef FASTMEM
+        if ((cpu->fastmem.read & 0x00F0) != 0x00F0) {
+            fail("memmap bank switch", "fastmem pages 4000-7FFF", 0x00F0, cpu->fastmem.read & 0x00F0);
+        }
+#endif
+    }
+    WRITE_BYTE(cpu, 0x0000, 0x0A);
+    WRITE_BYTE(cpu, 0x4000, 0x02);
+    WRITE_BYTE(cpu, 0xA010, 0x5A);
+    memmap_expect(cpu, "memmap cartridge RAM");
+
+    for (uint8_t mode = 0; mode < 4; mode++) {
+        cpu->bus.io.stat = (cpu->bus.io.stat & ~0x03) | mode;
+        memory_map_video(cpu);
+        memmap_expect(cpu, "memmap STAT mode");
+    }
+
+    // writes reach the RAM behind every view of it, tile data is marked
+    cpu->bus.io.stat &= ~0x03;
+    memory_map_video(cpu);
+    WRITE_BYTE(cpu, 0xC456, 0x77);
+    WRITE_BYTE(cpu, 0xD001, 0x78);
+    WRITE_BYTE(cpu, 0x8020, 0x79);
+    mbc_expect_byte(cpu, "memmap WRAM write", 0xE456, 0x77);
+    if (cpu->bus.wram[0x1001] != 0x78) {
+        fail("memmap WRAM write", "bus.wram", 0x78, cpu->bus.wram[0x1001]);
+    }
+    mbc_expect_byte(cpu, "memmap VRAM write", 0x8020, 0x79);
+    if (!(cpu->bus.tile_dirty[0] & 1ull << 2)) {
+        fail("memmap VRAM write", "tile marked", 1, 0);
+    }
+    memmap_expect(cpu, "memmap writes");
+
+#ifdef FASTMEM
+    // ROM, VRAM outside mode 3, WRAM and echo through the window, never F000-FFFF
+    if (cpu->fastmem.read != 0x73FF || cpu->fastmem.write != 0x3000) {
+        fail("memmap fastmem pages", "read << 16 | write", 0x73FF3000,
+             (unsigned)cpu->fastmem.read << 16 | cpu->fastmem.write);
+    }
+    fastmem_free(cpu);
+    mbc_expect_byte(cpu, "memmap fastmem freed", 0xC456, 0x77);
+#endif
+    unload_rom(cpu);
+    free(cpu);
+}
+
+/* Inline, scalar and worker drawing
+   The same frames are drawn three ways while VRAM, OAM and the LCD
+   registers change in the HBlank of every line, through WRITE_BYTE as a
+   game would: inline with the SSSE3 span shading where it is built in,
+   inline through gpu->scalar_shading, and on the render worker (worker.h).
+   The worker's framebuffer at each VBlank holds the frame before, and
+   after gpu_stop_worker() whatever inline drawing left.
+*/
+#define RENDER_FRAMES 4
+#define RENDER_LINE 456
+#define RENDER_PHASE 100 // cycles into each line's HBlank, which starts as it is drawn
+#define RENDER_FRAMEBUFFER (SCREEN_WIDTH * SCREEN_HEIGHT)
+
+enum render_way { RENDER_INLINE, RENDER_SCALAR, RENDER_WORKER };
+
+struct render_frames {
+    uint8_t vblank[RENDER_FRAMES][RENDER_FRAMEBUFFER]; // framebuffer as each frame ends
+    uint8_t last[RENDER_FRAMEBUFFER];                  // halfway into the frame after them
+};
+
+static uint32_t render_random(uint32_t *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+
+// A few registers, VRAM bytes and OAM bytes changed before the next line
+static void render_poke(struct CPU *cpu, uint32_t *state) {
+    static const uint16_t regs[] = { 0xFF40, 0xFF42, 0xFF43, 0xFF47, 0xFF48, 0xFF49, 0xFF4A, 0xFF4B };
+    for (int i = render_random(state) % 3; i >= 0; i--) {
+        uint32_t r = render_random(state);
+        uint16_t addr = regs[r % 8];
+        uint8_t value = r >> 8;
+        if (addr == 0xFF40) {
+            value |= 0x80; // the LCD stays on
+        } else if (addr == 0xFF4A) {
+            value %= SCREEN_HEIGHT + 8; // the window starts on screen now and then
+        }
+        WRITE_BYTE(cpu, addr, value);
+    }
+    for (int i = 0; i < 4; i++) {
+        uint32_t r = render_random(state);
+        WRITE_BYTE(cpu, VRAM_BEGIN + r % VRAM_SIZE, r >> 16); // tile data and maps
+    }
+    for (int i = 0; i < 2; i++) {
+        uint32_t r = render_random(state);
+        WRITE_BYTE(cpu, OAM_BEGIN + r % OAM_SIZE, r >> 16);
+    }
+}
+
+// Run up to master clock `target`, keeping the framebuffer of each frame that ends on the way
+static void render_run_to(struct CPU *cpu, struct GPU *gpu, uint64_t target,
+                          struct render_frames *frames, int *frame) {
+    while (cpu->sched.now < target) {
+        cpu_run_cycles(cpu, gpu, (uint32_t)(target - cpu->sched.now));
+        if (gpu->should_render) {
+            gpu->should_render = false;
+            if (*frame < RENDER_FRAMES) {
+                memcpy(frames->vblank[(*frame)++], gpu->framebuffer, RENDER_FRAMEBUFFER);
+            }
+        }
+    }
+}
+
+static void render_run(enum render_way way, struct render_frames *frames) {
+    struct CPU *cpu = check_cpu(0x00, 2, 0);
+    cpu->bus.rom0[0x0200] = 0x18; // JR -2
+    cpu->bus.rom0[0x0201] = 0xFE;
+    cpu->pc = 0x0200;
+    cpu->ime = false;
+    cpu->bus.ie = 0;
+    uint32_t state = 0x2545F491;
+    for (int i = 0; i < VRAM_SIZE; i++) {
+        cpu->bus.vram[i] = render_random(&state);
+    }
+    for (int i = 0; i < OAM_SIZE; i++) {
+        cpu->bus.oam[i] = render_random(&state);
+    }
+    memset(cpu->bus.tile_dirty, 0xFF, sizeof(cpu->bus.tile_dirty));
+    cpu->bus.oam_dirty = true;
+
+    struct GPU *gpu = calloc(1, sizeof(struct GPU));
+    gpu->bus = &cpu->bus;
+    gpu->scalar_shading = way == RENDER_SCALAR;
+    if (way == RENDER_WORKER && gpu_start_worker(cpu, gpu) != 0) {
+        fprintf(stderr, "render: gpu_start_worker() failed\n");
+        failures++;
+    }
+    // LY starts out past VBlank (cpu_init()) and only wraps to 0 at 255, so
+    // frames are counted rather than lines; then half a frame more
+    int frame = 0;
+    int last_line = INT32_MAX;
+    for (int line = 0; line < last_line; line++) {
+        render_run_to(cpu, gpu, (uint64_t)line * RENDER_LINE + RENDER_PHASE, frames, &frame);
+        render_poke(cpu, &state);
+        if (frame == RENDER_FRAMES && last_line == INT32_MAX) {
+            last_line = line + 77;
+        }
+        if (line > 4 * RENDER_FRAMES * 154) {
+            fail("render", "frames", RENDER_FRAMES, frame);
+            break;
+        }
+    }
+    gpu_stop_worker(cpu, gpu);
+    memcpy(frames->last, gpu->framebuffer, RENDER_FRAMEBUFFER);
+    free(gpu);
+    free_cpu(cpu);
+}
+
+// Report the first line `got` differs from `expected` on
+static void render_expect(const char *name, const uint8_t *expected, const uint8_t *got) {
+    for (int i = 0; i < RENDER_FRAMEBUFFER; i++) {
+        if (expected[i] != got[i]) {
+            fprintf(stderr, "%s: differs from line %d on\n", name, i / SCREEN_WIDTH);
+            failures++;
+            return;
+        }
+    }
+}
+
+static void check_render(void) {
+    struct render_frames *inline_frames = malloc(sizeof(struct render_frames));
+    struct render_frames *scalar = malloc(sizeof(struct render_frames));
+    struct render_frames *worker = malloc(sizeof(struct render_frames));
+    if (!inline_frames || !scalar || !worker) {
+        fprintf(stderr, "render: out of memory\n");
+        exit(1);
+    }
+    render_run(RENDER_INLINE, inline_frames);
+    render_run(RENDER_SCALAR, scalar);
+    render_run(RENDER_WORKER, worker);
+
+    char name[64];
+    for (int f = 0; f < RENDER_FRAMES; f++) {
+        snprintf(name, sizeof(name), "render scalar frame %d", f);
+        render_expect(name, inline_frames->vblank[f], scalar->vblank[f]);
+        if (f > 0) {
+            snprintf(name, sizeof(name), "render worker frame %d", f - 1);
+            render_expect(name, inline_frames->vblank[f - 1], worker->vblank[f]);
+        }
+    }
+    render_expect("render scalar, frame in progress", inline_frames->last, scalar->last);
+    render_expect("render worker stopped, frame in progress", inline_frames->last, worker->last);
+    free(inline_frames);
+    free(scalar);
+    free(worker);
+}
+
+int main(int argc, char *argv[]) {
+    bool fuse = false;
+    bool hle = false;
+    bool idle = false;
+    bool rtc = false;
+    bool mbc = false;
+    bool memmap = false;
+    bool render = false;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--fuse") == 0) {
+            fuse = true;
+        } else if (strcmp(argv[i], "--hle") == 0) {
+            hle = true;
+        } else if (strcmp(argv[i], "--idle") == 0) {
+            idle = true;
+        } else if (strcmp(argv[i], "--rtc") == 0) {
+            rtc = true;
+        } else if (strcmp(argv[i], "--mbc") == 0) {
+            mbc = true;
+        } else if (strcmp(argv[i], "--memmap") == 0) {
+            memmap = true;
+        } else if (strcmp(argv[i], "--render") == 0) {
+            render = true;
+        } else {
+            fprintf(stderr, "Unknown option %s\n", argv[i]);
+            return 1;
+        }
+    }
+    if (!fuse && !hle && !idle && !rtc && !mbc && !memmap && !render) {
+        fprintf(stderr, "Usage: %s [--fuse] [--hle] [--idle] [--rtc] [--mbc] [--memmap] [--render]\n", argv[0]);
+        return 1;
+    }
+    if (fuse) {
+        check_fuse();
+    }
+    if (hle) {
+        check_hle();
+    }
+    if (idle) {
+        check_idle();
+    }
+    if (rtc) {
+        check_rtc();
+    }
+    if (mbc) {
+        check_mbc();
+    }
+    if (memmap) {
+        check_memmap();
+    }
+    if (render) {
+        check_render();
+    }
+    return failures ? 1 : 0;
+}
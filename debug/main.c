@@ -30,8 +30,7 @@ int main(int argc, char *argv[]) {
 
 
     struct CPU cpu = {0};
-    struct MemoryBus bus; // leave bus uninitialized for now
-    cpu_init(&cpu, &bus);
+    cpu_init(&cpu);
 
     // Load the selected ROM
     LOG("Loading ROM: %s\n", rom_path);
@@ -54,17 +53,15 @@ int main(int argc, char *argv[]) {
     // Debug bootrom status
     LOG("Boot ROM status: %s\n", cpu.bootrom_enabled ? "ENABLED" : "DISABLED");
     
-    LOG("ROM type: 0x%02X\n", cpu.bus.rom[0x0147]);
+    LOG("ROM type: 0x%02X\n", cpu.bus.rom0[0x0147]);
 
     LOG("CPU and Memory Bus initialized.\n");
 
-    patch_checksum(cpu.bus.rom); // Patch the checksum after loading the ROM
-
     // Initialize GPU
     struct GPU gpu = {
         .mode = 0,
         .mode_clock = 0,
-        .vram = cpu.bus.rom,
+        .bus = &cpu.bus,
         .framebuffer = {0},
         .should_render = false,
         .off_count = 0,
@@ -198,29 +195,29 @@ int main(int argc, char *argv[]) {
                         // Instantaneous VRAM dump - dump immediately and don't toggle
                         LOG("Performing instantaneous VRAM dump...\n");
                         fprintf(log_file, "\n=== INSTANTANEOUS VRAM & LCDC DEBUG DUMP ===\n");
-                        fprintf(log_file, "LCDC (0xFF40): 0x%02X\n", cpu.bus.rom[0xFF40]);
-                        fprintf(log_file, "  - LCD Enable: %s\n", (cpu.bus.rom[0xFF40] & 0x80) ? "ON" : "OFF");
-                        fprintf(log_file, "  - Window Tile Map: %s\n", (cpu.bus.rom[0xFF40] & 0x40) ? "0x9C00-0x9FFF" : "0x9800-0x9BFF");
-                        fprintf(log_file, "  - Window Enable: %s\n", (cpu.bus.rom[0xFF40] & 0x20) ? "ON" : "OFF");
-                        fprintf(log_file, "  - BG & Window Tile Data: %s\n", (cpu.bus.rom[0xFF40] & 0x10) ? "0x8000-0x8FFF" : "0x8800-0x97FF");
-                        fprintf(log_file, "  - BG Tile Map: %s\n", (cpu.bus.rom[0xFF40] & 0x08) ? "0x9C00-0x9FFF" : "0x9800-0x9BFF");
-                        fprintf(log_file, "  - Sprite Size: %s\n", (cpu.bus.rom[0xFF40] & 0x04) ? "8x16" : "8x8");
-                        fprintf(log_file, "  - Sprite Enable: %s\n", (cpu.bus.rom[0xFF40] & 0x02) ? "ON" : "OFF");
-                        fprintf(log_file, "  - BG/Window Enable: %s\n", (cpu.bus.rom[0xFF40] & 0x01) ? "ON" : "OFF");
+                        fprintf(log_file, "LCDC (0xFF40): 0x%02X\n", cpu.bus.io.lcdc);
+                        fprintf(log_file, "  - LCD Enable: %s\n", (cpu.bus.io.lcdc & 0x80) ? "ON" : "OFF");
+                        fprintf(log_file, "  - Window Tile Map: %s\n", (cpu.bus.io.lcdc & 0x40) ? "0x9C00-0x9FFF" : "0x9800-0x9BFF");
+                        fprintf(log_file, "  - Window Enable: %s\n", (cpu.bus.io.lcdc & 0x20) ? "ON" : "OFF");
+                        fprintf(log_file, "  - BG & Window Tile Data: %s\n", (cpu.bus.io.lcdc & 0x10) ? "0x8000-0x8FFF" : "0x8800-0x97FF");
+                        fprintf(log_file, "  - BG Tile Map: %s\n", (cpu.bus.io.lcdc & 0x08) ? "0x9C00-0x9FFF" : "0x9800-0x9BFF");
+                        fprintf(log_file, "  - Sprite Size: %s\n", (cpu.bus.io.lcdc & 0x04) ? "8x16" : "8x8");
+                        fprintf(log_file, "  - Sprite Enable: %s\n", (cpu.bus.io.lcdc & 0x02) ? "ON" : "OFF");
+                        fprintf(log_file, "  - BG/Window Enable: %s\n", (cpu.bus.io.lcdc & 0x01) ? "ON" : "OFF");
                         
-                        fprintf(log_file, "STAT (0xFF41): 0x%02X (Mode %d)\n", cpu.bus.rom[0xFF41], cpu.bus.rom[0xFF41] & 0x03);
-                        fprintf(log_file, "SCY (0xFF42): %d\n", cpu.bus.rom[0xFF42]);
-                        fprintf(log_file, "SCX (0xFF43): %d\n", cpu.bus.rom[0xFF43]);
-                        fprintf(log_file, "LY (0xFF44): %d\n", cpu.bus.rom[0xFF44]);
-                        fprintf(log_file, "LYC (0xFF45): %d\n", cpu.bus.rom[0xFF45]);
-                        fprintf(log_file, "WY (0xFF4A): %d\n", cpu.bus.rom[0xFF4A]);
-                        fprintf(log_file, "WX (0xFF4B): %d\n", cpu.bus.rom[0xFF4B]);
+                        fprintf(log_file, "STAT (0xFF41): 0x%02X (Mode %d)\n", cpu.bus.io.stat, cpu.bus.io.stat & 0x03);
+                        fprintf(log_file, "SCY (0xFF42): %d\n", cpu.bus.io.scy);
+                        fprintf(log_file, "SCX (0xFF43): %d\n", cpu.bus.io.scx);
+                        fprintf(log_file, "LY (0xFF44): %d\n", cpu.bus.io.ly);
+                        fprintf(log_file, "LYC (0xFF45): %d\n", cpu.bus.io.lyc);
+                        fprintf(log_file, "WY (0xFF4A): %d\n", cpu.bus.io.wy);
+                        fprintf(log_file, "WX (0xFF4B): %d\n", cpu.bus.io.wx);
                         
                         // Dump first 16 bytes of tile data
                         fprintf(log_file, "\nTile Data (0x8000-0x800F):\n");
                         for (int i = 0; i < 16; i++) {
                             if (i % 8 == 0) fprintf(log_file, "0x%04X: ", 0x8000 + i);
-                            fprintf(log_file, "%02X ", cpu.bus.rom[0x8000 + i]);
+                            fprintf(log_file, "%02X ", cpu.bus.vram[i]);
                             if ((i + 1) % 8 == 0) fprintf(log_file, "\n");
                         }
                         
@@ -228,7 +225,7 @@ int main(int argc, char *argv[]) {
                         fprintf(log_file, "\nComplete BG Tile Map (0x9800-0x9BFF):\n");
                         for (int i = 0; i < 0x400; i++) {
                             if (i % 32 == 0) fprintf(log_file, "0x%04X: ", 0x9800 + i);
-                            fprintf(log_file, "%02X ", cpu.bus.rom[0x9800 + i]);
+                            fprintf(log_file, "%02X ", cpu.bus.vram[0x1800 + i]);
                             if ((i + 1) % 32 == 0) fprintf(log_file, "\n");
                         }
                         
@@ -236,7 +233,7 @@ int main(int argc, char *argv[]) {
                         fprintf(log_file, "\nComplete Window Tile Map (0x9C00-0x9FFF):\n");
                         for (int i = 0; i < 0x400; i++) {
                             if (i % 32 == 0) fprintf(log_file, "0x%04X: ", 0x9C00 + i);
-                            fprintf(log_file, "%02X ", cpu.bus.rom[0x9C00 + i]);
+                            fprintf(log_file, "%02X ", cpu.bus.vram[0x1C00 + i]);
                             if ((i + 1) % 32 == 0) fprintf(log_file, "\n");
                         }
                         
@@ -244,7 +241,7 @@ int main(int argc, char *argv[]) {
                         fprintf(log_file, "\nOAM (First 16 bytes - 4 sprites):\n");
                         for (int i = 0; i < 16; i++) {
                             if (i % 4 == 0) fprintf(log_file, "Sprite %d: ", i / 4);
-                            fprintf(log_file, "%02X ", cpu.bus.rom[0xFE00 + i]);
+                            fprintf(log_file, "%02X ", cpu.bus.oam[i]);
                             if ((i + 1) % 4 == 0) fprintf(log_file, "\n");
                         }
                         fprintf(log_file, "\nSRAM BANK0:\n");
@@ -320,22 +317,24 @@ int main(int argc, char *argv[]) {
             if (debug_cpu_logging) {
                 fprintf(log_file, "A:%02X F:%02X B:%02X C:%02X D:%02X E:%02X H:%02X"\
                     "L:%02X SP:%04X PC:%04X PCMEM:%02X,%02X,%02X,%02X,%02X,%02X" \
-                    " IE:%02X CURRENT ROM BANK:%d PPU MODE:%d CYCLES TAKEN:%d"\
+                    " IE:%02X CURRENT ROM BANK:%d PPU MODE:%d CYCLES TAKEN:%u"\
                     " LY:%02X P1:%02X\n",
                         cpu.regs.a, PACK_FLAGS(&cpu), cpu.regs.b, cpu.regs.c, cpu.regs.d,
                         cpu.regs.e, GET_H(&cpu), GET_L(&cpu), cpu.sp, cpu.pc,
                         READ_BYTE(&cpu, cpu.pc), READ_BYTE(&cpu, cpu.pc + 1),
                         READ_BYTE(&cpu, cpu.pc + 2), READ_BYTE(&cpu, cpu.pc + 3),
                         READ_BYTE(&cpu, cpu.pc + 4), READ_BYTE(&cpu, cpu.pc + 5)
-                        ,cpu.bus.rom[0xFFFF], cpu.bus.current_rom_bank, 
-                        cpu.bus.rom[0xFF41] & 0x03, cpu.cycles, cpu.bus.rom[0xFF44],
-                        cpu.bus.rom[INPUT_JOYPAD]
+                        ,cpu.bus.ie, cpu.bus.current_rom_bank, 
+                        cpu.bus.io.stat & 0x03, cpu.cycles, cpu.bus.io.ly,
+                        cpu.bus.io.p1
                     );
                 fflush(log_file);
             }
             
 
-            step_cpu(&cpu); // Step the CPU
+            // one instruction at a time while something below looks at every one
+            bool single_step = debug_cpu_logging || debug_memory_dump || debug_rtc_info;
+            cpu_run_cycles(&cpu, &gpu, single_step ? 1 : CYCLES_PER_FRAME); // Run CPU, timer and GPU
             
             if (debug_memory_dump && cpu.regs.hl == 0xA000 && mem_dumped == false) {
                 debug_cycle_counter++;
@@ -358,24 +357,20 @@ int main(int argc, char *argv[]) {
             }
             
             if (debug_rtc_info && cpu.bus.mbc_type == 3) {
-                LOG("RTC Selected Register: 0x%02X, Current RAM Bank: %d\n", 
-                    cpu.selected_rtc_register, cpu.bus.current_ram_bank);
+                LOG("RTC Latch: 0x%02X, Current RAM Bank: %d\n", 
+                    cpu.rtc.latch, cpu.bus.current_ram_bank);
             }
             
             if (cpu.bus.current_rom_bank == 0) {
                 printf("CURRENT ROM BANK: %d\n", cpu.bus.current_rom_bank);
             }
             // LOG("CURRENT ROM BANK: %d\n", cpu.bus.current_rom_bank);
-            do {
-                step_timer(&cpu);  // Step the timer
-                step_gpu(&gpu, cpu.cycles); // Step the GPU
-            } while (cpu.halted && ((cpu.bus.rom[0xFF0F] & cpu.bus.rom[0xFFFF]) == 0)); // Handle interrupts if CPU is halted
 
         }
 
-        if (prev_joypad != cpu.bus.rom[INPUT_JOYPAD]) {
+        if (prev_joypad != cpu.bus.io.p1) {
             // Check if this is a meaningful joypad state change
-            uint8_t current_joypad = cpu.bus.rom[INPUT_JOYPAD];
+            uint8_t current_joypad = cpu.bus.io.p1;
             if (current_joypad != 0xFF) {
                 LOG("Joypad state changed: %02X\n", current_joypad);
                 prev_joypad = current_joypad;
@@ -531,6 +526,7 @@ int main(int argc, char *argv[]) {
     fclose(log_file);
     fclose(memory_dump);
     
+    unload_rom(&cpu);
     free(sdl_pixels);
     SDL_DestroyTexture(texture);
     SDL_DestroyRenderer(renderer);
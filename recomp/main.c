@@ -0,0 +1,903 @@
+#include "../src/cpu.h"
+#include "../src/graphics.h"
+#include "../src/timer.h"
+#include "../src/rom.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Static recompiler: cartridge code to C.
+ *
+ *   recomp/gbrecomp <rom> <out.c> [frames]
+ *
+ * Starts at the entry point, the RST targets and the interrupt vectors and
+ * follows jumps, calls and return addresses through all ROM banks, writing
+ * one C function per basic block plus the aot_image table src/aot.c looks
+ * blocks up in. Code in a switchable bank is only found when the bank is
+ * known: either the block is in that bank already, or bank 0 code selected
+ * it with LD A,n / LD (2000-3FFF),A just before.
+ *
+ * To catch what the walk can't see (jump tables, JP (HL), bank switches
+ * through helpers) the ROM is first run headless on the interpreter for
+ * `frames` frames (default 600) and every PC reached by a jump, call,
+ * return or interrupt is used as a starting point too.
+ *
+ * Cycle counts are measured on the interpreter, and the few instructions
+ * without a translation (DAA, HALT, STOP, EI, RETI) call exec_inst().
+ * `make aot AOT_ROM=<rom>` builds bench/gbemu_aot around the output.
+ */
+
+#define DEFAULT_TRACE_FRAMES 600
+
+static struct CPU *cpu; // the cartridge, also run for the trace
+
+static uint8_t op_cycles[256];    // not taken for conditional ops
+static uint8_t taken_cycles[256]; // conditional ops only
+static uint8_t cb_cycles[256];
+
+struct seed {
+    uint16_t bank;
+    uint16_t pc;
+    uint16_t hint; // bank last selected by bank 0 code, 0 if unknown
+};
+
+static struct seed *queue;
+static size_t queue_len, queue_cap;
+static uint8_t *queued[AOT_MAX_BANKS]; // [bank][PC & 0x3FFF], nonzero once queued
+
+struct text {
+    char *data;
+    size_t len, cap;
+};
+
+struct block {
+    struct text text;
+    uint16_t bank;
+    uint16_t start;
+    uint16_t pc;        // instruction being translated
+    uint16_t hint;      // see struct seed
+    int a_value;        // value of A if it is a known constant, else -1
+    uint32_t cycles;    // cycles up to here without taking any branch
+    uint32_t max_cycles; // most cycles any way out of the block takes, see struct aot_block
+    uint32_t insts;
+    bool guarded;       // the current instruction may leave for the interpreter
+};
+
+enum { INST_NEXT, INST_END, INST_STOP };
+
+static const char *const reg8[8] = {
+    "cpu->regs.b", "cpu->regs.c", "cpu->regs.d", "cpu->regs.e",
+    "cpu->regs.h", "cpu->regs.l", NULL, "cpu->regs.a"
+};
+static const char *const reg16[4] = { "cpu->regs.bc", "cpu->regs.de", "cpu->regs.hl", "cpu->sp" };
+static const char *const condition[4] = { "!FLAG_Z(cpu)", "FLAG_Z(cpu)", "!FLAG_C(cpu)", "FLAG_C(cpu)" };
+
+static void text_printf(struct text *t, const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(NULL, 0, fmt, args);
+    va_end(args);
+    if (t->len + n + 1 > t->cap) {
+        t->cap = (t->len + n + 1) * 2;
+        t->data = realloc(t->data, t->cap);
+        if (!t->data) {
+            fprintf(stderr, "Out of memory\n");
+            exit(1);
+        }
+    }
+    va_start(args, fmt);
+    vsnprintf(t->data + t->len, n + 1, fmt, args);
+    va_end(args);
+    t->len += n;
+}
+
+#define LINE(b, ...) do { \
+        text_printf(&(b)->text, "    "); \
+        text_printf(&(b)->text, __VA_ARGS__); \
+        text_printf(&(b)->text, "\n"); \
+    } while (0)
+
+static uint8_t rom_byte(uint32_t bank, uint16_t addr) {
+    if (addr < 0x4000) {
+        return cpu->bus.rom0[addr];
+    }
+    return cpu->bus.rom_banks[(bank - 1) * 0x4000 + (addr - 0x4000)];
+}
+
+// Bank the CPU currently runs `pc` from, same selection as aot_find()
+static uint32_t code_bank(uint16_t pc) {
+    if (pc < 0x4000) {
+        return 0;
+    }
+    return cpu->bus.current_rom_bank;
+}
+
+static void add_seed(uint32_t bank, uint16_t pc, uint32_t hint) {
+    if (pc >= 0x8000) {
+        return; // RAM code is left to the interpreter
+    }
+    if (pc < 0x4000) {
+        bank = 0;
+    } else if (bank == 0 || bank >= cpu->bus.num_rom_banks || bank >= AOT_MAX_BANKS) {
+        return;
+    }
+    if (!queued[bank]) {
+        queued[bank] = calloc(AOT_BANK_SIZE, 1);
+        if (!queued[bank]) {
+            fprintf(stderr, "Out of memory\n");
+            exit(1);
+        }
+    }
+    if (queued[bank][pc & 0x3FFF]) {
+        return;
+    }
+    queued[bank][pc & 0x3FFF] = 1;
+    if (queue_len == queue_cap) {
+        queue_cap = queue_cap ? queue_cap * 2 : 1024;
+        queue = realloc(queue, queue_cap * sizeof(struct seed));
+        if (!queue) {
+            fprintf(stderr, "Out of memory\n");
+            exit(1);
+        }
+    }
+    queue[queue_len++] = (struct seed){ bank, pc, hint };
+}
+
+// Queue a jump or call target of the block being translated
+static void follow(struct block *b, uint16_t target) {
+    if (b->bank) {
+        add_seed(b->bank, target, 0);
+    } else {
+        add_seed(b->hint, target, b->hint);
+    }
+}
+
+// JR/RET/JP/CALL cc, the condition is in bits 3-4
+static bool is_conditional(uint8_t op) {
+    return (op & 0xE7) == 0x20 || (op & 0xE7) == 0xC0 || (op & 0xE7) == 0xC2 || (op & 0xE7) == 0xC4;
+}
+
+/* Run every opcode once on a scratch CPU and keep the cycles it reports,
+   so translated blocks account exactly like the interpreter does. */
+static void measure_cycles(void) {
+    struct CPU *scratch = cpu_alloc();
+    if (!scratch) {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+    cpu_init(scratch);
+    for (int cb = 0; cb < 2; cb++) {
+        for (int op = 0; op < 256; op++) {
+            for (int taken = 0; taken < 2; taken++) {
+                bool conditional = !cb && is_conditional(op);
+                if (taken && !conditional) {
+                    continue;
+                }
+                uint8_t flags = 0;
+                if (conditional) {
+                    int cc = (op >> 3) & 3;
+                    bool set = (cc & 1) ? taken : !taken; // Z and C are taken when set
+                    flags = set ? (cc < 2 ? FLAG_ZERO : FLAG_CARRY) : 0;
+                }
+                scratch->bus.wram[0x0000] = cb ? 0xCB : op;
+                scratch->bus.wram[0x0001] = cb ? op : 0x00;
+                scratch->bus.wram[0x0002] = 0xC0;
+                scratch->pc = 0xC001;
+                scratch->sp = 0xD000;
+                scratch->regs.bc = 0xC200;
+                scratch->regs.de = 0xC200;
+                scratch->regs.hl = 0xC100;
+                scratch->halted = false;
+                scratch->ime = false;
+                scratch->ime_pending = false;
+                UNPACK_FLAGS(scratch, flags);
+                scratch->cycles = 4; // preset like cpu_begin_step()
+                exec_inst(scratch, cb ? 0xCB : op);
+                if (cb) {
+                    cb_cycles[op] = scratch->cycles;
+                } else if (taken) {
+                    taken_cycles[op] = scratch->cycles;
+                } else {
+                    op_cycles[op] = scratch->cycles;
+                }
+            }
+        }
+    }
+    free(scratch);
+}
+
+/* Run the cartridge and queue every PC that was not reached by falling
+   through from the previous instruction */
+static uint32_t trace(uint32_t frames) {
+    struct GPU *gpu = calloc(1, sizeof(struct GPU));
+    if (!gpu) {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+    gpu->bus = &cpu->bus;
+    size_t before = queue_len;
+    uint64_t total = (uint64_t)frames * CYCLES_PER_FRAME;
+    for (uint64_t elapsed = 0; elapsed < total;) {
+        uint16_t pc = cpu->pc;
+        uint16_t next = pc + inst_length[READ_BYTE(cpu, pc)];
+        step_cpu(cpu);
+        do {
+            step_timer(cpu);
+            step_gpu(gpu, cpu->cycles);
+            memory_map_video(cpu);
+            elapsed += cpu->cycles;
+        } while (cpu->halted && ((cpu->bus.io.iflag & cpu->bus.ie) == 0));
+        if (cpu->pc != next && cpu->pc < 0x8000) {
+            add_seed(code_bank(cpu->pc), cpu->pc, 0);
+        }
+    }
+    free(gpu);
+    return queue_len - before;
+}
+
+static void guard_read(struct block *b, const char *addr) {
+    b->guarded = true;
+    LINE(b, "if (!aot_can_read(%s)) AOT_EXIT(0x%04X);", addr, b->pc);
+}
+
+static void guard_write(struct block *b, const char *addr) {
+    b->guarded = true;
+    LINE(b, "if (!aot_can_write(%s)) AOT_EXIT(0x%04X);", addr, b->pc);
+}
+
+// stack accesses touch two bytes
+static void guard_stack(struct block *b, bool push) {
+    b->guarded = true;
+    if (push) {
+        LINE(b, "if (!aot_can_write(cpu->sp - 1) || !aot_can_write(cpu->sp - 2)) AOT_EXIT(0x%04X);", b->pc);
+    } else {
+        LINE(b, "if (!aot_can_read(cpu->sp) || !aot_can_read(cpu->sp + 1)) AOT_EXIT(0x%04X);", b->pc);
+    }
+}
+
+// Source operand `r` of LD and ALU ops, guarding (HL) first
+static const char *operand(struct block *b, int r) {
+    if (r == 6) {
+        guard_read(b, "cpu->regs.hl");
+        return "READ_BYTE(cpu, cpu->regs.hl)";
+    }
+    return reg8[r];
+}
+
+static void emit_alu(struct block *b, int alu, const char *src) {
+    switch (alu) {
+    case 0: // ADD
+    case 1: // ADC
+        LINE(b, "{");
+        LINE(b, "    uint8_t v = %s;", src);
+        LINE(b, "    uint16_t result = cpu->regs.a + v%s;", alu ? " + (FLAG_C(cpu) ? 1 : 0)" : "");
+        LINE(b, "    FLAGS_ADD(cpu, cpu->regs.a, v, result);");
+        LINE(b, "    cpu->regs.a = result & 0xFF;");
+        LINE(b, "}");
+        break;
+    case 2: // SUB
+    case 3: // SBC
+    case 7: // CP
+        LINE(b, "{");
+        LINE(b, "    uint8_t v = %s;", src);
+        LINE(b, "    uint16_t result = cpu->regs.a - v%s;", alu == 3 ? " - (FLAG_C(cpu) ? 1 : 0)" : "");
+        LINE(b, "    FLAGS_SUB(cpu, cpu->regs.a, v, result);");
+        if (alu != 7) {
+            LINE(b, "    cpu->regs.a = result & 0xFF;");
+        }
+        LINE(b, "}");
+        break;
+    case 4: // AND
+        LINE(b, "cpu->regs.a &= %s;", src);
+        LINE(b, "FLAGS_AND(cpu, cpu->regs.a);");
+        break;
+    case 5: // XOR
+    case 6: // OR
+        LINE(b, "cpu->regs.a %s= %s;", alu == 5 ? "^" : "|", src);
+        LINE(b, "FLAGS_OR(cpu, cpu->regs.a);");
+        break;
+    }
+}
+
+static void emit_cb(struct block *b, uint8_t op) {
+    int r = op & 7;
+    int n = (op >> 3) & 7;
+    const char *reg = r == 6 ? "READ_BYTE(cpu, cpu->regs.hl)" : reg8[r];
+    if (r == 6) {
+        if (op >= 0x40 && op < 0x80) {
+            guard_read(b, "cpu->regs.hl");
+        } else {
+            guard_write(b, "cpu->regs.hl");
+        }
+    }
+#define CB_STORE(value) do { \
+        if (r == 6) LINE(b, "    WRITE_BYTE(cpu, cpu->regs.hl, %s);", value); \
+        else LINE(b, "    %s = %s;", reg8[r], value); \
+    } while (0)
+    if (op < 0x40) {
+        static const char *const expr[8] = {
+            "(v << 1) | (v >> 7)", "(v >> 1) | (v << 7)",
+            "(v << 1) | (FLAG_C(cpu) ? 0x01 : 0)", "(v >> 1) | (FLAG_C(cpu) ? 0x80 : 0)",
+            "v << 1", "(v >> 1) | (v & 0x80)", "(v >> 4) | (v << 4)", "v >> 1"
+        };
+        static const char *const carry[8] = {
+            "(v & 0x80) != 0", "(v & 0x01) != 0", "(v & 0x80) != 0", "(v & 0x01) != 0",
+            "(v & 0x80) != 0", "(v & 0x01) != 0", "false", "(v & 0x01) != 0"
+        };
+        LINE(b, "{");
+        LINE(b, "    uint8_t v = %s;", reg);
+        LINE(b, "    uint8_t res = (uint8_t)(%s);", expr[n]);
+        CB_STORE("res");
+        LINE(b, "    FLAGS_ROT(cpu, res, %s);", carry[n]);
+        LINE(b, "}");
+    } else if (op < 0x80) {
+        LINE(b, "FLAGS_BIT(cpu, (%s >> %d) & 1);", reg, n);
+    } else {
+        char value[64];
+        if (op < 0xC0) {
+            snprintf(value, sizeof(value), "v & 0x%02X", (uint8_t)~(1 << n));
+        } else {
+            snprintf(value, sizeof(value), "v | 0x%02X", 1 << n);
+        }
+        LINE(b, "{");
+        LINE(b, "    uint8_t v = %s;", reg);
+        CB_STORE(value);
+        LINE(b, "}");
+    }
+#undef CB_STORE
+}
+
+// Run the instruction with the interpreter, `end` leaves the block after it
+static void emit_fallback(struct block *b, uint8_t op, bool end) {
+    LINE(b, "cpu->pc = 0x%04X;", (uint16_t)(b->pc + 1));
+    LINE(b, "cpu->cycles = 4;");
+    LINE(b, "exec_inst(cpu, 0x%02X);", op);
+    LINE(b, "cycles += cpu->cycles;");
+    if (end) {
+        LINE(b, "return cycles;");
+    }
+}
+
+static void emit_exit(struct block *b, int cycles, uint16_t target) {
+    LINE(b, "cycles += %d;", cycles);
+    LINE(b, "AOT_EXIT(0x%04X);", target);
+}
+
+/* Translate one instruction
+   @return INST_NEXT to go on with the next one, INST_END if the block ends
+           after it, INST_STOP if the block has to end in front of it
+*/
+static int emit_inst(struct block *b, uint8_t op, uint16_t imm, uint16_t next) {
+    int r = (op >> 3) & 7;
+    int cc = (op >> 3) & 3;
+    int a_value = -1; // A after this instruction, if known
+
+    if (op == 0x76) { // HALT
+        emit_fallback(b, op, true);
+        add_seed(b->bank, next, b->hint);
+        return INST_END;
+    }
+    if (op >= 0x40 && op < 0x80) { // LD r,r'
+        if ((op & 7) == 7 && r != 7) {
+            a_value = b->a_value; // LD r,A
+        }
+        if (r == 6) {
+            guard_write(b, "cpu->regs.hl");
+            LINE(b, "WRITE_BYTE(cpu, cpu->regs.hl, %s);", reg8[op & 7]);
+            if ((op & 7) == 7) {
+                a_value = b->a_value;
+            }
+        } else if (r != (op & 7)) {
+            const char *src = operand(b, op & 7);
+            LINE(b, "%s = %s;", reg8[r], src);
+        } else if (r == 7) {
+            a_value = b->a_value; // LD A,A
+        }
+        b->a_value = a_value;
+        LINE(b, "cycles += %d;", op_cycles[op]);
+        return INST_NEXT;
+    }
+    if (op >= 0x80 && op < 0xC0) { // ALU A,r
+        emit_alu(b, r, operand(b, op & 7));
+        if (r == 7) {
+            a_value = b->a_value; // CP leaves A alone
+        }
+        b->a_value = a_value;
+        LINE(b, "cycles += %d;", op_cycles[op]);
+        return INST_NEXT;
+    }
+    if ((op & 0xC7) == 0xC6) { // ALU A,n
+        char value[8];
+        snprintf(value, sizeof(value), "0x%02X", imm);
+        emit_alu(b, r, value);
+        b->a_value = r == 7 ? b->a_value : -1;
+        LINE(b, "cycles += %d;", op_cycles[op]);
+        return INST_NEXT;
+    }
+    if ((op & 0xC7) == 0x04 || (op & 0xC7) == 0x05) { // INC r / DEC r
+        bool inc = (op & 1) == 0;
+        if (r == 6) {
+            guard_write(b, "cpu->regs.hl");
+            LINE(b, "{");
+            LINE(b, "    uint8_t val = READ_BYTE(cpu, cpu->regs.hl);");
+            LINE(b, "    val%s;", inc ? "++" : "--");
+            LINE(b, "    WRITE_BYTE(cpu, cpu->regs.hl, val);");
+            LINE(b, "    FLAGS_%s(cpu, val);", inc ? "INC" : "DEC");
+            LINE(b, "}");
+        } else {
+            LINE(b, "%s = %s(%s);", reg8[r], inc ? "INC" : "DEC", reg8[r]);
+            LINE(b, "FLAGS_%s(cpu, %s);", inc ? "INC" : "DEC", reg8[r]);
+        }
+        if (r != 7) {
+            a_value = b->a_value;
+        }
+        b->a_value = a_value;
+        LINE(b, "cycles += %d;", op_cycles[op]);
+        return INST_NEXT;
+    }
+    if ((op & 0xC7) == 0x06) { // LD r,n
+        if (r == 6) {
+            guard_write(b, "cpu->regs.hl");
+            LINE(b, "WRITE_BYTE(cpu, cpu->regs.hl, 0x%02X);", imm);
+        } else {
+            LINE(b, "%s = 0x%02X;", reg8[r], imm);
+        }
+        b->a_value = r == 7 ? imm : b->a_value;
+        LINE(b, "cycles += %d;", op_cycles[op]);
+        return INST_NEXT;
+    }
+    if ((op & 0xC7) == 0xC7) { // RST
+        guard_stack(b, true);
+        LINE(b, "cpu->sp -= 2;");
+        LINE(b, "WRITE_WORD(cpu, cpu->sp, 0x%04X);", next);
+        emit_exit(b, op_cycles[op], op & 0x38);
+        follow(b, op & 0x38);
+        add_seed(b->bank, next, b->hint);
+        return INST_END;
+    }
+
+    switch (op) {
+    case 0x00: // NOP
+    case 0xD3: case 0xDB: case 0xDD: case 0xE3: case 0xE4: case 0xEB: // unused opcodes
+    case 0xEC: case 0xED: case 0xF4: case 0xFC: case 0xFD:
+        break;
+    case 0x01: case 0x11: case 0x21: case 0x31: // LD rr,nn
+        LINE(b, "%s = 0x%04X;", reg16[op >> 4], imm);
+        break;
+    case 0x02: case 0x12: // LD (BC),A / LD (DE),A
+        guard_write(b, reg16[op >> 4]);
+        LINE(b, "WRITE_BYTE(cpu, %s, cpu->regs.a);", reg16[op >> 4]);
+        break;
+    case 0x0A: case 0x1A: // LD A,(BC) / LD A,(DE)
+        guard_read(b, reg16[op >> 4]);
+        LINE(b, "cpu->regs.a = READ_BYTE(cpu, %s);", reg16[op >> 4]);
+        b->a_value = -1;
+        break;
+    case 0x22: case 0x32: // LD (HL+),A / LD (HL-),A
+        guard_write(b, "cpu->regs.hl");
+        LINE(b, "WRITE_BYTE(cpu, cpu->regs.hl, cpu->regs.a);");
+        LINE(b, "cpu->regs.hl%s;", op == 0x22 ? "++" : "--");
+        break;
+    case 0x2A: case 0x3A: // LD A,(HL+) / LD A,(HL-)
+        guard_read(b, "cpu->regs.hl");
+        LINE(b, "cpu->regs.a = READ_BYTE(cpu, cpu->regs.hl);");
+        LINE(b, "cpu->regs.hl%s;", op == 0x2A ? "++" : "--");
+        b->a_value = -1;
+        break;
+    case 0x03: case 0x13: case 0x23: case 0x33: // INC rr
+        LINE(b, "%s++;", reg16[op >> 4]);
+        break;
+    case 0x0B: case 0x1B: case 0x2B: case 0x3B: // DEC rr
+        LINE(b, "%s--;", reg16[op >> 4]);
+        break;
+    case 0x09: case 0x19: case 0x29: case 0x39: // ADD HL,rr
+        LINE(b, "{");
+        LINE(b, "    uint16_t hl = cpu->regs.hl;");
+        LINE(b, "    uint16_t v = %s;", reg16[op >> 4]);
+        LINE(b, "    FLAGS_ADD16(cpu, hl, v);");
+        LINE(b, "    cpu->regs.hl = hl + v;");
+        LINE(b, "}");
+        break;
+    case 0x07: // RLCA
+        LINE(b, "{");
+        LINE(b, "    bool carry = (cpu->regs.a & 0x80) != 0;");
+        LINE(b, "    cpu->regs.a = (cpu->regs.a << 1) | carry;");
+        LINE(b, "    FLAGS_ROTA(cpu, carry);");
+        LINE(b, "}");
+        b->a_value = -1;
+        break;
+    case 0x0F: // RRCA
+        LINE(b, "{");
+        LINE(b, "    bool carry = (cpu->regs.a & 0x01) != 0;");
+        LINE(b, "    cpu->regs.a = (cpu->regs.a >> 1) | (carry << 7);");
+        LINE(b, "    FLAGS_ROTA(cpu, carry);");
+        LINE(b, "}");
+        b->a_value = -1;
+        break;
+    case 0x17: // RLA
+    case 0x1F: // RRA
+        LINE(b, "{");
+        LINE(b, "    bool carry_in = FLAG_C(cpu);");
+        if (op == 0x17) {
+            LINE(b, "    bool carry_out = (cpu->regs.a & 0x80) != 0;");
+            LINE(b, "    cpu->regs.a = (cpu->regs.a << 1) | (carry_in ? 1 : 0);");
+        } else {
+            LINE(b, "    bool carry_out = (cpu->regs.a & 0x01) != 0;");
+            LINE(b, "    cpu->regs.a = (cpu->regs.a >> 1) | (carry_in ? 0x80 : 0);");
+        }
+        LINE(b, "    FLAGS_ROTA(cpu, carry_out);");
+        LINE(b, "}");
+        b->a_value = -1;
+        break;
+    case 0x08: // LD (nn),SP
+        if (!aot_can_write(imm) || !aot_can_write(imm + 1)) {
+            return INST_STOP;
+        }
+        LINE(b, "WRITE_WORD(cpu, 0x%04X, cpu->sp);", imm);
+        break;
+    case 0x27: // DAA
+        emit_fallback(b, op, false);
+        b->a_value = -1;
+        break;
+    case 0x2F: // CPL
+        LINE(b, "cpu->regs.a = ~cpu->regs.a;");
+        LINE(b, "FLAGS_SET(cpu, (FLAG_Z_KEPT(cpu) ? FLAG_ZERO : 0) | FLAG_SUBTRACTION |");
+        LINE(b, "               FLAG_HALF_CARRY | (FLAG_C_KEPT(cpu) ? FLAG_CARRY : 0));");
+        b->a_value = -1;
+        break;
+    case 0x37: // SCF
+        LINE(b, "FLAGS_SET(cpu, (FLAG_Z_KEPT(cpu) ? FLAG_ZERO : 0) | FLAG_CARRY);");
+        break;
+    case 0x3F: // CCF
+        LINE(b, "FLAGS_SET(cpu, (FLAG_Z_KEPT(cpu) ? FLAG_ZERO : 0) | (FLAG_C(cpu) ? 0 : FLAG_CARRY));");
+        break;
+    case 0x10: // STOP
+    case 0xFB: // EI, takes effect after the next instruction
+        emit_fallback(b, op, true);
+        add_seed(b->bank, next, b->hint);
+        return INST_END;
+    case 0xF3: // DI
+        LINE(b, "cpu->ime_pending = false;");
+        LINE(b, "cpu->ime = false;");
+        break;
+    case 0x18: { // JR n
+        uint16_t target = next + (int8_t)imm;
+        emit_exit(b, op_cycles[op], target);
+        follow(b, target);
+        return INST_END;
+    }
+    case 0x20: case 0x28: case 0x30: case 0x38: { // JR cc,n
+        uint16_t target = next + (int8_t)imm;
+        LINE(b, "if (%s) {", condition[cc]);
+        LINE(b, "    cycles += %d;", taken_cycles[op]);
+        LINE(b, "    AOT_EXIT(0x%04X);", target);
+        LINE(b, "}");
+        follow(b, target);
+        break;
+    }
+    case 0xC3: // JP nn
+        emit_exit(b, op_cycles[op], imm);
+        follow(b, imm);
+        return INST_END;
+    case 0xC2: case 0xCA: case 0xD2: case 0xDA: // JP cc,nn
+        LINE(b, "if (%s) {", condition[cc]);
+        LINE(b, "    cycles += %d;", taken_cycles[op]);
+        LINE(b, "    AOT_EXIT(0x%04X);", imm);
+        LINE(b, "}");
+        follow(b, imm);
+        break;
+    case 0xE9: // JP (HL)
+        LINE(b, "cycles += %d;", op_cycles[op]);
+        LINE(b, "AOT_EXIT(cpu->regs.hl);");
+        return INST_END;
+    case 0xCD: // CALL nn
+        guard_stack(b, true);
+        LINE(b, "cpu->sp -= 2;");
+        LINE(b, "WRITE_WORD(cpu, cpu->sp, 0x%04X);", next);
+        emit_exit(b, op_cycles[op], imm);
+        follow(b, imm);
+        add_seed(b->bank, next, b->hint);
+        return INST_END;
+    case 0xC4: case 0xCC: case 0xD4: case 0xDC: // CALL cc,nn
+        LINE(b, "if (%s) {", condition[cc]);
+        LINE(b, "    if (!aot_can_write(cpu->sp - 1) || !aot_can_write(cpu->sp - 2)) AOT_EXIT(0x%04X);", b->pc);
+        LINE(b, "    cpu->sp -= 2;");
+        LINE(b, "    WRITE_WORD(cpu, cpu->sp, 0x%04X);", next);
+        LINE(b, "    cycles += %d;", taken_cycles[op]);
+        LINE(b, "    AOT_EXIT(0x%04X);", imm);
+        LINE(b, "}");
+        follow(b, imm);
+        break;
+    case 0xC9: // RET
+        guard_stack(b, false);
+        LINE(b, "cpu->pc = READ_WORD(cpu, cpu->sp);");
+        LINE(b, "cpu->sp += 2;");
+        LINE(b, "return cycles + %d;", op_cycles[op]);
+        return INST_END;
+    case 0xC0: case 0xC8: case 0xD0: case 0xD8: // RET cc
+        LINE(b, "if (%s) {", condition[cc]);
+        LINE(b, "    if (!aot_can_read(cpu->sp) || !aot_can_read(cpu->sp + 1)) AOT_EXIT(0x%04X);", b->pc);
+        LINE(b, "    cpu->pc = READ_WORD(cpu, cpu->sp);");
+        LINE(b, "    cpu->sp += 2;");
+        LINE(b, "    return cycles + %d;", taken_cycles[op]);
+        LINE(b, "}");
+        break;
+    case 0xD9: // RETI
+        guard_stack(b, false);
+        emit_fallback(b, op, true);
+        return INST_END;
+    case 0xC1: case 0xD1: case 0xE1: // POP rr
+        guard_stack(b, false);
+        LINE(b, "%s = READ_BYTE(cpu, cpu->sp);", reg8[((op >> 4) & 3) * 2 + 1]);
+        LINE(b, "%s = READ_BYTE(cpu, cpu->sp + 1);", reg8[((op >> 4) & 3) * 2]);
+        LINE(b, "cpu->sp += 2;");
+        break;
+    case 0xF1: // POP AF
+        guard_stack(b, false);
+        LINE(b, "{");
+        LINE(b, "    uint16_t af = READ_WORD(cpu, cpu->sp);");
+        LINE(b, "    cpu->sp += 2;");
+        LINE(b, "    SET_AF(cpu, af);");
+        LINE(b, "}");
+        b->a_value = -1;
+        break;
+    case 0xC5: case 0xD5: // PUSH BC / PUSH DE
+        guard_stack(b, true);
+        LINE(b, "cpu->sp -= 2;");
+        LINE(b, "WRITE_WORD(cpu, cpu->sp, (%s << 8) | %s);",
+             reg8[((op >> 4) & 3) * 2], reg8[((op >> 4) & 3) * 2 + 1]);
+        break;
+    case 0xE5: // PUSH HL
+        guard_stack(b, true);
+        LINE(b, "cpu->sp -= 2;");
+        LINE(b, "WRITE_WORD(cpu, cpu->sp, cpu->regs.hl);");
+        break;
+    case 0xF5: // PUSH AF
+        guard_stack(b, true);
+        LINE(b, "cpu->sp -= 2;");
+        LINE(b, "WRITE_WORD(cpu, cpu->sp, GET_AF(cpu));");
+        break;
+    case 0xE0: // LDH (n),A
+    case 0xEA: { // LD (nn),A
+        uint16_t addr = op == 0xE0 ? 0xFF00 + imm : imm;
+        if (!aot_can_write(addr)) {
+            if (addr >= 0x2000 && addr < 0x4000 && b->a_value >= 0) {
+                // ROM bank select, remember it for code in bank 0 after this
+                uint32_t bank = cpu->bus.mbc_type == 1 ? b->a_value & 0x1F : b->a_value;
+                b->hint = bank ? bank : 1;
+            }
+            return INST_STOP;
+        }
+        LINE(b, "WRITE_BYTE(cpu, 0x%04X, cpu->regs.a);", addr);
+        break;
+    }
+    case 0xF0: // LDH A,(n)
+    case 0xFA: { // LD A,(nn)
+        uint16_t addr = op == 0xF0 ? 0xFF00 + imm : imm;
+        if (!aot_can_read(addr)) {
+            return INST_STOP;
+        }
+        LINE(b, "cpu->regs.a = READ_BYTE(cpu, 0x%04X);", addr);
+        b->a_value = -1;
+        break;
+    }
+    case 0xE2: // LD (C),A
+        guard_write(b, "0xFF00 + cpu->regs.c");
+        LINE(b, "WRITE_BYTE(cpu, 0xFF00 + cpu->regs.c, cpu->regs.a);");
+        break;
+    case 0xF2: // LD A,(C)
+        guard_read(b, "0xFF00 + cpu->regs.c");
+        LINE(b, "cpu->regs.a = READ_BYTE(cpu, 0xFF00 + cpu->regs.c);");
+        b->a_value = -1;
+        break;
+    case 0xE8: // ADD SP,n
+    case 0xF8: // LD HL,SP+n
+        LINE(b, "{");
+        LINE(b, "    int8_t offset = %d;", (int8_t)imm);
+        LINE(b, "    uint16_t result = cpu->sp + offset;");
+        LINE(b, "    FLAGS_ADDSP(cpu, cpu->sp, offset);");
+        LINE(b, "    %s = result;", op == 0xE8 ? "cpu->sp" : "cpu->regs.hl");
+        LINE(b, "}");
+        break;
+    case 0xF9: // LD SP,HL
+        LINE(b, "cpu->sp = cpu->regs.hl;");
+        break;
+    case 0xCB:
+        emit_cb(b, imm);
+        LINE(b, "cycles += %d;", cb_cycles[imm]);
+        if ((imm & 7) == 7 && (imm < 0x40 || imm >= 0x80)) {
+            b->a_value = -1;
+        }
+        return INST_NEXT;
+    default:
+        fprintf(stderr, "Unhandled opcode 0x%02X\n", op);
+        exit(1);
+    }
+    if (op != 0x27) {
+        LINE(b, "cycles += %d;", op_cycles[op]);
+    }
+    return INST_NEXT;
+}
+
+/* Translate the block at a seed into `b`
+   @return false if its first instruction has to be interpreted */
+static bool translate(const struct seed *seed, struct block *b) {
+    uint16_t last = seed->pc < 0x4000 ? 0x3FFF : 0x7FFF;
+    b->text.len = 0;
+    b->bank = seed->bank;
+    b->start = seed->pc;
+    b->pc = seed->pc;
+    b->hint = seed->hint;
+    b->a_value = -1;
+    b->cycles = 0;
+    b->max_cycles = 0;
+    b->insts = 0;
+    text_printf(&b->text, "static uint32_t b%03X_%04X(struct CPU *cpu) {\n", b->bank, b->start);
+    LINE(b, "uint32_t cycles = 0;");
+
+    while (true) {
+        uint8_t op = b->pc <= last ? rom_byte(b->bank, b->pc) : 0x00; // ran into the next bank, ends below
+        uint8_t length = inst_length[op];
+        uint16_t next = b->pc + length;
+        if (b->cycles >= AOT_MAX_BLOCK_CYCLES || b->pc + length - 1 > last) {
+            if (b->pc + length - 1 <= last) {
+                add_seed(b->bank, b->pc, b->hint);
+            }
+            LINE(b, "AOT_EXIT(0x%04X);", b->pc);
+            break;
+        }
+        uint16_t imm = 0;
+        if (length == 2) {
+            imm = rom_byte(b->bank, b->pc + 1);
+        } else if (length == 3) {
+            imm = rom_byte(b->bank, b->pc + 1) | rom_byte(b->bank, b->pc + 2) << 8;
+        }
+
+        text_printf(&b->text, "    // %04X:", b->pc);
+        for (int i = 0; i < length; i++) {
+            text_printf(&b->text, " %02X", rom_byte(b->bank, b->pc + i));
+        }
+        text_printf(&b->text, "\n");
+        size_t mark = b->text.len;
+        b->guarded = false;
+        int result = emit_inst(b, op, imm, next);
+        if (result == INST_STOP) {
+            // the interpreter runs it and comes back for the next instruction
+            add_seed(b->bank, next, b->hint);
+            if (b->insts == 0) {
+                return false;
+            }
+            b->text.len = mark;
+            LINE(b, "AOT_EXIT(0x%04X);", b->pc);
+            break;
+        }
+        b->insts++;
+        uint32_t most = op == 0xCB ? cb_cycles[imm] : op_cycles[op];
+        if (taken_cycles[op] > most) {
+            most = taken_cycles[op];
+        }
+        if (b->cycles + most > b->max_cycles) {
+            b->max_cycles = b->cycles + most;
+        }
+        if (result == INST_END) {
+            break;
+        }
+        if (b->guarded) {
+            // a guarded access may leave for the interpreter, which then needs the next block
+            add_seed(b->bank, next, b->hint);
+        }
+        b->cycles += op == 0xCB ? cb_cycles[imm] : op_cycles[op];
+        b->pc = next;
+    }
+    text_printf(&b->text, "}\n\n");
+    return true;
+}
+
+struct entry {
+    uint32_t key;    // bank << 16 | PC
+    uint32_t cycles; // the block's max_cycles
+};
+
+static int compare_keys(const void *a, const void *b) {
+    uint32_t x = ((const struct entry *)a)->key, y = ((const struct entry *)b)->key;
+    return x < y ? -1 : x > y;
+}
+
+static const char *base_name(const char *path) {
+    const char *slash = strrchr(path, '/');
+    return slash ? slash + 1 : path;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 3 || argc > 4) {
+        fprintf(stderr, "Usage: %s <rom> <out.c> [frames]\n", argv[0]);
+        return 1;
+    }
+    uint32_t frames = argc == 4 ? (uint32_t)atoi(argv[3]) : DEFAULT_TRACE_FRAMES;
+
+    cpu = cpu_alloc();
+    if (!cpu) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+    cpu_init(cpu);
+    if (load_rom(cpu, argv[1]) != 0) {
+        fprintf(stderr, "Failed to load ROM\n");
+        return 1;
+    }
+    uint32_t rom_hash = aot_rom_hash(cpu);
+    measure_cycles();
+
+    // entry point, RST targets and interrupt vectors
+    add_seed(0, 0x0100, 0);
+    for (uint16_t vector = 0x00; vector <= 0x60; vector += 8) {
+        add_seed(0, vector, 0);
+    }
+    uint32_t traced = trace(frames);
+
+    FILE *out = fopen(argv[2], "w");
+    if (!out) {
+        perror("Failed to open output");
+        return 1;
+    }
+    fprintf(out, "/* Generated by recomp/gbrecomp from %s, do not edit. */\n", base_name(argv[1]));
+    fprintf(out, "#include \"aot.h\"\n#include \"cpu.h\"\n\n#ifdef AOT\n\n");
+
+    struct block block = { 0 };
+    struct entry *keys = NULL;
+    size_t num_keys = 0, keys_cap = 0;
+    uint64_t insts = 0;
+    for (size_t i = 0; i < queue_len; i++) { // translating queues more seeds
+        struct seed seed = queue[i];
+        if (!translate(&seed, &block)) {
+            continue;
+        }
+        fwrite(block.text.data, 1, block.text.len, out);
+        if (num_keys == keys_cap) {
+            keys_cap = keys_cap ? keys_cap * 2 : 1024;
+            keys = realloc(keys, keys_cap * sizeof(struct entry));
+            if (!keys) {
+                fprintf(stderr, "Out of memory\n");
+                return 1;
+            }
+        }
+        keys[num_keys++] = (struct entry){ (uint32_t)seed.bank << 16 | seed.pc, block.max_cycles };
+        insts += block.insts;
+    }
+
+    qsort(keys, num_keys, sizeof(struct entry), compare_keys);
+    fprintf(out, "static const struct aot_block blocks[] = {\n");
+    for (size_t i = 0; i < num_keys; i++) {
+        uint32_t key = keys[i].key;
+        fprintf(out, "    { 0x%08X, b%03X_%04X, %u },\n", key, key >> 16, key & 0xFFFF, keys[i].cycles);
+    }
+    fprintf(out, "};\n\n");
+    fprintf(out, "const struct aot_image aot_image = {\n");
+    fprintf(out, "    .rom_name = \"");
+    for (const char *c = base_name(argv[1]); *c; c++) {
+        fprintf(out, *c == '"' || *c == '\\' ? "\\%c" : "%c", *c);
+    }
+    fprintf(out, "\",\n");
+    fprintf(out, "    .rom_hash = 0x%08X,\n", rom_hash);
+    fprintf(out, "    .num_rom_banks = %u,\n", cpu->bus.num_rom_banks);
+    fprintf(out, "    .blocks = blocks,\n");
+    fprintf(out, "    .num_blocks = %zu,\n", num_keys);
+    fprintf(out, "};\n\n#endif\n");
+    fclose(out);
+
+    printf("%s: %zu blocks, %llu instructions (%u entry points from %u traced frames)\n",
+           argv[2], num_keys, (unsigned long long)insts, traced, frames);
+
+    free(keys);
+    free(block.text.data);
+    free(queue);
+    for (int bank = 0; bank < AOT_MAX_BANKS; bank++) {
+        free(queued[bank]);
+    }
+    unload_rom(cpu);
+    free(cpu);
+    return 0;
+}
@@ -31,8 +31,7 @@ int main(int argc, char *argv[]) {
     }
 
     struct CPU cpu = {0};
-    struct MemoryBus bus; // leave bus uninitialized for now
-    cpu_init(&cpu, &bus);
+    cpu_init(&cpu);
 
     // Load the selected ROM
     LOG("Loading ROM: %s\n", rom_path);
@@ -54,19 +53,37 @@ int main(int argc, char *argv[]) {
         fprintf(stderr, "Failed to load boot ROM\n");
     }
 
-    patch_checksum(cpu.bus.rom); // Patch the checksum after loading the ROM
+#ifdef FASTMEM
+    if (fastmem_init(&cpu) != 0) {
+        LOG("Fastmem window unavailable, using the page table\n");
+    }
+#endif
+#ifdef JIT
+    if (jit_init(&cpu) != 0) {
+        LOG("JIT unavailable, using the interpreter\n");
+    }
+#endif
+#ifdef AOT
+    if (aot_attach(&cpu, &aot_image) != 0) {
+        LOG("Recompiled image is for %s, using the interpreter\n", aot_image.rom_name);
+    }
+#endif
 
     // Initialize GPU
     struct GPU gpu = {
         .mode = 0,
         .mode_clock = 0,
-        .vram = cpu.bus.rom,
+        .bus = &cpu.bus,
         .framebuffer = {0},
         .should_render = false,
         .off_count = 0,
         .delay_cycles = 0,
         .stopped = false,
     };
+    // frames are drawn on another core while the next one runs, and shown a frame later
+    if (gpu_start_worker(&cpu, &gpu) != 0) {
+        LOG("Render worker unavailable, drawing inline\n");
+    }
 
     if (SDL_Init(SDL_INIT_VIDEO) != 0) {
         fprintf(stderr, "SDL_Init Error: %s\n", SDL_GetError());
@@ -121,8 +138,8 @@ int main(int argc, char *argv[]) {
     static uint8_t button_actions = 0x0F;     // All action buttons released (1=released, 0=pressed)
     
     if (!cpu.save_loaded && cpu.save_file_path) {
-        if (load_save_file(&cpu, cpu.save_file_path) != 0) {
-        } else {
+        // mapped, the game's writes reach the file as they happen; else it is read now and written on exit
+        if (save_map(&cpu, cpu.save_file_path) != 0 && load_save_file(&cpu, cpu.save_file_path) == 0) {
             cpu.save_loaded = true; // Mark save as loaded
         }
     }
@@ -186,13 +203,7 @@ int main(int argc, char *argv[]) {
 
         
         while (!gpu.should_render) {
-        
-            step_cpu(&cpu); // Step the CPU
-            do {
-                step_timer(&cpu);  // Step the timer
-                step_gpu(&gpu, cpu.cycles); // Step the GPU
-            } while (cpu.halted && ((cpu.bus.rom[0xFF0F] & cpu.bus.rom[0xFFFF]) == 0)); // Handle interrupts if CPU is halted
-
+            cpu_run_cycles(&cpu, &gpu, CYCLES_PER_FRAME); // Run CPU, timer and GPU up to the end of the frame
         }
 
         uint32_t frame_time = SDL_GetTicks() - frame_start;
@@ -230,14 +241,28 @@ int main(int argc, char *argv[]) {
 
     }
 
+    gpu_stop_worker(&cpu, &gpu);
+
     if (cpu.save_file_path) {
         // Save the state if a save file path is provided
-        if (write_save_file(&cpu, cpu.save_file_path) != 0) {
+        if (cpu.save) {
+            save_unmap(&cpu); // already in the file, syncs it and the clock
+        } else if (write_save_file(&cpu, cpu.save_file_path) != 0) {
             LOG("Failed to save CPU state to %s\n", cpu.save_file_path);
         }
         free(cpu.save_file_path); // was dynamically allocated
     }
 
+#ifdef AOT
+    aot_detach(&cpu);
+#endif
+#ifdef JIT
+    jit_free(&cpu);
+#endif
+    unload_rom(&cpu);
+#ifdef FASTMEM
+    fastmem_free(&cpu);
+#endif
     free(sdl_pixels);
     SDL_DestroyTexture(texture);
     SDL_DestroyRenderer(renderer);
@@ -0,0 +1,129 @@
+#include "aot.h"
+#include "cpu.h"
+
+#ifdef AOT
+#include <stdlib.h>
+
+uint32_t aot_rom_hash(struct CPU *cpu) {
+    uint32_t hash = 2166136261u;
+    for (uint32_t addr = 0; addr < AOT_BANK_SIZE; addr++) {
+        if (addr != 0x014D) {
+            hash = (hash ^ cpu->bus.rom0[addr]) * 16777619u;
+        }
+    }
+    if (cpu->bus.rom_banks) {
+        size_t size = (size_t)(cpu->bus.num_rom_banks - 1) * AOT_BANK_SIZE;
+        for (size_t i = 0; i < size; i++) {
+            hash = (hash ^ cpu->bus.rom_banks[i]) * 16777619u;
+        }
+    }
+    return hash;
+}
+
+int aot_attach(struct CPU *cpu, const struct aot_image *image) {
+    if (image->num_rom_banks != cpu->bus.num_rom_banks || image->rom_hash != aot_rom_hash(cpu)) {
+        return -1;
+    }
+    struct aot *aot = calloc(1, sizeof(struct aot));
+    if (!aot) {
+        return -1;
+    }
+    aot->image = image;
+    for (uint32_t i = 0; i < image->num_blocks; i++) {
+        const struct aot_block *block = &image->blocks[i];
+        uint32_t bank = block->key >> 16;
+        if (bank >= AOT_MAX_BANKS) {
+            continue;
+        }
+        if (!aot->banks[bank]) {
+            aot->banks[bank] = calloc(AOT_BANK_SIZE, sizeof(const struct aot_block *));
+            if (!aot->banks[bank]) {
+                cpu->aot = aot;
+                aot_detach(cpu);
+                return -1;
+            }
+        }
+        aot->banks[bank][block->key & 0x3FFF] = block;
+    }
+    cpu->aot = aot;
+    return 0;
+}
+
+void aot_detach(struct CPU *cpu) {
+    if (!cpu->aot) {
+        return;
+    }
+    for (int bank = 0; bank < AOT_MAX_BANKS; bank++) {
+        free(cpu->aot->banks[bank]);
+    }
+    free(cpu->aot);
+    cpu->aot = NULL;
+}
+
+// Block for the code at PC with the current banking, NULL if there is none
+static inline const struct aot_block *aot_find(struct CPU *cpu) {
+    uint16_t pc = cpu->pc;
+    uint32_t bank = 0;
+    if (pc >= 0x8000) {
+        return NULL;
+    }
+    if (pc >= 0x4000) {
+        bank = cpu->bus.current_rom_bank;
+        if (bank == 0 || bank >= AOT_MAX_BANKS) {
+            return NULL;
+        }
+    }
+    const struct aot_block **table = cpu->aot->banks[bank];
+    return table ? table[pc & 0x3FFF] : NULL;
+}
+
+uint32_t aot_run(struct CPU *cpu, uint32_t budget) {
+    if (cpu->bootrom_enabled) {
+        return 0;
+    }
+    // a pending interrupt is taken after the next instruction, not the next block
+    if (cpu->ime && (cpu->bus.io.iflag & cpu->bus.ie & 0x1F)) {
+        return 0;
+    }
+
+    uint32_t elapsed = 0;
+    while (true) {
+        const struct aot_block *block = aot_find(cpu);
+        if (!block || elapsed + block->cycles > budget) {
+            break; // the interpreter runs what is left up to the budget
+        }
+        uint32_t cycles = block->run(cpu);
+        if (!cycles) {
+            break; // stopped in front of its first instruction
+        }
+        elapsed += cycles;
+        // same checks exec_chain() does between instructions
+        if (cpu->halted || (cpu->ime && (cpu->bus.io.iflag & cpu->bus.ie & 0x1F))) {
+            break;
+        }
+        if (cpu->ime_pending) {
+            // the block ended in EI: cpu_begin_step() sets IME and the entry
+            // check above hands the next instruction to the interpreter
+            break;
+        }
+    }
+    return elapsed;
+}
+
+void aot_exec(struct CPU *cpu) {
+    struct scheduler *sched = &cpu->sched;
+    uint32_t budget = AOT_STEP_CYCLES;
+    if (sched->gpu) {
+        // up to the next timer or GPU event, which cpu_run_cycles() handles before the next step
+        uint64_t left = sched->next - sched->now;
+        budget = left < UINT32_MAX ? (uint32_t)left : UINT32_MAX;
+    }
+    uint32_t cycles = aot_run(cpu, budget);
+    if (cycles) {
+        cpu->cycles = cycles;
+        return;
+    }
+    exec_next(cpu);
+}
+
+#endif
@@ -0,0 +1,123 @@
+#ifndef _AOT_H
+#define _AOT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Ahead-of-time recompiled ROMs
+   Built with -DAOT. recomp/gbrecomp walks the code of one cartridge and
+   writes a C file with a function per basic block (see recomp/main.c). The
+   file is compiled into the emulator and attached to the CPU with
+   aot_attach(); from then on step_cpu() and exec_block() call the block
+   functions instead of interpreting.
+
+   - Blocks are keyed by bank and PC like the predecoded instruction cache.
+     Anything the recompiler did not discover, and all code running from
+     RAM, is left to the interpreter.
+   - A block returns the cycles the interpreter would have taken. Like the
+     JIT it stops in front of accesses whose result depends on the GPU or
+     timer (I/O, VRAM, OAM) and in front of MBC writes, so the interpreter
+     runs those with the peripherals caught up and the bank never changes
+     under a running block.
+   - A block is only run if the most cycles it can take fit in what is left
+     of the budget. Under cpu_run_cycles() the budget ends at the
+     scheduler's next event and the interpreter runs the instructions left
+     before it, so the timer and GPU raise their interrupts between the same
+     two instructions as when interpreted. Pending interrupts are then
+     taken by step_cpu() before the next run.
+*/
+#if defined(AOT) && defined(ALLOW_ROM_WRITES)
+#undef AOT // the blocks are only valid while ROM can't be written
+#endif
+
+#ifdef AOT
+
+struct CPU;
+
+#define AOT_MAX_BANKS 512
+#define AOT_BANK_SIZE 0x4000
+#define AOT_MAX_BLOCK_CYCLES 64 // the recompiler ends blocks once they get this long
+#define AOT_STEP_CYCLES 128     // budget of one step_cpu() call outside cpu_run_cycles(), see aot_exec()
+
+typedef uint32_t (*aot_block_fn)(struct CPU *cpu);
+
+struct aot_block {
+	uint32_t key;     // bank << 16 | PC
+	aot_block_fn run; // runs the block, returns its cycles (0 = nothing run)
+	uint32_t cycles;  // most cycles a run through the block takes, whichever way it leaves
+};
+
+struct aot_image {
+	const char *rom_name;   // file the image was generated from
+	uint32_t rom_hash;      // aot_rom_hash() of that ROM
+	uint32_t num_rom_banks;
+	const struct aot_block *blocks;
+	uint32_t num_blocks;
+};
+
+struct aot {
+	const struct aot_image *image;
+	const struct aot_block **banks[AOT_MAX_BANKS]; // [bank][PC & 0x3FFF], [0] is the fixed bank
+};
+
+/* Image written by recomp/gbrecomp, linked into AOT builds */
+extern const struct aot_image aot_image;
+
+/* Memory translated code may touch
+   Everything else (I/O, VRAM, OAM, IE, and writes to the MBC registers)
+   makes the block stop in front of the instruction.
+*/
+static inline bool aot_can_read(uint16_t addr) {
+	return addr < 0x8000 || (addr >= 0xA000 && addr < 0xFE00) || (addr >= 0xFF80 && addr < 0xFFFF);
+}
+
+static inline bool aot_can_write(uint16_t addr) {
+	return (addr >= 0xA000 && addr < 0xFE00) || (addr >= 0xFF80 && addr < 0xFFFF);
+}
+
+// leave the block in front of the instruction at `next`, used by generated code
+#define AOT_EXIT(next) do { cpu->pc = (next); return cycles; } while (0)
+
+/* Hash the loaded ROM the same way the recompiler does
+   The header checksum byte is skipped since patch_checksum() rewrites it.
+   @param cpu Pointer to the CPU structure, with a ROM loaded.
+   @return 32-bit FNV-1a hash of all ROM banks
+*/
+uint32_t aot_rom_hash(struct CPU *cpu);
+
+/* Run a recompiled image for the loaded ROM
+   @param cpu Pointer to the CPU structure.
+   @param image Image generated from the same ROM.
+   @return 0 on success, -1 if the image belongs to another ROM or on
+           allocation failure
+*/
+int aot_attach(struct CPU *cpu, const struct aot_image *image);
+
+/* Drop the image again, the interpreter is used afterwards
+   @param cpu Pointer to the CPU structure.
+   @return void
+*/
+void aot_detach(struct CPU *cpu);
+
+/* Run recompiled blocks from PC
+   Only runs a block if all of it fits in what is left of `budget`. Stops
+   before one that doesn't, where the interpreter has to take over, or
+   after an EI so the interrupt it enables is taken one instruction later.
+   @param cpu Pointer to the CPU structure.
+   @param budget Cycles to run for.
+   @return cycles run, 0 if the instruction at PC has to be interpreted
+*/
+uint32_t aot_run(struct CPU *cpu, uint32_t budget);
+
+/* Execute the next piece of code for step_cpu()
+   Runs recompiled blocks up to the scheduler's next event (AOT_STEP_CYCLES
+   outside cpu_run_cycles()) and leaves the total in cpu->cycles, or
+   interprets one instruction.
+   @param cpu Pointer to the CPU structure.
+   @return void
+*/
+void aot_exec(struct CPU *cpu);
+
+#endif
+
+#endif
@@ -1,7 +1,12 @@
 #include "cpu.h"
+#include "graphics.h"
+#include "timer.h"
+#include "rom.h"
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 void dma_transfer(struct CPU *cpu, uint8_t value) {
     cpu->dma_transfer = true; // Set DMA transfer flag
@@ -30,7 +35,7 @@ void dma_transfer(struct CPU *cpu, uint8_t value) {
 }
 
 uint8_t read_joypad(struct CPU *cpu) {
-    uint8_t p1 = cpu->bus.rom[0xFF00] & 0x30; // bits 4 and 5
+    uint8_t p1 = cpu->bus.io.p1 & 0x30; // bits 4 and 5
 
     // Start with all buttons unpressed (bits 0–3 high)
     uint8_t result = p1 | 0x0F;
@@ -45,7 +50,18 @@ uint8_t read_joypad(struct CPU *cpu) {
     return result;
 }
 
-void cpu_init(struct CPU *cpu, struct MemoryBus *bus) {
+const uint8_t no_cartridge[0x4000] = { [0 ... 0x3FFF] = 0xFF };
+
+struct CPU *cpu_alloc(void) {
+    struct CPU *cpu = aligned_alloc(_Alignof(struct CPU), sizeof(struct CPU));
+    if (cpu) {
+        memset(cpu, 0, sizeof(struct CPU));
+    }
+    return cpu;
+}
+
+void cpu_init(struct CPU *cpu) {
+    struct MemoryBus *bus = &cpu->bus;
     cpu->regs.a = 0x01;
     cpu->regs.b = 0x00;
     cpu->regs.c = 0x13;
@@ -58,56 +74,81 @@ void cpu_init(struct CPU *cpu, struct MemoryBus *bus) {
     cpu->pc = 0x0100; // Set PC to the start of the program
     cpu->sp = 0xFFFE; // Initialize stack pointer to 0xFFFE
 
-    cpu->f.zero = true;
-    cpu->f.subtraction = false;
-    cpu->f.half_carry = true;
-    cpu->f.carry = true;
-
-    for (int i = 0xFF00; i <= 0xFFFF; i++) {
-        bus->rom[i] = 0xFF; // Initialize ROM to 0xFF
-    }
-    bus->rom[0xFF00] = 0xCF; // Initialize Joypad register
-    bus->rom[0xFF01] = 0x00; // Initialize Serial Transfer Data
-    bus->rom[0xFF02] = 0x7E; // Initialize Serial Transfer Control
-    bus->rom[0xFF03] = 0xFF; // Initialize Divider Register
-    bus->rom[0xFF04] = 0x18;
-    bus->rom[0xFF05] = 0x00;
-    bus->rom[0xFF06] = 0x00;
-    bus->rom[0xFF07] = 0xF8;
-    bus->rom[0xFF0F] = 0xE1; // Interrupt Flag
-    bus->rom[0xFF10] = 0x80;
-    bus->rom[0xFF11] = 0xBF;
-    bus->rom[0xFF12] = 0xF3;
-    bus->rom[0xFF13] = 0xFF;
-    bus->rom[0xFF14] = 0xBF;
-    bus->rom[0xFF16] = 0x3F;
-    bus->rom[0xFF17] = 0x00;
-    bus->rom[0xFF18] = 0xFF;
-    bus->rom[0xFF19] = 0xBF;
-    bus->rom[0xFF1A] = 0x7F;
-    bus->rom[0xFF1B] = 0xFF;
-    bus->rom[0xFF1C] = 0x9F;
-    bus->rom[0xFF1D] = 0xFF;
-    bus->rom[0xFF1E] = 0xBF;
-    bus->rom[0xFF20] = 0xFF;
-    bus->rom[0xFF21] = 0x00;
-    bus->rom[0xFF22] = 0x00;
-    bus->rom[0xFF23] = 0xBF;
-    bus->rom[0xFF24] = 0x77;
-    bus->rom[0xFF25] = 0xF3;
-    bus->rom[0xFF26] = 0xF1; // Sound on
-    bus->rom[0xFF40] = 0x91; // LCD Control
-    bus->rom[0xFF41] = 0x81; // LCD Status
-    bus->rom[0xFF42] = 0x00;
-    bus->rom[0xFF43] = 0x00;
-    bus->rom[0xFF44] = 0x91; // LY Register
-    bus->rom[0xFF45] = 0x00;
-    bus->rom[0xFF46] = 0xFF;
-    bus->rom[0xFF47] = 0xFC;
-    bus->rom[0xFF4A] = 0x00;
-    bus->rom[0xFF4B] = 0x00;
-    bus->rom[0xFFFF] = 0x00; // Interrupt Enable Register
-    cpu->bus = *bus;
+    UNPACK_FLAGS(cpu, cpu->regs.f);
+#ifdef ICACHE
+    memset(&cpu->icache, 0, sizeof(cpu->icache));
+#endif
+#ifdef JIT
+    cpu->jit = NULL;
+#endif
+    cpu->save = NULL;
+#ifdef AOT
+    cpu->aot = NULL;
+#endif
+#ifdef IDLE_SKIP
+    cpu->idle = (struct idle_loop){ .pc = 0xFFFF };
+#endif
+#ifdef FUSE
+    cpu->fuse = (struct fuse_loop){ .pc = 0xFFFF };
+#endif
+    cpu->sched = (struct scheduler){ 0 };
+    cpu->rtc = (struct rtc){ 0 };
+
+    memset(bus->high, 0xFF, sizeof(bus->high)); // unused I/O reads 0xFF
+    memset(bus->oam, 0, sizeof(bus->oam));
+    memset(bus->vram, 0, sizeof(bus->vram));
+    memset(bus->tile_dirty, 0xFF, sizeof(bus->tile_dirty)); // whatever a GPU had decoded is stale
+    bus->oam_dirty = true;
+    memset(bus->wram, 0, sizeof(bus->wram));
+    bus->io.p1 = 0xCF; // Initialize Joypad register
+    bus->io.sb = 0x00; // Initialize Serial Transfer Data
+    bus->io.sc = 0x7E; // Initialize Serial Transfer Control
+    bus->io.raw[0x03] = 0xFF; // Initialize Divider Register
+    bus->io.div = 0x18;
+    bus->io.tima = 0x00;
+    bus->io.tma = 0x00;
+    bus->io.tac = 0xF8;
+    bus->io.iflag = 0xE1; // Interrupt Flag
+    bus->io.raw[0x10] = 0x80;
+    bus->io.raw[0x11] = 0xBF;
+    bus->io.raw[0x12] = 0xF3;
+    bus->io.raw[0x13] = 0xFF;
+    bus->io.raw[0x14] = 0xBF;
+    bus->io.raw[0x16] = 0x3F;
+    bus->io.raw[0x17] = 0x00;
+    bus->io.raw[0x18] = 0xFF;
+    bus->io.raw[0x19] = 0xBF;
+    bus->io.raw[0x1A] = 0x7F;
+    bus->io.raw[0x1B] = 0xFF;
+    bus->io.raw[0x1C] = 0x9F;
+    bus->io.raw[0x1D] = 0xFF;
+    bus->io.raw[0x1E] = 0xBF;
+    bus->io.raw[0x20] = 0xFF;
+    bus->io.raw[0x21] = 0x00;
+    bus->io.raw[0x22] = 0x00;
+    bus->io.raw[0x23] = 0xBF;
+    bus->io.raw[0x24] = 0x77;
+    bus->io.raw[0x25] = 0xF3;
+    bus->io.raw[0x26] = 0xF1; // Sound on
+    bus->io.lcdc = 0x91; // LCD Control
+    bus->io.stat = 0x81; // LCD Status
+    bus->io.scy = 0x00;
+    bus->io.scx = 0x00;
+    bus->io.ly = 0x91; // LY Register
+    bus->io.lyc = 0x00;
+    bus->io.dma = 0xFF;
+    bus->io.bgp = 0xFC;
+    bus->io.wy = 0x00;
+    bus->io.wx = 0x00;
+    bus->ie = 0x00; // Interrupt Enable Register
+    bus->rom0 = (uint8_t *)no_cartridge; // until load_rom(), never written
+    bus->image = NULL;
+    bus->rom_banks = NULL;
+    bus->cart_ram = NULL;
+    bus->ram_size = 0;
+    bus->num_rom_banks = 0;
+    bus->mbc_type = 0;
+    mbc_init(cpu);
 
 
 
@@ -115,6 +156,7 @@ void cpu_init(struct CPU *cpu, struct MemoryBus *bus) {
     cpu->ime = false;
     cpu->ime_pending = false; // Initialize IME pending state to false
     cpu->divider_cycles = 0; // Initialize cycles until next interrupt to 0
+    memory_map_update(cpu); // again once a ROM is loaded
     // WRITE_BYTE(cpu, 0xFFFF, 0x00); // Initialize IE register to 0
     // WRITE_BYTE(cpu, 0xFF0F, 0x00); // Initialize IF register with some flags set
     // WRITE_BYTE(cpu, 0xFF00, 0x00); // Initialize Joypad register
@@ -138,8 +180,8 @@ void cpu_interrupt_jump(struct CPU *cpu, uint16_t vector) {
 int cpu_handle_interrupts(struct CPU *cpu) {
     if (!cpu->ime) return 1;
 
-    uint8_t interrupt_flags = cpu->bus.rom[0xFF0F];  // Correct: IF register
-    uint8_t interrupt_enable = cpu->bus.rom[0xFFFF]; // Correct: IE register
+    uint8_t interrupt_flags = cpu->bus.io.iflag;
+    uint8_t interrupt_enable = cpu->bus.ie;
 
     uint8_t enabled_interrupts = interrupt_flags & interrupt_enable & 0x1F; // Lower 5 bits
 
@@ -164,282 +206,590 @@ int cpu_handle_interrupts(struct CPU *cpu) {
 
 
 
-void exec_inst(struct CPU *cpu, uint8_t opcode) {
-    switch (opcode) {
-        case 0x00: // NOP
-            break;
-        case 0x01: // _ BC,nn
-            SET_BC(cpu, READ_WORD(cpu, cpu->pc));
-            cpu->pc += 2; // Increment PC by 2 to skip the immediate value
+/* Instruction length in bytes, by opcode (CB counts its second byte as an
+   8-bit immediate). STOP is treated as a single byte like its handler does. */
+const uint8_t inst_length[256] = {
+    1, 3, 1, 1, 1, 1, 2, 1, 3, 1, 1, 1, 1, 1, 2, 1, // 0x00
+    1, 3, 1, 1, 1, 1, 2, 1, 2, 1, 1, 1, 1, 1, 2, 1, // 0x10
+    2, 3, 1, 1, 1, 1, 2, 1, 2, 1, 1, 1, 1, 1, 2, 1, // 0x20
+    2, 3, 1, 1, 1, 1, 2, 1, 2, 1, 1, 1, 1, 1, 2, 1, // 0x30
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 0x40
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 0x50
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 0x60
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 0x70
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 0x80
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 0x90
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 0xA0
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 0xB0
+    1, 1, 3, 3, 3, 1, 2, 1, 1, 1, 3, 2, 3, 3, 2, 1, // 0xC0
+    1, 1, 3, 1, 3, 1, 2, 1, 1, 1, 3, 1, 3, 1, 2, 1, // 0xD0
+    2, 1, 1, 1, 1, 1, 2, 1, 2, 1, 3, 1, 1, 1, 2, 1, // 0xE0
+    2, 1, 1, 1, 1, 1, 2, 1, 2, 1, 3, 1, 1, 1, 2, 1, // 0xF0
+};
+
+/* Fill in length and immediate for `opcode`, reading the operand bytes
+   from `addr` on. */
+static inline void decode_operands(struct CPU *cpu, uint8_t opcode, uint16_t addr,
+                                   struct decoded_inst *inst) {
+    inst->opcode = opcode;
+    inst->length = inst_length[opcode];
+    if (inst->length == 3) {
+        inst->imm = READ_WORD(cpu, addr);
+    } else if (inst->length == 2) {
+        inst->imm = READ_BYTE(cpu, addr);
+    } else {
+        inst->imm = 0;
+    }
+}
+
+#ifdef ICACHE
+void icache_flush(struct CPU *cpu) {
+    memset(cpu->icache.ram, 0, sizeof(cpu->icache.ram));
+}
+
+/* Find the cache slot for the instruction at `pc`
+   @param last Set to the last address of the cached region, an instruction
+               running past it is not cached.
+   @return the slot, or NULL if code at `pc` is not cached
+*/
+static inline struct decoded_inst *icache_slot(struct CPU *cpu, uint16_t pc, uint16_t *last) {
+    if (cpu->bootrom_enabled) {
+        return NULL;
+    }
+    if (pc < 0x8000) {
+        struct rom_image *image = cpu->bus.image;
+        unsigned bank = 0;
+        if (!image) {
+            return NULL;
+        }
+        if (pc >= 0x4000) {
+            bank = cpu->bus.current_rom_bank;
+            if (bank == 0 || bank >= ICACHE_ROM_BANKS) {
+                return NULL;
+            }
+        }
+        struct decoded_inst *table = __atomic_load_n(&image->decoded[bank], __ATOMIC_ACQUIRE);
+        if (!table && !(table = rom_decoded(image, bank))) {
+            return NULL;
+        }
+        *last = pc | 0x3FFF;
+        return &table[pc & 0x3FFF];
+    }
+    if (pc >= 0xC000 && pc < 0xE000) {
+        *last = 0xDFFF;
+        return &cpu->icache.ram[ICACHE_WRAM + (pc - 0xC000)];
+    }
+    if (pc >= 0xFF80 && pc < 0xFFFF) {
+        *last = 0xFFFE;
+        return &cpu->icache.ram[ICACHE_HRAM + (pc - 0xFF80)];
+    }
+    return NULL;
+}
+#else
+void icache_flush(struct CPU *cpu) {
+    (void)cpu;
+}
+#endif
+
+/* Fetch the instruction at PC and advance PC past it
+   @param scratch Decoded into when the instruction is not cacheable.
+   @return the decoded instruction
+*/
+static inline const struct decoded_inst *fetch_inst(struct CPU *cpu,
+                                                    struct decoded_inst *scratch) {
+    uint16_t pc = cpu->pc;
+#ifdef ICACHE
+    uint16_t last;
+    struct decoded_inst *slot = icache_slot(cpu, pc, &last);
+    if (slot) {
+        struct decoded_inst cached = { .word = __atomic_load_n(&slot->word, __ATOMIC_ACQUIRE) };
+        if (cached.length) {
+            cpu->pc = pc + cached.length;
+            return slot;
+        }
+    }
+#endif
+    decode_operands(cpu, READ_BYTE(cpu, pc), pc + 1, scratch);
+    cpu->pc = pc + scratch->length;
+#ifdef ICACHE
+    if (slot && pc + scratch->length - 1 <= last) {
+        // another CPU sharing the ROM may have filled it meanwhile, with the same
+        uint32_t empty = 0;
+        __atomic_compare_exchange_n(&slot->word, &empty, scratch->word, false,
+                                    __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+        return scratch;
+    }
+#endif
+    return scratch;
+}
+
+/* Decide whether the next instruction can be run straight from the current
+   handler. Anything step_cpu() would have to look at first (halt, a pending
+   interrupt) hands control back to the caller instead, and so does a jump
+   back to or before the instruction that made it, or to the polling loop
+   being watched, so that idle_skip() and fuse_skip() see every loop head. Under cpu_run_cycles() `clock` moves the
+   master clock along after each instruction, for registers read on the way,
+   and the run also stops where a register write makes a device due.
+   @param at Address of the instruction just run, then of the one fetched.
+*/
+static inline bool exec_chain(struct CPU *cpu, const struct decoded_inst **inst,
+                              struct decoded_inst *scratch, uint32_t *elapsed,
+                              uint32_t budget, struct scheduler *clock, uint16_t *at) {
+    *elapsed += cpu->cycles;
+    if (clock) {
+        clock->now += cpu->cycles;
+        if (clock->now >= clock->next) {
+            return false;
+        }
+    }
+    if (*elapsed >= budget || cpu->halted || cpu->pc <= *at) {
+        return false;
+    }
+#ifdef IDLE_SKIP
+    if (cpu->pc == cpu->idle.pc) {
+        return false; // back at the polling loop, e.g. from an interrupt handler
+    }
+#endif
+    if (cpu->ime && (cpu->bus.io.iflag & cpu->bus.ie & 0x1F)) {
+        return false;
+    }
+    if (cpu->ime_pending) {
+        cpu->ime = true;
+        cpu->ime_pending = false;
+    }
+    cpu->cycles = 4;
+    *at = cpu->pc;
+    *inst = fetch_inst(cpu, scratch);
+    return true;
+}
+
+/* Opcode dispatch
+   With GCC/Clang every handler ends in its own indirect jump through
+   dispatch_table (threaded code), so the host branch predictor sees one
+   branch per opcode instead of the single shared jump of a switch. Build with
+   -DDISPATCH_SWITCH to fall back to the portable switch. */
+#if !defined(DISPATCH_SWITCH) && defined(__GNUC__)
+#define DISPATCH_THREADED
+#endif
+
+#ifdef DISPATCH_THREADED
+#define OPCODE(op) op_##op:
+#define DISPATCH() goto *dispatch_table[inst->opcode]
+#define NEXT do { \
+        if (!exec_chain(cpu, &inst, &scratch, &elapsed, budget, clock, &at)) goto done; \
+        DISPATCH(); \
+    } while (0)
+#else
+#define OPCODE(op) case op:
+#define NEXT goto next_inst
+#endif
+
+/* A CALL to where a library routine may start ends the run, so that
+   cpu_run_cycles() gets to run it natively (hle.h) */
+#define CALL_NEXT do { \
+        if (hle_entry(cpu, cpu->pc)) goto leave; \
+        NEXT; \
+    } while (0)
+
+/* Operands of the instruction being executed. PC already points past them. */
+#define IMM8 ((uint8_t)inst->imm)
+#define IMM16 (inst->imm)
+
+/* CB-prefixed handlers
+   Every CB opcode gets its own handler with the operand and bit number fixed
+   at compile time. Opcodes are laid out as eight-operand rows (B C D E H L
+   (HL) A), so CB_ROW_LO/CB_ROW_HI stamp out one half row of the opcode map
+   for a given operation. Register operands take 8 cycles, BIT n,(HL) 12 and
+   the read-modify-write (HL) forms 16. */
+#ifdef DISPATCH_THREADED
+#define CB_OPCODE(op) cb_##op:
+#else
+#define CB_OPCODE(op) case op:
+#endif
+
+#define CB_GET_B (cpu->regs.b)
+#define CB_GET_C (cpu->regs.c)
+#define CB_GET_D (cpu->regs.d)
+#define CB_GET_E (cpu->regs.e)
+#define CB_GET_H (cpu->regs.h)
+#define CB_GET_L (cpu->regs.l)
+#define CB_GET_HL READ_BYTE(cpu, cpu->regs.hl)
+#define CB_GET_A (cpu->regs.a)
+
+#define CB_SET_B(v) (cpu->regs.b = (v))
+#define CB_SET_C(v) (cpu->regs.c = (v))
+#define CB_SET_D(v) (cpu->regs.d = (v))
+#define CB_SET_E(v) (cpu->regs.e = (v))
+#define CB_SET_H(v) (cpu->regs.h = (v))
+#define CB_SET_L(v) (cpu->regs.l = (v))
+#define CB_SET_HL(v) WRITE_BYTE(cpu, cpu->regs.hl, (v))
+#define CB_SET_A(v) (cpu->regs.a = (v))
+
+#define CB_CYCLES_B 8
+#define CB_CYCLES_C 8
+#define CB_CYCLES_D 8
+#define CB_CYCLES_E 8
+#define CB_CYCLES_H 8
+#define CB_CYCLES_L 8
+#define CB_CYCLES_HL 16
+#define CB_CYCLES_A 8
+
+/* rotate/shift: `expr` computes res from the operand v, `carry_out` is the
+   new carry flag */
+#define CB_SHIFT(r, expr, carry_out) { \
+        uint8_t v = CB_GET_##r; \
+        uint8_t res = (uint8_t)(expr); \
+        CB_SET_##r(res); \
+        FLAGS_ROT(cpu, res, carry_out); \
+        cpu->cycles = CB_CYCLES_##r; \
+    } \
+    NEXT;
+
+#define CB_RLC(n, r) CB_SHIFT(r, (v << 1) | (v >> 7), (v & 0x80) != 0)
+#define CB_RRC(n, r) CB_SHIFT(r, (v >> 1) | (v << 7), (v & 0x01) != 0)
+#define CB_RL(n, r) CB_SHIFT(r, (v << 1) | (FLAG_C(cpu) ? 0x01 : 0), (v & 0x80) != 0)
+#define CB_RR(n, r) CB_SHIFT(r, (v >> 1) | (FLAG_C(cpu) ? 0x80 : 0), (v & 0x01) != 0)
+#define CB_SLA(n, r) CB_SHIFT(r, v << 1, (v & 0x80) != 0)
+#define CB_SRA(n, r) CB_SHIFT(r, (v >> 1) | (v & 0x80), (v & 0x01) != 0)
+#define CB_SWAP(n, r) CB_SHIFT(r, (v >> 4) | (v << 4), false)
+#define CB_SRL(n, r) CB_SHIFT(r, v >> 1, (v & 0x01) != 0)
+
+#define CB_BIT(n, r) \
+    FLAGS_BIT(cpu, (CB_GET_##r >> (n)) & 1); \
+    cpu->cycles = CB_CYCLES_##r == 16 ? 12 : 8; \
+    NEXT;
+
+#define CB_RES(n, r) \
+    CB_SET_##r(CB_GET_##r & (uint8_t)~(1 << (n))); \
+    cpu->cycles = CB_CYCLES_##r; \
+    NEXT;
+
+#define CB_SET(n, r) \
+    CB_SET_##r(CB_GET_##r | (1 << (n))); \
+    cpu->cycles = CB_CYCLES_##r; \
+    NEXT;
+
+#define CB_ROW_LO(hi, op, n) \
+    CB_OPCODE(hi##0) op(n, B) CB_OPCODE(hi##1) op(n, C) \
+    CB_OPCODE(hi##2) op(n, D) CB_OPCODE(hi##3) op(n, E) \
+    CB_OPCODE(hi##4) op(n, H) CB_OPCODE(hi##5) op(n, L) \
+    CB_OPCODE(hi##6) op(n, HL) CB_OPCODE(hi##7) op(n, A)
+#define CB_ROW_HI(hi, op, n) \
+    CB_OPCODE(hi##8) op(n, B) CB_OPCODE(hi##9) op(n, C) \
+    CB_OPCODE(hi##A) op(n, D) CB_OPCODE(hi##B) op(n, E) \
+    CB_OPCODE(hi##C) op(n, H) CB_OPCODE(hi##D) op(n, L) \
+    CB_OPCODE(hi##E) op(n, HL) CB_OPCODE(hi##F) op(n, A)
+
+/* Execute `inst`, then keep fetching and executing the following
+   instructions until `budget` cycles have elapsed or exec_chain() decides the
+   caller has to take over (halt, pending interrupt, a jump back).
+   @param clock Scheduler to move along, NULL outside cpu_run_cycles().
+   @param last Address of `inst`, set to that of the last instruction run.
+   @return cycles taken by the executed instructions
+*/
+static uint32_t exec_run(struct CPU *cpu, const struct decoded_inst *inst, uint32_t budget,
+                         struct scheduler *clock, uint16_t *last) {
+    uint32_t elapsed = 0;
+    uint16_t at = *last;
+    struct decoded_inst scratch;
+#ifdef DISPATCH_THREADED
+    static const void *const dispatch_table[256] = {
+        &&op_0x00, &&op_0x01, &&op_0x02, &&op_0x03, &&op_0x04, &&op_0x05, &&op_0x06, &&op_0x07,
+        &&op_0x08, &&op_0x09, &&op_0x0A, &&op_0x0B, &&op_0x0C, &&op_0x0D, &&op_0x0E, &&op_0x0F,
+        &&op_0x10, &&op_0x11, &&op_0x12, &&op_0x13, &&op_0x14, &&op_0x15, &&op_0x16, &&op_0x17,
+        &&op_0x18, &&op_0x19, &&op_0x1A, &&op_0x1B, &&op_0x1C, &&op_0x1D, &&op_0x1E, &&op_0x1F,
+        &&op_0x20, &&op_0x21, &&op_0x22, &&op_0x23, &&op_0x24, &&op_0x25, &&op_0x26, &&op_0x27,
+        &&op_0x28, &&op_0x29, &&op_0x2A, &&op_0x2B, &&op_0x2C, &&op_0x2D, &&op_0x2E, &&op_0x2F,
+        &&op_0x30, &&op_0x31, &&op_0x32, &&op_0x33, &&op_0x34, &&op_0x35, &&op_0x36, &&op_0x37,
+        &&op_0x38, &&op_0x39, &&op_0x3A, &&op_0x3B, &&op_0x3C, &&op_0x3D, &&op_0x3E, &&op_0x3F,
+        &&op_0x40, &&op_0x41, &&op_0x42, &&op_0x43, &&op_0x44, &&op_0x45, &&op_0x46, &&op_0x47,
+        &&op_0x48, &&op_0x49, &&op_0x4A, &&op_0x4B, &&op_0x4C, &&op_0x4D, &&op_0x4E, &&op_0x4F,
+        &&op_0x50, &&op_0x51, &&op_0x52, &&op_0x53, &&op_0x54, &&op_0x55, &&op_0x56, &&op_0x57,
+        &&op_0x58, &&op_0x59, &&op_0x5A, &&op_0x5B, &&op_0x5C, &&op_0x5D, &&op_0x5E, &&op_0x5F,
+        &&op_0x60, &&op_0x61, &&op_0x62, &&op_0x63, &&op_0x64, &&op_0x65, &&op_0x66, &&op_0x67,
+        &&op_0x68, &&op_0x69, &&op_0x6A, &&op_0x6B, &&op_0x6C, &&op_0x6D, &&op_0x6E, &&op_0x6F,
+        &&op_0x70, &&op_0x71, &&op_0x72, &&op_0x73, &&op_0x74, &&op_0x75, &&op_0x76, &&op_0x77,
+        &&op_0x78, &&op_0x79, &&op_0x7A, &&op_0x7B, &&op_0x7C, &&op_0x7D, &&op_0x7E, &&op_0x7F,
+        &&op_0x80, &&op_0x81, &&op_0x82, &&op_0x83, &&op_0x84, &&op_0x85, &&op_0x86, &&op_0x87,
+        &&op_0x88, &&op_0x89, &&op_0x8A, &&op_0x8B, &&op_0x8C, &&op_0x8D, &&op_0x8E, &&op_0x8F,
+        &&op_0x90, &&op_0x91, &&op_0x92, &&op_0x93, &&op_0x94, &&op_0x95, &&op_0x96, &&op_0x97,
+        &&op_0x98, &&op_0x99, &&op_0x9A, &&op_0x9B, &&op_0x9C, &&op_0x9D, &&op_0x9E, &&op_0x9F,
+        &&op_0xA0, &&op_0xA1, &&op_0xA2, &&op_0xA3, &&op_0xA4, &&op_0xA5, &&op_0xA6, &&op_0xA7,
+        &&op_0xA8, &&op_0xA9, &&op_0xAA, &&op_0xAB, &&op_0xAC, &&op_0xAD, &&op_0xAE, &&op_0xAF,
+        &&op_0xB0, &&op_0xB1, &&op_0xB2, &&op_0xB3, &&op_0xB4, &&op_0xB5, &&op_0xB6, &&op_0xB7,
+        &&op_0xB8, &&op_0xB9, &&op_0xBA, &&op_0xBB, &&op_0xBC, &&op_0xBD, &&op_0xBE, &&op_0xBF,
+        &&op_0xC0, &&op_0xC1, &&op_0xC2, &&op_0xC3, &&op_0xC4, &&op_0xC5, &&op_0xC6, &&op_0xC7,
+        &&op_0xC8, &&op_0xC9, &&op_0xCA, &&op_0xCB, &&op_0xCC, &&op_0xCD, &&op_0xCE, &&op_0xCF,
+        &&op_0xD0, &&op_0xD1, &&op_0xD2, &&op_0xD3, &&op_0xD4, &&op_0xD5, &&op_0xD6, &&op_0xD7,
+        &&op_0xD8, &&op_0xD9, &&op_0xDA, &&op_0xDB, &&op_0xDC, &&op_0xDD, &&op_0xDE, &&op_0xDF,
+        &&op_0xE0, &&op_0xE1, &&op_0xE2, &&op_0xE3, &&op_0xE4, &&op_0xE5, &&op_0xE6, &&op_0xE7,
+        &&op_0xE8, &&op_0xE9, &&op_0xEA, &&op_0xEB, &&op_0xEC, &&op_0xED, &&op_0xEE, &&op_0xEF,
+        &&op_0xF0, &&op_0xF1, &&op_0xF2, &&op_0xF3, &&op_0xF4, &&op_0xF5, &&op_0xF6, &&op_0xF7,
+        &&op_0xF8, &&op_0xF9, &&op_0xFA, &&op_0xFB, &&op_0xFC, &&op_0xFD, &&op_0xFE, &&op_0xFF,
+    };
+    static const void *const cb_table[256] = {
+        &&cb_0x00, &&cb_0x01, &&cb_0x02, &&cb_0x03, &&cb_0x04, &&cb_0x05, &&cb_0x06, &&cb_0x07,
+        &&cb_0x08, &&cb_0x09, &&cb_0x0A, &&cb_0x0B, &&cb_0x0C, &&cb_0x0D, &&cb_0x0E, &&cb_0x0F,
+        &&cb_0x10, &&cb_0x11, &&cb_0x12, &&cb_0x13, &&cb_0x14, &&cb_0x15, &&cb_0x16, &&cb_0x17,
+        &&cb_0x18, &&cb_0x19, &&cb_0x1A, &&cb_0x1B, &&cb_0x1C, &&cb_0x1D, &&cb_0x1E, &&cb_0x1F,
+        &&cb_0x20, &&cb_0x21, &&cb_0x22, &&cb_0x23, &&cb_0x24, &&cb_0x25, &&cb_0x26, &&cb_0x27,
+        &&cb_0x28, &&cb_0x29, &&cb_0x2A, &&cb_0x2B, &&cb_0x2C, &&cb_0x2D, &&cb_0x2E, &&cb_0x2F,
+        &&cb_0x30, &&cb_0x31, &&cb_0x32, &&cb_0x33, &&cb_0x34, &&cb_0x35, &&cb_0x36, &&cb_0x37,
+        &&cb_0x38, &&cb_0x39, &&cb_0x3A, &&cb_0x3B, &&cb_0x3C, &&cb_0x3D, &&cb_0x3E, &&cb_0x3F,
+        &&cb_0x40, &&cb_0x41, &&cb_0x42, &&cb_0x43, &&cb_0x44, &&cb_0x45, &&cb_0x46, &&cb_0x47,
+        &&cb_0x48, &&cb_0x49, &&cb_0x4A, &&cb_0x4B, &&cb_0x4C, &&cb_0x4D, &&cb_0x4E, &&cb_0x4F,
+        &&cb_0x50, &&cb_0x51, &&cb_0x52, &&cb_0x53, &&cb_0x54, &&cb_0x55, &&cb_0x56, &&cb_0x57,
+        &&cb_0x58, &&cb_0x59, &&cb_0x5A, &&cb_0x5B, &&cb_0x5C, &&cb_0x5D, &&cb_0x5E, &&cb_0x5F,
+        &&cb_0x60, &&cb_0x61, &&cb_0x62, &&cb_0x63, &&cb_0x64, &&cb_0x65, &&cb_0x66, &&cb_0x67,
+        &&cb_0x68, &&cb_0x69, &&cb_0x6A, &&cb_0x6B, &&cb_0x6C, &&cb_0x6D, &&cb_0x6E, &&cb_0x6F,
+        &&cb_0x70, &&cb_0x71, &&cb_0x72, &&cb_0x73, &&cb_0x74, &&cb_0x75, &&cb_0x76, &&cb_0x77,
+        &&cb_0x78, &&cb_0x79, &&cb_0x7A, &&cb_0x7B, &&cb_0x7C, &&cb_0x7D, &&cb_0x7E, &&cb_0x7F,
+        &&cb_0x80, &&cb_0x81, &&cb_0x82, &&cb_0x83, &&cb_0x84, &&cb_0x85, &&cb_0x86, &&cb_0x87,
+        &&cb_0x88, &&cb_0x89, &&cb_0x8A, &&cb_0x8B, &&cb_0x8C, &&cb_0x8D, &&cb_0x8E, &&cb_0x8F,
+        &&cb_0x90, &&cb_0x91, &&cb_0x92, &&cb_0x93, &&cb_0x94, &&cb_0x95, &&cb_0x96, &&cb_0x97,
+        &&cb_0x98, &&cb_0x99, &&cb_0x9A, &&cb_0x9B, &&cb_0x9C, &&cb_0x9D, &&cb_0x9E, &&cb_0x9F,
+        &&cb_0xA0, &&cb_0xA1, &&cb_0xA2, &&cb_0xA3, &&cb_0xA4, &&cb_0xA5, &&cb_0xA6, &&cb_0xA7,
+        &&cb_0xA8, &&cb_0xA9, &&cb_0xAA, &&cb_0xAB, &&cb_0xAC, &&cb_0xAD, &&cb_0xAE, &&cb_0xAF,
+        &&cb_0xB0, &&cb_0xB1, &&cb_0xB2, &&cb_0xB3, &&cb_0xB4, &&cb_0xB5, &&cb_0xB6, &&cb_0xB7,
+        &&cb_0xB8, &&cb_0xB9, &&cb_0xBA, &&cb_0xBB, &&cb_0xBC, &&cb_0xBD, &&cb_0xBE, &&cb_0xBF,
+        &&cb_0xC0, &&cb_0xC1, &&cb_0xC2, &&cb_0xC3, &&cb_0xC4, &&cb_0xC5, &&cb_0xC6, &&cb_0xC7,
+        &&cb_0xC8, &&cb_0xC9, &&cb_0xCA, &&cb_0xCB, &&cb_0xCC, &&cb_0xCD, &&cb_0xCE, &&cb_0xCF,
+        &&cb_0xD0, &&cb_0xD1, &&cb_0xD2, &&cb_0xD3, &&cb_0xD4, &&cb_0xD5, &&cb_0xD6, &&cb_0xD7,
+        &&cb_0xD8, &&cb_0xD9, &&cb_0xDA, &&cb_0xDB, &&cb_0xDC, &&cb_0xDD, &&cb_0xDE, &&cb_0xDF,
+        &&cb_0xE0, &&cb_0xE1, &&cb_0xE2, &&cb_0xE3, &&cb_0xE4, &&cb_0xE5, &&cb_0xE6, &&cb_0xE7,
+        &&cb_0xE8, &&cb_0xE9, &&cb_0xEA, &&cb_0xEB, &&cb_0xEC, &&cb_0xED, &&cb_0xEE, &&cb_0xEF,
+        &&cb_0xF0, &&cb_0xF1, &&cb_0xF2, &&cb_0xF3, &&cb_0xF4, &&cb_0xF5, &&cb_0xF6, &&cb_0xF7,
+        &&cb_0xF8, &&cb_0xF9, &&cb_0xFA, &&cb_0xFB, &&cb_0xFC, &&cb_0xFD, &&cb_0xFE, &&cb_0xFF,
+    };
+    DISPATCH();
+#else
+dispatch:
+    switch (inst->opcode) {
+#endif
+        OPCODE(0x00) // NOP
+            NEXT;
+        OPCODE(0x01) // _ BC,nn
+            SET_BC(cpu, IMM16);
             cpu->cycles = 12; // LD BC,nn takes 12 cycles
-            break;
-        case 0x02: // LD (BC),A
+            NEXT;
+        OPCODE(0x02) // LD (BC),A
             WRITE_BYTE(cpu, GET_BC(cpu), cpu->regs.a);
             cpu->cycles = 8; // LD (BC),A takes 8 cycles
-            break;
-        case 0x03: // INC BC
+            NEXT;
+        OPCODE(0x03) // INC BC
             SET_BC(cpu, INC(GET_BC(cpu)));
             cpu->cycles = 8; // INC BC takes 8 cycles
-            break;
-        case 0x04: // INC B
+            NEXT;
+        OPCODE(0x04) // INC B
             cpu->regs.b = INC(cpu->regs.b);
-            cpu->f.zero = (cpu->regs.b == 0);
-            cpu->f.half_carry = ((cpu->regs.b - 1) & 0x0F) == 0x0F; // Check half carry
-            cpu->f.subtraction = false;
-            break;
-        case 0x05: // DEC B
+            FLAGS_INC(cpu, cpu->regs.b);
+            NEXT;
+        OPCODE(0x05) // DEC B
             cpu->regs.b = DEC(cpu->regs.b);
-            cpu->f.zero = (cpu->regs.b == 0);
-            cpu->f.half_carry = ((cpu->regs.b & 0x0F) == 0x0F);
-            cpu->f.subtraction = true; // N flag is set for DEC
-            break;
-        case 0x06: // LD B,n
-            cpu->regs.b = READ_BYTE(cpu, cpu->pc);
-            cpu->pc++; // Increment PC by 1 to skip the immediate value
+            FLAGS_DEC(cpu, cpu->regs.b);
+            NEXT;
+        OPCODE(0x06) // LD B,n
+            cpu->regs.b = IMM8;
             cpu->cycles = 8; // LD B,n takes 12 cycles
-            break;
-        case 0x07: // RLCA
+            NEXT;
+        OPCODE(0x07) // RLCA
             {
                 bool carry = (cpu->regs.a & 0x80) != 0; // Check if bit 7 is set
                 cpu->regs.a = (cpu->regs.a << 1) | carry; // Rotate left
-                cpu->f.zero = false; // Z flag is always false for RLCA
-                cpu->f.subtraction = false; // N flag is always false for RLCA
-                cpu->f.half_carry = false; // H flag is always false for RLCA
-                cpu->f.carry = carry; // C flag is set if bit 7 was set
+                FLAGS_ROTA(cpu, carry);
             }
-            break;
-        case 0x08: // LD (nn),SP
+            NEXT;
+        OPCODE(0x08) // LD (nn),SP
             {
-                uint16_t address = READ_WORD(cpu, cpu->pc);
-                cpu->pc += 2; // Increment PC by 2 to skip the immediate value
+                uint16_t address = IMM16;
                 WRITE_WORD(cpu, address, cpu->sp);
                 cpu->cycles = 20; // LD (nn),SP takes 20 cycles
             }
-            break;
-        case 0x09: // ADD HL,BC
+            NEXT;
+        OPCODE(0x09) // ADD HL,BC
             {
                 uint16_t hl = cpu->regs.hl;
                 uint16_t bc = GET_BC(cpu);
                 uint32_t result = hl + bc;
-                cpu->f.carry = (result > 0xFFFF); // Set C flag if overflow
-                cpu->f.half_carry = ((hl & 0xFFF) + (bc & 0xFFF)) > 0xFFF; // Check half carry
-                cpu->f.subtraction = false; // N flag is always false for ADD
+                FLAGS_ADD16(cpu, hl, bc);
                 cpu->regs.hl = result & 0xFFFF; // Store the result in HL
                 cpu->cycles = 8;
 
             }
-            break;
-        case 0x0A: // LD A,(BC)
+            NEXT;
+        OPCODE(0x0A) // LD A,(BC)
             cpu->regs.a = READ_BYTE(cpu, GET_BC(cpu));
             cpu->cycles = 8;
 
-            break;
-        case 0x0B: // DEC BC
+            NEXT;
+        OPCODE(0x0B) // DEC BC
             SET_BC(cpu, DEC(GET_BC(cpu)));
             cpu->cycles = 8;
 
-            break;
-        case 0x0C: // INC C
+            NEXT;
+        OPCODE(0x0C) // INC C
             cpu->regs.c = INC(cpu->regs.c);
-            cpu->f.zero = (cpu->regs.c == 0);
-            cpu->f.half_carry = ((cpu->regs.c - 1) & 0x0F) == 0x0F; // Check half carry
-            cpu->f.subtraction = false; // N flag is always false for INC
-            break;
-        case 0x0D: // DEC C
+            FLAGS_INC(cpu, cpu->regs.c);
+            NEXT;
+        OPCODE(0x0D) // DEC C
             cpu->regs.c = DEC(cpu->regs.c);
-            cpu->f.zero = (cpu->regs.c == 0);
-            cpu->f.half_carry = ((cpu->regs.c + 1) & 0x0F) == 0x00; // Check half carry
-            cpu->f.subtraction = true; // N flag is set for DEC
-            break;
-        case 0x0E: // LD C,n
-            cpu->regs.c = READ_BYTE(cpu, cpu->pc);
-            cpu->pc++; // Increment PC by 1 to skip the immediate value
+            FLAGS_DEC(cpu, cpu->regs.c);
+            NEXT;
+        OPCODE(0x0E) // LD C,n
+            cpu->regs.c = IMM8;
             cpu->cycles = 8;
 
-            break;
-        case 0x0F: // RRCA
+            NEXT;
+        OPCODE(0x0F) // RRCA
             {
                 bool carry = (cpu->regs.a & 0x01) != 0; // Check if bit 0 is set
                 cpu->regs.a = (cpu->regs.a >> 1) | (carry << 7); // Rotate right
-                cpu->f.zero = false; // Z flag is always false for RRCA
-                cpu->f.subtraction = false; // N flag is always false for RRCA
-                cpu->f.half_carry = false; // H flag is always false for RRCA
-                cpu->f.carry = carry; // C flag is set if bit 0 was set
+                FLAGS_ROTA(cpu, carry);
             }
-            break;
-        case 0x10: // STOP
+            NEXT;
+        OPCODE(0x10) // STOP
             cpu->halted = true; // Set halted state
-            break;
-        case 0x11: // LD DE,nn
-            SET_DE(cpu, READ_WORD(cpu, cpu->pc));
-            cpu->pc += 2; // Increment PC by 2 to skip the immediate value
+            NEXT;
+        OPCODE(0x11) // LD DE,nn
+            SET_DE(cpu, IMM16);
             cpu->cycles = 12; // LD DE,nn takes 12 cycles
-            break;
-        case 0x12: // LD (DE),A
+            NEXT;
+        OPCODE(0x12) // LD (DE),A
             WRITE_BYTE(cpu, GET_DE(cpu), cpu->regs.a);
             cpu->cycles = 8;
 
-            break;
-        case 0x13: // INC DE
+            NEXT;
+        OPCODE(0x13) // INC DE
             SET_DE(cpu, INC(GET_DE(cpu)));
             cpu->cycles = 8;
 
-            break;
-        case 0x14: // INC D
+            NEXT;
+        OPCODE(0x14) // INC D
             cpu->regs.d = INC(cpu->regs.d);
-            cpu->f.zero = (cpu->regs.d == 0);
-            cpu->f.half_carry = ((cpu->regs.d - 1) & 0x0F) == 0x0F; // Check half carry
-            cpu->f.subtraction = false; // N flag is always false for INC
-            break;
-        case 0x15: // DEC D
+            FLAGS_INC(cpu, cpu->regs.d);
+            NEXT;
+        OPCODE(0x15) // DEC D
             cpu->regs.d = DEC(cpu->regs.d);
-            cpu->f.zero = (cpu->regs.d == 0);
-            cpu->f.half_carry = ((cpu->regs.d + 1) & 0x0F) == 0x00;
-            cpu->f.subtraction = true;
-            break;
+            FLAGS_DEC(cpu, cpu->regs.d);
+            NEXT;
 
-        case 0x16: // LD D,n
-            cpu->regs.d = READ_BYTE(cpu, cpu->pc);
-            cpu->pc++; // Increment PC by 1 to skip the immediate value
+        OPCODE(0x16) // LD D,n
+            cpu->regs.d = IMM8;
             cpu->cycles = 8;
-            break;
+            NEXT;
 
-        case 0x17: // RLA
+        OPCODE(0x17) // RLA
             {
-                bool carry_in = cpu->f.carry;
+                bool carry_in = FLAG_C(cpu);
                 bool carry_out = (cpu->regs.a & 0x80) != 0;
                 cpu->regs.a = (cpu->regs.a << 1) | (carry_in ? 1 : 0);
-                cpu->f.carry = carry_out;
-                cpu->f.zero = false;
-                cpu->f.subtraction = false;
-                cpu->f.half_carry = false;
+                FLAGS_ROTA(cpu, carry_out);
             }
-            break;
+            NEXT;
 
-        case 0x18: // JR n
+        OPCODE(0x18) // JR n
             {
-                int8_t offset = (int8_t)READ_BYTE(cpu, cpu->pc);
-                cpu->pc++; // Increment PC by 1 to skip the immediate value
+                int8_t offset = (int8_t)IMM8;
                 cpu->pc += offset;
                 cpu->cycles = 12; // JR takes 12 cycles
             }
-            break;
+            NEXT;
 
-        case 0x19: // ADD HL,DE
+        OPCODE(0x19) // ADD HL,DE
             {
                 uint16_t hl = cpu->regs.hl;
                 uint16_t de = GET_DE(cpu);
                 uint32_t result = hl + de;
-                cpu->f.carry = (result > 0xFFFF);
-                cpu->f.half_carry = ((hl & 0xFFF) + (de & 0xFFF)) > 0xFFF;
-                cpu->f.subtraction = false;
+                FLAGS_ADD16(cpu, hl, de);
                 cpu->regs.hl = result & 0xFFFF;
                 cpu->cycles = 8; // ADD HL,DE takes 8 cycles
             }
-            break;
+            NEXT;
 
-        case 0x1A: // LD A,(DE)
+        OPCODE(0x1A) // LD A,(DE)
             cpu->regs.a = READ_BYTE(cpu, GET_DE(cpu));
             cpu->cycles = 8;
-            break;
+            NEXT;
 
-        case 0x1B: // DEC DE
+        OPCODE(0x1B) // DEC DE
             SET_DE(cpu, DEC(GET_DE(cpu)));
             cpu->cycles = 8;
-            break;
+            NEXT;
 
-        case 0x1C: // INC E
+        OPCODE(0x1C) // INC E
             cpu->regs.e = INC(cpu->regs.e);
-            cpu->f.zero = (cpu->regs.e == 0);
-            cpu->f.half_carry = ((cpu->regs.e - 1) & 0x0F) == 0x0F;
-            cpu->f.subtraction = false;
-            break;
+            FLAGS_INC(cpu, cpu->regs.e);
+            NEXT;
 
-        case 0x1D: // DEC E
+        OPCODE(0x1D) // DEC E
             cpu->regs.e = DEC(cpu->regs.e);
-            cpu->f.zero = (cpu->regs.e == 0);
-            cpu->f.half_carry = ((cpu->regs.e + 1) & 0x0F) == 0x00;
-            cpu->f.subtraction = true;
-            break;
+            FLAGS_DEC(cpu, cpu->regs.e);
+            NEXT;
 
-        case 0x1E: // LD E,n
-            cpu->regs.e = READ_BYTE(cpu, cpu->pc);
-            cpu->pc++; // Increment PC by 1 to skip the immediate value
+        OPCODE(0x1E) // LD E,n
+            cpu->regs.e = IMM8;
             cpu->cycles = 8;
-            break;
+            NEXT;
 
-        case 0x1F: // RRA
+        OPCODE(0x1F) // RRA
             {
-                bool carry_in = cpu->f.carry;
+                bool carry_in = FLAG_C(cpu);
                 bool carry_out = (cpu->regs.a & 0x01) != 0;
                 cpu->regs.a = (cpu->regs.a >> 1) | (carry_in ? 0x80 : 0);
-                cpu->f.carry = carry_out;
-                cpu->f.zero = false;
-                cpu->f.subtraction = false;
-                cpu->f.half_carry = false;
+                FLAGS_ROTA(cpu, carry_out);
             }
-            break;
+            NEXT;
 
-        case 0x20: // JR NZ,n
+        OPCODE(0x20) // JR NZ,n
             {
-                int8_t offset = (int8_t)READ_BYTE(cpu, cpu->pc);
-                cpu->pc++; // Increment PC by 1 to skip the immediate value
-                if (!cpu->f.zero) {
+                int8_t offset = (int8_t)IMM8;
+                if (!FLAG_Z(cpu)) {
                     cpu->pc += offset;
                     cpu->cycles = 12; // JR NZ,n takes 12 cycles if taken
                 } else {
                     cpu->cycles = 8; // JR NZ,n takes 8 cycles if not taken
                 }
             }
-            break;
+            NEXT;
 
-        case 0x21: // LD HL,nn
+        OPCODE(0x21) // LD HL,nn
         {
-            uint8_t low = READ_BYTE(cpu, cpu->pc);
-            uint8_t high = READ_BYTE(cpu, cpu->pc + 1);
-            uint16_t addr = (high << 8) | low;
-            cpu->regs.hl = addr;
-            cpu->pc += 2;
+            cpu->regs.hl = IMM16;
             cpu->cycles = 12; // LD HL,nn takes 12 cycles
-            break;
+            NEXT;
         }
 
-        case 0x22: // LD (HL+),A
+        OPCODE(0x22) // LD (HL+),A
             WRITE_BYTE(cpu, cpu->regs.hl, cpu->regs.a);
             cpu->regs.hl++;
             cpu->cycles = 8;
-            break;
+            NEXT;
 
-        case 0x23: // INC HL
+        OPCODE(0x23) // INC HL
             cpu->regs.hl = INC(cpu->regs.hl);
             cpu->cycles = 8;
-            break;
+            NEXT;
 
-        case 0x24: // INC H
+        OPCODE(0x24) // INC H
             SET_H(cpu, INC(GET_H(cpu)));
-            cpu->f.zero = (GET_H(cpu) == 0);
-            cpu->f.half_carry = ((GET_H(cpu) - 1) & 0x0F) == 0x0F; // Check half carry
-            cpu->f.subtraction = false; // N flag is always false for INC
-            break;
-        case 0x25: // DEC H
+            FLAGS_INC(cpu, GET_H(cpu));
+            NEXT;
+        OPCODE(0x25) // DEC H
             SET_H(cpu, DEC(GET_H(cpu)));
-            cpu->f.zero = (GET_H(cpu) == 0);
-            cpu->f.half_carry = ((GET_H(cpu) + 1) & 0x0F) == 0x00; // Check half carry
-            cpu->f.subtraction = true; // N flag is set for DEC
-            break;
+            FLAGS_DEC(cpu, GET_H(cpu));
+            NEXT;
 
-        case 0x26: // LD H,n
-            SET_H(cpu, READ_BYTE(cpu, cpu->pc));
-            cpu->pc++; // Increment PC by 1 to skip the immediate value
+        OPCODE(0x26) // LD H,n
+            SET_H(cpu, IMM8);
             cpu->cycles = 8;
-            break;
+            NEXT;
 
-        case 0x27: // DAA
+        OPCODE(0x27) // DAA
             {
                 uint8_t a = cpu->regs.a;
-                bool carry = cpu->f.carry;
-                bool half_carry = cpu->f.half_carry;
-                bool subtraction = cpu->f.subtraction;
+                bool carry = FLAG_C(cpu);
+                bool half_carry = FLAG_H(cpu);
+                bool subtraction = FLAG_N(cpu);
 
                 uint8_t correction = 0;
 
@@ -459,1230 +809,1008 @@ void exec_inst(struct CPU *cpu, uint8_t opcode) {
                 }
 
                 cpu->regs.a = a;
-                cpu->f.zero = (a == 0);
-                cpu->f.half_carry = false;
-                cpu->f.carry = carry;
+                FLAGS_SET(cpu, (a == 0 ? FLAG_ZERO : 0) | (subtraction ? FLAG_SUBTRACTION : 0) |
+                               (carry ? FLAG_CARRY : 0));
             }
-            break;
+            NEXT;
 
-        case 0x28: // JR Z,n
+        OPCODE(0x28) // JR Z,n
             {
-                int8_t offset = (int8_t)READ_BYTE(cpu, cpu->pc);
-                cpu->pc++; // Increment PC by 1 to skip the immediate value
-                if (cpu->f.zero) {
+                int8_t offset = (int8_t)IMM8;
+                if (FLAG_Z(cpu)) {
                     cpu->pc += offset;
                     cpu->cycles = 12; // JR Z,n takes 8 cycles if taken
                 } else {
                     cpu->cycles = 8; // JR Z,n takes 4 cycles if not taken
                 }
             }
-            break;
+            NEXT;
 
-        case 0x29: // ADD HL,HL
+        OPCODE(0x29) // ADD HL,HL
             {
                 uint16_t hl = cpu->regs.hl;
                 uint32_t result = hl + hl;
-                cpu->f.carry = (result > 0xFFFF);
-                cpu->f.half_carry = ((hl & 0xFFF) + (hl & 0xFFF)) > 0xFFF;
-                cpu->f.subtraction = false;
+                FLAGS_ADD16(cpu, hl, hl);
                 cpu->regs.hl = result & 0xFFFF;
                 cpu->cycles = 8;
             }
-            break;
+            NEXT;
 
-        case 0x2A: // LD A,(HL+)
+        OPCODE(0x2A) // LD A,(HL+)
             cpu->regs.a = READ_BYTE(cpu, cpu->regs.hl);
             cpu->regs.hl++;
             cpu->cycles = 8; // LD A,(HL+) takes 8 cycles
-            break;
+            NEXT;
 
-        case 0x2B: // DEC HL
+        OPCODE(0x2B) // DEC HL
             cpu->regs.hl = DEC(cpu->regs.hl);
             cpu->cycles = 8;
-            break;
+            NEXT;
 
-        case 0x2C: // INC L
+        OPCODE(0x2C) // INC L
             SET_L(cpu, (uint8_t)(GET_L(cpu) + 1));
-            cpu->f.zero = (GET_L(cpu) == 0);
-            cpu->f.half_carry = ((GET_L(cpu) - 1) & 0x0F) == 0x0F; // Check half carry
-            cpu->f.subtraction = false; // N flag is always false for INC
-            break;
+            FLAGS_INC(cpu, GET_L(cpu));
+            NEXT;
 
-        case 0x2D: // DEC L
+        OPCODE(0x2D) // DEC L
         {
             uint8_t l = GET_L(cpu);        // original L
             uint8_t result = l - 1;        // decrement
             SET_L(cpu, result);
 
-            cpu->f.zero = (result == 0);
-            cpu->f.subtraction = true;
-            cpu->f.half_carry = ((l & 0x0F) == 0x00); // borrow from bit 4
-            break;
+            FLAGS_DEC(cpu, result);
+            NEXT;
         }
 
-        case 0x2E: // LD L,n
-            SET_L(cpu, READ_BYTE(cpu, cpu->pc));
-            cpu->pc++;
+        OPCODE(0x2E) // LD L,n
+            SET_L(cpu, IMM8);
             cpu->cycles = 8;
 
-            break;
+            NEXT;
 
-        case 0x2F: // CPL (complement A)
+        OPCODE(0x2F) // CPL (complement A)
             cpu->regs.a = ~cpu->regs.a;
-            cpu->f.subtraction = true;
-            cpu->f.half_carry = true;
-            break;
+            FLAGS_SET(cpu, (FLAG_Z_KEPT(cpu) ? FLAG_ZERO : 0) | FLAG_SUBTRACTION |
+                           FLAG_HALF_CARRY | (FLAG_C_KEPT(cpu) ? FLAG_CARRY : 0));
+            NEXT;
 
 
-        case 0x30: // JR NC, r8 (Jump relative if carry flag is 0)
+        OPCODE(0x30) // JR NC, r8 (Jump relative if carry flag is 0)
         {
-            int8_t offset = (int8_t)READ_BYTE(cpu, cpu->pc);
-            cpu->pc++; // Increment PC by 1 to skip the immediate value
-            if (!cpu->f.carry) {
+            int8_t offset = (int8_t)IMM8;
+            if (!FLAG_C(cpu)) {
                 cpu->pc += offset;
                 cpu->cycles = 12; // JR NC, r8 takes 12 cycles if taken
             } else cpu->cycles = 8;
         }
-        break;
+        NEXT;
 
-        case 0x31: // LD SP, nn (Load immediate 16-bit into SP)
+        OPCODE(0x31) // LD SP, nn (Load immediate 16-bit into SP)
         {
-            cpu->sp = READ_WORD(cpu, cpu->pc);
-            cpu->pc += 2;
+            cpu->sp = IMM16;
             cpu->cycles = 12; // LD SP, nn takes 12 cycles
         }
-        break;
+        NEXT;
 
-        case 0x32: // LD (HL-), A (Store A into address HL, then decrement HL)
+        OPCODE(0x32) // LD (HL-), A (Store A into address HL, then decrement HL)
         {
             WRITE_BYTE(cpu, cpu->regs.hl, cpu->regs.a);
             cpu->regs.hl--;
             cpu->cycles = 8;
         }
-        break;
+        NEXT;
 
-        case 0x33: // INC SP
+        OPCODE(0x33) // INC SP
             cpu->sp++;
             cpu->cycles = 8;
-            break;
+            NEXT;
 
-        case 0x34: // INC (HL)
+        OPCODE(0x34) // INC (HL)
         {
             uint8_t val = READ_BYTE(cpu, cpu->regs.hl);
             val++;
             WRITE_BYTE(cpu, cpu->regs.hl, val);
-            cpu->f.zero = (val == 0);
-            cpu->f.subtraction = false;
-            cpu->f.half_carry = ((val & 0x0F) == 0);
+            FLAGS_INC(cpu, val);
             cpu->cycles = 12;
         }
-        break;
+        NEXT;
 
-        case 0x35: // DEC (HL)
+        OPCODE(0x35) // DEC (HL)
         {
             uint8_t val = READ_BYTE(cpu, cpu->regs.hl);
             val--;
             WRITE_BYTE(cpu, cpu->regs.hl, val);
-            cpu->f.zero = (val == 0);
-            cpu->f.subtraction = true;
-            cpu->f.half_carry = ((val & 0x0F) == 0x0F);
+            FLAGS_DEC(cpu, val);
             cpu->cycles = 12; // DEC (HL) takes 12 cycles
         }
-        break;
+        NEXT;
 
-        case 0x36: // LD (HL), n
+        OPCODE(0x36) // LD (HL), n
         {
-            uint8_t value = READ_BYTE(cpu, cpu->pc);
-            cpu->pc++; // Increment PC by 1 to skip the immediate value
+            uint8_t value = IMM8;
             WRITE_BYTE(cpu, cpu->regs.hl, value);
             cpu->cycles = 12; // LD (HL), n takes 12 cycles
         }
-        break;
+        NEXT;
 
-        case 0x37: // SCF (Set Carry Flag)
-            cpu->f.carry = true;
-            cpu->f.subtraction = false;
-            cpu->f.half_carry = false;
-            break;
+        OPCODE(0x37) // SCF (Set Carry Flag)
+            FLAGS_SET(cpu, (FLAG_Z_KEPT(cpu) ? FLAG_ZERO : 0) | FLAG_CARRY);
+            NEXT;
 
-        case 0x38: // JR C, r8 (Jump relative if carry flag set)
+        OPCODE(0x38) // JR C, r8 (Jump relative if carry flag set)
         {
-            int8_t offset = (int8_t)READ_BYTE(cpu, cpu->pc);
-            cpu->pc++; // Increment PC by 1 to skip the immediate value
-            if (cpu->f.carry) {
+            int8_t offset = (int8_t)IMM8;
+            if (FLAG_C(cpu)) {
                 cpu->pc += offset;
                 cpu->cycles = 12; // JR C, r8 takes 12 cycles if taken
             } else cpu->cycles = 8;
         }
-        break;
+        NEXT;
 
-        case 0x39: // ADD HL, SP
+        OPCODE(0x39) // ADD HL, SP
         {
             uint32_t result = cpu->regs.hl + cpu->sp;
-            cpu->f.carry = (result > 0xFFFF);
-            cpu->f.half_carry = ((cpu->regs.hl & 0xFFF) + (cpu->sp & 0xFFF)) > 0xFFF;
-            cpu->f.subtraction = false;
+            FLAGS_ADD16(cpu, cpu->regs.hl, cpu->sp);
             cpu->regs.hl = result & 0xFFFF;
             cpu->cycles = 8;
         }
-        break;
+        NEXT;
 
-        case 0x3A: // LD A, (HL-)
+        OPCODE(0x3A) // LD A, (HL-)
         {
             cpu->regs.a = READ_BYTE(cpu, cpu->regs.hl);
             cpu->regs.hl--;
             cpu->cycles = 8;
         }
-        break;
+        NEXT;
 
-        case 0x3B: // DEC SP
+        OPCODE(0x3B) // DEC SP
             cpu->sp--;
             cpu->cycles = 8;
-            break;
+            NEXT;
 
-        case 0x3C: // INC A
+        OPCODE(0x3C) // INC A
             cpu->regs.a++;
-            cpu->f.zero = (cpu->regs.a == 0);
-            cpu->f.subtraction = false;
-            cpu->f.half_carry = ((cpu->regs.a & 0x0F) == 0);
-            break;
+            FLAGS_INC(cpu, cpu->regs.a);
+            NEXT;
 
-        case 0x3D: // DEC A
+        OPCODE(0x3D) // DEC A
             cpu->regs.a--;
-            cpu->f.zero = (cpu->regs.a == 0);
-            cpu->f.subtraction = true;
-            cpu->f.half_carry = ((cpu->regs.a & 0x0F) == 0x0F);
-            break;
+            FLAGS_DEC(cpu, cpu->regs.a);
+            NEXT;
 
-        case 0x3E: // LD A, n
-            cpu->regs.a = READ_BYTE(cpu, cpu->pc);
-            cpu->pc++; // Increment PC by 1 to skip the immediate value
+        OPCODE(0x3E) // LD A, n
+            cpu->regs.a = IMM8;
             cpu->cycles = 8;
-            break;
+            NEXT;
 
-        case 0x3F: // CCF (Complement Carry Flag)
-            cpu->f.carry = !cpu->f.carry;
-            cpu->f.subtraction = false;
-            cpu->f.half_carry = false;
-            break;
-        case 0x40: // LD B,B
-            break;
+        OPCODE(0x3F) // CCF (Complement Carry Flag)
+            FLAGS_SET(cpu, (FLAG_Z_KEPT(cpu) ? FLAG_ZERO : 0) | (FLAG_C(cpu) ? 0 : FLAG_CARRY));
+            NEXT;
+        OPCODE(0x40) // LD B,B
+            NEXT;
 
-        case 0x41: // LD B,C
+        OPCODE(0x41) // LD B,C
             cpu->regs.b = cpu->regs.c;
-            break;
+            NEXT;
 
-        case 0x42: // LD B,D
+        OPCODE(0x42) // LD B,D
             cpu->regs.b = cpu->regs.d;
-            break;
+            NEXT;
 
-        case 0x43: // LD B,E
+        OPCODE(0x43) // LD B,E
             cpu->regs.b = cpu->regs.e;
-            break;
+            NEXT;
 
-        case 0x44: // LD B,H
+        OPCODE(0x44) // LD B,H
             cpu->regs.b = GET_H(cpu);
-            break;
+            NEXT;
 
-        case 0x45: // LD B,L
+        OPCODE(0x45) // LD B,L
             cpu->regs.b = GET_L(cpu);
-            break;
+            NEXT;
 
-        case 0x46: // LD B,(HL)
+        OPCODE(0x46) // LD B,(HL)
             cpu->regs.b = READ_BYTE(cpu, cpu->regs.hl);
             cpu->cycles = 8;
-            break;
+            NEXT;
 
-        case 0x47: // LD B,A
+        OPCODE(0x47) // LD B,A
             cpu->regs.b = cpu->regs.a;
-            break;
+            NEXT;
 
-        case 0x48: // LD C,B
+        OPCODE(0x48) // LD C,B
             cpu->regs.c = cpu->regs.b;
-            break;
+            NEXT;
 
-        case 0x49: // LD C,C
+        OPCODE(0x49) // LD C,C
             cpu->regs.c = cpu->regs.c;
-            break;
+            NEXT;
 
-        case 0x4A: // LD C,D
+        OPCODE(0x4A) // LD C,D
             cpu->regs.c = cpu->regs.d;
-            break;
+            NEXT;
 
-        case 0x4B: // LD C,E
+        OPCODE(0x4B) // LD C,E
             cpu->regs.c = cpu->regs.e;
-            break;
+            NEXT;
 
-        case 0x4C: // LD C,H
+        OPCODE(0x4C) // LD C,H
             cpu->regs.c = GET_H(cpu);
-            break;
+            NEXT;
 
-        case 0x4D: // LD C,L
+        OPCODE(0x4D) // LD C,L
             cpu->regs.c = GET_L(cpu);
-            break;
+            NEXT;
 
-        case 0x4E: // LD C,(HL)
+        OPCODE(0x4E) // LD C,(HL)
             cpu->regs.c = READ_BYTE(cpu, cpu->regs.hl);
             cpu->cycles = 8;
-            break;
+            NEXT;
 
-        case 0x4F: // LD C,A
+        OPCODE(0x4F) // LD C,A
             cpu->regs.c = cpu->regs.a;
-            break;
+            NEXT;
 
-        case 0x50: // LD D,B
+        OPCODE(0x50) // LD D,B
             cpu->regs.d = cpu->regs.b;
             // No flags affected
-            break;
+            NEXT;
 
-        case 0x51: // LD D,C
+        OPCODE(0x51) // LD D,C
             cpu->regs.d = cpu->regs.c;
             // No flags affected
-            break;
+            NEXT;
 
-        case 0x52: // LD D,D
+        OPCODE(0x52) // LD D,D
             // No flags affected
-            break;
+            NEXT;
 
-        case 0x53: // LD D,E
+        OPCODE(0x53) // LD D,E
             cpu->regs.d = cpu->regs.e;
             // No flags affected
-            break;
+            NEXT;
 
-        case 0x54: // LD D,H
+        OPCODE(0x54) // LD D,H
             cpu->regs.d = GET_H(cpu);
             // No flags affected
-            break;
+            NEXT;
 
-        case 0x55: // LD D,L
+        OPCODE(0x55) // LD D,L
             cpu->regs.d = GET_L(cpu);
             // No flags affected
-            break;
+            NEXT;
 
-        case 0x56: // LD D,(HL)
+        OPCODE(0x56) // LD D,(HL)
             cpu->regs.d = READ_BYTE(cpu, cpu->regs.hl);
             cpu->cycles = 8;
-            break;
+            NEXT;
 
-        case 0x57: // LD D,A
+        OPCODE(0x57) // LD D,A
             cpu->regs.d = cpu->regs.a;
             // No flags affected
-            break;
+            NEXT;
 
-        case 0x58: // LD E,B
+        OPCODE(0x58) // LD E,B
             cpu->regs.e = cpu->regs.b;
             // No flags affected
-            break;
+            NEXT;
 
-        case 0x59: // LD E,C
+        OPCODE(0x59) // LD E,C
             cpu->regs.e = cpu->regs.c;
             // No flags affected
-            break;
+            NEXT;
 
-        case 0x5A: // LD E,D
+        OPCODE(0x5A) // LD E,D
             cpu->regs.e = cpu->regs.d;
             // No flags affected
-            break;
+            NEXT;
 
-        case 0x5B: // LD E,E
+        OPCODE(0x5B) // LD E,E
             // No flags affected
-            break;
+            NEXT;
 
-        case 0x5C: // LD E,H
+        OPCODE(0x5C) // LD E,H
             cpu->regs.e = GET_H(cpu);
             // No flags affected
-            break;
+            NEXT;
 
-        case 0x5D: // LD E,L
+        OPCODE(0x5D) // LD E,L
             cpu->regs.e = GET_L(cpu);
             // No flags affected
-            break;
+            NEXT;
 
-        case 0x5E: // LD E,(HL)
+        OPCODE(0x5E) // LD E,(HL)
             cpu->regs.e = READ_BYTE(cpu, cpu->regs.hl);
             cpu->cycles = 8;
-            break;
+            NEXT;
 
-        case 0x5F: // LD E,A
+        OPCODE(0x5F) // LD E,A
             cpu->regs.e = cpu->regs.a;
             // No flags affected
-            break;
-        case 0x60: // LD H,B
+            NEXT;
+        OPCODE(0x60) // LD H,B
             SET_H(cpu, cpu->regs.b);
             // No flags affected
-            break;
+            NEXT;
 
-        case 0x61: // LD H,C
+        OPCODE(0x61) // LD H,C
             SET_H(cpu, cpu->regs.c);
             // No flags affected
-            break;
+            NEXT;
 
-        case 0x62: // LD H,D
+        OPCODE(0x62) // LD H,D
             SET_H(cpu, cpu->regs.d);
             // No flags affected
-            break;
+            NEXT;
 
-        case 0x63: // LD H,E
+        OPCODE(0x63) // LD H,E
             SET_H(cpu, cpu->regs.e);
             // No flags affected
-            break;
+            NEXT;
 
-        case 0x64: // LD H,H
+        OPCODE(0x64) // LD H,H
             // No flags affected
-            break;
+            NEXT;
 
-        case 0x65: // LD H,L
+        OPCODE(0x65) // LD H,L
             SET_H(cpu, GET_L(cpu));
             // No flags affected
-            break;
+            NEXT;
 
-        case 0x66: // LD H,(HL)
+        OPCODE(0x66) // LD H,(HL)
             SET_H(cpu, READ_BYTE(cpu, cpu->regs.hl));
             cpu->cycles = 8;
-            break;
+            NEXT;
 
-        case 0x67: // LD H,A
+        OPCODE(0x67) // LD H,A
             SET_H(cpu, cpu->regs.a);
             // No flags affected
-            break;
+            NEXT;
 
-        case 0x68: // LD L,B
+        OPCODE(0x68) // LD L,B
             SET_L(cpu, cpu->regs.b);
             // No flags affected
-            break;
+            NEXT;
 
-        case 0x69: // LD L,C
+        OPCODE(0x69) // LD L,C
             SET_L(cpu, cpu->regs.c);
             // No flags affected
-            break;
+            NEXT;
 
-        case 0x6A: // LD L,D
+        OPCODE(0x6A) // LD L,D
             SET_L(cpu, cpu->regs.d);
             // No flags affected
-            break;
+            NEXT;
 
-        case 0x6B: // LD L,E
+        OPCODE(0x6B) // LD L,E
             SET_L(cpu, cpu->regs.e);
             // No flags affected
-            break;
+            NEXT;
 
-        case 0x6C: // LD L,H
+        OPCODE(0x6C) // LD L,H
             SET_L(cpu, GET_H(cpu));
             // No flags affected
-            break;
+            NEXT;
 
-        case 0x6D: // LD L,L
+        OPCODE(0x6D) // LD L,L
             // No flags affected
-            break;
+            NEXT;
 
-        case 0x6E: // LD L,(HL)
+        OPCODE(0x6E) // LD L,(HL)
             SET_L(cpu, READ_BYTE(cpu, cpu->regs.hl));
             cpu->cycles = 8;
-            break;
+            NEXT;
 
-        case 0x6F: // LD L,A
+        OPCODE(0x6F) // LD L,A
             SET_L(cpu, cpu->regs.a);
             // No flags affected
-            break;
+            NEXT;
 
-        case 0x70: // LD (HL),B
+        OPCODE(0x70) // LD (HL),B
             WRITE_BYTE(cpu, cpu->regs.hl, cpu->regs.b);
             // No flags affected
             cpu->cycles = 8;
-            break;
+            NEXT;
 
-        case 0x71: // LD (HL),C
+        OPCODE(0x71) // LD (HL),C
             WRITE_BYTE(cpu, cpu->regs.hl, cpu->regs.c);
             // No flags affected
             cpu->cycles = 8;
-            break;
+            NEXT;
 
-        case 0x72: // LD (HL),D
+        OPCODE(0x72) // LD (HL),D
             WRITE_BYTE(cpu, cpu->regs.hl, cpu->regs.d);
             // No flags affected
             cpu->cycles = 8;
-            break;
+            NEXT;
 
-        case 0x73: // LD (HL),E
+        OPCODE(0x73) // LD (HL),E
             WRITE_BYTE(cpu, cpu->regs.hl, cpu->regs.e);
             // No flags affected
             cpu->cycles = 8;
-            break;
+            NEXT;
 
-        case 0x74: // LD (HL),H
+        OPCODE(0x74) // LD (HL),H
             WRITE_BYTE(cpu, cpu->regs.hl, GET_H(cpu));
             // No flags affected
             cpu->cycles = 8;
-            break;
+            NEXT;
 
-        case 0x75: // LD (HL),L
+        OPCODE(0x75) // LD (HL),L
             WRITE_BYTE(cpu, cpu->regs.hl, GET_L(cpu));
             // No flags affected
             cpu->cycles = 8;
-            break;
+            NEXT;
 
-        case 0x76: // HALT
+        OPCODE(0x76) // HALT
             cpu->halted = true;
             // No flags affected
-            break;
+            NEXT;
 
-        case 0x77: // LD (HL),A
+        OPCODE(0x77) // LD (HL),A
             WRITE_BYTE(cpu, cpu->regs.hl, cpu->regs.a);
             // No flags affected
             cpu->cycles = 8;
-            break;
+            NEXT;
 
-        case 0x78: // LD A,B
+        OPCODE(0x78) // LD A,B
             cpu->regs.a = cpu->regs.b;
             // No flags affected
-            break;
+            NEXT;
 
-        case 0x79: // LD A,C
+        OPCODE(0x79) // LD A,C
             cpu->regs.a = cpu->regs.c;
             // No flags affected
-            break;
+            NEXT;
 
-        case 0x7A: // LD A,D
+        OPCODE(0x7A) // LD A,D
             cpu->regs.a = cpu->regs.d;
             // No flags affected
-            break;
+            NEXT;
 
-        case 0x7B: // LD A,E
+        OPCODE(0x7B) // LD A,E
             cpu->regs.a = cpu->regs.e;
             // No flags affected
-            break;
+            NEXT;
 
-        case 0x7C: // LD A,H
+        OPCODE(0x7C) // LD A,H
             cpu->regs.a = GET_H(cpu);
             // No flags affected
-            break;
+            NEXT;
 
-        case 0x7D: // LD A,L
+        OPCODE(0x7D) // LD A,L
             cpu->regs.a = GET_L(cpu);
             // No flags affected
-            break;
+            NEXT;
 
-        case 0x7E: // LD A,(HL)
+        OPCODE(0x7E) // LD A,(HL)
             cpu->regs.a = READ_BYTE(cpu, cpu->regs.hl);
             // No flags affected
             cpu->cycles = 8;
-            break;
+            NEXT;
 
-        case 0x7F: // LD A,A
+        OPCODE(0x7F) // LD A,A
             // No flags affected
-            break;
+            NEXT;
 
-        case 0x80: // ADD A,B
+        OPCODE(0x80) // ADD A,B
             {
                 uint16_t result = cpu->regs.a + cpu->regs.b;
-                cpu->f.zero = ((result & 0xFF) == 0);
-                cpu->f.subtraction = false;
-                cpu->f.half_carry = ((cpu->regs.a & 0xF) + (cpu->regs.b & 0xF)) > 0xF;
-                cpu->f.carry = (result > 0xFF);
+                FLAGS_ADD(cpu, cpu->regs.a, cpu->regs.b, result);
                 cpu->regs.a = result & 0xFF;
             }
-            break;
+            NEXT;
 
-        case 0x81: // ADD A,C
+        OPCODE(0x81) // ADD A,C
             {
                 uint16_t result = cpu->regs.a + cpu->regs.c;
-                cpu->f.zero = ((result & 0xFF) == 0);
-                cpu->f.subtraction = false;
-                cpu->f.half_carry = ((cpu->regs.a & 0xF) + (cpu->regs.c & 0xF)) > 0xF;
-                cpu->f.carry = (result > 0xFF);
+                FLAGS_ADD(cpu, cpu->regs.a, cpu->regs.c, result);
                 cpu->regs.a = result & 0xFF;
             }
-            break;
-                case 0x82: // ADD A,D
+            NEXT;
+                OPCODE(0x82) // ADD A,D
             {
                 uint16_t result = cpu->regs.a + cpu->regs.d;
-                cpu->f.zero = ((result & 0xFF) == 0);
-                cpu->f.subtraction = false;
-                cpu->f.half_carry = ((cpu->regs.a & 0xF) + (cpu->regs.d & 0xF)) > 0xF;
-                cpu->f.carry = (result > 0xFF);
+                FLAGS_ADD(cpu, cpu->regs.a, cpu->regs.d, result);
                 cpu->regs.a = result & 0xFF;
             }
-            break;
+            NEXT;
 
-        case 0x83: // ADD A,E
+        OPCODE(0x83) // ADD A,E
             {
                 uint16_t result = cpu->regs.a + cpu->regs.e;
-                cpu->f.zero = ((result & 0xFF) == 0);
-                cpu->f.subtraction = false;
-                cpu->f.half_carry = ((cpu->regs.a & 0xF) + (cpu->regs.e & 0xF)) > 0xF;
-                cpu->f.carry = (result > 0xFF);
+                FLAGS_ADD(cpu, cpu->regs.a, cpu->regs.e, result);
                 cpu->regs.a = result & 0xFF;
             }
-            break;
+            NEXT;
 
-        case 0x84: // ADD A,H
+        OPCODE(0x84) // ADD A,H
             {
                 uint16_t result = cpu->regs.a + GET_H(cpu);
-                cpu->f.zero = ((result & 0xFF) == 0);
-                cpu->f.subtraction = false;
-                cpu->f.half_carry = ((cpu->regs.a & 0xF) + (GET_H(cpu) & 0xF)) > 0xF;
-                cpu->f.carry = (result > 0xFF);
+                FLAGS_ADD(cpu, cpu->regs.a, GET_H(cpu), result);
                 cpu->regs.a = result & 0xFF;
             }
-            break;
+            NEXT;
 
-        case 0x85: // ADD A,L
+        OPCODE(0x85) // ADD A,L
             {
                 uint16_t result = cpu->regs.a + GET_L(cpu);
-                cpu->f.zero = ((result & 0xFF) == 0);
-                cpu->f.subtraction = false;
-                cpu->f.half_carry = ((cpu->regs.a & 0xF) + (GET_L(cpu) & 0xF)) > 0xF;
-                cpu->f.carry = (result > 0xFF);
+                FLAGS_ADD(cpu, cpu->regs.a, GET_L(cpu), result);
                 cpu->regs.a = result & 0xFF;
             }
-            break;
+            NEXT;
 
-        case 0x86: // ADD A,(HL)
+        OPCODE(0x86) // ADD A,(HL)
             {
                 uint8_t value = READ_BYTE(cpu, cpu->regs.hl);
                 uint16_t result = cpu->regs.a + value;
-                cpu->f.zero = ((result & 0xFF) == 0);
-                cpu->f.subtraction = false;
-                cpu->f.half_carry = ((cpu->regs.a & 0xF) + (value & 0xF)) > 0xF;
-                cpu->f.carry = (result > 0xFF);
+                FLAGS_ADD(cpu, cpu->regs.a, value, result);
                 cpu->regs.a = result & 0xFF;
                 cpu->cycles = 8;
             }
-            break;
+            NEXT;
 
-        case 0x87: // ADD A,A
+        OPCODE(0x87) // ADD A,A
             {
                 uint16_t result = cpu->regs.a + cpu->regs.a;
-                cpu->f.zero = ((result & 0xFF) == 0);
-                cpu->f.subtraction = false;
-                cpu->f.half_carry = ((cpu->regs.a & 0xF) + (cpu->regs.a & 0xF)) > 0xF;
-                cpu->f.carry = (result > 0xFF);
+                FLAGS_ADD(cpu, cpu->regs.a, cpu->regs.a, result);
                 cpu->regs.a = result & 0xFF;
             }
-            break;
+            NEXT;
 
-        case 0x88: // ADC A,B
+        OPCODE(0x88) // ADC A,B
             {
-                uint16_t carry = cpu->f.carry ? 1 : 0;
+                uint16_t carry = FLAG_C(cpu) ? 1 : 0;
                 uint16_t result = cpu->regs.a + cpu->regs.b + carry;
-                cpu->f.zero = ((result & 0xFF) == 0);
-                cpu->f.subtraction = false;
-                cpu->f.half_carry = ((cpu->regs.a & 0xF) + (cpu->regs.b & 0xF) + carry) > 0xF;
-                cpu->f.carry = (result > 0xFF);
+                FLAGS_ADD(cpu, cpu->regs.a, cpu->regs.b, result);
                 cpu->regs.a = result & 0xFF;
             }
-            break;
+            NEXT;
 
-        case 0x89: // ADC A,C
+        OPCODE(0x89) // ADC A,C
             {
-                uint16_t carry = cpu->f.carry ? 1 : 0;
+                uint16_t carry = FLAG_C(cpu) ? 1 : 0;
                 uint16_t result = cpu->regs.a + cpu->regs.c + carry;
-                cpu->f.zero = ((result & 0xFF) == 0);
-                cpu->f.subtraction = false;
-                cpu->f.half_carry = ((cpu->regs.a & 0xF) + (cpu->regs.c & 0xF) + carry) > 0xF;
-                cpu->f.carry = (result > 0xFF);
+                FLAGS_ADD(cpu, cpu->regs.a, cpu->regs.c, result);
                 cpu->regs.a = result & 0xFF;
             }
-            break;
+            NEXT;
 
-        case 0x8A: // ADC A,D
+        OPCODE(0x8A) // ADC A,D
             {
-                uint16_t carry = cpu->f.carry ? 1 : 0;
+                uint16_t carry = FLAG_C(cpu) ? 1 : 0;
                 uint16_t result = cpu->regs.a + cpu->regs.d + carry;
-                cpu->f.zero = ((result & 0xFF) == 0);
-                cpu->f.subtraction = false;
-                cpu->f.half_carry = ((cpu->regs.a & 0xF) + (cpu->regs.d & 0xF) + carry) > 0xF;
-                cpu->f.carry = (result > 0xFF);
+                FLAGS_ADD(cpu, cpu->regs.a, cpu->regs.d, result);
                 cpu->regs.a = result & 0xFF;
             }
-            break;
+            NEXT;
 
-        case 0x8B: // ADC A,E
+        OPCODE(0x8B) // ADC A,E
             {
-                uint16_t carry = cpu->f.carry ? 1 : 0;
+                uint16_t carry = FLAG_C(cpu) ? 1 : 0;
                 uint16_t result = cpu->regs.a + cpu->regs.e + carry;
-                cpu->f.zero = ((result & 0xFF) == 0);
-                cpu->f.subtraction = false;
-                cpu->f.half_carry = ((cpu->regs.a & 0xF) + (cpu->regs.e & 0xF) + carry) > 0xF;
-                cpu->f.carry = (result > 0xFF);
+                FLAGS_ADD(cpu, cpu->regs.a, cpu->regs.e, result);
                 cpu->regs.a = result & 0xFF;
             }
-            break;
-                case 0x8C: // ADC A,H
+            NEXT;
+                OPCODE(0x8C) // ADC A,H
             {
-                uint16_t carry = cpu->f.carry ? 1 : 0;
+                uint16_t carry = FLAG_C(cpu) ? 1 : 0;
                 uint16_t result = cpu->regs.a + GET_H(cpu) + carry;
-                cpu->f.zero = ((result & 0xFF) == 0);
-                cpu->f.subtraction = false;
-                cpu->f.half_carry = ((cpu->regs.a & 0xF) + (GET_H(cpu) & 0xF) + carry) > 0xF;
-                cpu->f.carry = (result > 0xFF);
+                FLAGS_ADD(cpu, cpu->regs.a, GET_H(cpu), result);
                 cpu->regs.a = result & 0xFF;
             }
-            break;
+            NEXT;
 
-        case 0x8D: // ADC A,L
+        OPCODE(0x8D) // ADC A,L
             {
-                uint16_t carry = cpu->f.carry ? 1 : 0;
+                uint16_t carry = FLAG_C(cpu) ? 1 : 0;
                 uint16_t result = cpu->regs.a + GET_L(cpu) + carry;
-                cpu->f.zero = ((result & 0xFF) == 0);
-                cpu->f.subtraction = false;
-                cpu->f.half_carry = ((cpu->regs.a & 0xF) + (GET_L(cpu) & 0xF) + carry) > 0xF;
-                cpu->f.carry = (result > 0xFF);
+                FLAGS_ADD(cpu, cpu->regs.a, GET_L(cpu), result);
                 cpu->regs.a = result & 0xFF;
             }
-            break;
+            NEXT;
 
-        case 0x8E: // ADC A,(HL)
+        OPCODE(0x8E) // ADC A,(HL)
             {
                 uint8_t value = READ_BYTE(cpu, cpu->regs.hl);
-                uint16_t carry = cpu->f.carry ? 1 : 0;
+                uint16_t carry = FLAG_C(cpu) ? 1 : 0;
                 uint16_t result = cpu->regs.a + value + carry;
-                cpu->f.zero = ((result & 0xFF) == 0);
-                cpu->f.subtraction = false;
-                cpu->f.half_carry = ((cpu->regs.a & 0xF) + (value & 0xF) + carry) > 0xF;
-                cpu->f.carry = (result > 0xFF);
+                FLAGS_ADD(cpu, cpu->regs.a, value, result);
                 cpu->regs.a = result & 0xFF;
                 cpu->cycles = 8;
             }
-            break;
+            NEXT;
 
-        case 0x8F: // ADC A,A
+        OPCODE(0x8F) // ADC A,A
             {
-                uint16_t carry = cpu->f.carry ? 1 : 0;
+                uint16_t carry = FLAG_C(cpu) ? 1 : 0;
                 uint16_t result = cpu->regs.a + cpu->regs.a + carry;
-                cpu->f.zero = ((result & 0xFF) == 0);
-                cpu->f.subtraction = false;
-                cpu->f.half_carry = ((cpu->regs.a & 0xF) + (cpu->regs.a & 0xF) + carry) > 0xF;
-                cpu->f.carry = (result > 0xFF);
+                FLAGS_ADD(cpu, cpu->regs.a, cpu->regs.a, result);
                 cpu->regs.a = result & 0xFF;
             }
-            break;
+            NEXT;
 
-        case 0x90: // SUB B
+        OPCODE(0x90) // SUB B
             {
                 uint16_t result = cpu->regs.a - cpu->regs.b;
-                cpu->f.zero = ((result & 0xFF) == 0);
-                cpu->f.subtraction = true;
-                cpu->f.half_carry = ((cpu->regs.a & 0xF) < (cpu->regs.b & 0xF));
-                cpu->f.carry = (cpu->regs.a < cpu->regs.b);
+                FLAGS_SUB(cpu, cpu->regs.a, cpu->regs.b, result);
                 cpu->regs.a = result & 0xFF;
             }
-            break;
+            NEXT;
 
-        case 0x91: // SUB C
+        OPCODE(0x91) // SUB C
             {
                 uint16_t result = cpu->regs.a - cpu->regs.c;
-                cpu->f.zero = ((result & 0xFF) == 0);
-                cpu->f.subtraction = true;
-                cpu->f.half_carry = ((cpu->regs.a & 0xF) < (cpu->regs.c & 0xF));
-                cpu->f.carry = (cpu->regs.a < cpu->regs.c);
+                FLAGS_SUB(cpu, cpu->regs.a, cpu->regs.c, result);
                 cpu->regs.a = result & 0xFF;
             }
-            break;
+            NEXT;
 
-        case 0x92: // SUB D
+        OPCODE(0x92) // SUB D
             {
                 uint16_t result = cpu->regs.a - cpu->regs.d;
-                cpu->f.zero = ((result & 0xFF) == 0);
-                cpu->f.subtraction = true;
-                cpu->f.half_carry = ((cpu->regs.a & 0xF) < (cpu->regs.d & 0xF));
-                cpu->f.carry = (cpu->regs.a < cpu->regs.d);
+                FLAGS_SUB(cpu, cpu->regs.a, cpu->regs.d, result);
                 cpu->regs.a = result & 0xFF;
             }
-            break;
+            NEXT;
 
-        case 0x93: // SUB E
+        OPCODE(0x93) // SUB E
             {
                 uint16_t result = cpu->regs.a - cpu->regs.e;
-                cpu->f.zero = ((result & 0xFF) == 0);
-                cpu->f.subtraction = true;
-                cpu->f.half_carry = ((cpu->regs.a & 0xF) < (cpu->regs.e & 0xF));
-                cpu->f.carry = (cpu->regs.a < cpu->regs.e);
+                FLAGS_SUB(cpu, cpu->regs.a, cpu->regs.e, result);
                 cpu->regs.a = result & 0xFF;
             }
-            break;
+            NEXT;
 
-        case 0x94: // SUB H
+        OPCODE(0x94) // SUB H
             {
                 uint16_t result = cpu->regs.a - GET_H(cpu);
-                cpu->f.zero = ((result & 0xFF) == 0);
-                cpu->f.subtraction = true;
-                cpu->f.half_carry = ((cpu->regs.a & 0xF) < (GET_H(cpu) & 0xF));
-                cpu->f.carry = (cpu->regs.a < GET_H(cpu));
+                FLAGS_SUB(cpu, cpu->regs.a, GET_H(cpu), result);
                 cpu->regs.a = result & 0xFF;
             }
-            break;
+            NEXT;
 
-        case 0x95: // SUB L
+        OPCODE(0x95) // SUB L
             {
                 uint16_t result = cpu->regs.a - GET_L(cpu);
-                cpu->f.zero = ((result & 0xFF) == 0);
-                cpu->f.subtraction = true;
-                cpu->f.half_carry = ((cpu->regs.a & 0xF) < (GET_L(cpu) & 0xF));
-                cpu->f.carry = (cpu->regs.a < GET_L(cpu));
+                FLAGS_SUB(cpu, cpu->regs.a, GET_L(cpu), result);
                 cpu->regs.a = result & 0xFF;
             }
-            break;
+            NEXT;
 
-        case 0x96: // SUB (HL)
+        OPCODE(0x96) // SUB (HL)
             {
                 uint8_t value = READ_BYTE(cpu, cpu->regs.hl);
                 uint16_t result = cpu->regs.a - value;
-                cpu->f.zero = ((result & 0xFF) == 0);
-                cpu->f.subtraction = true;
-                cpu->f.half_carry = ((cpu->regs.a & 0xF) < (value & 0xF));
-                cpu->f.carry = (cpu->regs.a < value);
+                FLAGS_SUB(cpu, cpu->regs.a, value, result);
                 cpu->regs.a = result & 0xFF;
                 cpu->cycles = 8;
             }
-            break;
+            NEXT;
 
-        case 0x97: // SUB A
+        OPCODE(0x97) // SUB A
             {
-                cpu->f.zero = 1;
-                cpu->f.subtraction = true;
-                cpu->f.half_carry = 0;
-                cpu->f.carry = 0;
+                FLAGS_SET(cpu, FLAG_ZERO | FLAG_SUBTRACTION);
                 cpu->regs.a = 0;
             }
-            break;
-                case 0x98: // SBC A,B
+            NEXT;
+                OPCODE(0x98) // SBC A,B
             {
-                uint16_t carry = cpu->f.carry ? 1 : 0;
+                uint16_t carry = FLAG_C(cpu) ? 1 : 0;
                 uint16_t result = cpu->regs.a - cpu->regs.b - carry;
-                cpu->f.zero = ((result & 0xFF) == 0);
-                cpu->f.subtraction = true;
-                cpu->f.half_carry = ((cpu->regs.a & 0xF) < ((cpu->regs.b & 0xF) + carry));
-                cpu->f.carry = (cpu->regs.a < (cpu->regs.b + carry));
+                FLAGS_SUB(cpu, cpu->regs.a, cpu->regs.b, result);
                 cpu->regs.a = result & 0xFF;
             }
-            break;
+            NEXT;
 
-        case 0x99: // SBC A,C
+        OPCODE(0x99) // SBC A,C
             {
-                uint16_t carry = cpu->f.carry ? 1 : 0;
+                uint16_t carry = FLAG_C(cpu) ? 1 : 0;
                 uint16_t result = cpu->regs.a - cpu->regs.c - carry;
-                cpu->f.zero = ((result & 0xFF) == 0);
-                cpu->f.subtraction = true;
-                cpu->f.half_carry = ((cpu->regs.a & 0xF) < ((cpu->regs.c & 0xF) + carry));
-                cpu->f.carry = (cpu->regs.a < (cpu->regs.c + carry));
+                FLAGS_SUB(cpu, cpu->regs.a, cpu->regs.c, result);
                 cpu->regs.a = result & 0xFF;
             }
-            break;
+            NEXT;
 
-        case 0x9A: // SBC A,D
+        OPCODE(0x9A) // SBC A,D
             {
-                uint16_t carry = cpu->f.carry ? 1 : 0;
+                uint16_t carry = FLAG_C(cpu) ? 1 : 0;
                 uint16_t result = cpu->regs.a - cpu->regs.d - carry;
-                cpu->f.zero = ((result & 0xFF) == 0);
-                cpu->f.subtraction = true;
-                cpu->f.half_carry = ((cpu->regs.a & 0xF) < ((cpu->regs.d & 0xF) + carry));
-                cpu->f.carry = (cpu->regs.a < (cpu->regs.d + carry));
+                FLAGS_SUB(cpu, cpu->regs.a, cpu->regs.d, result);
                 cpu->regs.a = result & 0xFF;
             }
-            break;
+            NEXT;
 
-        case 0x9B: // SBC A,E
+        OPCODE(0x9B) // SBC A,E
             {
-                uint16_t carry = cpu->f.carry ? 1 : 0;
+                uint16_t carry = FLAG_C(cpu) ? 1 : 0;
                 uint16_t result = cpu->regs.a - cpu->regs.e - carry;
-                cpu->f.zero = ((result & 0xFF) == 0);
-                cpu->f.subtraction = true;
-                cpu->f.half_carry = ((cpu->regs.a & 0xF) < ((cpu->regs.e & 0xF) + carry));
-                cpu->f.carry = (cpu->regs.a < (cpu->regs.e + carry));
+                FLAGS_SUB(cpu, cpu->regs.a, cpu->regs.e, result);
                 cpu->regs.a = result & 0xFF;
             }
-            break;
+            NEXT;
 
-        case 0x9C: // SBC A,H
+        OPCODE(0x9C) // SBC A,H
             {
-                uint16_t carry = cpu->f.carry ? 1 : 0;
+                uint16_t carry = FLAG_C(cpu) ? 1 : 0;
                 uint16_t result = cpu->regs.a - GET_H(cpu) - carry;
-                cpu->f.zero = ((result & 0xFF) == 0);
-                cpu->f.subtraction = true;
-                cpu->f.half_carry = ((cpu->regs.a & 0xF) < ((GET_H(cpu) & 0xF) + carry));
-                cpu->f.carry = (cpu->regs.a < (GET_H(cpu) + carry));
+                FLAGS_SUB(cpu, cpu->regs.a, GET_H(cpu), result);
                 cpu->regs.a = result & 0xFF;
             }
-            break;
+            NEXT;
 
-        case 0x9D: // SBC A,L
+        OPCODE(0x9D) // SBC A,L
             {
-                uint16_t carry = cpu->f.carry ? 1 : 0;
+                uint16_t carry = FLAG_C(cpu) ? 1 : 0;
                 uint16_t result = cpu->regs.a - GET_L(cpu) - carry;
-                cpu->f.zero = ((result & 0xFF) == 0);
-                cpu->f.subtraction = true;
-                cpu->f.half_carry = ((cpu->regs.a & 0xF) < ((GET_L(cpu) & 0xF) + carry));
-                cpu->f.carry = (cpu->regs.a < (GET_L(cpu) + carry));
+                FLAGS_SUB(cpu, cpu->regs.a, GET_L(cpu), result);
                 cpu->regs.a = result & 0xFF;
             }
-            break;
+            NEXT;
 
-        case 0x9E: // SBC A,(HL)
+        OPCODE(0x9E) // SBC A,(HL)
             {
                 uint8_t value = READ_BYTE(cpu, cpu->regs.hl);
-                uint16_t carry = cpu->f.carry ? 1 : 0;
+                uint16_t carry = FLAG_C(cpu) ? 1 : 0;
                 uint16_t result = cpu->regs.a - value - carry;
-                cpu->f.zero = ((result & 0xFF) == 0);
-                cpu->f.subtraction = true;
-                cpu->f.half_carry = ((cpu->regs.a & 0xF) < ((value & 0xF) + carry));
-                cpu->f.carry = (cpu->regs.a < (value + carry));
+                FLAGS_SUB(cpu, cpu->regs.a, value, result);
                 cpu->regs.a = result & 0xFF;
                 cpu->cycles = 8;
             }
-            break;
+            NEXT;
 
-        case 0x9F: // SBC A,A
+        OPCODE(0x9F) // SBC A,A
             {
                 uint8_t a = cpu->regs.a;
-                uint8_t carry = cpu->f.carry ? 1 : 0;
+                uint8_t carry = FLAG_C(cpu) ? 1 : 0;
                 uint16_t result = (uint16_t)a - a - carry;
 
                 cpu->regs.a = (uint8_t)result;
 
-                cpu->f.zero = (cpu->regs.a == 0);
-                cpu->f.subtraction = true;
-                cpu->f.half_carry = ((a & 0x0F) - (a & 0x0F) - carry) & 0x10 ? 1 : 0;
-                cpu->f.carry = (result & 0x100) ? 1 : 0;
+                FLAGS_SUB(cpu, a, a, result);
             }
-            break;
+            NEXT;
 
-        case 0xA0: // AND B
+        OPCODE(0xA0) // AND B
             {
                 cpu->regs.a &= cpu->regs.b;
-                cpu->f.zero = (cpu->regs.a == 0);
-                cpu->f.subtraction = false;
-                cpu->f.half_carry = true;
-                cpu->f.carry = false;
+                FLAGS_AND(cpu, cpu->regs.a);
             }
-            break;
+            NEXT;
 
-        case 0xA1: // AND C
+        OPCODE(0xA1) // AND C
             {
                 cpu->regs.a &= cpu->regs.c;
-                cpu->f.zero = (cpu->regs.a == 0);
-                cpu->f.subtraction = false;
-                cpu->f.half_carry = true;
-                cpu->f.carry = false;
+                FLAGS_AND(cpu, cpu->regs.a);
             }
-            break;
+            NEXT;
 
-        case 0xA2: // AND D
+        OPCODE(0xA2) // AND D
             {
                 cpu->regs.a &= cpu->regs.d;
-                cpu->f.zero = (cpu->regs.a == 0);
-                cpu->f.subtraction = false;
-                cpu->f.half_carry = true;
-                cpu->f.carry = false;
+                FLAGS_AND(cpu, cpu->regs.a);
             }
-            break;
+            NEXT;
 
-        case 0xA3: // AND E
+        OPCODE(0xA3) // AND E
             {
                 cpu->regs.a &= cpu->regs.e;
-                cpu->f.zero = (cpu->regs.a == 0);
-                cpu->f.subtraction = false;
-                cpu->f.half_carry = true;
-                cpu->f.carry = false;
+                FLAGS_AND(cpu, cpu->regs.a);
             }
-            break;
+            NEXT;
 
-        case 0xA4: // AND H
+        OPCODE(0xA4) // AND H
             {
                 cpu->regs.a &= GET_H(cpu);
-                cpu->f.zero = (cpu->regs.a == 0);
-                cpu->f.subtraction = false;
-                cpu->f.half_carry = true;
-                cpu->f.carry = false;
+                FLAGS_AND(cpu, cpu->regs.a);
             }
-            break;
+            NEXT;
 
-        case 0xA5: // AND L
+        OPCODE(0xA5) // AND L
             {
                 cpu->regs.a &= GET_L(cpu);
-                cpu->f.zero = (cpu->regs.a == 0);
-                cpu->f.subtraction = false;
-                cpu->f.half_carry = true;
-                cpu->f.carry = false;
+                FLAGS_AND(cpu, cpu->regs.a);
             }
-            break;
+            NEXT;
 
-        case 0xA6: // AND (HL)
+        OPCODE(0xA6) // AND (HL)
             {
                 uint8_t value = READ_BYTE(cpu, cpu->regs.hl);
                 cpu->regs.a &= value;
-                cpu->f.zero = (cpu->regs.a == 0);
-                cpu->f.subtraction = false;
-                cpu->f.half_carry = true;
-                cpu->f.carry = false;
+                FLAGS_AND(cpu, cpu->regs.a);
                 cpu->cycles = 8;
             }
-            break;
+            NEXT;
 
-        case 0xA7: // AND A
+        OPCODE(0xA7) // AND A
             {
                 cpu->regs.a &= cpu->regs.a;
-                cpu->f.zero = (cpu->regs.a == 0);
-                cpu->f.subtraction = false;
-                cpu->f.half_carry = true;
-                cpu->f.carry = false;
+                FLAGS_AND(cpu, cpu->regs.a);
             }
-            break;
-        case 0xA8: // XOR B
+            NEXT;
+        OPCODE(0xA8) // XOR B
             cpu->regs.a ^= cpu->regs.b;
-            cpu->f.zero = (cpu->regs.a == 0);
-            cpu->f.subtraction = false;
-            cpu->f.half_carry = false;
-            cpu->f.carry = false;
-            break;
+            FLAGS_OR(cpu, cpu->regs.a);
+            NEXT;
 
-        case 0xA9: // XOR C
+        OPCODE(0xA9) // XOR C
             cpu->regs.a ^= cpu->regs.c;
-            cpu->f.zero = (cpu->regs.a == 0);
-            cpu->f.subtraction = false;
-            cpu->f.half_carry = false;
-            cpu->f.carry = false;
-            break;
+            FLAGS_OR(cpu, cpu->regs.a);
+            NEXT;
 
-        case 0xAA: // XOR D
+        OPCODE(0xAA) // XOR D
             cpu->regs.a ^= cpu->regs.d;
-            cpu->f.zero = (cpu->regs.a == 0);
-            cpu->f.subtraction = false;
-            cpu->f.half_carry = false;
-            cpu->f.carry = false;
-            break;
+            FLAGS_OR(cpu, cpu->regs.a);
+            NEXT;
 
-        case 0xAB: // XOR E
+        OPCODE(0xAB) // XOR E
             cpu->regs.a ^= cpu->regs.e;
-            cpu->f.zero = (cpu->regs.a == 0);
-            cpu->f.subtraction = false;
-            cpu->f.half_carry = false;
-            cpu->f.carry = false;
-            break;
+            FLAGS_OR(cpu, cpu->regs.a);
+            NEXT;
 
-        case 0xAC: // XOR H
+        OPCODE(0xAC) // XOR H
             cpu->regs.a ^= GET_H(cpu);
-            cpu->f.zero = (cpu->regs.a == 0);
-            cpu->f.subtraction = false;
-            cpu->f.half_carry = false;
-            cpu->f.carry = false;
-            break;
+            FLAGS_OR(cpu, cpu->regs.a);
+            NEXT;
 
-        case 0xAD: // XOR L
+        OPCODE(0xAD) // XOR L
             cpu->regs.a ^= GET_L(cpu);
-            cpu->f.zero = (cpu->regs.a == 0);
-            cpu->f.subtraction = false;
-            cpu->f.half_carry = false;
-            cpu->f.carry = false;
-            break;
+            FLAGS_OR(cpu, cpu->regs.a);
+            NEXT;
 
-        case 0xAE: // XOR (HL)
+        OPCODE(0xAE) // XOR (HL)
             {
                 uint8_t value = READ_BYTE(cpu, cpu->regs.hl);
                 cpu->regs.a ^= value;
-                cpu->f.zero = (cpu->regs.a == 0);
-                cpu->f.subtraction = false;
-                cpu->f.half_carry = false;
-                cpu->f.carry = false;
+                FLAGS_OR(cpu, cpu->regs.a);
                 cpu->cycles = 8;
             }
-            break;
+            NEXT;
 
-        case 0xAF: // XOR A
+        OPCODE(0xAF) // XOR A
             cpu->regs.a ^= cpu->regs.a;
-            cpu->f.zero = (cpu->regs.a == 0);
-            cpu->f.subtraction = false;
-            cpu->f.half_carry = false;
-            cpu->f.carry = false;
-            break;
+            FLAGS_OR(cpu, cpu->regs.a);
+            NEXT;
 
-        case 0xB0: // OR B
+        OPCODE(0xB0) // OR B
             cpu->regs.a |= cpu->regs.b;
-            cpu->f.zero = (cpu->regs.a == 0);
-            cpu->f.subtraction = false;
-            cpu->f.half_carry = false;
-            cpu->f.carry = false;
-            break;
+            FLAGS_OR(cpu, cpu->regs.a);
+            NEXT;
 
-        case 0xB1: // OR C
+        OPCODE(0xB1) // OR C
             cpu->regs.a |= cpu->regs.c;
-            cpu->f.zero = (cpu->regs.a == 0);
-            cpu->f.subtraction = false;
-            cpu->f.half_carry = false;
-            cpu->f.carry = false;
-            break;
+            FLAGS_OR(cpu, cpu->regs.a);
+            NEXT;
 
-        case 0xB2: // OR D
+        OPCODE(0xB2) // OR D
             cpu->regs.a |= cpu->regs.d;
-            cpu->f.zero = (cpu->regs.a == 0);
-            cpu->f.subtraction = false;
-            cpu->f.half_carry = false;
-            cpu->f.carry = false;
-            break;
+            FLAGS_OR(cpu, cpu->regs.a);
+            NEXT;
 
-        case 0xB3: // OR E
+        OPCODE(0xB3) // OR E
             cpu->regs.a |= cpu->regs.e;
-            cpu->f.zero = (cpu->regs.a == 0);
-            cpu->f.subtraction = false;
-            cpu->f.half_carry = false;
-            cpu->f.carry = false;
-            break;
+            FLAGS_OR(cpu, cpu->regs.a);
+            NEXT;
 
-        case 0xB4: // OR H
+        OPCODE(0xB4) // OR H
             cpu->regs.a |= GET_H(cpu);
-            cpu->f.zero = (cpu->regs.a == 0);
-            cpu->f.subtraction = false;
-            cpu->f.half_carry = false;
-            cpu->f.carry = false;
-            break;
+            FLAGS_OR(cpu, cpu->regs.a);
+            NEXT;
 
-        case 0xB5: // OR L
+        OPCODE(0xB5) // OR L
             cpu->regs.a |= GET_L(cpu);
-            cpu->f.zero = (cpu->regs.a == 0);
-            cpu->f.subtraction = false;
-            cpu->f.half_carry = false;
-            cpu->f.carry = false;
-            break;
+            FLAGS_OR(cpu, cpu->regs.a);
+            NEXT;
 
-        case 0xB6: // OR (HL)
+        OPCODE(0xB6) // OR (HL)
             {
                 uint8_t value = READ_BYTE(cpu, cpu->regs.hl);
                 cpu->regs.a |= value;
-                cpu->f.zero = (cpu->regs.a == 0);
-                cpu->f.subtraction = false;
-                cpu->f.half_carry = false;
-                cpu->f.carry = false;
+                FLAGS_OR(cpu, cpu->regs.a);
                 cpu->cycles = 8;
             }
-            break;
+            NEXT;
 
-        case 0xB7: // OR A
+        OPCODE(0xB7) // OR A
             cpu->regs.a |= cpu->regs.a;
-            cpu->f.zero = (cpu->regs.a == 0);
-            cpu->f.subtraction = false;
-            cpu->f.half_carry = false;
-            cpu->f.carry = false;
-            break;
+            FLAGS_OR(cpu, cpu->regs.a);
+            NEXT;
 
-        case 0xB8: // CP B
+        OPCODE(0xB8) // CP B
             {
                 uint16_t result = cpu->regs.a - cpu->regs.b;
-                cpu->f.zero = ((result & 0xFF) == 0);
-                cpu->f.subtraction = true;
-                cpu->f.half_carry = ((cpu->regs.a & 0xF) < (cpu->regs.b & 0xF));
-                cpu->f.carry = (cpu->regs.a < cpu->regs.b);
+                FLAGS_SUB(cpu, cpu->regs.a, cpu->regs.b, result);
             }
-            break;
+            NEXT;
 
-        case 0xB9: // CP C
+        OPCODE(0xB9) // CP C
             {
                 uint16_t result = cpu->regs.a - cpu->regs.c;
-                cpu->f.zero = ((result & 0xFF) == 0);
-                cpu->f.subtraction = true;
-                cpu->f.half_carry = ((cpu->regs.a & 0xF) < (cpu->regs.c & 0xF));
-                cpu->f.carry = (cpu->regs.a < cpu->regs.c);
+                FLAGS_SUB(cpu, cpu->regs.a, cpu->regs.c, result);
             }
-            break;
+            NEXT;
 
-        case 0xBA: // CP D
+        OPCODE(0xBA) // CP D
             {
                 uint16_t result = cpu->regs.a - cpu->regs.d;
-                cpu->f.zero = ((result & 0xFF) == 0);
-                cpu->f.subtraction = true;
-                cpu->f.half_carry = ((cpu->regs.a & 0xF) < (cpu->regs.d & 0xF));
-                cpu->f.carry = (cpu->regs.a < cpu->regs.d);
+                FLAGS_SUB(cpu, cpu->regs.a, cpu->regs.d, result);
             }
-            break;
+            NEXT;
 
-        case 0xBB: // CP E
+        OPCODE(0xBB) // CP E
             {
                 uint16_t result = cpu->regs.a - cpu->regs.e;
-                cpu->f.zero = ((result & 0xFF) == 0);
-                cpu->f.subtraction = true;
-                cpu->f.half_carry = ((cpu->regs.a & 0xF) < (cpu->regs.e & 0xF));
-                cpu->f.carry = (cpu->regs.a < cpu->regs.e);
+                FLAGS_SUB(cpu, cpu->regs.a, cpu->regs.e, result);
             }
-            break;
+            NEXT;
 
-        case 0xBC: // CP H
+        OPCODE(0xBC) // CP H
             {
                 uint16_t result = cpu->regs.a - GET_H(cpu);
-                cpu->f.zero = ((result & 0xFF) == 0);
-                cpu->f.subtraction = true;
-                cpu->f.half_carry = ((cpu->regs.a & 0xF) < (GET_H(cpu) & 0xF));
-                cpu->f.carry = (cpu->regs.a < GET_H(cpu));
+                FLAGS_SUB(cpu, cpu->regs.a, GET_H(cpu), result);
             }
-            break;
+            NEXT;
 
-        case 0xBD: // CP L
+        OPCODE(0xBD) // CP L
             {
                 uint16_t result = cpu->regs.a - GET_L(cpu);
-                cpu->f.zero = ((result & 0xFF) == 0);
-                cpu->f.subtraction = true;
-                cpu->f.half_carry = ((cpu->regs.a & 0xF) < (GET_L(cpu) & 0xF));
-                cpu->f.carry = (cpu->regs.a < GET_L(cpu));
+                FLAGS_SUB(cpu, cpu->regs.a, GET_L(cpu), result);
             }
-            break;
+            NEXT;
 
-        case 0xBE: // CP (HL)
+        OPCODE(0xBE) // CP (HL)
             {
                 uint8_t value = READ_BYTE(cpu, cpu->regs.hl);
                 uint16_t result = cpu->regs.a - value;
-                cpu->f.zero = ((result & 0xFF) == 0);
-                cpu->f.subtraction = true;
-                cpu->f.half_carry = ((cpu->regs.a & 0xF) < (value & 0xF));
-                cpu->f.carry = (cpu->regs.a < value);
+                FLAGS_SUB(cpu, cpu->regs.a, value, result);
                 cpu->cycles = 8;
             }
-            break;
+            NEXT;
 
-        case 0xBF: // CP A
-            cpu->f.zero = 1;
-            cpu->f.subtraction = true;
-            cpu->f.half_carry = 0;
-            cpu->f.carry = 0;
-            break;
-        case 0xC0: // RET NZ
-            if (!cpu->f.zero) {
+        OPCODE(0xBF) // CP A
+            FLAGS_SET(cpu, FLAG_ZERO | FLAG_SUBTRACTION);
+            NEXT;
+        OPCODE(0xC0) // RET NZ
+            if (!FLAG_Z(cpu)) {
                 cpu->pc = READ_WORD(cpu, cpu->sp);
                 cpu->sp += 2;
                 cpu->cycles = 20;
             } else {
                 cpu->cycles = 8;
             }
-            break;
+            NEXT;
 
-        case 0xC1: // POP BC
+        OPCODE(0xC1) // POP BC
             cpu->regs.c = READ_BYTE(cpu, cpu->sp);
             cpu->regs.b = READ_BYTE(cpu, cpu->sp + 1);
             cpu->sp += 2;
             cpu->cycles = 12;
-            break;
+            NEXT;
 
-        case 0xC2: // JP NZ,nn
+        OPCODE(0xC2) // JP NZ,nn
             {
-                uint16_t addr = READ_WORD(cpu, cpu->pc);
-                cpu->pc += 2;
-                if (!cpu->f.zero) {
+                uint16_t addr = IMM16;
+                if (!FLAG_Z(cpu)) {
                     cpu->pc = addr;
                     cpu->cycles = 16;
                 } else cpu->cycles = 12;
             }
-            break;
+            NEXT;
 
-        case 0xC3: // JP nn
+        OPCODE(0xC3) // JP nn
             {
-                uint16_t addr = READ_WORD(cpu, cpu->pc);
+                uint16_t addr = IMM16;
                 cpu->pc = addr;
                 cpu->cycles = 16;
             }
-            break;
+            NEXT;
 
-        case 0xC4: // CALL NZ,nn
+        OPCODE(0xC4) // CALL NZ,nn
             {
-                uint16_t addr = READ_WORD(cpu, cpu->pc);
-                cpu->pc += 2;
-                if (!cpu->f.zero) {
+                uint16_t addr = IMM16;
+                if (!FLAG_Z(cpu)) {
                     cpu->sp -= 2;
                     WRITE_WORD(cpu, cpu->sp, cpu->pc);
                     cpu->pc = addr;
@@ -1690,795 +1818,601 @@ void exec_inst(struct CPU *cpu, uint8_t opcode) {
                 }
                 else cpu->cycles = 12;
             }
-            break;
+            CALL_NEXT;
 
-        case 0xC5: // PUSH BC
+        OPCODE(0xC5) // PUSH BC
             cpu->sp -= 2;
             WRITE_WORD(cpu, cpu->sp, (cpu->regs.b << 8) | cpu->regs.c);
             cpu->cycles = 16;
-            break;
+            NEXT;
 
-        case 0xC6: // ADD A,n
+        OPCODE(0xC6) // ADD A,n
             {
-                uint8_t value = READ_BYTE(cpu, cpu->pc);
-                cpu->pc++; // Increment PC by 1 to skip the immediate value
+                uint8_t value = IMM8;
                 uint16_t result = cpu->regs.a + value;
-                cpu->f.zero = ((result & 0xFF) == 0);
-                cpu->f.subtraction = false;
-                cpu->f.half_carry = ((cpu->regs.a & 0xF) + (value & 0xF)) > 0xF;
-                cpu->f.carry = (result > 0xFF);
+                FLAGS_ADD(cpu, cpu->regs.a, value, result);
                 cpu->regs.a = result & 0xFF;
                 cpu->cycles = 8;
             }
-            break;
+            NEXT;
 
-        case 0xC7: // RST 00H
+        OPCODE(0xC7) // RST 00H
             cpu->sp -= 2;
             WRITE_WORD(cpu, cpu->sp, cpu->pc);
             cpu->pc = 0x00;
             cpu->cycles = 16;
-            break;
+            NEXT;
 
-        case 0xC8: // RET Z
-            if (cpu->f.zero) {
+        OPCODE(0xC8) // RET Z
+            if (FLAG_Z(cpu)) {
                 cpu->pc = READ_WORD(cpu, cpu->sp);
                 cpu->sp += 2;
                 cpu->cycles = 20;
             } else cpu->cycles = 8;
-            break;
+            NEXT;
 
-        case 0xC9: // RET
+        OPCODE(0xC9) // RET
             cpu->pc = READ_WORD(cpu, cpu->sp);
             cpu->sp += 2;
             cpu->cycles = 16;
-            break;
+            NEXT;
 
-        case 0xCA: // JP Z,nn
+        OPCODE(0xCA) // JP Z,nn
             {
-                uint16_t addr = READ_WORD(cpu, cpu->pc);
-                cpu->pc += 2;
-                if (cpu->f.zero) {
+                uint16_t addr = IMM16;
+                if (FLAG_Z(cpu)) {
                     cpu->pc = addr;
                     cpu->cycles = 16;
                 } else cpu->cycles = 12;
             }
-            break;
-        case 0xCB: // cb prefix
-            // Handle CB-prefixed opcodes here
-            _exec_cb_inst(cpu, READ_BYTE(cpu, cpu->pc));
-            cpu->pc++;
-            break;
-
-        case 0xCC: // CALL Z,nn
-            {
-                uint16_t addr = READ_WORD(cpu, cpu->pc);
-                cpu->pc += 2;
-                if (cpu->f.zero) {
+            NEXT;
+        OPCODE(0xCB) // cb prefix
+#ifdef DISPATCH_THREADED
+            goto *cb_table[IMM8];
+#else
+            switch (IMM8) {
+#endif
+            CB_ROW_LO(0x0, CB_RLC, 0)
+            CB_ROW_HI(0x0, CB_RRC, 0)
+            CB_ROW_LO(0x1, CB_RL, 0)
+            CB_ROW_HI(0x1, CB_RR, 0)
+            CB_ROW_LO(0x2, CB_SLA, 0)
+            CB_ROW_HI(0x2, CB_SRA, 0)
+            CB_ROW_LO(0x3, CB_SWAP, 0)
+            CB_ROW_HI(0x3, CB_SRL, 0)
+            CB_ROW_LO(0x4, CB_BIT, 0)
+            CB_ROW_HI(0x4, CB_BIT, 1)
+            CB_ROW_LO(0x5, CB_BIT, 2)
+            CB_ROW_HI(0x5, CB_BIT, 3)
+            CB_ROW_LO(0x6, CB_BIT, 4)
+            CB_ROW_HI(0x6, CB_BIT, 5)
+            CB_ROW_LO(0x7, CB_BIT, 6)
+            CB_ROW_HI(0x7, CB_BIT, 7)
+            CB_ROW_LO(0x8, CB_RES, 0)
+            CB_ROW_HI(0x8, CB_RES, 1)
+            CB_ROW_LO(0x9, CB_RES, 2)
+            CB_ROW_HI(0x9, CB_RES, 3)
+            CB_ROW_LO(0xA, CB_RES, 4)
+            CB_ROW_HI(0xA, CB_RES, 5)
+            CB_ROW_LO(0xB, CB_RES, 6)
+            CB_ROW_HI(0xB, CB_RES, 7)
+            CB_ROW_LO(0xC, CB_SET, 0)
+            CB_ROW_HI(0xC, CB_SET, 1)
+            CB_ROW_LO(0xD, CB_SET, 2)
+            CB_ROW_HI(0xD, CB_SET, 3)
+            CB_ROW_LO(0xE, CB_SET, 4)
+            CB_ROW_HI(0xE, CB_SET, 5)
+            CB_ROW_LO(0xF, CB_SET, 6)
+            CB_ROW_HI(0xF, CB_SET, 7)
+#ifndef DISPATCH_THREADED
+            }
+#endif
+
+        OPCODE(0xCC) // CALL Z,nn
+            {
+                uint16_t addr = IMM16;
+                if (FLAG_Z(cpu)) {
                     cpu->sp -= 2;
                     WRITE_WORD(cpu, cpu->sp, cpu->pc);
                     cpu->pc = addr;
                     cpu->cycles = 24;
                 } else cpu->cycles = 12;
             }
-            break;
+            CALL_NEXT;
 
-        case 0xCD: // CALL nn
+        OPCODE(0xCD) // CALL nn
             {
-                uint16_t addr = READ_WORD(cpu, cpu->pc);
-                cpu->pc += 2;
+                uint16_t addr = IMM16;
                 cpu->sp -= 2;
                 WRITE_WORD(cpu, cpu->sp, cpu->pc);
                 cpu->pc = addr;
                 cpu->cycles = 24;
             }
-            break;
+            CALL_NEXT;
 
-        case 0xCE: // ADC A,n
+        OPCODE(0xCE) // ADC A,n
             {
-                uint8_t value = READ_BYTE(cpu, cpu->pc);
-                cpu->pc++; // Increment PC by 1 to skip the immediate value
-                uint16_t result = cpu->regs.a + value + (cpu->f.carry ? 1 : 0);
-                cpu->f.zero = ((result & 0xFF) == 0);
-                cpu->f.subtraction = false;
-                cpu->f.half_carry = ((cpu->regs.a & 0xF) + (value & 0xF) + (cpu->f.carry ? 1 : 0)) > 0xF;
-                cpu->f.carry = (result > 0xFF);
+                uint8_t value = IMM8;
+                uint16_t result = cpu->regs.a + value + (FLAG_C(cpu) ? 1 : 0);
+                FLAGS_ADD(cpu, cpu->regs.a, value, result);
                 cpu->regs.a = result & 0xFF;
                 cpu->cycles = 8;
             }
-            break;
+            NEXT;
 
-        case 0xCF: // RST 08H
+        OPCODE(0xCF) // RST 08H
             cpu->sp -= 2;
             WRITE_WORD(cpu, cpu->sp, cpu->pc);
             cpu->pc = 0x08;
             cpu->cycles = 16;
-            break;
-        case 0xD0: // RET NC
-            if (!cpu->f.carry) {
+            NEXT;
+        OPCODE(0xD0) // RET NC
+            if (!FLAG_C(cpu)) {
                 cpu->pc = READ_WORD(cpu, cpu->sp);
                 cpu->sp += 2;
                 cpu->cycles = 20;
             } else cpu->cycles = 8;
-            break;
+            NEXT;
 
-        case 0xD1: // POP DE
+        OPCODE(0xD1) // POP DE
             cpu->regs.e = READ_BYTE(cpu, cpu->sp);
             cpu->regs.d = READ_BYTE(cpu, cpu->sp + 1);
             cpu->sp += 2;
             cpu->cycles = 12;
-            break;
+            NEXT;
 
-        case 0xD2: // JP NC,nn
+        OPCODE(0xD2) // JP NC,nn
             {
-                uint16_t addr = READ_WORD(cpu, cpu->pc);
-                cpu->pc += 2;
-                if (!cpu->f.carry) {
+                uint16_t addr = IMM16;
+                if (!FLAG_C(cpu)) {
                     cpu->pc = addr;
                     cpu->cycles = 16;
                 } else cpu->cycles = 12;
             }
-            break;
+            NEXT;
 
-        case 0xD3: // (unofficial, usually NOP or illegal)
-            break;
+        OPCODE(0xD3) // (unofficial, usually NOP or illegal)
+            NEXT;
 
-        case 0xD4: // CALL NC,nn
+        OPCODE(0xD4) // CALL NC,nn
             {
-                uint16_t addr = READ_WORD(cpu, cpu->pc);
-                cpu->pc += 2;
-                if (!cpu->f.carry) {
+                uint16_t addr = IMM16;
+                if (!FLAG_C(cpu)) {
                     cpu->sp -= 2;
                     WRITE_WORD(cpu, cpu->sp, cpu->pc);
                     cpu->pc = addr;
                     cpu->cycles = 24;
                 } else cpu->cycles = 12;
             }
-            break;
+            CALL_NEXT;
 
-        case 0xD5: // PUSH DE
+        OPCODE(0xD5) // PUSH DE
             cpu->sp -= 2;
             WRITE_WORD(cpu, cpu->sp, (cpu->regs.d << 8) | cpu->regs.e);
             cpu->cycles = 16;
-            break;
+            NEXT;
 
-        case 0xD6: // SUB n
+        OPCODE(0xD6) // SUB n
             {
-                uint8_t value = READ_BYTE(cpu, cpu->pc);
-                cpu->pc++; // Increment PC by 1 to skip the immediate value
+                uint8_t value = IMM8;
                 uint16_t result = cpu->regs.a - value;
-                cpu->f.zero = ((result & 0xFF) == 0);
-                cpu->f.subtraction = true;
-                cpu->f.half_carry = ((cpu->regs.a & 0xF) < (value & 0xF));
-                cpu->f.carry = (cpu->regs.a < value);
+                FLAGS_SUB(cpu, cpu->regs.a, value, result);
                 cpu->regs.a = result & 0xFF;
                 cpu->cycles = 8;
             }
-            break;
+            NEXT;
 
-        case 0xD7: // RST 10H
+        OPCODE(0xD7) // RST 10H
             cpu->sp -= 2;
             WRITE_WORD(cpu, cpu->sp, cpu->pc);
             cpu->pc = 0x10;
             cpu->cycles = 16;
-            break;
+            NEXT;
 
-        case 0xD8: // RET C
-            if (cpu->f.carry) {
+        OPCODE(0xD8) // RET C
+            if (FLAG_C(cpu)) {
                 cpu->pc = READ_WORD(cpu, cpu->sp);
                 cpu->sp += 2;
                 cpu->cycles = 20;
             } else cpu->cycles = 8;
-            break;
+            NEXT;
 
-        case 0xD9: // RETI
+        OPCODE(0xD9) // RETI
             cpu->pc = READ_WORD(cpu, cpu->sp);
             cpu->sp += 2;
             cpu->ime = true; // Set the interrupt master enable flag
             cpu->cycles = 16;
-            break;
+            NEXT;
 
-        case 0xDA: // JP C,nn
+        OPCODE(0xDA) // JP C,nn
             {
-                uint16_t addr = READ_WORD(cpu, cpu->pc);
-                cpu->pc += 2;
-                if (cpu->f.carry) {
+                uint16_t addr = IMM16;
+                if (FLAG_C(cpu)) {
                     cpu->pc = addr;
                     cpu->cycles = 16;
                 } else cpu->cycles = 12;
             }
-            break;
+            NEXT;
 
-        case 0xDB: // (unofficial, usually NOP or illegal)
+        OPCODE(0xDB) // (unofficial, usually NOP or illegal)
             // Technically an illegal opcode on the Game Boy
-            break;
+            NEXT;
 
-        case 0xDC: // CALL C,nn
+        OPCODE(0xDC) // CALL C,nn
             {
-                uint16_t addr = READ_WORD(cpu, cpu->pc);
-                cpu->pc += 2;
-                if (cpu->f.carry) {
+                uint16_t addr = IMM16;
+                if (FLAG_C(cpu)) {
                     cpu->sp -= 2;
                     WRITE_WORD(cpu, cpu->sp, cpu->pc);
                     cpu->pc = addr;
                     cpu->cycles = 24;
                 } else cpu->cycles = 12;
             }
-            break;
+            CALL_NEXT;
 
-        case 0xDD: // (unofficial, usually NOP or illegal)
+        OPCODE(0xDD) // (unofficial, usually NOP or illegal)
             // Technically an illegal opcode on the Game Boy
-            break;
+            NEXT;
 
-        case 0xDE: // SBC A,n
+        OPCODE(0xDE) // SBC A,n
             {
-                uint8_t value = READ_BYTE(cpu, cpu->pc);
-                cpu->pc++; // Increment PC by 1 to skip the immediate value
-                uint16_t result = cpu->regs.a - value - (cpu->f.carry ? 1 : 0);
-                cpu->f.zero = ((result & 0xFF) == 0);
-                cpu->f.subtraction = true;
-                cpu->f.half_carry = ((cpu->regs.a & 0xF) < ((value & 0xF) + (cpu->f.carry ? 1 : 0)));
-                cpu->f.carry = (result > 0xFF);
+                uint8_t value = IMM8;
+                uint16_t result = cpu->regs.a - value - (FLAG_C(cpu) ? 1 : 0);
+                FLAGS_SUB(cpu, cpu->regs.a, value, result);
                 cpu->regs.a = result & 0xFF;
                 cpu->cycles = 8;
             }
-            break;
+            NEXT;
 
-        case 0xDF: // RST 18H
+        OPCODE(0xDF) // RST 18H
             cpu->sp -= 2;
             WRITE_WORD(cpu, cpu->sp, cpu->pc);
             cpu->pc = 0x0018;
             cpu->cycles = 16;
-            break;
-        case 0xE0: // LDH (n),A
+            NEXT;
+        OPCODE(0xE0) // LDH (n),A
             {
-                uint8_t offset = READ_BYTE(cpu, cpu->pc);
-                cpu->pc++; // Increment PC by 1 to skip the immediate value
+                uint8_t offset = IMM8;
                 WRITE_BYTE(cpu, 0xFF00 + offset, cpu->regs.a);
                 cpu->cycles = 12;
             }
-            break;
+            NEXT;
 
-        case 0xE1: // POP HL
+        OPCODE(0xE1) // POP HL
             SET_L(cpu, READ_BYTE(cpu, cpu->sp));
             SET_H(cpu, READ_BYTE(cpu, cpu->sp+1));
             cpu->sp += 2;
             cpu->cycles = 12;
-            break;
+            NEXT;
 
-        case 0xE2: // LD (C),A
+        OPCODE(0xE2) // LD (C),A
             WRITE_BYTE(cpu, 0xFF00 + cpu->regs.c, cpu->regs.a);
             cpu->cycles = 8;
-            break;
+            NEXT;
 
-        case 0xE3: // (unofficial, usually NOP or illegal)
+        OPCODE(0xE3) // (unofficial, usually NOP or illegal)
             // Technically an illegal opcode on the Game Boy
-            break;
+            NEXT;
 
-        case 0xE4: // (unofficial, usually NOP or illegal)
+        OPCODE(0xE4) // (unofficial, usually NOP or illegal)
             // Technically an illegal opcode on the Game Boy
-            break;
+            NEXT;
 
-        case 0xE5: // PUSH HL
+        OPCODE(0xE5) // PUSH HL
             cpu->sp -= 2;
             WRITE_WORD(cpu, cpu->sp, cpu->regs.hl);
             cpu->cycles = 16;
-            break;
+            NEXT;
 
-        case 0xE6: // AND n
+        OPCODE(0xE6) // AND n
             {
-                uint8_t value = READ_BYTE(cpu, cpu->pc);
-                cpu->pc++; // Increment PC by 1 to skip the immediate value
+                uint8_t value = IMM8;
                 cpu->regs.a &= value;
-                cpu->f.zero = (cpu->regs.a == 0);
-                cpu->f.subtraction = false;
-                cpu->f.half_carry = true;
-                cpu->f.carry = false;
+                FLAGS_AND(cpu, cpu->regs.a);
                 cpu->cycles = 8;
             }
-            break;
+            NEXT;
 
-        case 0xE7: // RST 20H
+        OPCODE(0xE7) // RST 20H
             cpu->sp -= 2;
             WRITE_WORD(cpu, cpu->sp, cpu->pc);
             cpu->pc = 0x20;
             cpu->cycles = 16;
-            break;
+            NEXT;
 
-        case 0xE8: // ADD SP,n
+        OPCODE(0xE8) // ADD SP,n
             {
-                int8_t offset = (int8_t)READ_BYTE(cpu, cpu->pc);
-                cpu->pc++; // Increment PC by 1 to skip the immediate value
+                int8_t offset = (int8_t)IMM8;
                 uint16_t result = cpu->sp + offset;
-                cpu->f.zero = false;
-                cpu->f.subtraction = false;
-                cpu->f.half_carry = ((cpu->sp & 0xF) + (offset & 0xF)) > 0xF;
-                cpu->f.carry = ((cpu->sp & 0xFF) + (offset & 0xFF)) > 0xFF;
+                FLAGS_ADDSP(cpu, cpu->sp, offset);
                 cpu->sp = result;
                 cpu->cycles = 16;
             }
-            break;
+            NEXT;
 
-        case 0xE9: // JP (HL)
+        OPCODE(0xE9) // JP (HL)
             cpu->pc = cpu->regs.hl;
-            break;
+            NEXT;
 
-        case 0xEA: // LD (nn),A
+        OPCODE(0xEA) // LD (nn),A
             {
-                uint16_t addr = READ_WORD(cpu, cpu->pc);
-                cpu->pc += 2;
+                uint16_t addr = IMM16;
                 WRITE_BYTE(cpu, addr, cpu->regs.a);
                 cpu->cycles = 12;
             }
-            break;
+            NEXT;
 
-        case 0xEB: // (unofficial, usually NOP or illegal)
+        OPCODE(0xEB) // (unofficial, usually NOP or illegal)
             // Technically an illegal opcode on the Game Boy
-            break;
+            NEXT;
 
-        case 0xEC: // (unofficial, usually NOP or illegal)
+        OPCODE(0xEC) // (unofficial, usually NOP or illegal)
             // Technically an illegal opcode on the Game Boy
-            break;
+            NEXT;
 
-        case 0xED: // (unofficial, usually NOP or illegal)
+        OPCODE(0xED) // (unofficial, usually NOP or illegal)
             // Technically an illegal opcode on the Game Boy
-            break;
+            NEXT;
 
-        case 0xEE: // XOR n
+        OPCODE(0xEE) // XOR n
             {
-                uint8_t value = READ_BYTE(cpu, cpu->pc);
-                cpu->pc++; // Increment PC by 1 to skip the immediate value
+                uint8_t value = IMM8;
                 cpu->regs.a ^= value;
-                cpu->f.zero = (cpu->regs.a == 0);
-                cpu->f.subtraction = false;
-                cpu->f.half_carry = false;
-                cpu->f.carry = false;
+                FLAGS_OR(cpu, cpu->regs.a);
                 cpu->cycles = 8;
             }
-            break;
+            NEXT;
 
-        case 0xEF: // RST 28H
+        OPCODE(0xEF) // RST 28H
             cpu->sp -= 2;
             WRITE_WORD(cpu, cpu->sp, cpu->pc);
             cpu->pc = 0x28;
             cpu->cycles = 16;
-            break;
-        case 0xF0: // LDH A,(n)
+            NEXT;
+        OPCODE(0xF0) // LDH A,(n)
             {
-                uint8_t offset = READ_BYTE(cpu, cpu->pc);
-                cpu->pc++; // Increment PC by 1 to skip the immediate value
+                uint8_t offset = IMM8;
                 cpu->regs.a = READ_BYTE(cpu, 0xFF00 + offset);
                 cpu->cycles = 12;
             }
-            break;
+            NEXT;
 
-        case 0xF1: // POP AF
+        OPCODE(0xF1) // POP AF
             {
                 uint16_t af = READ_WORD(cpu, cpu->sp);
                 cpu->sp += 2;
                 SET_AF(cpu, af);
                 cpu->cycles = 12;
             }
-            break;
+            NEXT;
 
-        case 0xF2: // LD A,(C)
+        OPCODE(0xF2) // LD A,(C)
             cpu->regs.a = READ_BYTE(cpu, 0xFF00 + cpu->regs.c);
             cpu->cycles = 8;
-            break;
+            NEXT;
 
-        case 0xF3: // DI
+        OPCODE(0xF3) // DI
             cpu->ime_pending = false; // Disable interrupts immediately
             cpu->ime = false;  // Clear the interrupt master enable flag
 
-            break;
+            NEXT;
 
-        case 0xF4: // (unofficial, usually NOP or illegal)
+        OPCODE(0xF4) // (unofficial, usually NOP or illegal)
             // Technically an illegal opcode on the Game Boy
-            break;
+            NEXT;
 
-        case 0xF5: // PUSH AF
+        OPCODE(0xF5) // PUSH AF
             cpu->sp -= 2;
             WRITE_WORD(cpu, cpu->sp, GET_AF(cpu));
             cpu->cycles = 16;
-            break;
+            NEXT;
 
-        case 0xF6: // OR n
+        OPCODE(0xF6) // OR n
             {
-                uint8_t value = READ_BYTE(cpu, cpu->pc);
-                cpu->pc++; // Increment PC by 1 to skip the immediate value
+                uint8_t value = IMM8;
                 cpu->regs.a |= value;
-                cpu->f.zero = (cpu->regs.a == 0);
-                cpu->f.subtraction = false;
-                cpu->f.half_carry = false;
-                cpu->f.carry = false;
+                FLAGS_OR(cpu, cpu->regs.a);
                 cpu->cycles = 8;
             }
-            break;
+            NEXT;
 
-        case 0xF7: // RST 30H
+        OPCODE(0xF7) // RST 30H
             cpu->sp -= 2;
             WRITE_WORD(cpu, cpu->sp, cpu->pc);
             cpu->pc = 0x30;
             cpu->cycles = 16;
-            break;
+            NEXT;
 
-        case 0xF8: // LD HL,SP+n
+        OPCODE(0xF8) // LD HL,SP+n
             {
-                int8_t offset = (int8_t)READ_BYTE(cpu, cpu->pc);
-                cpu->pc++; // Increment PC by 1 to skip the immediate value
+                int8_t offset = (int8_t)IMM8;
                 uint16_t result = cpu->sp + offset;
-                uint8_t sp_low = cpu->sp & 0xFF;
-
-                cpu->f.zero = false;
-                cpu->f.subtraction = false;
-                cpu->f.half_carry = ((sp_low & 0x0F) + (offset & 0x0F)) > 0x0F;
-                cpu->f.carry = ((sp_low & 0xFF) + (offset & 0xFF)) > 0xFF;
+                FLAGS_ADDSP(cpu, cpu->sp, offset);
                 cpu->regs.hl = result;
                 cpu->cycles = 12;
             }
-            break;
+            NEXT;
 
-        case 0xF9: // LD SP,HL
+        OPCODE(0xF9) // LD SP,HL
             cpu->sp = cpu->regs.hl;
             cpu->cycles = 8;
-            break;
+            NEXT;
 
-        case 0xFA: // LD A,(nn)
+        OPCODE(0xFA) // LD A,(nn)
             {
-                uint16_t addr = READ_WORD(cpu, cpu->pc);
-                cpu->pc += 2;
+                uint16_t addr = IMM16;
                 cpu->regs.a = READ_BYTE(cpu, addr);
                 cpu->cycles = 16;
             }
-            break;
+            NEXT;
 
-        case 0xFB: // EI
+        OPCODE(0xFB) // EI
             // Enable interrupts (implementation depends on interrupt logic) 
             cpu->ime_pending = true; // Set a flag to enable interrupts on the next instruction
-            break;
+            NEXT;
 
-        case 0xFC: // (unofficial, usually NOP or illegal)
+        OPCODE(0xFC) // (unofficial, usually NOP or illegal)
             // Technically an illegal opcode on the Game Boy
-            break;
+            NEXT;
 
-        case 0xFD: // (unofficial, usually NOP or illegal)
+        OPCODE(0xFD) // (unofficial, usually NOP or illegal)
             // Technically an illegal opcode on the Game Boy
-            break;
+            NEXT;
 
-        case 0xFE: // CP A n
+        OPCODE(0xFE) // CP A n
             {
-                uint8_t value = READ_BYTE(cpu, cpu->pc);
-                cpu->pc++; // Increment PC by 1 to skip the immediate value
-                uint8_t result = cpu->regs.a - value;
-                cpu->f.zero = (result == 0);
-                cpu->f.subtraction = true;
-                cpu->f.half_carry = ((cpu->regs.a & 0xF) < (value & 0xF));
-                cpu->f.carry = (cpu->regs.a < value);
+                uint8_t value = IMM8;
+                uint16_t result = cpu->regs.a - value;
+                FLAGS_SUB(cpu, cpu->regs.a, value, result);
                 cpu->cycles = 8;
             }
-            break;
+            NEXT;
 
-        case 0xFF: // RST 38H
+        OPCODE(0xFF) // RST 38H
             cpu->sp -= 2;
             WRITE_WORD(cpu, cpu->sp, cpu->pc);
             cpu->pc = 0x0038;
             cpu->cycles = 16;
-            break;
-
-        default:
-            fprintf(stderr, "Unknown opcode: 0x%02X\n", opcode);
-            break;
+            NEXT;
+#ifndef DISPATCH_THREADED
     }
-}
-
-void _exec_cb_inst(struct CPU *cpu, uint8_t opcode) {
-    cpu->cycles = 12;
-    uint8_t *reg_ptr = NULL;
-    uint8_t hl_value = 0; // For (HL) operations
-    bool left = true;
-    uint8_t is_h = 0; // 1 if h 2 if L 3 if (HL) 0 if some other register
-    uint8_t reg = opcode & 0x0F;
-    uint8_t instruction = (opcode & 0xF0) >> 4;
-    switch (reg) {
-        case 0x00: reg_ptr = &cpu->regs.b; break;
-        case 0x01: reg_ptr = &cpu->regs.c; break;
-        case 0x02: reg_ptr = &cpu->regs.d; break;
-        case 0x03: reg_ptr = &cpu->regs.e; break;
-        case 0x04: reg_ptr = (uint8_t*)(&cpu->regs.hl)+1; is_h = 1; break; // (H)
-        case 0x05: reg_ptr = (uint8_t*)(&cpu->regs.hl); is_h = 2; break; // (L)
-        case 0x06: hl_value = READ_BYTE(cpu, cpu->regs.hl); reg_ptr = &hl_value; is_h = 3; break; // (HL)
-        case 0x07: reg_ptr = &cpu->regs.a; break;
-        case 0x08: reg_ptr = &cpu->regs.b; left = false; break; // B
-        case 0x09: reg_ptr = &cpu->regs.c; left = false; break; // C
-        case 0x0A: reg_ptr = &cpu->regs.d; left = false; break; // D
-        case 0x0B: reg_ptr = &cpu->regs.e; left = false; break; // E
-        case 0x0C: reg_ptr = (uint8_t*)(&cpu->regs.hl)+1; left = false; is_h = 1; break; // H
-        case 0x0D: reg_ptr = (uint8_t*)(&cpu->regs.hl); left = false; is_h = 2; break; // L
-        case 0x0E: hl_value = READ_BYTE(cpu, cpu->regs.hl); reg_ptr = &hl_value; is_h = 3; left = false; break; // (HL)
-        case 0x0F: reg_ptr = &cpu->regs.a; left = false; break; // RLC A
-        default:
-            fprintf(stderr, "Unknown CB register: %d\n", reg);
-            return;
+next_inst:
+    if (!exec_chain(cpu, &inst, &scratch, &elapsed, budget, clock, &at)) goto done;
+    goto dispatch;
+#endif
+leave: // as exec_chain() does when it ends the run
+    elapsed += cpu->cycles;
+    if (clock) {
+        clock->now += cpu->cycles;
     }
-    if (left) {
-        switch (instruction) {
-            case 0x00: // RLC
-            {
-                uint8_t old_value = *reg_ptr;
-                *reg_ptr = (*reg_ptr << 1) | (*reg_ptr >> 7);
-                cpu->f.zero = (*reg_ptr == 0);
-                cpu->f.subtraction = false;
-                cpu->f.half_carry = false;
-                cpu->f.carry = (old_value & 0x80) != 0;
-                break;
-            }
-
-            case 0x01: // RL
-                {
-                    uint8_t old_value = *reg_ptr;
-                    uint8_t carry = cpu->f.carry ? 1 : 0;
-                    *reg_ptr = (*reg_ptr << 1) | carry;
-                    cpu->f.zero = (*reg_ptr == 0);
-                    cpu->f.subtraction = false;
-                    cpu->f.half_carry = false;
-                    cpu->f.carry = (old_value & 0x80) != 0;
-                }
-                break;
-            case 0x02: // SLA
-                {
-                    uint8_t old_value = *reg_ptr;
-                    cpu->f.carry = (old_value & 0x80) != 0;
-                    *reg_ptr <<= 1;
-                    cpu->f.zero = (*reg_ptr == 0);
-                    cpu->f.subtraction = false;
-                    cpu->f.half_carry = false;
-
-                }
-                break;
-            case 0x03: // SWAP
-                {
-                    *reg_ptr = (*reg_ptr >> 4) | (*reg_ptr << 4);
-                    cpu->f.zero = (*reg_ptr == 0);
-                    cpu->f.subtraction = false;
-                    cpu->f.half_carry = false;
-                    cpu->f.carry = false; // No carry for SWAP
-                }
-                break;
-            case 0x04: // BIT 0, reg
-                {
-                    uint8_t bit = (*reg_ptr >> 0) & 1;
-                    cpu->f.zero = (bit == 0);
-                    cpu->f.subtraction = false;
-                    cpu->f.half_carry = true;
-
-                }
-                break;
-            case 0x05: // BIT 2, reg
-                {
-                    uint8_t bit = (*reg_ptr >> 2) & 1;
-                    cpu->f.zero = (bit == 0);
-                    cpu->f.subtraction = false;
-                    cpu->f.half_carry = true;
-
-                }
-                break;
-            case 0x06: // BIT 4, reg
-                {
-                    uint8_t bit = (*reg_ptr >> 4) & 1;
-                    cpu->f.zero = (bit == 0);
-                    cpu->f.subtraction = false;
-                    cpu->f.half_carry = true;
-
-                }
-                break;
-            case 0x07: // BIT 6, reg
-                {
-                    uint8_t bit = (*reg_ptr >> 6) & 1;
-                    cpu->f.zero = (bit == 0);
-                    cpu->f.subtraction = false;
-                    cpu->f.half_carry = true;
-                }
-                break;
-            case 0x08: // RES 0, reg
-                {
-                    *reg_ptr &= ~(1 << 0); // Clear bit 0
-
-                }
-                break;
-            case 0x09: // RES 2, reg
-                {
-                    *reg_ptr &= ~(1 << 2); // Clear bit 2
-
-                }
-                break;
-            case 0x0A: // RES 4, reg
-                {
-                    *reg_ptr &= ~(1 << 4); // Clear bit 4
-
-                }
-                break;
-            case 0x0B: // RES 6, reg
-                {
-                    *reg_ptr &= ~(1 << 6); // Clear bit 6
+done:
+    *last = at;
+    return elapsed;
+}
 
-                }
-                break;
-            case 0x0C: // SET 0, reg
-                {
-                    *reg_ptr |= (1 << 0); // Set bit 0
+#undef OPCODE
+#undef NEXT
+#undef CALL_NEXT
+#undef DISPATCH
+#undef CB_OPCODE
+#undef IMM8
+#undef IMM16
 
-                }
-                break;
-            case 0x0D: // SET 2, reg
-                {
-                    *reg_ptr |= (1 << 2); // Set bit 2
-
-                }
-                break;
-            case 0x0E: // SET 4, reg
-                {
-                    *reg_ptr |= (1 << 4); // Set bit 4
+void exec_inst(struct CPU *cpu, uint8_t opcode) {
+    struct decoded_inst inst;
+    uint16_t at = cpu->pc - 1;
+    decode_operands(cpu, opcode, cpu->pc, &inst);
+    cpu->pc += inst.length - 1;
+    exec_run(cpu, &inst, 0, NULL, &at);
+}
 
-                }
-                break;
-            case 0x0F: // SET 6, reg
-                {
-                    *reg_ptr |= (1 << 6); // Set bit 6
+void exec_next(struct CPU *cpu) {
+    struct decoded_inst scratch;
+    uint16_t at = cpu->pc;
+    exec_run(cpu, fetch_inst(cpu, &scratch), 0, NULL, &at);
+}
 
-                }
-                break;
-            default:
-                fprintf(stderr, "Unknown CB instruction: 0x%02X\n", opcode);
-                return;
+uint32_t exec_block(struct CPU *cpu, uint32_t cycles) {
+    uint32_t elapsed = 0;
+    while (elapsed < cycles) {
+        if (!cpu_begin_step(cpu)) {
+            elapsed += cpu->cycles;
+            continue;
         }
-    } else {
-        switch (instruction) {
-            case 0x00: // RRC
-                {
-                    uint8_t old_value = *reg_ptr;
-                    *reg_ptr = (*reg_ptr >> 1) | ((*reg_ptr & 0x01) << 7);
-                    cpu->f.zero = (*reg_ptr == 0);
-                    cpu->f.subtraction = false;
-                    cpu->f.half_carry = false;
-                    cpu->f.carry = (old_value & 0x01) != 0; // Carry is the last bit
-                }
-                break;
-            case 0x01: // RR
-                {
-                    uint8_t old_value = *reg_ptr;
-                    uint8_t carry = cpu->f.carry ? 0x80 : 0; // Carry is the last bit
-                    *reg_ptr = (*reg_ptr >> 1) | carry;
-                    cpu->f.zero = (*reg_ptr == 0);
-                    cpu->f.subtraction = false;
-                    cpu->f.half_carry = false;
-                    cpu->f.carry = (old_value & 0x01) != 0; // Carry is the last bit
-                }
-                break;
-            case 0x02: // SRA
-                {
-                    uint8_t msb = *reg_ptr & 0x80;           // Preserve bit 7
-                    cpu->f.carry = (*reg_ptr & 0x01) != 0;
-                    *reg_ptr >>= 1;
-                    *reg_ptr |= msb;
-                    cpu->f.zero = (*reg_ptr == 0);
-                    cpu->f.subtraction = false;
-                    cpu->f.half_carry = false;
-                }
-                break;
-            case 0x03: // SRL
-                {
-                    cpu->f.carry = (*reg_ptr & 0x01) ? true : false; // Carry is the last bit
-                    *reg_ptr >>= 1;
-                    cpu->f.zero = (*reg_ptr == 0);
-                    cpu->f.subtraction = false;
-                    cpu->f.half_carry = false;
-                }
-                break;
-            case 0x04: // BIT 1, reg
-                {
-                    uint8_t bit = (*reg_ptr >> 1) & 1;
-                    cpu->f.zero = (bit == 0);
-                    cpu->f.subtraction = false;
-                    cpu->f.half_carry = true;
-                }
-                break;
-            case 0x05: // BIT 3, reg
-                {
-                    uint8_t bit = (*reg_ptr >> 3) & 1;
-                    cpu->f.zero = (bit == 0);
-                    cpu->f.subtraction = false;
-                    cpu->f.half_carry = true;
-                }
-                break;
-            case 0x06: // BIT 5, reg
-                {
-                    uint8_t bit = (*reg_ptr >> 5) & 1;
-                    cpu->f.zero = (bit == 0);
-                    cpu->f.subtraction = false;
-                    cpu->f.half_carry = true;
-                }
-                break;
-            case 0x07: // BIT 7, reg
-                {
-                    uint8_t bit = (*reg_ptr >> 7) & 1;
-                    cpu->f.zero = (bit == 0);
-                    cpu->f.subtraction = false;
-                    cpu->f.half_carry = true;
-                }
-                break;
-            case 0x08: // RES 1, reg
-                {
-                    *reg_ptr &= ~(1 << 1); // Clear bit 1
-
-                }
-                break;
-            case 0x09: // RES 3, reg
-                {
-                    *reg_ptr &= ~(1 << 3); // Clear bit 3
-
-                }
-                break;
-            case 0x0A: // RES 5, reg
-                {
-                    *reg_ptr &= ~(1 << 5); // Clear bit 5
-
-                }
-                break;
-            case 0x0B: // RES 7, reg
-                {
-                    *reg_ptr &= ~(1 << 7); // Clear bit 7
-
-                }
-                break;
-            case 0x0C: // SET 1, reg
-                {
-                    *reg_ptr |= (1 << 1); // Set bit 1
-
-                }
-                break;
-            case 0x0D: // SET 3, reg
-                {
-                    *reg_ptr |= (1 << 3); // Set bit 3
-
-                }
-                break;
-            case 0x0E: // SET 5, reg
-                {
-                    *reg_ptr |= (1 << 5); // Set bit 5
-
-                }
-                break;
-            case 0x0F: // SET 7, reg
-                {
-                    *reg_ptr |= (1 << 7); // Set bit 7
-
-                }
-                break;
-            default:
-                fprintf(stderr, "Unknown CB instruction: 0x%02X\n", opcode);
-                return;
+#ifdef AOT
+        if (cpu->aot) {
+            uint32_t ran = aot_run(cpu, cycles - elapsed);
+            if (ran) {
+                elapsed += ran;
+                continue;
+            }
+        }
+#endif
+#ifdef JIT
+        if (cpu->jit) {
+            uint32_t ran = jit_run(cpu, cycles - elapsed);
+            if (ran) {
+                elapsed += ran;
+                continue;
+            }
         }
+#endif
+        struct decoded_inst scratch;
+        uint16_t at = cpu->pc;
+        elapsed += exec_run(cpu, fetch_inst(cpu, &scratch), cycles - elapsed, NULL, &at);
     }
+    return elapsed;
+}
 
-    // sync HL with h and l
-    if (is_h){
-        if (is_h == 1) {
-            // H was modified, update high byte of hl
-            cpu->regs.hl = (cpu->regs.hl & 0x00FF) | (*reg_ptr << 8);
-        } else if (is_h == 2) {
-            // L was modified, update low byte of hl
-            cpu->regs.hl = (cpu->regs.hl & 0xFF00) | (*reg_ptr);
-        } else if (is_h == 3) {
-            // (HL) operation - write back to memory for non-BIT instructions
-            if (instruction <= 0x03 || instruction >= 0x08) {
-                WRITE_BYTE(cpu, cpu->regs.hl, hl_value);
-            }
-            if (instruction <= 0x07 && instruction >= 0x04) {
-                cpu->cycles = 12; // BIT instructions take 12 cycles for (HL)
-            } else {
-                cpu->cycles = 16; // Other (HL) instructions take 16 cycles
+uint32_t cpu_run_cycles(struct CPU *cpu, struct GPU *gpu, uint32_t cycles) {
+    struct scheduler *sched = &cpu->sched;
+    uint64_t start = sched->now;
+    uint64_t end = start + cycles;
+    sched->gpu = gpu;
+    for (int i = 0; i < SCHED_SOURCES; i++) {
+        sched->slot[i].due = start; // work out what comes next before the first instruction
+    }
+    sched->next = start;
+    // sched.now and sched.next as of the top of the loop
+    uint64_t now = start;
+    uint64_t next = start;
+    for (;;) {
+        if (now >= next) {
+            sched_run_due(cpu); // mode change, LY, timer interrupt, ...
+            next = sched->next;
+        }
+        // a halt is slept through to the end even if the frame or the budget ends on the way
+        bool asleep = cpu->halted && !(cpu->bus.io.iflag & cpu->bus.ie);
+        if (!asleep && (now >= end || gpu->should_render)) {
+            break;
+        }
+        uint16_t from = cpu->pc;
+        uint32_t ran;
+        if (!cpu_begin_step(cpu)) {
+            ran = cpu->cycles; // a halted step or the jump into an interrupt handler
+        }
+#ifdef AOT
+        else if (cpu->aot) {
+            aot_exec(cpu);
+            ran = cpu->cycles;
+        }
+#endif
+#ifdef JIT
+        else if (cpu->jit) {
+            jit_exec(cpu);
+            ran = cpu->cycles;
+        }
+#endif
+        else {
+            // interpret up to the next event, the end, or a jump back
+            struct decoded_inst scratch;
+            uint64_t stop = next < end ? next : end;
+            ran = exec_run(cpu, fetch_inst(cpu, &scratch), stop - now, sched, &from);
+        }
+        next = sched->next; // a register write on the way may have made a device due
+        // idle_skip() looks from before the last instruction or JIT/AOT run
+        sched->now = now + ran - cpu->cycles;
+        ran += idle_skip(cpu, gpu, from, ran, end > now + ran ? (uint32_t)(end - now - ran) : 0);
+        if (cpu->halted && !(cpu->bus.io.iflag & cpu->bus.ie)) {
+            // nothing can wake the CPU before the next event, sleep through
+            // the 4-cycle halted steps up to the one it falls into (cpu->cycles
+            // is a whole run when a JIT/AOT block ended in HALT)
+            uint32_t round = 4;
+            uint64_t after = now + ran;
+            if (next > after) {
+                ran += (next - after + round - 1) / round * round;
             }
         }
+        now += ran;
+        sched->now = now;
+        bool skipped = hle_skip(cpu, end); // a library routine just called
+        skipped = fuse_skip(cpu, from, end) || skipped;
+        if (skipped) {
+            now = sched->now; // native or fused iterations and the events between them
+            next = sched->next;
+        }
     }
-    // Update the CPU state after executing the instruction
-    return;
+    sched_sync_all(cpu);
+    sched->gpu = NULL;
+    return (uint32_t)(now - start);
 }
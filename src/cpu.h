@@ -15,22 +15,44 @@
 
 // Forward declaration to avoid circular include
 struct CPU;
+struct GPU;
 int load_save_file(struct CPU *cpu, const char *save_path);
 
+#include "jit.h"
+#include "fastmem.h"
+#include "aot.h"
+#include "idle.h"
+#include "fuse.h"
+#include "hle.h"
+#include "sched.h"
+#include "memmap.h"
+#include "mbc.h"
+#include "rtc.h"
+#include "save.h"
+
 
 #define FLAG_ZERO      0x80 // 1000 0000
 #define FLAG_SUBTRACTION 0x40 // 0100 0000
 #define FLAG_HALF_CARRY 0x20 // 0010 0000
 #define FLAG_CARRY     0x10 // 0001 0000
 
+/* Register pairs
+   Each pair is a union of the 16-bit value and its two 8-bit halves, laid
+   out for the host byte order, so both widths are plain loads and stores.
+*/
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define REG_PAIR(hi, lo, pair) \
+	union { uint16_t pair; struct { uint8_t hi; uint8_t lo; }; }
+#else
+#define REG_PAIR(hi, lo, pair) \
+	union { uint16_t pair; struct { uint8_t lo; uint8_t hi; }; }
+#endif
+
 struct registers{
-	uint8_t a;
-	uint8_t b;
-	uint8_t c;
-	uint8_t d;
-	uint8_t e;
-	uint8_t f; // Flags
-	uint16_t hl; // Combined HL register
+	REG_PAIR(a, f, af); // f is only filled in on request, see struct flags
+	REG_PAIR(b, c, bc);
+	REG_PAIR(d, e, de);
+	REG_PAIR(h, l, hl);
 };
 
 // register f
@@ -38,12 +60,54 @@ struct registers{
 // -Bit 6: "subtraction"
 // -Bit 5: "half carry"
 // -Bit 4: "carry"
+//
+// Flags are evaluated lazily by default: an ALU op only records what it did
+// (kind, operands, result) and Z/N/H/C are derived from that record when
+// something actually reads them. Most flag results are overwritten before
+// anyone looks at them. Build with -DEAGER_FLAGS to compute all four on
+// every op instead, and with -DFLAG_STATS to count records nobody read.
+enum flag_op {
+	FLAG_OP_NONE,  // f holds the whole of F
+	FLAG_OP_ADD,   // ADD/ADC: res = a + b + carry
+	FLAG_OP_SUB,   // SUB/SBC/CP: res = a - b - carry
+	FLAG_OP_INC,   // INC r: res = r + 1, C kept
+	FLAG_OP_DEC,   // DEC r: res = r - 1, C kept
+	FLAG_OP_AND,   // AND: H set
+	FLAG_OP_OR,    // OR/XOR
+	FLAG_OP_ROT,   // CB rotates/shifts/SWAP: bit 8 of res is the carry out
+	FLAG_OP_ROTA,  // RLCA/RRCA/RLA/RRA: as ROT but Z is always clear
+	FLAG_OP_BIT,   // BIT n: res is the tested bit, C kept
+	FLAG_OP_ADD16, // ADD HL,rr: res = a + b, Z kept
+	FLAG_OP_ADDSP  // ADD SP,e / LD HL,SP+e: a = SP, b = (uint8_t)e
+};
+
+#ifdef EAGER_FLAGS
 struct flags {
 	bool zero;       // Z
 	bool subtraction; // N
 	bool half_carry; // H
 	bool carry;      // C
 };
+#else
+struct flags {
+	uint8_t op;   // enum flag_op of the last flag-setting instruction
+	uint8_t f;    // flags the op leaves alone (all of F for FLAG_OP_NONE)
+	uint16_t a;   // first operand
+	uint16_t b;   // second operand
+	uint32_t res; // result, wide enough to keep the carry out
+#ifdef FLAG_STATS
+	bool read;    // has anything looked at this record yet
+#endif
+};
+#endif
+
+#ifdef FLAG_STATS
+struct flag_stats {
+	uint64_t writes; // flag records made
+	uint64_t unread; // records overwritten before anything read them
+	uint64_t reads;  // individual flag reads
+};
+#endif
 
 enum JumpTest {
 	JUMP_TEST_NONE,
@@ -56,14 +120,80 @@ enum JumpTest {
 	JUMP_TEST_ALWAYS
 };
 
+/* I/O registers
+   0xFF00-0xFF7F. The registers the core reads and writes directly have a
+   name; the sound registers, wave RAM and the unused addresses are only
+   reached through raw[addr - 0xFF00].
+*/
+union io_regs {
+	uint8_t raw[0x80];
+	struct {
+		uint8_t p1;         // FF00 joypad
+		uint8_t sb;         // FF01 serial data
+		uint8_t sc;         // FF02 serial control
+		uint8_t unused_03;
+		uint8_t div;        // FF04 divider
+		uint8_t tima;       // FF05 timer counter
+		uint8_t tma;        // FF06 timer modulo
+		uint8_t tac;        // FF07 timer control
+		uint8_t unused_08[7];
+		uint8_t iflag;      // FF0F interrupt flag
+		uint8_t sound[0x30]; // FF10-FF3F sound registers and wave RAM
+		uint8_t lcdc;       // FF40 LCD control
+		uint8_t stat;       // FF41 LCD status
+		uint8_t scy;        // FF42
+		uint8_t scx;        // FF43
+		uint8_t ly;         // FF44
+		uint8_t lyc;        // FF45
+		uint8_t dma;        // FF46 OAM DMA source
+		uint8_t bgp;        // FF47
+		uint8_t obp0;       // FF48
+		uint8_t obp1;       // FF49
+		uint8_t wy;         // FF4A
+		uint8_t wx;         // FF4B
+		uint8_t unused_4c[4];
+		uint8_t boot;       // FF50 boot ROM off
+		uint8_t unused_51[0x2F];
+	};
+};
+
+_Static_assert(sizeof(union io_regs) == 0x80, "I/O registers are 0xFF00-0xFF7F");
+
+/* Memory regions
+   Each region of the address space has storage of its own, sized to it:
+   page FF (I/O, HRAM, IE) first so that it shares cache lines with the
+   registers in struct CPU ahead of it, then OAM, VRAM and WRAM, each
+   starting on a cache line. ROM and cartridge RAM are only referenced
+   (rom0, rom_banks, cart_ram), so an instance holds about 17KB of guest
+   memory however large its cartridge. Echo RAM is WRAM again.
+*/
+#define BUS_ALIGN 64 // cache line
+#ifdef FASTMEM
+#define RAM_ALIGN FASTMEM_PAGE // VRAM and WRAM on host pages of their own, see fastmem.h
+#else
+#define RAM_ALIGN BUS_ALIGN
+#endif
+
 struct MemoryBus {
-	uint8_t rom [0x10000]; // 64KB addressable space
+	union {
+		_Alignas(BUS_ALIGN) uint8_t high[0x100]; // FF00-FFFF as one page
+		struct {
+			union io_regs io; // FF00-FF7F
+			uint8_t hram[0x7F]; // FF80-FFFE
+			uint8_t ie; // FFFF interrupt enable
+		};
+	};
 	size_t rom_size;
 	size_t ram_size; // Size of RAM for MBCs that support it
-	uint8_t current_rom_bank;
+	uint16_t current_rom_bank; // ROM bank mapped at 0x4000, as the mapper works it out
 	uint8_t current_ram_bank; // Current RAM bank for MBCs that support it
-	uint8_t *rom_banks;
+	uint8_t *rom0; // ROM bank 0, in the shared image once load_rom() has mapped it
+	uint8_t *rom_banks; // ROM bank 1 on, read-only
 	uint8_t *cart_ram; // RAM for MBCs that support it
+	uint8_t *romx; // host address of 0x4000 in the current ROM bank
+	uint8_t *sram; // host address of 0xA000 in cart RAM, NULL if it takes the mapper's read_ram()/write_ram()
+	const struct mbc *mbc; // mapper picked by mbc_init(), see mbc.h
+	struct rom_image *image; // shared mapping of the ROM file, see rom.h
 	bool rom_banking_toggle; // Use ROM banking for MBCs that support it
 	bool ram_enabled; // Use RAM banking for MBCs that support it
 	uint8_t mbc1_mode;
@@ -71,9 +201,62 @@ struct MemoryBus {
 	uint8_t rom_bank_lo;
 	uint8_t mbc_type;
 	uint8_t num_ram_banks;
-	uint8_t num_rom_banks;
+	uint16_t num_rom_banks;
+	uint64_t tile_dirty[6]; // tiles of 8000-97FF written since the GPU decoded them, a bit each
+	uint64_t vram_dirty[8]; // 16-byte blocks of 8000-9FFF written since the render worker copied them
+	bool vram_watched; // a render worker copies VRAM, the tile maps are written through the slow path too
+	bool oam_dirty; // OAM written since the GPU indexed its sprites
+	_Alignas(BUS_ALIGN) uint8_t oam[0x100]; // FE00-FEFF, FEA0 on is plain memory as well
+	_Alignas(RAM_ALIGN) uint8_t vram[0x2000]; // 8000-9FFF
+	uint8_t wram[0x2000]; // C000-DFFF
+#ifdef ALLOW_ROM_WRITES
+	uint8_t echo[0x1E00]; // E000-FDFF, plain RAM of its own in the sm83 tester
+#endif
+};
+
+/* Predecoded instructions
+   Code running from ROM (keyed by bank and PC), WRAM or HRAM is decoded once
+   and kept, so later fetches skip the address decode in READ_BYTE. WRAM and
+   HRAM entries are dropped again when something writes over them. Build with
+   -DNO_ICACHE to always decode from memory; the sm83 tester build
+   (ALLOW_ROM_WRITES) can rewrite ROM at will and never caches.
+
+   ROM entries only depend on the ROM, so they live in the shared image
+   (rom.h) and every CPU running it fills the same tables, possibly from
+   several threads. An entry is filled with one 32-bit atomic store and
+   never changes after that. ROM without an image (no cartridge, or set up
+   by hand like in the bench) isn't cached.
+*/
+#if !defined(NO_ICACHE) && !defined(ALLOW_ROM_WRITES)
+#define ICACHE
+#endif
+
+struct decoded_inst {
+	union {
+		struct {
+			uint8_t opcode; // first byte, selects the handler
+			uint8_t length; // instruction length in bytes, 0 = not decoded yet
+			uint16_t imm;   // 8- or 16-bit immediate operand
+		};
+		uint32_t word; // all of it, to fill and look up shared entries in one access
+	};
 };
 
+extern const uint8_t inst_length[256]; // instruction length in bytes, by opcode
+extern const uint8_t no_cartridge[0x4000]; // ROM bank 0 while no cartridge is loaded, open bus
+
+#define ICACHE_ROM_BANKS 512
+#define ICACHE_BANK_SIZE 0x4000
+#define ICACHE_WRAM 0x0000 // WRAM C000-DFFF
+#define ICACHE_HRAM 0x2000 // HRAM FF80-FFFE
+#define ICACHE_RAM_SIZE 0x2080
+
+#ifdef ICACHE
+struct icache {
+	struct decoded_inst ram[ICACHE_RAM_SIZE]; // ROM banks are in the image, see rom_decoded()
+};
+#endif
+
 struct CPU {
 	struct registers regs;
 	uint16_t pc; // Program Counter
@@ -83,7 +266,7 @@ struct CPU {
 	bool halted; // Halt state
 	bool ime; // Interrupt Master Enable
 	bool ime_pending; // IME pending state
-	uint8_t cycles; // Number of cycles to execute
+	uint32_t cycles; // Number of cycles to execute, a whole JIT/AOT run can take more than 255
 	uint16_t divider_cycles; // Divider cycles for timer
 	uint16_t tima_counter; // Timer counter for TIMA register
 	uint8_t bootrom[256]; // Boot ROM
@@ -91,51 +274,219 @@ struct CPU {
 	uint8_t p1_actions; // joypad actions (buttons)
 	uint8_t p1_directions; // joypad directions (up, down, left, right)
 	bool dma_transfer; // DMA transfer flag
-	uint8_t selected_rtc_register; // Currently selected RTC register (0x08-0x0C for MBC3)
+	struct rtc rtc; // MBC3 clock, see rtc.h
 	char *save_file_path; // Path to save file
 	bool save_loaded; // Flag to indicate if save file was loaded
+	struct save_map *save; // cartridge RAM mapped from the save file, NULL if not, see save.h
+	struct scheduler sched; // master clock and device events, see sched.h
+	struct memory_map map; // host pointers of plain memory pages, see memmap.h
+#ifdef FASTMEM
+	struct fastmem fastmem; // guest address space in host memory, see fastmem.h
+#endif
+#ifdef ICACHE
+	struct icache icache; // predecoded instructions
+#endif
+#ifdef JIT
+	struct jit *jit; // translated code, NULL while only interpreting
+#endif
+#ifdef AOT
+	struct aot *aot; // recompiled blocks of the loaded ROM, NULL if none
+#endif
+#ifdef IDLE_SKIP
+	struct idle_loop idle; // polling loop being watched, see idle_skip()
+#endif
+#ifdef FUSE
+	struct fuse_loop fuse; // copy or fill loop last jumped back to, see fuse_skip()
+#endif
+#ifdef HLE
+	struct hle_table hle; // library routines found in the ROM, see hle_skip()
+#endif
+#ifdef FLAG_STATS
+	struct flag_stats flag_stats;
+#endif
 };
 
 /* MACROS FOR QUICK ACCESS */
-// h and L are less used then HL
-#define GET_H(cpu) ((cpu)->regs.hl >> 8)
-#define GET_L(cpu) ((cpu)->regs.hl & 0xFF)
+#define GET_H(cpu) ((cpu)->regs.h)
+#define GET_L(cpu) ((cpu)->regs.l)
+#define SET_H(cpu, value) ((cpu)->regs.h = (value))
+#define SET_L(cpu, value) ((cpu)->regs.l = (value))
 
-#define SET_H(cpu, value) \
-	((cpu)->regs.hl = ((value) << 8) | (GET_L(cpu)))
-#define SET_L(cpu, value) \
-	((cpu)->regs.hl = (GET_H(cpu) << 8) | (value))
+#define GET_DE(cpu) ((cpu)->regs.de)
+#define SET_DE(cpu, value) ((cpu)->regs.de = (value))
 
-#define GET_DE(cpu) \
-	((cpu)->regs.d << 8 | (cpu)->regs.e)
+#define GET_BC(cpu) ((cpu)->regs.bc)
+#define SET_BC(cpu, value) ((cpu)->regs.bc = (value))
 
-#define SET_DE(cpu, value) \
-	do { \
-		(cpu)->regs.d = (value) >> 8; \
-		(cpu)->regs.e = (value) & 0xFF; \
-	} while (0)
 
-#define GET_BC(cpu) \
-	((cpu)->regs.b << 8 | (cpu)->regs.c)
-#define SET_BC(cpu, value) \
-	do { \
-		(cpu)->regs.b = (value) >> 8; \
-		(cpu)->regs.c = (value) & 0xFF; \
-	} while (0)
+/* Flag evaluation
+   Each of these derives one flag from a record. They are shared by the lazy
+   reads below and by the eager build, where `op` is a constant and the
+   switch folds away.
+*/
+static inline bool flag_eval_z(uint8_t op, uint8_t f, uint32_t res) {
+	switch (op) {
+		case FLAG_OP_NONE:
+		case FLAG_OP_ADD16: return (f & FLAG_ZERO) != 0;
+		case FLAG_OP_ROTA:
+		case FLAG_OP_ADDSP: return false;
+		default: return (res & 0xFF) == 0;
+	}
+}
 
+static inline bool flag_eval_n(uint8_t op, uint8_t f) {
+	switch (op) {
+		case FLAG_OP_NONE: return (f & FLAG_SUBTRACTION) != 0;
+		case FLAG_OP_SUB:
+		case FLAG_OP_DEC: return true;
+		default: return false;
+	}
+}
+
+static inline bool flag_eval_h(uint8_t op, uint8_t f, uint16_t a, uint16_t b, uint32_t res) {
+	switch (op) {
+		case FLAG_OP_NONE: return (f & FLAG_HALF_CARRY) != 0;
+		case FLAG_OP_ADD:
+		case FLAG_OP_SUB: return ((a ^ b ^ res) & 0x10) != 0;
+		case FLAG_OP_INC: return (res & 0x0F) == 0x00;
+		case FLAG_OP_DEC: return (res & 0x0F) == 0x0F;
+		case FLAG_OP_AND:
+		case FLAG_OP_BIT: return true;
+		case FLAG_OP_ADD16: return ((a ^ b ^ res) & 0x1000) != 0;
+		case FLAG_OP_ADDSP: return ((a & 0x0F) + (b & 0x0F)) > 0x0F;
+		default: return false;
+	}
+}
+
+static inline bool flag_eval_c(uint8_t op, uint8_t f, uint16_t a, uint16_t b, uint32_t res) {
+	switch (op) {
+		case FLAG_OP_NONE:
+		case FLAG_OP_INC:
+		case FLAG_OP_DEC:
+		case FLAG_OP_BIT: return (f & FLAG_CARRY) != 0;
+		case FLAG_OP_ADD:
+		case FLAG_OP_SUB:
+		case FLAG_OP_ROT:
+		case FLAG_OP_ROTA: return (res & 0x100) != 0;
+		case FLAG_OP_ADD16: return res > 0xFFFF;
+		case FLAG_OP_ADDSP: return ((a & 0xFF) + (b & 0xFF)) > 0xFF;
+		default: return false;
+	}
+}
+
+#ifdef EAGER_FLAGS
+
+#define FLAG_Z(cpu) ((cpu)->f.zero)
+#define FLAG_N(cpu) ((cpu)->f.subtraction)
+#define FLAG_H(cpu) ((cpu)->f.half_carry)
+#define FLAG_C(cpu) ((cpu)->f.carry)
+#define FLAG_Z_KEPT(cpu) ((cpu)->f.zero)
+#define FLAG_C_KEPT(cpu) ((cpu)->f.carry)
+
+static inline void flags_record(struct CPU *cpu, uint8_t op, uint8_t f,
+								uint16_t a, uint16_t b, uint32_t res) {
+	cpu->f.zero = flag_eval_z(op, f, res);
+	cpu->f.subtraction = flag_eval_n(op, f);
+	cpu->f.half_carry = flag_eval_h(op, f, a, b, res);
+	cpu->f.carry = flag_eval_c(op, f, a, b, res);
+}
+
+#else
+
+#ifdef FLAG_STATS
+static inline const struct flags *flags_read(struct CPU *cpu) {
+	cpu->flag_stats.reads++;
+	cpu->f.read = true;
+	return &cpu->f;
+}
+#else
+#define flags_read(cpu) (&(cpu)->f)
+#endif
+
+static inline bool FLAG_Z(struct CPU *cpu) {
+	const struct flags *lf = flags_read(cpu);
+	return flag_eval_z(lf->op, lf->f, lf->res);
+}
+
+static inline bool FLAG_N(struct CPU *cpu) {
+	const struct flags *lf = flags_read(cpu);
+	return flag_eval_n(lf->op, lf->f);
+}
+
+static inline bool FLAG_H(struct CPU *cpu) {
+	const struct flags *lf = flags_read(cpu);
+	return flag_eval_h(lf->op, lf->f, lf->a, lf->b, lf->res);
+}
+
+static inline bool FLAG_C(struct CPU *cpu) {
+	const struct flags *lf = flags_read(cpu);
+	return flag_eval_c(lf->op, lf->f, lf->a, lf->b, lf->res);
+}
+
+/* Zero and carry as carried over into the next record unchanged (INC, DEC,
+   BIT, ADD16, CPL, SCF, CCF's zero). Evaluated straight from the record
+   rather than through flags_read(), so FLAG_STATS doesn't count them as
+   reads; CCF's complemented carry still is one.
+*/
+static inline bool FLAG_Z_KEPT(const struct CPU *cpu) {
+	return flag_eval_z(cpu->f.op, cpu->f.f, cpu->f.res);
+}
+
+static inline bool FLAG_C_KEPT(const struct CPU *cpu) {
+	return flag_eval_c(cpu->f.op, cpu->f.f, cpu->f.a, cpu->f.b, cpu->f.res);
+}
+
+static inline void flags_record(struct CPU *cpu, uint8_t op, uint8_t f,
+								uint16_t a, uint16_t b, uint32_t res) {
+#ifdef FLAG_STATS
+	cpu->flag_stats.writes++;
+	if (!cpu->f.read) {
+		cpu->flag_stats.unread++;
+	}
+	cpu->f.read = false;
+#endif
+	cpu->f.op = op;
+	cpu->f.f = f;
+	cpu->f.a = a;
+	cpu->f.b = b;
+	cpu->f.res = res;
+}
+
+#endif
+
+/* Record the flags of an ALU instruction
+   `res` is the unmasked result: ADD/SUB keep their carry/borrow in bit 8,
+   ROT/ROTA take the carry out in bit 8. INC, DEC and BIT keep the current
+   carry, ADD16 keeps the current zero flag.
+*/
+#define FLAGS_ADD(cpu, a, b, res) flags_record(cpu, FLAG_OP_ADD, 0, (a), (b), (res))
+#define FLAGS_SUB(cpu, a, b, res) flags_record(cpu, FLAG_OP_SUB, 0, (a), (b), (res))
+#define FLAGS_INC(cpu, res) \
+	flags_record(cpu, FLAG_OP_INC, FLAG_C_KEPT(cpu) ? FLAG_CARRY : 0, 0, 0, (res))
+#define FLAGS_DEC(cpu, res) \
+	flags_record(cpu, FLAG_OP_DEC, FLAG_C_KEPT(cpu) ? FLAG_CARRY : 0, 0, 0, (res))
+#define FLAGS_AND(cpu, res) flags_record(cpu, FLAG_OP_AND, 0, 0, 0, (res))
+#define FLAGS_OR(cpu, res) flags_record(cpu, FLAG_OP_OR, 0, 0, 0, (res))
+#define FLAGS_ROT(cpu, res, carry) \
+	flags_record(cpu, FLAG_OP_ROT, 0, 0, 0, ((res) & 0xFF) | ((carry) ? 0x100 : 0))
+#define FLAGS_ROTA(cpu, carry) \
+	flags_record(cpu, FLAG_OP_ROTA, 0, 0, 0, (carry) ? 0x100 : 0)
+#define FLAGS_BIT(cpu, bit) \
+	flags_record(cpu, FLAG_OP_BIT, FLAG_C_KEPT(cpu) ? FLAG_CARRY : 0, 0, 0, (bit))
+#define FLAGS_ADD16(cpu, a, b) \
+	flags_record(cpu, FLAG_OP_ADD16, FLAG_Z_KEPT(cpu) ? FLAG_ZERO : 0, (a), (b), \
+				 (uint32_t)(a) + (uint32_t)(b))
+#define FLAGS_ADDSP(cpu, sp, offset) \
+	flags_record(cpu, FLAG_OP_ADDSP, 0, (sp), (uint8_t)(offset), 0)
+#define FLAGS_SET(cpu, value) flags_record(cpu, FLAG_OP_NONE, (value) & 0xF0, 0, 0, 0)
 
 #define PACK_FLAGS(cpu) ( \
-	((cpu)->f.zero         ? (1 << 7) : 0) | \
-	((cpu)->f.subtraction  ? (1 << 6) : 0) | \
-	((cpu)->f.half_carry   ? (1 << 5) : 0) | \
-	((cpu)->f.carry        ? (1 << 4) : 0))
-
-#define UNPACK_FLAGS(cpu, value) do { \
-	(cpu)->f.zero        = ((value) & (1 << 7)) != 0; \
-	(cpu)->f.subtraction = ((value) & (1 << 6)) != 0; \
-	(cpu)->f.half_carry  = ((value) & (1 << 5)) != 0; \
-	(cpu)->f.carry       = ((value) & (1 << 4)) != 0; \
-} while(0)
+	(FLAG_Z(cpu) ? FLAG_ZERO : 0) | \
+	(FLAG_N(cpu) ? FLAG_SUBTRACTION : 0) | \
+	(FLAG_H(cpu) ? FLAG_HALF_CARRY : 0) | \
+	(FLAG_C(cpu) ? FLAG_CARRY : 0))
+
+#define UNPACK_FLAGS(cpu, value) FLAGS_SET(cpu, value)
 
 #define GET_AF(cpu) \
 	(((cpu)->regs.a << 8) | (PACK_FLAGS(cpu) & 0xF0))  // lower nibble always 0
@@ -152,292 +503,118 @@ struct CPU {
 
 uint8_t read_joypad(struct CPU *cpu);
 
-static inline uint8_t READ_BYTE(struct CPU *cpu, uint16_t addr) {
-	if (cpu->bootrom_enabled && addr < 0x0100) {
-		return *(cpu->bootrom + addr);
+/* The CPU is about to write a register `source` counts with
+   Steps it up to now and has it look for its next event again after the
+   write.
+   @param cpu Pointer to the CPU structure.
+   @param source Source the register belongs to.
+   @return void
+*/
+static inline void sched_touch(struct CPU *cpu, enum sched_source source) {
+	struct scheduler *sched = &cpu->sched;
+	if (sched->slot[source].synced != sched->now) {
+		sched_sync(cpu, source);
 	}
-	if (addr == 0xFF00) {
-		#ifdef ALLOW_ROM_WRITES
-		return *(cpu->bus.rom + addr);
-		#endif
-		return read_joypad(cpu);
+	sched->slot[source].due = sched->now;
+	sched->next = sched->now;
+}
+
+/* Read a byte through the page table, see memmap.h
+   READ_BYTE itself, or its fallback for pages the fastmem window doesn't
+   take (fastmem.h).
+*/
+static inline uint8_t read_byte_paged(struct CPU *cpu, uint16_t addr) {
+	const uint8_t *page = cpu->map.read[addr >> 8];
+	if (page) {
+		return page[addr & 0xFF];
 	}
-	if (cpu->bus.current_rom_bank && addr >= 0x4000 && addr < 0x8000) {
-		if (cpu->bus.mbc_type == 1 && cpu->bus.mbc1_mode) {
-			return *(cpu->bus.rom_banks + ((cpu->bus.current_rom_bank & 0x1F) - 1)
-				* 0x4000 + (addr - 0x4000));
-		} else {
-			return *(cpu->bus.rom_banks + (cpu->bus.current_rom_bank - 1) * 0x4000 + 
-					(addr - 0x4000));
-		}
+	return read_byte_slow(cpu, addr);
+}
+
+/* Read a byte from the CPU's address space
+   Plain memory is read through the page table, or under -DFASTMEM straight
+   from the window, which leaves only the pages it doesn't cover to the
+   table, out of line.
+*/
+static inline uint8_t READ_BYTE(struct CPU *cpu, uint16_t addr) {
+#ifdef FASTMEM
+	if (cpu->fastmem.read >> (addr >> 12) & 1) {
+		return cpu->fastmem.window[addr];
 	}
-	if (0xA000 <= addr && addr < 0xC000) {
-		if (cpu->bus.ram_enabled) {
-			/* Check if MBC3 has an RTC register selected */
-			if (cpu->bus.mbc_type == 3 && (cpu->bus.current_ram_bank >= 0x08)) {
-				/* Return RTC register value (not implemented - return 0 for now) */
-				printf("RTC register read not implemented, returning 0xFF\n");
-				return 0xFF; // Placeholder for RTC register reads
-			}
-			
-			/* Regular cartridge RAM access */
-			if (cpu->bus.cart_ram) {
-				uint16_t offset;
-				if (cpu->bus.mbc_type == 1){
-					if (cpu->bus.ram_size <= 0x2000) {
-						// 2KB or 8KB RAM: wrap around using modulo
-						offset = (addr - 0xA000) % cpu->bus.ram_size;
-					} else if (cpu->bus.mbc1_mode == 1 && cpu->bus.ram_size >= 0x8000) {
-						// Mode 1, 32KB RAM: support 4 banks
-						offset = (cpu->bus.current_ram_bank * 0x2000) + (addr - 0xA000);
-					} else {
-						// Mode 0: always use RAM bank 0
-						offset = addr - 0xA000;
-					}
-				} else {
-					offset = (cpu->bus.current_ram_bank * 0x2000) + (addr - 0xA000);
-				}
-				// Bounds check
-				if (offset < cpu->bus.ram_size) {
-					return *(cpu->bus.cart_ram + offset); // Read from cart RAM
-				}
-			}
-		}
-		return 0xFF;
+	return fastmem_read_miss(cpu, addr);
+#else
+	return read_byte_paged(cpu, addr);
+#endif
+}
+
+void dma_transfer(struct CPU *cpu, uint8_t value); // Ensure proper declaration of dma_transfer for WRITE_BYTE
+
+/* Drop predecoded instructions and translated blocks that cover a RAM byte
+   being written
+   An instruction is at most three bytes long, so the ones starting up to two
+   bytes before `index` may include it as well.
+   @param index Offset into icache.ram (ICACHE_WRAM/ICACHE_HRAM based)
+*/
+static inline void icache_invalidate(struct CPU *cpu, uint16_t index) {
+	(void)cpu;
+	(void)index;
+#ifdef ICACHE
+	cpu->icache.ram[index].word = 0;
+	if (index >= 1) cpu->icache.ram[index - 1].word = 0;
+	if (index >= 2) cpu->icache.ram[index - 2].word = 0;
+#endif
+#ifdef JIT
+	if (cpu->jit && cpu->jit->ram_code[index]) {
+		jit_invalidate(cpu, index);
 	}
+#endif
+}
 
-	if (0x8000 <= addr && addr < 0xA000) { // VRAM
-		if (cpu->dma_transfer) {
-			return *(cpu->bus.rom + addr);
-		}
-		if ((*(cpu->bus.rom + 0xFF41) & 0x03) == 0x03) { // blocked in mode 3
-			return 0xFF; // Return dummy value if VRAM is blocked
-		}
-		return *(cpu->bus.rom + addr); // Read from VRAM
+/* Mark the tile holding VRAM address `addr` for the GPU to decode again
+   Everything that writes VRAM calls this, see graphics.h. The 16-byte
+   block written is marked for the render worker (worker.h) as well; a
+   block of tile data is one tile.
+*/
+static inline void vram_written(struct MemoryBus *bus, uint16_t addr) {
+	uint16_t block = (addr - 0x8000) >> 4;
+	bus->vram_dirty[block >> 6] |= 1ull << (block & 63);
+	if (addr < 0x9800) {
+		bus->tile_dirty[block >> 6] |= 1ull << (block & 63);
 	}
-	if (0xFE00 <= addr && addr < 0xFEA0) { // OAM
-		if (cpu->dma_transfer == true) {
-			return cpu->bus.rom[addr];
-		}
-		uint8_t stat_mode = *(cpu->bus.rom + 0xFF41) & 0x03;
-		if (stat_mode == 0x02 || stat_mode == 0x03) {
-			return 0xFF; // Block reads in mode 2 and 3
+}
+
+/* Write a byte through the page table, see memmap.h
+   WRITE_BYTE itself, or its fallback for pages the fastmem window doesn't
+   take (fastmem.h). Only WRAM can hold code among the pages mapped for
+   writing.
+*/
+static inline void write_byte_paged(struct CPU *cpu, uint16_t addr, uint8_t value) {
+	uint8_t *page = cpu->map.write[addr >> 8];
+	if (page) {
+		page[addr & 0xFF] = value;
+		if ((addr & 0xE000) == 0xC000) {
+			icache_invalidate(cpu, ICACHE_WRAM + (addr - 0xC000));
 		}
-		return *(cpu->bus.rom + addr); // Read from OAM
-	}
-	if (0xE000 <= addr && addr < 0xFE00) { // Echo RAM
-		#ifdef ALLOW_ROM_WRITES
-		return *(cpu->bus.rom + addr);
-		#endif
-		return *(cpu->bus.rom + (addr - 0x2000)); // Read from echo RAM
+		return;
 	}
-	return *(cpu->bus.rom + addr);
+	write_byte_slow(cpu, addr, value);
 }
 
-void dma_transfer(struct CPU *cpu, uint8_t value); // Ensure proper declaration of dma_transfer for WRITE_BYTE
-
+/* Write a byte to the CPU's address space
+   Through the page table, or under -DFASTMEM the window first, like
+   READ_BYTE. The window only takes writes to WRAM.
+*/
 static inline void WRITE_BYTE(struct CPU *cpu, uint16_t addr, uint8_t value) {
-	if (cpu->bootrom_enabled && (addr < 0x0100 || (addr >= 0x8000 && addr < 0xA000))) {
-		if (0x8000 <= addr && addr < 0xA000) {
-			// Allow bootrom to write to VRAM
-			*(cpu->bus.rom + addr) = value;
-		}
-		*(cpu->bootrom + addr) = value;
-		return;
-	} else if (addr < 0x8000) {
-		switch(cpu->bus.mbc_type) {
-			case 1: { // MBC1
-				if (addr < 0x2000) {
-					cpu->bus.ram_enabled = ((value & 0x0F) == 0x0A);
-				} else if (addr < 0x4000) {
-					cpu->bus.rom_bank_lo = value & 0x1F;
-					if ((cpu->bus.rom_bank_lo & 0x1F) == 0) {
-						cpu->bus.rom_bank_lo = 1; // only if lower bits are 0
-					}
-				} else if (addr < 0x6000) {
-					cpu->bus.rom_bank_hi = value & 0x03;
-					if (cpu->bus.mbc1_mode == 0) {
-						cpu->bus.current_ram_bank = 0;
-					} else {
-						cpu->bus.current_ram_bank = cpu->bus.rom_bank_hi;
-					}
-				} else if (addr < 0x8000) {
-					cpu->bus.mbc1_mode = value & 0x01;
-				}
-				
-				// Always update the final bank after any change
-				if (cpu->bus.mbc1_mode == 0) {
-					// ROM banking mode
-					cpu->bus.current_rom_bank = (cpu->bus.rom_bank_hi << 5) | (cpu->bus.rom_bank_lo & 0x1F);
-					if (cpu->bus.current_rom_bank == 0) {
-						cpu->bus.current_rom_bank = 1;
-					}
-					cpu->bus.current_rom_bank %= cpu->bus.num_rom_banks;
-				} else {
-					// RAM banking mode — upper bits ignored
-					cpu->bus.current_rom_bank = cpu->bus.rom_bank_lo & 0x1F;
-					if (cpu->bus.current_rom_bank == 0) {
-						cpu->bus.current_rom_bank = 1;
-					}
-					cpu->bus.current_rom_bank %= cpu->bus.num_rom_banks;
-				}
-				return;
-			}
-			case 3: /* MBC3 */
-			{
-				if (addr < 0x2000) { /* RAM/RTC enable */
-					/* 0x0000-0x1FFF: RAM/RTC Enable (0x0A to enable, any other value to disable) */
-					cpu->bus.ram_enabled = ((value & 0x0F) == 0x0A);
-				} else if (addr < 0x4000) { /* ROM bank select (0x2000-0x3FFF) */
-					/* Set the ROM bank number (1-127) */
-					uint8_t bank = value & 0x7F;
-					if (bank == 0) bank = 1;
-					cpu->bus.current_rom_bank = bank;
-					/* Ensure we don't exceed available ROM banks */
-					if (cpu->bus.current_rom_bank >= cpu->bus.num_rom_banks) {
-						cpu->bus.current_rom_bank %= cpu->bus.num_rom_banks;
-						if (cpu->bus.current_rom_bank == 0) cpu->bus.current_rom_bank = 1;
-					}
-				} else if (addr < 0x6000) { /* RAM bank or RTC register select (0x4000-0x5FFF) */
-					cpu->bus.current_ram_bank = value; // 0-3 for RAM banks, 8-12 for RTC registers
-				} else if (addr < 0x8000) { /* RTC latch (0x6000-0x7FFF) */
-					/* Latch RTC data on 0->1 transition */
-					static uint8_t prev_value = 0;
-					if (prev_value == 0x00 && value == 0x01) {
-						/* Update RTC values to current time */
-					}
-					prev_value = value;
-				}
-				return;
-			}
-			case 5: /* MBC5 */
-			{
-				if (addr < 0x2000) { /* RAM enable */
-					cpu->bus.ram_enabled = ((value & 0x0F) == 0x0A);
-				} else if (addr < 0x3000) { /* ROM bank lower 8 bits */
-					cpu->bus.current_rom_bank = (cpu->bus.current_rom_bank & 0x100) | (value & 0xFF);
-				} else if (addr < 0x4000) { /* ROM bank bit 8 */
-					cpu->bus.current_rom_bank = (cpu->bus.current_rom_bank & 0xFF) | ((value & 0x01) << 8);
-				} else if (addr < 0x6000) { /* RAM bank */
-					cpu->bus.current_ram_bank = value & 0x0F;
-				}
-				break;
-			}
-			default: /* Other MBCs */
-			#ifdef ALLOW_ROM_WRITES
-			if (addr < 0x4000) {
-				*(cpu->bus.rom + addr) = value; // Writes to ROM are NOT allowed
-			} else if (addr < 0x8000) {
-				// Allow writes to ROM banks
-				cpu->bus.rom_banks[(cpu->bus.current_rom_bank - 1) * 0x4000 + (addr - 0x4000)] = value;
-			}
-			#endif
-				break;
-		}
-	} else if (addr < 0xA000) {
-		if (cpu->dma_transfer) {
-			*(cpu->bus.rom + addr) = value;
-		}
-		if ((*(cpu->bus.rom + 0xFF41) & 0x03) == 0x03) { // blocked in mode 3
-			return; // Return dummy value if VRAM is blocked
-		}
-		*(cpu->bus.rom + addr) = value;
-	} else if (addr < 0xC000) {
-		/* Write to cartridge RAM or RTC registers if enabled */
-		if (cpu->bus.ram_enabled) {
-			/* Check if MBC3 has an RTC register selected */
-			if (cpu->bus.mbc_type == 3 && cpu->selected_rtc_register >= 0x08 && cpu->selected_rtc_register <= 0x0C) {
-				/* Write to RTC register (not implemented - ignore for now) */
-				return;
-			}
-			
-			/* Regular cartridge RAM write */
-			if (cpu->bus.cart_ram) {
-				uint16_t offset;
-				if (cpu->bus.mbc_type == 1){
-					if (cpu->bus.ram_size <= 0x2000) {
-						// 2KB or 8KB RAM: wrap around using modulo
-						offset = (addr - 0xA000) % cpu->bus.ram_size;
-					} else if (cpu->bus.mbc1_mode == 1 && cpu->bus.ram_size >= 0x8000) {
-						// Mode 1, 32KB RAM: support 4 banks
-						offset = (cpu->bus.current_ram_bank * 0x2000) + (addr - 0xA000);
-					} else {
-						// Mode 0: always use RAM bank 0
-						offset = addr - 0xA000;
-					}
-				} else {
-					offset = (cpu->bus.current_ram_bank * 0x2000) + (addr - 0xA000);
-				}
-
-				// Bounds check
-				if (offset < cpu->bus.ram_size) {
-					*(cpu->bus.cart_ram + offset) = value;
-				}
-				return;
-			}
-		}
-	} else if (addr < 0xE000) { // WRAM
-		*(cpu->bus.rom + addr) = value; // Write to WRAM
-	} else if (addr < 0xFE00) { // Echo RAM (0xE000-0xFDFF)
-		#ifdef ALLOW_ROM_WRITES
-		*(cpu->bus.rom + addr) = value;
-		return;
-		#endif
-		*(cpu->bus.rom + (addr - 0x2000)) = value;
-	} else if (addr < 0xFEA0) { // OAM
-		
-		if (cpu->dma_transfer == true) {
-			*(cpu->bus.rom + addr) = value;
-			return;
-		}
-		uint8_t stat_mode = *(cpu->bus.rom + 0xFF41) & 0x03;
-		if (stat_mode == 0x02 || stat_mode == 0x03) {
-			// Block writes in mode 2 and 3
-			return;
-		}
-		*(cpu->bus.rom + addr) = value;
-	} else if (addr == 0xFF0F) { /* Interrupt Flag */
-		*(cpu->bus.rom + addr) = value | 0xE0; /* Only lower 5 bits are used */
-		#ifdef ALLOW_ROM_WRITES
-		*(cpu->bus.rom + addr) = value;
-		#endif
-	} else if (addr == 0xFF50) { /* Bootrom */
-		if (cpu->bootrom_enabled) {
-			printf("Boot ROM disabled by write to 0xFF50 with value 0x%02X\n", value);
-		}
-		cpu->bootrom_enabled = false; /* Any write to 0xFF50 disables the bootrom */
-		*(cpu->bus.rom + addr) = value;
-	} else if (addr == 0xFF04) { /* DIV reset */
-		*(cpu->bus.rom + addr) = 0;
-		cpu->divider_cycles = 0;
-		#ifdef ALLOW_ROM_WRITES
-		*(cpu->bus.rom + addr) = value;
-		#endif
-	} else if (addr == 0xFF42 || addr == 0xFF43) {
-		#ifdef ALLOW_ROM_WRITES
-		*(cpu->bus.rom + addr) = value;
+#ifdef FASTMEM
+	if (cpu->fastmem.write >> (addr >> 12) & 1) {
+		cpu->fastmem.window[addr] = value;
+		icache_invalidate(cpu, ICACHE_WRAM + (addr - 0xC000));
 		return;
-		#endif
-		uint8_t stat_mode = *(cpu->bus.rom + 0xFF41) & 0x03;
-		if (stat_mode == 0x03) {
-			return;
-		}
-		*(cpu->bus.rom + addr) = value; // Write to SC registers
-	} else if (addr == 0xFF46) { /*DMA transfer*/
-		dma_transfer(cpu, value);
-		*(cpu->bus.rom + addr) = value;
-	} else if (addr == 0xFF00) { /* P1 register */
-		/* Update joypad state */
-		#ifdef ALLOW_ROM_WRITES
-		*(cpu->bus.rom + addr) = value;
-		return;
-		#endif
-		*(cpu->bus.rom + addr) = (*(cpu->bus.rom + 0xFF00) & 0xCF) | (value & 0x30);
-	} else {
-		// rest of the I/O registers/HRAM
-		*(cpu->bus.rom + addr) = value;
 	}
-	// *(cpu->bus.rom + addr) = value; // Write to memory bus
+	fastmem_write_miss(cpu, addr, value);
+#else
+	write_byte_paged(cpu, addr, value);
+#endif
 }
 
 // Read 16-bit values
@@ -472,19 +649,21 @@ void exec_inst(struct CPU *cpu, uint8_t opcode);
 */
 static inline void cpu_interrupt_jump(struct CPU *cpu, uint16_t vector);
 
-/* Execute a CPU CB instruction
-   This function decodes and executes a CPU instruction.
-   @param cpu Pointer to the CPU structure.
-   @return void
+/* Allocate a zeroed CPU
+   struct CPU is aligned for its memory regions (BUS_ALIGN, or host pages
+   under FASTMEM), which calloc() doesn't promise. Free it with free(),
+   after fastmem_free() if the window is mapped.
+   @return the CPU, NULL if out of memory
 */
-static inline void _exec_cb_inst(struct CPU *cpu, uint8_t opcode);
+struct CPU *cpu_alloc(void);
 
 /* Initialize the CPU
+   Resets the registers, I/O and guest RAM in place and leaves no cartridge
+   mapped: ROM reads return 0xFF until load_rom().
    @param cpu Pointer to the CPU structure.
-   @param bus Pointer to the MemoryBus structure.
    @return void
 */
-void cpu_init(struct CPU *cpu, struct MemoryBus *bus);
+void cpu_init(struct CPU *cpu);
 
 /*
    Handle CPU interrupts.
@@ -493,18 +672,46 @@ void cpu_init(struct CPU *cpu, struct MemoryBus *bus);
 */
 int cpu_handle_interrupts(struct CPU *cpu);
 
+/* Execute instructions back to back
+   Runs from the current PC until at least `cycles` cycles have elapsed,
+   handling halt and interrupts the same way step_cpu() does. Timer and GPU
+   are NOT stepped in between, so this is only exact for callers that do not
+   need per-instruction peripheral timing (benchmarks, batched runners).
+   @param cpu Pointer to the CPU structure.
+   @param cycles Minimum number of cycles to run.
+   @return Number of cycles actually executed.
+*/
+uint32_t exec_block(struct CPU *cpu, uint32_t cycles);
+
+/* Fetch and execute the instruction at PC
+   Like exec_inst(), but the opcode and operands come from the predecoded
+   instruction cache when PC is in cacheable memory.
+   @param cpu Pointer to the CPU structure.
+   @return void
+*/
+void exec_next(struct CPU *cpu);
+
+/* Forget every predecoded WRAM and HRAM instruction
+   Needed after memory was changed behind WRITE_BYTE's back (e.g. a memset
+   of bus.wram). cpu_init() starts with an empty cache. ROM entries stay,
+   the image they belong to can't change.
+   @param cpu Pointer to the CPU structure.
+   @return void
+*/
+void icache_flush(struct CPU *cpu);
+
 /**
- * Step the CPU for one instruction cycle.
- * This function handles the execution of a single CPU instruction,
- * including checking for interrupts and handling the halt state.
+ * Prepare the CPU for its next instruction.
+ * Handles the halt state, interrupt dispatch and the delayed EI.
  * @param cpu Pointer to the CPU structure.
- * @return void
+ * @return true if an instruction should be fetched and executed,
+ *         false if this step was consumed by halt or interrupt entry.
  */
-static inline void step_cpu(struct CPU *cpu) {
+static inline bool cpu_begin_step(struct CPU *cpu) {
     cpu->cycles = 4;
     if (cpu->halted) {
-        uint8_t if_reg = cpu->bus.rom[0xFF0F];
-        uint8_t ie_reg = cpu->bus.rom[0xFFFF];
+        uint8_t if_reg = cpu->bus.io.iflag;
+        uint8_t ie_reg = cpu->bus.ie;
         if ((if_reg & ie_reg)) {
             cpu->halted = false; // Wake up even if IME is 0
             if (cpu->ime) {
@@ -513,23 +720,169 @@ static inline void step_cpu(struct CPU *cpu) {
             }
         } else {
             cpu->cycles = 4;
-            return;
+            return false;
     }
     }
     if (cpu->ime) {
         if (!cpu_handle_interrupts(cpu)){
-            return;
+            return false;
         }
     }
     if (cpu->ime_pending) {
         cpu->ime = true; // Set IME to true if pending
         cpu->ime_pending = false; // Clear pending state
     }
+    return true;
+}
 
-    uint8_t opcode = READ_BYTE(cpu, cpu->pc);
-    cpu->pc++; // Increment PC to point to the next instruction
-    exec_inst(cpu, opcode);
+/**
+ * Step the CPU for one instruction cycle.
+ * This function handles the execution of a single CPU instruction,
+ * including checking for interrupts and handling the halt state.
+ * @param cpu Pointer to the CPU structure.
+ * @return void
+ */
+static inline void step_cpu(struct CPU *cpu) {
+    if (!cpu_begin_step(cpu)) {
+        return;
+    }
+
+#ifdef AOT
+    if (cpu->aot) {
+        aot_exec(cpu);
+        return;
+    }
+#endif
+#ifdef JIT
+    if (cpu->jit) {
+        jit_exec(cpu);
+        return;
+    }
+#endif
+    exec_next(cpu);
 }
 
+/**
+ * Fast-forward idle loops, see idle.h.
+ * Called by cpu_run_cycles() after each interpreted run or step, with the
+ * master clock at the start of its last instruction (or JIT/AOT run).
+ * @param cpu Pointer to the CPU structure.
+ * @param gpu Pointer to the GPU structure.
+ * @param from Address of that last instruction (PC before a JIT/AOT run).
+ * @param cycles Cycles of the run.
+ * @param left Cycles left of the budget after the run.
+ * @return cycles the timer and GPU can be stepped by on top of the
+ *         run's, never reaching an event or going past `left`
+ */
+static inline uint32_t idle_skip(struct CPU *cpu, struct GPU *gpu, uint16_t from, uint32_t cycles,
+                                 uint32_t left) {
+#ifdef IDLE_SKIP
+    struct idle_loop *idle = &cpu->idle;
+    if (cpu->halted) {
+        idle->ran = IDLE_LEFT; // halts are coalesced by cpu_run_cycles()
+        return 0;
+    }
+    uint16_t pc = cpu->pc;
+    // a run stops at every jump back, so one that ends in the loop having
+    // jumped from inside it never left it
+    bool inside = (uint16_t)(pc - idle->pc) < IDLE_MAX_BYTES &&
+                  (uint16_t)(from - idle->pc) < IDLE_MAX_BYTES;
+    idle->ran = inside ? idle->ran + cycles : IDLE_LEFT;
+    if (pc == idle->pc ? idle->cycles != 0 : (pc < from && from - pc < IDLE_MAX_BYTES)) {
+        return idle_visit(cpu, gpu, left); // back at the loop, or jumped back to what may be a new one
+    }
+    return 0;
+#else
+    (void)cpu;
+    (void)gpu;
+    (void)from;
+    (void)cycles;
+    (void)left;
+    return 0;
+#endif
+}
+
+/**
+ * Whether a library routine may start at `pc`, see hle.h.
+ * The interpreter's CALLs end its run when this holds, for hle_skip().
+ * @param cpu Pointer to the CPU structure.
+ * @param pc Address called.
+ * @return true if an entry point lies within the 32 bytes around it
+ */
+static inline bool hle_entry(const struct CPU *cpu, uint16_t pc) {
+#ifdef HLE
+    return (cpu->hle.pages[pc >> 8] >> ((pc >> 5) & 7)) & 1;
+#else
+    (void)cpu;
+    (void)pc;
+    return false;
+#endif
+}
+
+/**
+ * Run library routines natively, see hle.h.
+ * Called by cpu_run_cycles() after each interpreted run or step, once its
+ * cycles have been added to the master clock.
+ * @param cpu Pointer to the CPU structure.
+ * @param end Master clock time the run ends at.
+ * @return true if it looked at a routine, which may have moved the master
+ *         clock and run events
+ */
+static inline bool hle_skip(struct CPU *cpu, uint64_t end) {
+#ifdef HLE
+    if (hle_entry(cpu, cpu->pc) && !cpu->halted) {
+        hle_visit(cpu, end);
+        return true;
+    }
+    return false;
+#else
+    (void)cpu;
+    (void)end;
+    return false;
+#endif
+}
+
+/**
+ * Fuse copy and fill loops, see fuse.h.
+ * Called by cpu_run_cycles() after each interpreted run or step, once its
+ * cycles have been added to the master clock.
+ * @param cpu Pointer to the CPU structure.
+ * @param from Address of the last instruction run (PC before a JIT/AOT run).
+ * @param end Master clock time the run ends at.
+ * @return true if it looked at a loop, which may have moved the master
+ *         clock and run events
+ */
+static inline bool fuse_skip(struct CPU *cpu, uint16_t from, uint64_t end) {
+#ifdef FUSE
+    uint16_t pc = cpu->pc;
+    if (pc < from && from - pc < FUSE_MAX_BYTES && !cpu->halted) {
+        fuse_visit(cpu, end); // jumped back to what may be a copy or fill loop
+        return true;
+    }
+    return false;
+#else
+    (void)cpu;
+    (void)from;
+    (void)end;
+    return false;
+#endif
+}
+
+/**
+ * Run the CPU, timer and GPU together.
+ * Executes instructions until at least `cycles` cycles have elapsed or the
+ * GPU finishes a frame (gpu->should_render), moving cpu->sched.now along.
+ * The timer and GPU are only stepped when the scheduler has them due or the
+ * CPU touches their registers, halts are slept through up to the next
+ * event, and all of them are up to date again on return. A halt is only
+ * returned from once something can wake the CPU, so this gives the same
+ * results as calling step_cpu(), step_timer() and step_gpu() in turn.
+ * @param cpu Pointer to the CPU structure.
+ * @param gpu Pointer to the GPU structure.
+ * @param cycles Minimum number of cycles to run.
+ * @return Number of cycles actually run.
+ */
+uint32_t cpu_run_cycles(struct CPU *cpu, struct GPU *gpu, uint32_t cycles);
+
 
 #endif // _CPU_H
\ No newline at end of file
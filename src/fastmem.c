@@ -0,0 +1,151 @@
+#define _GNU_SOURCE // memfd_create()
+#include "fastmem.h"
+#include "cpu.h"
+#include "rom.h"
+
+#ifdef FASTMEM
+
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#define FASTMEM_WINDOW 0x10000 // the whole guest address space
+#define FASTMEM_RAM 0x4000     // bytes of the memfd: VRAM, then WRAM
+
+_Static_assert(offsetof(struct MemoryBus, wram) == offsetof(struct MemoryBus, vram) + 0x2000,
+               "WRAM follows VRAM, both are mapped from the memfd in one go");
+_Static_assert(offsetof(struct CPU, bus.vram) % FASTMEM_PAGE == 0, "VRAM starts a host page");
+
+// VRAM and WRAM as the one block the memfd holds
+static uint8_t *fastmem_ram(struct CPU *cpu) {
+    return (uint8_t *)&cpu->bus + offsetof(struct MemoryBus, vram);
+}
+
+// Map the 16KB of ROM at `src` into the window at `addr`, from the file of the image it is in
+static void fastmem_map_rom(struct CPU *cpu, uint16_t addr, const uint8_t *src) {
+    struct fastmem *fm = &cpu->fastmem;
+    int page = addr / FASTMEM_PAGE;
+    if (fm->host[page] == src) {
+        return; // mapped already, or neither then nor now
+    }
+    const struct rom_image *image = cpu->bus.image;
+    uint8_t *at = fm->window + addr;
+    bool mapped = false;
+    if (src && image && image->fd >= 0 && (uintptr_t)src >= (uintptr_t)image->data &&
+        (uintptr_t)src - (uintptr_t)image->data + 0x4000 <= image->size) {
+        size_t offset = src - image->data;
+        mapped = offset % FASTMEM_PAGE == 0 &&
+                 mmap(at, 0x4000, PROT_READ, MAP_PRIVATE | MAP_FIXED, image->fd, offset) != MAP_FAILED;
+        // the image has the header checksum patched (rom_patch()), the file doesn't
+        if (mapped && offset == 0 && memcmp(at, src, FASTMEM_PAGE) != 0) {
+            mapped = mprotect(at, FASTMEM_PAGE, PROT_READ | PROT_WRITE) == 0;
+            if (mapped) {
+                memcpy(at, src, FASTMEM_PAGE);
+                mprotect(at, FASTMEM_PAGE, PROT_READ);
+            }
+        }
+    }
+    if (!mapped) {
+        mmap(at, 0x4000, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED | MAP_NORESERVE, -1, 0);
+    }
+    for (int i = 0; i < 4; i++) {
+        fm->host[page + i] = mapped ? src + i * FASTMEM_PAGE : NULL;
+    }
+}
+
+void fastmem_sync(struct CPU *cpu, int first, int last) {
+    struct fastmem *fm = &cpu->fastmem;
+    if (!fm->window) {
+        return;
+    }
+    if (first <= 0x3) {
+        fastmem_map_rom(cpu, 0x0000, cpu->bus.rom0);
+    }
+    if (first <= 0x7 && last >= 0x4) {
+        fastmem_map_rom(cpu, 0x4000, cpu->bus.romx);
+    }
+    const struct memory_map *map = &cpu->map;
+    for (int page = first; page <= last; page++) {
+        const uint8_t *host = fm->host[page];
+        bool read = host != NULL;
+        bool write = host != NULL && (page == 0xC || page == 0xD); // WRITE_BYTE and the JIT count on WRAM only
+        if (host) {
+            // no early exit, so the compares vectorize
+            for (int i = 0; i < FASTMEM_PAGE / 0x100; i++) {
+                read &= map->read[page * 0x10 + i] == host + i * 0x100;
+                write &= map->write[page * 0x10 + i] == host + i * 0x100;
+            }
+        }
+        uint16_t bit = 1u << page;
+        fm->read = read ? fm->read | bit : fm->read & ~bit;
+        fm->write = write ? fm->write | bit : fm->write & ~bit;
+    }
+}
+
+uint8_t fastmem_read_miss(struct CPU *cpu, uint16_t addr) {
+    return read_byte_paged(cpu, addr);
+}
+
+void fastmem_write_miss(struct CPU *cpu, uint16_t addr, uint8_t value) {
+    write_byte_paged(cpu, addr, value);
+}
+
+int fastmem_init(struct CPU *cpu) {
+    struct fastmem *fm = &cpu->fastmem;
+    struct MemoryBus *bus = &cpu->bus;
+    if (fm->window) {
+        return 0;
+    }
+    uint8_t *ram = fastmem_ram(cpu);
+    if (sysconf(_SC_PAGESIZE) != FASTMEM_PAGE || (uintptr_t)ram % FASTMEM_PAGE != 0) {
+        return -1;
+    }
+    int fd = memfd_create("gbemu-ram", MFD_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    // the RAM as it is into the memfd, the window around it, then the memfd in place of the RAM
+    uint8_t *window = MAP_FAILED;
+    if (ftruncate(fd, FASTMEM_RAM) != 0 || pwrite(fd, ram, FASTMEM_RAM, 0) != FASTMEM_RAM ||
+        (window = mmap(NULL, FASTMEM_WINDOW, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0)) == MAP_FAILED ||
+        mmap(window + 0x8000, 0x2000, PROT_READ, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED ||
+        mmap(window + 0xC000, 0x2000, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0x2000) == MAP_FAILED ||
+        mmap(window + 0xE000, 0x1000, PROT_READ, MAP_SHARED | MAP_FIXED, fd, 0x2000) == MAP_FAILED || // echo
+        mmap(ram, FASTMEM_RAM, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) {
+        if (window != MAP_FAILED) {
+            munmap(window, FASTMEM_WINDOW);
+        }
+        close(fd);
+        return -1;
+    }
+    memset(fm, 0, sizeof(*fm));
+    fm->window = window;
+    fm->fd = fd;
+    fm->host[0x8] = bus->vram;
+    fm->host[0x9] = bus->vram + 0x1000;
+    fm->host[0xC] = bus->wram;
+    fm->host[0xD] = bus->wram + 0x1000;
+    fm->host[0xE] = bus->wram;
+    memory_map_update(cpu); // maps the ROM and works the pages out
+    return 0;
+}
+
+void fastmem_free(struct CPU *cpu) {
+    struct fastmem *fm = &cpu->fastmem;
+    if (!fm->window) {
+        return;
+    }
+    // private memory again, as before fastmem_init(); should that fail, the memfd pages stay, RAM all the same
+    uint8_t *ram = fastmem_ram(cpu);
+    uint8_t copy[FASTMEM_RAM];
+    memcpy(copy, ram, FASTMEM_RAM);
+    if (mmap(ram, FASTMEM_RAM, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) != MAP_FAILED) {
+        memcpy(ram, copy, FASTMEM_RAM);
+    }
+    munmap(fm->window, FASTMEM_WINDOW);
+    close(fm->fd);
+    memset(fm, 0, sizeof(*fm));
+}
+
+#endif
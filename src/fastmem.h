@@ -0,0 +1,104 @@
+#ifndef _FASTMEM_H
+#define _FASTMEM_H
+
+#include <stdint.h>
+
+/* Host-MMU window over the guest address space
+   Built with -DFASTMEM (Linux). fastmem_init() reserves 64KB of host
+   address space for a CPU and maps guest memory into it at its guest
+   address, so READ_BYTE and WRITE_BYTE (cpu.h) reach a plain byte as
+   window[addr] without looking its page up in the page table (memmap.h).
+
+   - VRAM and WRAM move into a memfd, mapped both where they are in struct
+     MemoryBus and into the window; E000-EFFF is WRAM mapped a second time.
+     ROM bank 0 and the switchable bank are mapped from the ROM file, and a
+     bank switch remaps 4000-7FFF with mmap(MAP_FIXED).
+   - The window goes by host pages of 4KB. One is read (written) through
+     only while the page table maps all 16 of its guest pages for reading
+     (writing) to the memory the window shows there; everything else falls
+     back to the page table. So the boot ROM, VRAM in mode 3, tile data and
+     MBC writes and cartridge RAM behave as without the window, and a page
+     the window has no mapping for never faults.
+   - F000-FFFF is never mapped: the end of echo RAM, OAM, I/O and HRAM
+     share that host page, so all of it takes the page table.
+   - READ_BYTE and WRITE_BYTE test the page's bit first and only go to
+     the page table, out of line, when it is clear; the JIT (jit.c) emits
+     the same test and a load or store through the window inline.
+   - The window only takes writes to WRAM, with the icache cleared behind
+     them as on the page table. There is no write trap (PROT_READ pages
+     and a SIGSEGV handler): every write the window leaves out has a side
+     effect (tile marking, MBC registers, I/O), so it would fault on the
+     hot path, a kernel round trip each time, and the handler would have
+     to decode the faulting host store and own SIGSEGV process-wide.
+   - A bank switch costs a system call, which is why this is a build flag.
+     Other host page sizes, or no cartridge image (ROM set up by hand),
+     leave the pages concerned on the page table.
+   - It doesn't pay for itself: against bench/gbemu, bench/gbemu_fastmem
+     has measured between level and 5% slower per instruction and 7-17%
+     per frame, bench/gbemu_jit_fastmem 2-6% slower than bench/gbemu_jit
+     (x86-64, 1 core, noisy). The page table already costs one load.
+*/
+#if defined(FASTMEM) && !defined(__linux__)
+#undef FASTMEM // memfd_create() is Linux only
+#endif
+
+#ifdef FASTMEM
+
+struct CPU;
+
+#define FASTMEM_PAGE 0x1000 // host page, the window's granularity
+#define FASTMEM_PAGES 16    // of the 64KB window
+
+struct fastmem {
+	uint8_t *window;                     // 64KB, guest address = offset; NULL before fastmem_init()
+	uint16_t read;                       // host pages read through the window, bit n for n * 0x1000
+	uint16_t write;                      // host pages written through it
+	int fd;                              // memfd holding VRAM and WRAM
+	const uint8_t *host[FASTMEM_PAGES];  // memory each page of the window shows, NULL if not mapped
+};
+
+/* Move VRAM and WRAM into a memfd and map the window
+   The CPU is aligned for it (cpu_alloc(), or a struct CPU variable). The
+   window follows the page table from then on; free it with fastmem_free()
+   before the CPU itself.
+   @param cpu Pointer to the CPU structure.
+   @return 0 on success, -1 if the host can't, leaving the CPU as it was
+*/
+int fastmem_init(struct CPU *cpu);
+
+/* Unmap the window and put VRAM and WRAM back in private memory
+   @param cpu Pointer to the CPU structure.
+   @return void
+*/
+void fastmem_free(struct CPU *cpu);
+
+/* READ_BYTE (cpu.h) for a page the window doesn't take: read_byte_paged(),
+   kept out of line so that only the window's test is inlined everywhere
+   @param cpu Pointer to the CPU structure.
+   @param addr Address to read.
+   @return the byte
+*/
+uint8_t fastmem_read_miss(struct CPU *cpu, uint16_t addr);
+
+/* WRITE_BYTE for a page the window doesn't take: write_byte_paged()
+   @param cpu Pointer to the CPU structure.
+   @param addr Address to write.
+   @param value Byte to write.
+   @return void
+*/
+void fastmem_write_miss(struct CPU *cpu, uint16_t addr, uint8_t value);
+
+/* Follow the page table over host pages `first` to `last`
+   Remaps the ROM pages among them if the bus points elsewhere now, then
+   works out which can be accessed through the window. memmap.c calls it
+   whenever it rebuilds pages.
+   @param cpu Pointer to the CPU structure.
+   @param first First host page (guest address >> 12).
+   @param last Last host page.
+   @return void
+*/
+void fastmem_sync(struct CPU *cpu, int first, int last);
+
+#endif
+
+#endif
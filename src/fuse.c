@@ -0,0 +1,201 @@
+#include "fuse.h"
+#include "cpu.h"
+#include "graphics.h"
+#include <string.h>
+
+#ifdef FUSE
+
+// Cycles of one iteration, by enum fuse_kind
+static const uint8_t fuse_cycles[] = {
+    [FUSE_COPY_BC] = 8 + 8 + 8 + 8 + 4 + 4 + 12,
+    [FUSE_COPY_R8] = 8 + 8 + 8 + 4 + 12,
+    [FUSE_FILL_R8] = 8 + 4 + 12,
+};
+
+// B C D E as counted down by DEC r, NULL for any other register
+static uint8_t *fuse_reg(struct CPU *cpu, int r) {
+    switch (r) {
+        case 0: return &cpu->regs.b;
+        case 1: return &cpu->regs.c;
+        case 2: return &cpu->regs.d;
+        case 3: return &cpu->regs.e;
+        default: return NULL;
+    }
+}
+
+/* Decode the loop starting at PC
+   Leaves kind FUSE_NONE unless it is one of the loops in enum fuse_kind,
+   with a counter that the body doesn't also use as a pointer.
+*/
+static void fuse_decode(struct CPU *cpu, struct fuse_loop *fuse) {
+    uint8_t op[FUSE_MAX_BYTES];
+    for (int i = 0; i < FUSE_MAX_BYTES; i++) {
+        op[i] = READ_BYTE(cpu, cpu->pc + i);
+    }
+    fuse->kind = FUSE_NONE;
+
+    if ((op[0] == 0x22 || op[0] == 0x32) && (op[1] & 0xE7) == 0x05 &&
+        op[2] == 0x20 && op[3] == 0xFC) { // LD (HL+-),A / DEC B C D E / JR NZ
+        fuse->kind = FUSE_FILL_R8;
+        fuse->counter = op[1] >> 3;
+        fuse->step = op[0] == 0x22 ? 1 : -1;
+        return;
+    }
+    if (!((op[0] == 0x2A && op[1] == 0x12) || (op[0] == 0x1A && op[1] == 0x22)) || op[2] != 0x13) {
+        return; // LD A,(HL+) / LD (DE),A or LD A,(DE) / LD (HL+),A, then INC DE
+    }
+    fuse->from_de = op[0] == 0x1A;
+    fuse->step = 1;
+    if ((op[3] == 0x05 || op[3] == 0x0D) && op[4] == 0x20 && op[5] == 0xFA) { // DEC B or C / JR NZ
+        fuse->kind = FUSE_COPY_R8;
+        fuse->counter = op[3] >> 3;
+    } else if (op[3] == 0x0B && op[4] == 0x78 && op[5] == 0xB1 && op[6] == 0x20 && op[7] == 0xF8) {
+        fuse->kind = FUSE_COPY_BC; // DEC BC / LD A,B / OR C / JR NZ
+    }
+}
+
+/* Host memory behind `count` bytes from `addr` on in direction `step`
+   @return pointer to the byte at `addr`, NULL unless the bytes all lie in
+           one of ROM, VRAM or WRAM (only VRAM and WRAM if `write`) and
+           access to them isn't blocked
+*/
+static uint8_t *fuse_span(struct CPU *cpu, uint16_t addr, int step, uint32_t count, bool write) {
+    if (step < 0 && addr < count - 1) {
+        return NULL;
+    }
+    uint32_t lo = step > 0 ? addr : addr - (count - 1);
+    uint32_t hi = step > 0 ? addr + (count - 1) : addr;
+    if (hi < 0x4000) {
+        return write ? NULL : cpu->bus.rom0 + addr;
+    }
+    if (lo >= 0x4000 && hi < 0x8000) {
+        if (write) {
+            return NULL;
+        }
+        return cpu->bus.romx ? cpu->bus.romx + (addr - 0x4000) : NULL;
+    }
+    if (lo >= 0x8000 && hi < 0xA000) {
+        if (cpu->dma_transfer || (cpu->bus.io.stat & 0x03) == 0x03) {
+            return NULL; // blocked in mode 3, which lasts until the next event
+        }
+        return cpu->bus.vram + (addr - 0x8000);
+    }
+    if (lo >= 0xC000 && hi < 0xE000) {
+        return cpu->bus.wram + (addr - 0xC000);
+    }
+    return NULL;
+}
+
+// WRITE_BYTE's side effects of writing `count` bytes from `addr` on
+static void fuse_written(struct CPU *cpu, uint16_t addr, int step, uint32_t count) {
+    uint16_t lo = step > 0 ? addr : addr - (count - 1);
+    if (addr < 0xC000) {
+        for (uint32_t i = 0; i < count; i += 16) {
+            vram_written(&cpu->bus, lo + i); // a tile at a time
+        }
+        vram_written(&cpu->bus, lo + count - 1);
+        return;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        icache_invalidate(cpu, ICACHE_WRAM + (lo - 0xC000) + i);
+    }
+}
+
+/* Run up to `limit` cycles of whole iterations of the loop at PC
+   @return cycles run, 0 if not even one can be
+*/
+static uint32_t fuse_run(struct CPU *cpu, struct fuse_loop *fuse, uint64_t limit) {
+    uint8_t *counter = fuse_reg(cpu, fuse->counter);
+    uint32_t left; // iterations up to the end of the loop, the one being started included
+    if (fuse->kind == FUSE_COPY_BC) {
+        left = cpu->regs.bc ? cpu->regs.bc : 0x10000;
+    } else {
+        left = *counter ? *counter : 0x100;
+    }
+    uint64_t fit = limit / fuse_cycles[fuse->kind];
+    uint32_t count = fit < left - 1 ? (uint32_t)fit : left - 1; // the last one is interpreted
+    if (!count) {
+        return 0;
+    }
+
+    if (fuse->kind == FUSE_FILL_R8) {
+        uint8_t *dst = fuse_span(cpu, cpu->regs.hl, fuse->step, count, true);
+        if (!dst) {
+            return 0;
+        }
+        memset(fuse->step > 0 ? dst : dst - (count - 1), cpu->regs.a, count);
+        fuse_written(cpu, cpu->regs.hl, fuse->step, count);
+        cpu->regs.hl += fuse->step * (int)count;
+    } else {
+        uint16_t from = fuse->from_de ? cpu->regs.de : cpu->regs.hl;
+        uint16_t to = fuse->from_de ? cpu->regs.hl : cpu->regs.de;
+        uint8_t *src = fuse_span(cpu, from, 1, count, false);
+        uint8_t *dst = fuse_span(cpu, to, 1, count, true);
+        if (!src || !dst) {
+            return 0;
+        }
+        if ((uintptr_t)dst > (uintptr_t)src && (uintptr_t)dst < (uintptr_t)(src + count)) {
+            for (uint32_t i = 0; i < count; i++) {
+                dst[i] = src[i]; // copying forward onto itself repeats the start
+            }
+        } else {
+            memmove(dst, src, count);
+        }
+        fuse_written(cpu, to, 1, count);
+        cpu->regs.hl += count;
+        cpu->regs.de += count;
+        cpu->regs.a = dst[count - 1];
+    }
+
+    if (fuse->kind == FUSE_COPY_BC) {
+        cpu->regs.bc -= count;
+        cpu->regs.a = cpu->regs.b | cpu->regs.c;
+        FLAGS_OR(cpu, cpu->regs.a);
+    } else {
+        *counter -= count;
+        FLAGS_DEC(cpu, *counter);
+    }
+    return count * fuse_cycles[fuse->kind];
+}
+
+// Nothing can interrupt the loop before the next event
+static inline bool fuse_quiet(struct CPU *cpu) {
+    return !cpu->ime_pending && !(cpu->ime && (cpu->bus.io.iflag & cpu->bus.ie & 0x1F));
+}
+
+void fuse_visit(struct CPU *cpu, uint64_t end) {
+    struct fuse_loop *fuse = &cpu->fuse;
+    struct scheduler *sched = &cpu->sched;
+    uint16_t head = cpu->pc;
+    uint16_t bank = head >= 0x4000 ? cpu->bus.current_rom_bank : 0;
+    if (head != fuse->pc || bank != fuse->bank) {
+        fuse->pc = head;
+        fuse->bank = bank;
+        fuse->kind = FUSE_NONE;
+        if (head < 0x8000 && !cpu->bootrom_enabled) {
+            fuse_decode(cpu, fuse);
+        }
+    }
+    if (fuse->kind == FUSE_NONE) {
+        return;
+    }
+
+    // the same checks as cpu_run_cycles() makes between instructions, with
+    // the events run where they would be
+    for (;;) {
+        if (sched->now >= sched->next) {
+            sched_run_due(cpu);
+        }
+        if (sched->now >= end || sched->gpu->should_render || !fuse_quiet(cpu)) {
+            return;
+        }
+        uint64_t stop = sched->next < end ? sched->next : end;
+        uint32_t cycles = fuse_run(cpu, fuse, stop - sched->now);
+        if (!cycles) {
+            return;
+        }
+        sched->now += cycles;
+    }
+}
+
+#endif
@@ -0,0 +1,65 @@
+#ifndef _FUSE_H
+#define _FUSE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Copy and fill loop fusion
+   Games copy tiles and maps and clear memory with a handful of tight loops,
+   e.g. `LD A,(HL+) / LD (DE),A / INC DE / DEC BC / LD A,B / OR C / JR NZ`
+   for a copy and `LD (HL+),A / DEC C / JR NZ` for a fill. fuse_skip()
+   (cpu.h) recognizes them when PC jumps back to their first instruction and
+   runs the iterations up to the next event in one go, as a host memcpy or
+   memset where it can.
+
+   - Only loops in ROM are fused, between WRAM, VRAM and ROM. Anything that
+     goes through cartridge RAM, echo RAM, OAM or I/O runs normally.
+   - Nothing the loop reads or writes changes how it runs before the next
+     event (VRAM stays blocked or open for the whole mode), so the fused
+     iterations do and take exactly what they would one by one. They stop
+     short of each event, which is run at the iteration boundary it is due
+     at or left to the interpreter if it falls inside an iteration.
+   - The last iteration is always left to the interpreter, so the loop is
+     left with the registers and flags it would have anyway. Build with
+     -DNO_FUSION to compare.
+*/
+#ifndef NO_FUSION
+#define FUSE
+#endif
+
+struct CPU;
+
+#ifdef FUSE
+
+#define FUSE_MAX_BYTES 8 // longest loop body recognized
+
+enum fuse_kind {
+	FUSE_NONE,
+	FUSE_COPY_BC, // LD A,(HL+) / LD (DE),A / INC DE / DEC BC / LD A,B / OR C / JR NZ, or (DE) to (HL+)
+	FUSE_COPY_R8, // LD A,(HL+) / LD (DE),A / INC DE / DEC r / JR NZ, or (DE) to (HL+)
+	FUSE_FILL_R8, // LD (HL+),A or LD (HL-),A / DEC r / JR NZ
+};
+
+struct fuse_loop {
+	uint16_t pc;      // first instruction of the loop last looked at
+	uint16_t bank;    // ROM bank it was decoded from
+	uint8_t kind;     // enum fuse_kind, FUSE_NONE if it isn't one
+	uint8_t counter;  // register counted down by an R8 loop, 0-7 as in B C D E H L (HL) A
+	bool from_de;     // copy reads (DE) and writes (HL+) rather than the other way round
+	int8_t step;      // +1 for (HL+), -1 for (HL-)
+};
+
+/* PC just jumped back to what may be a copy or fill loop
+   Decodes the loop if it is a new one and runs its iterations up to each
+   following event in one go, running the events in between, until the run
+   ends, something could interrupt it or only the last iteration is left.
+   Moves the master clock along with them.
+   @param cpu Pointer to the CPU structure.
+   @param end Master clock time the run ends at.
+   @return void
+*/
+void fuse_visit(struct CPU *cpu, uint64_t end);
+
+#endif
+
+#endif
@@ -2,13 +2,17 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
+#ifdef __SSSE3__
+#include <tmmintrin.h>
+#endif
 
 uint8_t inline read_vram(struct GPU *gpu, uint16_t addr) {
     if (addr < VRAM_BEGIN || addr > VRAM_END) {
         fprintf(stderr, "VRAM access out of bounds: 0x%04X\n", addr);
         return 0; // Return 0 for out of bounds access
     }
-    return *(gpu->vram + addr); // vram is mapped to 0x8000-0x9FFF of the memory bus
+    return gpu->bus->vram[addr - VRAM_BEGIN];
 }
 
 void inline write_vram(struct GPU *gpu, uint16_t addr, uint8_t value) {
@@ -16,12 +20,48 @@ void inline write_vram(struct GPU *gpu, uint16_t addr, uint8_t value) {
         fprintf(stderr, "VRAM access out of bounds: 0x%04X\n", addr);
         return; // Ignore out of bounds writes
     }
-    *(gpu->vram + addr) = value; // vram is mapped to 0x8000-0x9FFF of the memory bus
+    gpu->bus->vram[addr - VRAM_BEGIN] = value;
+}
+
+// Colour indices of one row from its two bitplanes, leftmost pixel first
+static void decode_row(uint8_t *pixels, uint8_t *flipped, uint8_t low, uint8_t high) {
+    for (int x = 0; x < 8; x++) {
+        uint8_t bit = 7 - x;
+        uint8_t color_index = ((high >> bit) & 1) << 1 | ((low >> bit) & 1);
+        pixels[x] = color_index;
+        flipped[7 - x] = color_index;
+    }
+}
+
+void decode_tiles(struct GPU *gpu) {
+    uint64_t *dirty = gpu->bus->tile_dirty;
+    for (int word = 0; word < 6; word++) {
+        while (dirty[word]) {
+            int tile = word * 64 + __builtin_ctzll(dirty[word]);
+            dirty[word] &= dirty[word] - 1;
+            const uint8_t *data = gpu->bus->vram + tile * 16;
+            for (int row = 0; row < 8; row++) {
+                decode_row(gpu->tiles[tile].pixels[row], gpu->tiles[tile].flipped[row],
+                           data[row * 2], data[row * 2 + 1]);
+            }
+        }
+    }
+}
+
+void gpu_set_render_policy(struct GPU *gpu, enum render_policy policy, uint32_t interval) {
+    gpu->render_policy = policy;
+    gpu->render_interval = interval ? interval : 1;
+    gpu->frame_count = 0;
+}
+
+void gpu_request_frame(struct GPU *gpu) {
+    gpu->render_requested = true;
 }
 
 void render_scanline(struct GPU *gpu, int line) {
     if (line < 0 || line >= SCREEN_HEIGHT) return;
     if (!(LCDC(gpu) & 0x80)) return;
+    decode_tiles(gpu);
     // Clear scanline to background color first
     uint8_t bg_color = (BGP(gpu) & 0x03); // Default color 0
     uint8_t* row_ptr = gpu->framebuffer + line * SCREEN_WIDTH;
@@ -38,6 +78,42 @@ void render_scanline(struct GPU *gpu, int line) {
     }
 }
 
+// Eight colour indices through the palette's four shades, one at a time if `scalar`
+static inline void shade_row(uint8_t *out, const uint8_t *pixels, const uint8_t shades[4], bool scalar) {
+#ifdef __SSSE3__
+    if (!scalar) {
+        uint32_t palette;
+        memcpy(&palette, shades, sizeof(palette));
+        __m128i row = _mm_loadl_epi64((const __m128i *)pixels);
+        _mm_storel_epi64((__m128i *)out, _mm_shuffle_epi8(_mm_cvtsi32_si128(palette), row));
+        return;
+    }
+#else
+    (void)scalar;
+#endif
+    for (int x = 0; x < 8; x++) {
+        out[x] = shades[pixels[x]];
+    }
+}
+
+/* Draw `count` pixels of a tile map line, from `x` pixels into its 256
+   Whole tile rows are shaded 8 pixels at a time into a line aligned on
+   tiles, and the fine scroll (x % 8) is only applied copying it out.
+*/
+static void render_span(struct GPU *gpu, uint8_t *out, int count, uint16_t tile_map,
+                        uint8_t x, uint8_t y, bool use_signed_tiles, const uint8_t shades[4]) {
+    uint8_t line[SCREEN_WIDTH + 16];
+    const uint8_t *map_row = gpu->bus->vram + (tile_map - VRAM_BEGIN) + (y / 8) * 32;
+    int fine = x % 8;
+    int tiles = (fine + count + 7) / 8;
+    for (int i = 0; i < tiles; i++) {
+        uint8_t tile_index = map_row[(x / 8 + i) % 32];
+        const Tile *tile = &gpu->tiles[use_signed_tiles ? 256 + (int8_t)tile_index : tile_index];
+        shade_row(line + i * 8, tile->pixels[y % 8], shades, gpu->scalar_shading);
+    }
+    memcpy(out, line + fine, count);
+}
+
 /*
  * LCDC (0xFF40) - LCD Control Register
  * Bit 7 - LCD Display Enable (0=Off, 1=On)
@@ -52,79 +128,65 @@ void render_scanline(struct GPU *gpu, int line) {
 void render_tile(struct GPU *gpu) {
     uint8_t lcdc = LCDC(gpu);
     const uint8_t ly = LY(gpu);
-    uint16_t tile_data;
-    bool window_enabled = (lcdc & 0x20) != 0;
+    uint8_t *out = gpu->framebuffer + ly * SCREEN_WIDTH;
+    bool use_signed_tiles = (lcdc & 0x10) == 0; // tiles 256-383 and 128-255 at 8800
+    uint8_t shades[4];
+    for (int color_index = 0; color_index < 4; color_index++) {
+        shades[color_index] = (BGP(gpu) >> (color_index * 2)) & 0x03;
+    }
 
-    uint8_t scx = SCX(gpu);
-    uint8_t scy = SCY(gpu);
+    // the window covers the line from WX-7 on, the background the pixels left of it
     int8_t wx = WX(gpu) - 7;
-    uint8_t wy = WY(gpu);
-
-    uint16_t memory_region = (lcdc & 0x10) ? 0x8000 : 0x8800;
-    bool use_signed_tiles = (lcdc & 0x10) == 0;
-    bool window_rendered_this_line = false;
-
-    
-    for (int pixel = 0; pixel < SCREEN_WIDTH; pixel++) {
-        bool using_window = window_enabled && (ly >= wy) && (wx <= pixel);
-        if (using_window) window_rendered_this_line = true;
-
-        tile_data = using_window
-            ? ((lcdc & 0x40) ? 0x9C00 : 0x9800) // Window Tile Map
-            : ((lcdc & 0x08) ? 0x9C00 : 0x9800); // BG Tile Map
-
-        uint16_t tile_addr;
-        uint8_t x_pos = using_window ? (pixel - wx) : (pixel + scx);
-        uint8_t y_pos = using_window ? gpu->window_line : (ly + scy);
-
-
-        uint8_t tile_index = read_vram(gpu, tile_data + (y_pos / 8) * 32 + (x_pos / 8));
-        tile_addr = memory_region + (use_signed_tiles ? (int8_t)tile_index + 128 : tile_index)*16;
-
-        // pixel# = 1 2 3 4 5 6 7 8
-        // data 2 = 1 0 1 0 1 1 1 0
-        // data 1 = 0 0 1 1 0 1 0 1
-
-        // Pixel 1 colour id: 10
-        // Pixel 2 colour id: 00
-        // Pixel 3 colour id: 11
-        // Pixel 4 colour id: 01
-        // Pixel 5 colour id: 10
-        // Pixel 6 colour id: 11
-        // Pixel 7 colour id: 10
-        // Pixel 8 colour id: 01
-
-        uint8_t line_in_tile = y_pos % 8;
-        uint8_t data1 = read_vram(gpu, tile_addr + line_in_tile * 2);     // Low bit plane
-        uint8_t data2 = read_vram(gpu, tile_addr + line_in_tile * 2 + 1); // High bit plane
-        uint8_t bit_index = 7 - (x_pos % 8);
-        uint8_t color_index = ((data2 >> bit_index) & 1) << 1 |
-                            ((data1 >> bit_index) & 1);
-        uint8_t mapped_color = (BGP(gpu) >> (color_index * 2)) & 0x03; // Map color index to BGP
-
-        gpu->framebuffer[ly * SCREEN_WIDTH + pixel] = mapped_color;
-
+    int split = SCREEN_WIDTH;
+    if (gpu_window_on_line(lcdc, ly, WY(gpu))) {
+        split = wx < 0 ? 0 : wx;
     }
-    if (window_rendered_this_line) {
+    if (split > 0) {
+        render_span(gpu, out, split, (lcdc & 0x08) ? 0x9C00 : 0x9800,
+                    SCX(gpu), ly + SCY(gpu), use_signed_tiles, shades);
+    }
+    if (split < SCREEN_WIDTH) {
+        render_span(gpu, out + split, SCREEN_WIDTH - split, (lcdc & 0x40) ? 0x9C00 : 0x9800,
+                    split - wx, gpu->window_line, use_signed_tiles, shades);
         gpu->window_line++;
     }
 }
 
-typedef struct {
-    uint8_t index;
-    uint8_t x;
-    uint8_t y;
-    uint8_t tile_index;
-    uint8_t flags;
-} SpriteInfo;
-
-int sprite_cmp(const void *a, const void *b) {
-    const SpriteInfo *s1 = (const SpriteInfo *)a;
-    const SpriteInfo *s2 = (const SpriteInfo *)b;
-    // Game Boy sprite priority: lower index = higher priority
-    // If X positions are the same, use index for priority
-    if (s1->x != s2->x) return s2->x - s1->x;
-    return s2->index - s1->index;
+// Drawn before `b`: further right, or at the same X later in OAM
+static bool sprite_drawn_before(const struct oam_entry *a, int a_index, const struct oam_entry *b, int b_index) {
+    return a->x != b->x ? a->x > b->x : a_index > b_index;
+}
+
+void index_sprites(struct GPU *gpu, uint8_t height) {
+    gpu->bus->oam_dirty = false;
+    gpu->sprite_height = height;
+    memset(gpu->line_sprite_count, 0, sizeof(gpu->line_sprite_count));
+    for (int sprite = 0; sprite < 40; sprite++) {
+        const uint8_t *oam = gpu->bus->oam + sprite * 4;
+        struct oam_entry *entry = &gpu->oam_entries[sprite];
+        *entry = (struct oam_entry){
+            .y = oam[0] - 16,
+            .x = oam[1] - 8,
+            .tile_index = oam[2],
+            .flags = oam[3],
+        };
+        // lines y to y + height - 1, sprites partly above the screen wrap to 240-255 and aren't shown
+        for (int line = entry->y; line < entry->y + height && line < SCREEN_HEIGHT; line++) {
+            uint8_t count = gpu->line_sprite_count[line];
+            if (count == SPRITES_PER_LINE) {
+                continue; // the first 10 in OAM order only
+            }
+            // insert in drawing order
+            uint8_t *list = gpu->line_sprites[line];
+            int i = count;
+            while (i > 0 && sprite_drawn_before(entry, sprite, &gpu->oam_entries[list[i - 1]], list[i - 1])) {
+                list[i] = list[i - 1];
+                i--;
+            }
+            list[i] = sprite;
+            gpu->line_sprite_count[line] = count + 1;
+        }
+    }
 }
 
 /*
@@ -155,67 +217,39 @@ void render_sprites(struct GPU *gpu) {
     uint8_t lcdc = LCDC(gpu);
     bool use8x16_sprites = (lcdc & 0x04) != 0; // check if 1x1 or 1x2 sprites are used
     uint8_t ly = LY(gpu);
-    size_t drawn = 0;
-    SpriteInfo to_draw[10];
-
-    for (size_t sprite_index = 0; sprite_index < 40 && drawn < 10; sprite_index++) {
-        uint8_t index = sprite_index * 4;
-        uint8_t y_pos = gpu->vram[0xFE00 + index] - 16; // Y coordinate (subtract 16 for top margin)
-        uint8_t x_pos = gpu->vram[0xFE00 + index + 1] - 8; // X coordinate (subtract 8 for left margin)
-        uint8_t y_size = use8x16_sprites ? 16 : 8; // Sprite height
-        // check if sprite is on the current line
-        if (ly >= y_pos && ly < y_pos + y_size) {
-            to_draw[drawn++] = (SpriteInfo){
-                                    .index = sprite_index,
-                                    .x = x_pos,
-                                    .y = y_pos,
-                                    .tile_index = gpu->vram[0xFE00 + index + 2],
-                                    .flags = gpu->vram[0xFE00 + index + 3]
-                                }; // Store sprite index and X position
-
-        }
+    uint8_t y_size = use8x16_sprites ? 16 : 8; // Sprite height
+    if (gpu->bus->oam_dirty || gpu->sprite_height != y_size) {
+        index_sprites(gpu, y_size);
     }
 
-    // sort sprites by X position and then by index for priority
-    qsort(to_draw, drawn, sizeof(SpriteInfo), sprite_cmp);
-    for (size_t i = 0; i < drawn; i++) {
-        uint8_t obp = (to_draw[i].flags & 0x10) ? OBP1(gpu) : OBP0(gpu); // Object Palette
+    for (size_t i = 0; i < gpu->line_sprite_count[ly]; i++) {
+        struct oam_entry sprite = gpu->oam_entries[gpu->line_sprites[ly][i]];
+        uint8_t obp = (sprite.flags & 0x10) ? OBP1(gpu) : OBP0(gpu); // Object Palette
 
-        bool y_flip = (to_draw[i].flags & 0x40) != 0; // Y flip
-        bool x_flip = (to_draw[i].flags & 0x20) != 0; // X flip
-        bool priority = (to_draw[i].flags & 0x80) != 0; // Priority
+        bool y_flip = (sprite.flags & 0x40) != 0; // Y flip
+        bool x_flip = (sprite.flags & 0x20) != 0; // X flip
+        bool priority = (sprite.flags & 0x80) != 0; // Priority
 
-        uint8_t y_size = use8x16_sprites ? 16 : 8; // Sprite height
-        uint8_t line_in_sprite = ly - to_draw[i].y; // Line in sprite (0-15 for 8x16, 0-7 for 8x8)
+        uint8_t line_in_sprite = ly - sprite.y; // Line in sprite (0-15 for 8x16, 0-7 for 8x8)
         if (y_flip) line_in_sprite = y_size - 1 - line_in_sprite; // Flip Y coordinate
 
         // For 8x16 sprites, pick tile_index or tile_index+1 depending on line_in_sprite
         if (use8x16_sprites) {
             if (line_in_sprite < 8) {
                 // top tile
-                to_draw[i].tile_index &= 0xFE;
+                sprite.tile_index &= 0xFE;
             } else {
                 // bottom tile
-                to_draw[i].tile_index = (to_draw[i].tile_index & 0xFE) + 1;
+                sprite.tile_index = (sprite.tile_index & 0xFE) + 1;
                 line_in_sprite -= 8;
             }
         }
 
-        line_in_sprite *= 2; // Each line has 2 bytes (8 pixels each)
-
-        uint16_t tile_addr = 0x8000 + (to_draw[i].tile_index * 16) + line_in_sprite;
-        uint8_t data1 = read_vram(gpu, tile_addr);     // Low bit plane
-        uint8_t data2 = read_vram(gpu, tile_addr + 1); // High bit plane
+        const Tile *tile = &gpu->tiles[sprite.tile_index];
+        const uint8_t *row = x_flip ? tile->flipped[line_in_sprite] : tile->pixels[line_in_sprite];
         for (int pixel = 0; pixel < 8; pixel++) {
-            uint8_t color_index;
-            if (x_flip) {
-                color_index = ((data2 >> pixel) & 1) << 1 |
-                                ((data1 >> pixel) & 1);
-            } else {
-                color_index = ((data2 >> (7 - pixel)) & 1) << 1 |
-                                    ((data1 >> (7 - pixel)) & 1);
-            }
-            int pixel_x = to_draw[i].x + pixel;
+            uint8_t color_index = row[pixel];
+            int pixel_x = sprite.x + pixel;
             if (pixel_x < 0 || pixel_x >= SCREEN_WIDTH) continue;
 
             uint8_t bg_pixel = gpu->framebuffer[ly * SCREEN_WIDTH + pixel_x]; // check if pixel is already drawn
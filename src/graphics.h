@@ -4,6 +4,8 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include "cpu.h"
+#include "worker.h"
 
 #define WHITE 0b11
 #define DARK_GRAY 0b10
@@ -21,6 +23,8 @@
 #define SCREEN_WIDTH 160
 #define SCREEN_HEIGHT 144
 
+#define CYCLES_PER_FRAME (456 * 154) // 144 visible lines and 10 of VBlank, 456 cycles each
+
 #define COLOUR_FROM_PALETTE(palette, color) \
     ((palette) == WHITE ? 0xFFFFFF : \
      (palette) == DARK_GRAY ? 0xAAAAAA : \
@@ -41,38 +45,84 @@
 #define OAM_FLAGS_X_FLIP(flags)          (((flags) >> 5) & 0x1)
 #define OAM_FLAGS_PALETTE(flags)         (((flags) >> 4) & 0x1)
 
-#define SCY(gpu) (gpu->vram[0xFF42]) // Scroll Y (0xFF42)
-#define SCX(gpu) (gpu->vram[0xFF43]) // Scroll X (0xFF43)
-#define LY(gpu) (gpu->vram[0xFF44]) // Current Line (0xFF44)
-#define LYC(gpu) (gpu->vram[0xFF45]) // LY Compare (0xFF45)
-#define BGP(gpu) (gpu->vram[0xFF47]) // BG Palette (0xFF47)
-#define OBP0(gpu) (gpu->vram[0xFF48]) // Object Palette 0 (0xFF48)
-#define OBP1(gpu) (gpu->vram[0xFF49]) // Object Palette 1 (0xFF49)
-#define WY(gpu) (gpu->vram[0xFF4A]) // Window Y (0xFF4A)
-#define WX(gpu) (gpu->vram[0xFF4B]) // Window X (0xFF4B)
-#define STAT(gpu) (gpu->vram[0xFF41]) // LCD Status (0xFF41)
-#define LCDC(gpu) (gpu->vram[0xFF40]) // LCD Control (0xFF40)
-#define LCDC_MODE(gpu) ((gpu)->vram[0xFF41] & 0x03) // LCDC Mode bits (0xFF41)
+#define SCY(gpu) (gpu->bus->io.scy) // Scroll Y (0xFF42)
+#define SCX(gpu) (gpu->bus->io.scx) // Scroll X (0xFF43)
+#define LY(gpu) (gpu->bus->io.ly) // Current Line (0xFF44)
+#define LYC(gpu) (gpu->bus->io.lyc) // LY Compare (0xFF45)
+#define BGP(gpu) (gpu->bus->io.bgp) // BG Palette (0xFF47)
+#define OBP0(gpu) (gpu->bus->io.obp0) // Object Palette 0 (0xFF48)
+#define OBP1(gpu) (gpu->bus->io.obp1) // Object Palette 1 (0xFF49)
+#define WY(gpu) (gpu->bus->io.wy) // Window Y (0xFF4A)
+#define WX(gpu) (gpu->bus->io.wx) // Window X (0xFF4B)
+#define STAT(gpu) (gpu->bus->io.stat) // LCD Status (0xFF41)
+#define LCDC(gpu) (gpu->bus->io.lcdc) // LCD Control (0xFF40)
+#define LCDC_MODE(gpu) ((gpu)->bus->io.stat & 0x03) // LCDC Mode bits (0xFF41)
 
 #define REQUEST_INTERRUPT(gpu, flag) \
-    (gpu->vram[0xFF0F] |= (flag))
-
+    (gpu->bus->io.iflag |= (flag))
+
+/* Decoded tiles
+   VRAM keeps each 8x8 tile as two bitplanes per row. The GPU keeps the 384
+   tiles of 8000-97FF decoded as well, one colour index (0-3) per byte, and
+   a mirrored copy for sprites with X flip. A write to tile data marks its
+   tile in bus.tile_dirty (vram_written(), cpu.h); render_scanline() decodes
+   the marked tiles again before drawing, so the renderer reads rows of
+   ready colour indices.
+*/
 typedef struct {
-    uint8_t data[16];  // each row = 2 bytes (8 pixels × 2 bits)
+    uint8_t pixels[8][8];  // colour index of each pixel, row by row
+    uint8_t flipped[8][8]; // the same rows mirrored, for X-flipped sprites
 } Tile;
 
+/* Sprite index
+   The GPU decodes OAM into oam_entries and lists, for each visible line,
+   the sprites on it: the first 10 in OAM order, sorted into the order they
+   are drawn in (right to left, higher OAM index first at the same X, so
+   the sprite with priority ends up on top). Writes to OAM and OAM DMA set
+   bus.oam_dirty, and render_sprites() builds the index again when that is
+   set or LCDC switched sprite size; a line is then drawn from its list
+   without scanning OAM or sorting.
+*/
+#define SPRITES_PER_LINE 10
+
 struct oam_entry {
-    uint8_t y;        // Y coordinate (0-255)
-    uint8_t x;        // X coordinate (0-255)
+    uint8_t y;        // top line on screen, OAM Y - 16 (0-255)
+    uint8_t x;        // left pixel on screen, OAM X - 8 (0-255)
     uint8_t tile_index; // Tile index (0-255)
     uint8_t flags;    // Flags (palette, priority, y-flip, x-flip)
 };
 
+/* Render policy
+   Which frames render_scanline() draws. The PPU steps exactly the same
+   either way (LY, STAT, LYC, the VBlank and STAT interrupts, should_render
+   at VBlank); a skipped frame only leaves the framebuffer as it was.
+   Headless, fast-forward and training runs that look at few frames skip
+   the renderer for the rest.
+
+   - RENDER_ALWAYS, the default, draws every frame.
+   - RENDER_EVERY_NTH draws one frame in `render_interval`.
+   - RENDER_ON_DEMAND draws only frames asked for with gpu_request_frame().
+
+   The choice for a frame is made as LY wraps to 0, so a request made
+   during a frame is for the next one. skip_frame says whether the frame
+   in progress (or, at should_render, the one just finished) is skipped.
+   While the LCD is off nothing is drawn; the lines of a frame it cut short
+   are there only if that frame wasn't skipped.
+*/
+enum render_policy {
+    RENDER_ALWAYS,
+    RENDER_EVERY_NTH,
+    RENDER_ON_DEMAND,
+};
+
 struct GPU {
-    uint8_t *vram; // Pointer to VRAM (0x8000 - 0x9FFF)
-    Tile tiles[384]; // 384 tiles, each 16 bytes (8x8 pixels)
+    struct MemoryBus *bus; // VRAM, OAM and LCD registers of the CPU it draws for
+    Tile tiles[384]; // 8000-97FF decoded, 8000 is tile 0 and 8800 tile 128
     uint8_t framebuffer[SCREEN_WIDTH * SCREEN_HEIGHT]; // Framebuffer for rendering
-    struct oam_entry oam_entries[40]; // Object Attribute Memory (OAM)
+    struct oam_entry oam_entries[40]; // OAM decoded, see index_sprites()
+    uint8_t line_sprites[SCREEN_HEIGHT][SPRITES_PER_LINE]; // sprites of each line in drawing order
+    uint8_t line_sprite_count[SCREEN_HEIGHT];
+    uint8_t sprite_height; // 8 or 16, the sprite size the index is for, 0 before the first
 
     uint8_t mode; // Current mode (0, 1, 2, or 3)
     uint32_t mode_clock; // Mode clock for timing (up to 456 cycles)
@@ -85,8 +135,63 @@ struct GPU {
     int16_t delay_cycles; // Delay cycles for rendering
     bool stopped; // Flag to indicate if GPU is stopped
 
+    enum render_policy render_policy; // which frames are drawn
+    uint32_t render_interval; // RENDER_EVERY_NTH draws one frame in this many
+    uint32_t frame_count; // frames started under the policy
+    bool render_requested; // draw the next frame whatever the policy
+    bool skip_frame; // the frame in progress isn't drawn
+    struct render_worker *worker; // draws the frames instead, see worker.h
+    bool scalar_shading; // shade tile rows without SSSE3 where it is built in, to compare (checks/gbemu --render)
 };
 
+/* Choose which frames are drawn, from the next one on
+   @param gpu Pointer to the GPU structure.
+   @param policy RENDER_ALWAYS, RENDER_EVERY_NTH or RENDER_ON_DEMAND.
+   @param interval One frame in this many is drawn under RENDER_EVERY_NTH.
+   @return void
+*/
+void gpu_set_render_policy(struct GPU *gpu, enum render_policy policy, uint32_t interval);
+
+/* Draw the next frame whatever the policy
+   @param gpu Pointer to the GPU structure.
+   @return void
+*/
+void gpu_request_frame(struct GPU *gpu);
+
+// Decide whether the frame starting now is drawn
+static inline void gpu_begin_frame(struct GPU *gpu) {
+    bool draw = true;
+    if (gpu->render_policy == RENDER_EVERY_NTH) {
+        draw = ++gpu->frame_count >= gpu->render_interval;
+    } else if (gpu->render_policy == RENDER_ON_DEMAND) {
+        draw = false;
+    }
+    if (draw || gpu->render_requested) {
+        gpu->frame_count = 0;
+        gpu->render_requested = false;
+        draw = true;
+    }
+    gpu->skip_frame = !draw;
+}
+
+/* Whether render_tile() draws the window on a line, moving window_line on
+   The worker (worker.h) keeps the count with the same rule as it records
+   lines.
+   @param lcdc LCDC as the line is drawn.
+   @param ly The line.
+   @param wy WY as the line is drawn.
+   @return true if the window covers part of the line
+*/
+static inline bool gpu_window_on_line(uint8_t lcdc, uint8_t ly, uint8_t wy) {
+    return (lcdc & 0x21) == 0x21 && ly >= wy; // WX-7 is under 160 whatever WX is, see render_tile()
+}
+
+/* Decode the tiles written since the last call into gpu->tiles
+   @param gpu Pointer to the GPU structure.
+   @return void
+*/
+void decode_tiles(struct GPU *gpu);
+
 /* Render a scanline */
 void render_scanline(struct GPU *gpu, int line);
 
@@ -97,6 +202,9 @@ static inline void step_gpu(struct GPU *gpu, int cycles) {
         if (gpu->off_count >= 456*154) {
             gpu->off_count -= 456*154;
             gpu->should_render = true; // Force render if LCD is off
+            if (gpu->worker) {
+                worker_end_frame(gpu);
+            }
         }
         gpu->mode = 3;
         gpu->mode_clock = 0;
@@ -137,7 +245,11 @@ static inline void step_gpu(struct GPU *gpu, int cycles) {
                 }
 
                 // Render scanline at the END of pixel transfer
-                render_scanline(gpu, LY(gpu));
+                if (!gpu->skip_frame && gpu->worker) {
+                    worker_record_line(gpu); // drawn on the worker thread
+                } else if (!gpu->skip_frame) {
+                    render_scanline(gpu, LY(gpu));
+                }
             }
             break;
 
@@ -167,6 +279,9 @@ static inline void step_gpu(struct GPU *gpu, int cycles) {
                         REQUEST_INTERRUPT(gpu, 0x02); // STAT interrupt
                     }
                     gpu->should_render = true;
+                    if (gpu->worker) {
+                        worker_end_frame(gpu);
+                    }
                 } else {
                     // Back to OAM Search
                     gpu->mode = 2;
@@ -196,6 +311,7 @@ static inline void step_gpu(struct GPU *gpu, int cycles) {
                     LY(gpu) = 0;
                     gpu->mode = 2; // Back to OAM Search
                     gpu->window_line = 0; // Reset window line
+                    gpu_begin_frame(gpu);
                     // Trigger OAM STAT interrupt if enabled
                     if (STAT(gpu) & 0x20) {
                         REQUEST_INTERRUPT(gpu, 0x02); // Request LCD STAT interrupt
@@ -207,6 +323,38 @@ static inline void step_gpu(struct GPU *gpu, int cycles) {
             break;
     }
 }
+/* Cycles until step_gpu() next changes the mode, LY, STAT or IF
+   Stepping fewer cycles than this, in any number of calls, only moves the
+   GPU's counters along. Used to fast-forward idle loops.
+   @param gpu Pointer to the GPU structure.
+   @return cycles until the next mode change, 1 if it is due next step
+*/
+static inline uint32_t gpu_cycles_to_event(struct GPU *gpu) {
+    static const uint16_t mode_cycles[4] = { 204, 456, 80, 172 }; // HBlank, VBlank line, OAM, transfer
+    if (!(LCDC(gpu) & 0x80)) {
+        return 456*154 - gpu->off_count; // the forced render
+    }
+    if (gpu->delay_cycles > 0) {
+        return gpu->delay_cycles; // left over cycles are dropped when the delay ends
+    }
+    uint32_t length = mode_cycles[gpu->mode & 0x03];
+    return gpu->mode_clock < length ? length - gpu->mode_clock : 1;
+}
+/* Step the GPU by fewer cycles than gpu_cycles_to_event()
+   Does what step_gpu() would, as long as step_gpu() has run since LCDC was
+   last written.
+   @param gpu Pointer to the GPU structure.
+   @param cycles Cycles to step by.
+*/
+static inline void gpu_advance(struct GPU *gpu, uint32_t cycles) {
+    if (!(LCDC(gpu) & 0x80)) {
+        gpu->off_count += cycles;
+    } else if (gpu->delay_cycles > 0) {
+        gpu->delay_cycles -= cycles;
+    } else {
+        gpu->mode_clock += cycles;
+    }
+}
 /* helper to read from VRAM */
 uint8_t read_vram(struct GPU *gpu, uint16_t addr);
 /* helper to write to VRAM */
@@ -215,6 +363,13 @@ void write_vram(struct GPU *gpu, uint16_t addr, uint8_t value);
 /* Render A background/window line */
 void render_tile(struct GPU *gpu);
 
+/* Decode OAM and list the sprites of every line
+   @param gpu Pointer to the GPU structure.
+   @param height Sprite height, 8 or 16.
+   @return void
+*/
+void index_sprites(struct GPU *gpu, uint8_t height);
+
 /* Render Sprites on a scanline */
 void render_sprites(struct GPU *gpu);
 
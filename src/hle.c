@@ -0,0 +1,213 @@
+#include "hle.h"
+#include "cpu.h"
+#include "graphics.h"
+#include <string.h>
+
+#ifdef HLE
+
+#define HLE_MAX_BYTES 16 // longest signature
+
+struct hle_signature {
+    uint8_t kind;   // enum hle_kind
+    uint8_t length; // bytes matched from the entry point on
+    uint8_t bytes[HLE_MAX_BYTES];
+};
+
+static const struct hle_signature hle_signatures[] = {
+    { HLE_MEMCPY, 9, { 0x2A, 0x12, 0x13, 0x0B, 0x78, 0xB1, 0x20, 0xF8, 0xC9 } },
+    { HLE_MEMSET, 9, { 0x57, 0x7A, 0x22, 0x0B, 0x78, 0xB1, 0x20, 0xF9, 0xC9 } },
+    // LD D,0 / LD L,D / LD B,8 / ADD HL,HL / JR NC,+1 / ADD HL,DE / DEC B / JR NZ / RET
+    { HLE_MUL8, 13, { 0x16, 0x00, 0x6A, 0x06, 0x08, 0x29, 0x30, 0x01, 0x19, 0x05, 0x20, 0xF9, 0xC9 } },
+};
+
+// Cycles of one iteration of a loop, the last one's JR NZ taking 4 fewer
+#define HLE_MEMCPY_CYCLES (8 + 8 + 8 + 8 + 4 + 4 + 12)
+#define HLE_MEMSET_CYCLES (4 + 8 + 8 + 4 + 4 + 12)
+#define HLE_RET_CYCLES 16
+
+static void hle_add(struct hle_table *hle, const uint8_t *host, uint16_t addr, uint8_t kind) {
+    if (hle->count == HLE_MAX_ROUTINES) {
+        return;
+    }
+    hle->routine[hle->count++] = (struct hle_routine){ .host = host, .addr = addr, .kind = kind };
+    hle->pages[addr >> 8] |= 1 << ((addr >> 5) & 7);
+}
+
+int hle_scan(struct CPU *cpu) {
+    struct hle_table *hle = &cpu->hle;
+    memset(hle, 0, sizeof(*hle));
+    for (int bank = 0; bank < cpu->bus.num_rom_banks; bank++) {
+        const uint8_t *data = bank ? cpu->bus.rom_banks + (size_t)(bank - 1) * 0x4000 : cpu->bus.rom0;
+        uint16_t base = bank ? 0x4000 : 0x0000;
+        for (int offset = 0; offset < 0x4000; offset++) {
+            for (size_t i = 0; i < sizeof(hle_signatures) / sizeof(hle_signatures[0]); i++) {
+                const struct hle_signature *sig = &hle_signatures[i];
+                if (data[offset] == sig->bytes[0] && offset + sig->length <= 0x4000 &&
+                    memcmp(data + offset, sig->bytes, sig->length) == 0) {
+                    hle_add(hle, data + offset, base + offset, sig->kind);
+                }
+            }
+        }
+    }
+    return hle->count;
+}
+
+// The routine whose entry point PC is at, as the page table maps it now
+static const struct hle_routine *hle_find(struct CPU *cpu, uint16_t pc) {
+    const uint8_t *page = cpu->map.read[pc >> 8];
+    if (!page || pc >= 0x8000) {
+        return NULL; // the boot ROM over page 0 is mapped, but to other memory
+    }
+    const struct hle_table *hle = &cpu->hle;
+    for (int i = 0; i < hle->count; i++) {
+        if (hle->routine[i].addr == pc && hle->routine[i].host == page + (pc & 0xFF)) {
+            return &hle->routine[i];
+        }
+    }
+    return NULL;
+}
+
+/* `count` bytes from `addr` on lie in ROM, VRAM or WRAM (only VRAM and
+   WRAM if `write`), where reading and writing has nothing to do with the
+   time until the next event
+*/
+static bool hle_plain(uint16_t addr, uint32_t count, bool write) {
+    uint32_t hi = addr + count - 1;
+    if (addr >= 0xC000) {
+        return hi < 0xE000;
+    }
+    return hi < 0xA000 && (!write || addr >= 0x8000);
+}
+
+// Iterations of a loop to run in `limit` cycles: all `left` of them if the RET fits as well, else all but the last
+static uint32_t hle_iterations(uint32_t left, uint32_t cycles, uint64_t limit, bool *whole) {
+    *whole = (uint64_t)left * cycles - 4 + HLE_RET_CYCLES <= limit;
+    if (*whole) {
+        return left;
+    }
+    uint64_t fit = limit / cycles;
+    return fit < left - 1 ? (uint32_t)fit : left - 1;
+}
+
+static uint32_t hle_ret(struct CPU *cpu, bool *returned) {
+    cpu->pc = READ_WORD(cpu, cpu->sp);
+    cpu->sp += 2;
+    *returned = true;
+    return HLE_RET_CYCLES;
+}
+
+/* Run the routine from PC, its entry point or loop head, for up to `limit` cycles
+   @param returned Set if it ran to the end, RET included; PC is at the
+                   loop head otherwise.
+   @return cycles run, 0 if nothing could be
+*/
+static uint32_t hle_run(struct CPU *cpu, const struct hle_routine *routine, uint64_t limit, bool *returned) {
+    bool whole;
+    switch (routine->kind) {
+        case HLE_MEMCPY: {
+            uint32_t left = cpu->regs.bc ? cpu->regs.bc : 0x10000;
+            uint32_t count = hle_iterations(left, HLE_MEMCPY_CYCLES, limit, &whole);
+            if (!count || !hle_plain(cpu->regs.hl, count, false) || !hle_plain(cpu->regs.de, count, true)) {
+                return 0;
+            }
+            for (uint32_t i = 0; i < count; i++) {
+                WRITE_BYTE(cpu, cpu->regs.de++, READ_BYTE(cpu, cpu->regs.hl++));
+            }
+            cpu->regs.bc -= count;
+            cpu->regs.a = cpu->regs.b | cpu->regs.c;
+            FLAGS_OR(cpu, cpu->regs.a);
+            uint32_t cycles = count * HLE_MEMCPY_CYCLES;
+            return whole ? cycles - 4 + hle_ret(cpu, returned) : cycles;
+        }
+        case HLE_MEMSET: {
+            uint32_t entry = cpu->pc == routine->addr ? 4 : 0; // LD D,A, then the loop from the next byte
+            uint32_t left = cpu->regs.bc ? cpu->regs.bc : 0x10000;
+            uint32_t count = limit < entry ? 0 : hle_iterations(left, HLE_MEMSET_CYCLES, limit - entry, &whole);
+            if (!count || !hle_plain(cpu->regs.hl, count, true)) {
+                return 0;
+            }
+            if (entry) {
+                cpu->regs.d = cpu->regs.a;
+                cpu->pc++;
+            }
+            for (uint32_t i = 0; i < count; i++) {
+                WRITE_BYTE(cpu, cpu->regs.hl++, cpu->regs.d);
+            }
+            cpu->regs.bc -= count;
+            cpu->regs.a = cpu->regs.b | cpu->regs.c;
+            FLAGS_OR(cpu, cpu->regs.a);
+            uint32_t cycles = entry + count * HLE_MEMSET_CYCLES;
+            return whole ? cycles - 4 + hle_ret(cpu, returned) : cycles;
+        }
+        case HLE_MUL8: {
+            // the steps of the ROM code, counted up without dispatching them
+            uint32_t cycles = 8 + 4 + 8;
+            uint32_t hl = cpu->regs.h << 8;
+            bool carry = false;
+            for (int bit = 8; bit > 0; bit--) {
+                hl <<= 1;
+                carry = hl > 0xFFFF;
+                hl &= 0xFFFF;
+                cycles += 8;
+                if (carry) {
+                    hl += cpu->regs.e;
+                    carry = hl > 0xFFFF;
+                    hl &= 0xFFFF;
+                    cycles += 8 + 8;
+                } else {
+                    cycles += 12;
+                }
+                cycles += 4 + (bit > 1 ? 12 : 8);
+            }
+            if (cpu->pc != routine->addr || cycles + HLE_RET_CYCLES > limit) {
+                return 0;
+            }
+            cpu->regs.d = 0;
+            cpu->regs.hl = hl;
+            cpu->regs.b = 0;
+            // DEC B down to 0, with the carry of the last ADD
+            FLAGS_SET(cpu, FLAG_ZERO | FLAG_SUBTRACTION | (carry ? FLAG_CARRY : 0));
+            return cycles + hle_ret(cpu, returned);
+        }
+        default:
+            return 0;
+    }
+}
+
+// Nothing can interrupt the routine before the next event
+static inline bool hle_quiet(struct CPU *cpu) {
+    return !cpu->ime_pending && !(cpu->ime && (cpu->bus.io.iflag & cpu->bus.ie & 0x1F));
+}
+
+void hle_visit(struct CPU *cpu, uint64_t end) {
+    const struct hle_routine *routine = hle_find(cpu, cpu->pc);
+    if (!routine) {
+        return;
+    }
+    struct scheduler *sched = &cpu->sched;
+    bool ran = false;
+    bool returned = false;
+    // the same checks as cpu_run_cycles() makes between instructions, with
+    // the events run where they would be
+    for (;;) {
+        if (sched->now >= sched->next) {
+            sched_run_due(cpu);
+        }
+        if (sched->now >= end || sched->gpu->should_render || !hle_quiet(cpu)) {
+            break;
+        }
+        uint64_t stop = sched->next < end ? sched->next : end;
+        uint32_t cycles = hle_run(cpu, routine, stop - sched->now, &returned);
+        if (!cycles) {
+            break;
+        }
+        sched->now += cycles;
+        ran = true;
+        if (returned) {
+            break;
+        }
+    }
+    cpu->hle.runs += ran;
+}
+
+#endif
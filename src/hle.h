@@ -0,0 +1,82 @@
+#ifndef _HLE_H
+#define _HLE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Library routine high-level emulation
+   Many ROMs carry the same small runtime routines for copying, clearing and
+   multiplying and call them over and over. load_rom() runs hle_scan(),
+   which looks for the routines of a signature table in every bank. A CALL
+   to one of them ends the interpreter's run of instructions, and
+   hle_skip() (cpu.h) then runs the routine natively, RET included, instead
+   of one instruction at a time. The JIT leaves CALLs to the interpreter, so
+   calls from translated code get there too.
+
+   - A native routine reads and writes through READ_BYTE/WRITE_BYTE in the
+     ROM code's order and takes the cycles it would, so memory, registers,
+     flags and the clock come out the same; checks/gbemu --hle compares
+     each against exec_inst().
+   - Nothing it touches may depend on the time: copies and fills only read
+     ROM, VRAM and WRAM and only write VRAM and WRAM, else the ROM code
+     runs. Loops run whole iterations up to each event, which is run at the
+     iteration boundary it is due at, as loop fusion does (fuse.h); an
+     interrupt, the end of the run or the frame leave the rest to the ROM
+     code. The multiply only runs whole, when it fits before the next event.
+   - hle_signatures (hle.c) matches a routine's exact bytes from its entry
+     point to its RET, and the routine is told apart by the host address of
+     its entry, so bank switches can't mix them up. Its entries are the
+     common hand-written forms of these loops, not taken from a particular
+     SDK. New routines add a signature and a case to hle_run(). Build with
+     -DNO_HLE to compare.
+*/
+#ifndef NO_HLE
+#define HLE
+#endif
+
+struct CPU;
+
+#ifdef HLE
+
+#define HLE_MAX_ROUTINES 64 // routines kept per ROM, the first ones found
+
+enum hle_kind {
+	HLE_MEMCPY, // LD A,(HL+) / LD (DE),A / INC DE / DEC BC / LD A,B / OR C / JR NZ / RET
+	HLE_MEMSET, // LD D,A / LD A,D / LD (HL+),A / DEC BC / LD A,B / OR C / JR NZ / RET
+	HLE_MUL8,   // HL = H * E by shift and add, B counting the 8 bits
+};
+
+struct hle_routine {
+	const uint8_t *host; // entry point in the ROM image
+	uint16_t addr;       // its guest address, 0x4000 on for banks other than 0
+	uint8_t kind;        // enum hle_kind
+};
+
+struct hle_table {
+	uint8_t pages[256]; // per 256-byte page of PC, a bit for each 32 bytes holding an entry point
+	uint16_t count;
+	uint32_t runs;      // calls run natively, whole or in part
+	struct hle_routine routine[HLE_MAX_ROUTINES];
+};
+
+/* Find the routines of the signature table in every bank of the ROM
+   load_rom() and unload_rom() run it; a ROM set up by hand can run it
+   once it is in place.
+   @param cpu Pointer to the CPU structure.
+   @return number of routines found
+*/
+int hle_scan(struct CPU *cpu);
+
+/* PC may be at the entry point of a routine
+   Runs the routine natively if it is, up to its RET or as far as it gets
+   before `end`, an interrupt or the frame, running the events on the way.
+   Moves the master clock along with it.
+   @param cpu Pointer to the CPU structure.
+   @param end Master clock time the run ends at.
+   @return void
+*/
+void hle_visit(struct CPU *cpu, uint64_t end);
+
+#endif
+
+#endif
@@ -0,0 +1,282 @@
+#include "idle.h"
+#include "cpu.h"
+#include "graphics.h"
+#include "timer.h"
+
+#ifdef IDLE_SKIP
+
+// What a loop body reads and how long an iteration takes
+struct idle_body {
+    uint8_t cycles; // 0 if the loop can't be skipped
+    bool reads_gpu, reads_if, reads_div, reads_tima;
+};
+
+// register pairs whose value at a point of the body is known
+struct idle_regs {
+    uint16_t bc, de, hl;
+    bool bc_known, de_known, hl_known;
+};
+
+// Note a read of `addr`, false if the value may change without an event
+static bool idle_read(struct idle_body *body, uint16_t addr) {
+    if (addr >= 0xA000 && addr < 0xC000) {
+        return false; // cartridge RAM, may be an RTC register
+    }
+    if ((addr >= 0x8000 && addr < 0xA000) || (addr >= 0xFE00 && addr < 0xFEA0) ||
+        addr == 0xFF41 || addr == 0xFF44) {
+        body->reads_gpu = true; // changes with the mode or line
+    } else if (addr == 0xFF0F) {
+        body->reads_if = true;
+    } else if (addr == 0xFF04) {
+        body->reads_div = true;
+    } else if (addr == 0xFF05) {
+        body->reads_tima = true;
+    }
+    return true;
+}
+
+// Forget the pair holding register r (B C D E H L, A) after a write to it
+static void idle_clobber(struct idle_regs *regs, int r) {
+    if (r == 0 || r == 1) {
+        regs->bc_known = false;
+    } else if (r == 2 || r == 3) {
+        regs->de_known = false;
+    } else if (r == 4 || r == 5) {
+        regs->hl_known = false;
+    }
+}
+
+// Read through (HL), false if HL isn't known here
+static bool idle_read_hl(struct idle_body *body, struct idle_regs *regs) {
+    return regs->hl_known && idle_read(body, regs->hl);
+}
+
+/* Decode the loop starting at PC
+   Walks the body up to a jump back to PC and adds up its cycles. Registers
+   start out with their current values; pairs loaded with a constant stay
+   known, any other write makes them unknown.
+   @return the body, cycles 0 if it writes memory, branches elsewhere, reads
+           through an unknown pair or doesn't loop back in time
+*/
+static struct idle_body idle_decode(struct CPU *cpu) {
+    struct idle_body body = { 0 };
+    struct idle_regs regs = {
+        .bc = cpu->regs.bc, .de = cpu->regs.de, .hl = cpu->regs.hl,
+        .bc_known = true, .de_known = true, .hl_known = true
+    };
+    uint16_t head = cpu->pc;
+    uint16_t pc = head;
+    uint32_t cycles = 0;
+
+    for (int i = 0; i < IDLE_MAX_INSTS && pc - head < IDLE_MAX_BYTES; i++) {
+        uint8_t op = READ_BYTE(cpu, pc);
+        uint8_t b1 = READ_BYTE(cpu, pc + 1);
+        uint16_t nn = b1 | READ_BYTE(cpu, pc + 2) << 8;
+        uint16_t next = pc + inst_length[op];
+        int r = (op >> 3) & 7;
+
+        if (op == 0x00) { // NOP
+            cycles += 4;
+        } else if (op >= 0x40 && op < 0x80 && op != 0x76 && (op & 0xF8) != 0x70) { // LD r,r'
+            if ((op & 7) == 6 && !idle_read_hl(&body, &regs)) {
+                return (struct idle_body){ 0 };
+            }
+            idle_clobber(&regs, r);
+            cycles += (op & 7) == 6 ? 8 : 4;
+        } else if ((op & 0xC7) == 0x06 && op != 0x36) { // LD r,n
+            if (r == 0) {
+                regs.bc = (regs.bc & 0x00FF) | b1 << 8;
+            } else if (r == 1) {
+                regs.bc = (regs.bc & 0xFF00) | b1;
+            } else if (r == 2) {
+                regs.de = (regs.de & 0x00FF) | b1 << 8;
+            } else if (r == 3) {
+                regs.de = (regs.de & 0xFF00) | b1;
+            } else if (r == 4) {
+                regs.hl = (regs.hl & 0x00FF) | b1 << 8;
+            } else if (r == 5) {
+                regs.hl = (regs.hl & 0xFF00) | b1;
+            }
+            cycles += 8;
+        } else if ((op & 0xCF) == 0x01) { // LD rr,nn
+            if (op == 0x01) {
+                regs.bc = nn;
+                regs.bc_known = true;
+            } else if (op == 0x11) {
+                regs.de = nn;
+                regs.de_known = true;
+            } else if (op == 0x21) {
+                regs.hl = nn;
+                regs.hl_known = true;
+            }
+            cycles += 12;
+        } else if ((op & 0xC6) == 0x04 && op != 0x34 && op != 0x35) { // INC r / DEC r
+            idle_clobber(&regs, r);
+            cycles += 4;
+        } else if ((op & 0xC7) == 0x03) { // INC rr / DEC rr
+            idle_clobber(&regs, (op >> 3) & 6);
+            cycles += 8;
+        } else if ((op & 0xCF) == 0x09) { // ADD HL,rr
+            regs.hl_known = false;
+            cycles += 8;
+        } else if (op == 0x07 || op == 0x0F || op == 0x17 || op == 0x1F ||
+                   op == 0x27 || op == 0x2F || op == 0x37 || op == 0x3F) {
+            cycles += 4; // rotates of A, DAA, CPL, SCF, CCF
+        } else if (op == 0x0A || op == 0x1A) { // LD A,(BC) / LD A,(DE)
+            bool known = op == 0x0A ? regs.bc_known : regs.de_known;
+            if (!known || !idle_read(&body, op == 0x0A ? regs.bc : regs.de)) {
+                return (struct idle_body){ 0 };
+            }
+            cycles += 8;
+        } else if (op == 0x2A || op == 0x3A) { // LD A,(HL+) / LD A,(HL-)
+            if (!idle_read_hl(&body, &regs)) {
+                return (struct idle_body){ 0 };
+            }
+            regs.hl_known = false;
+            cycles += 8;
+        } else if (op >= 0x80 && op < 0xC0) { // ALU A,r
+            if ((op & 7) == 6 && !idle_read_hl(&body, &regs)) {
+                return (struct idle_body){ 0 };
+            }
+            cycles += (op & 7) == 6 ? 8 : 4;
+        } else if ((op & 0xC7) == 0xC6) { // ALU A,n
+            cycles += 8;
+        } else if (op == 0xF0) { // LDH A,(n)
+            idle_read(&body, 0xFF00 + b1);
+            cycles += 12;
+        } else if (op == 0xF2) { // LD A,(C)
+            if (!regs.bc_known) {
+                return (struct idle_body){ 0 };
+            }
+            idle_read(&body, 0xFF00 + (regs.bc & 0xFF));
+            cycles += 8;
+        } else if (op == 0xFA) { // LD A,(nn)
+            if (!idle_read(&body, nn)) {
+                return (struct idle_body){ 0 };
+            }
+            cycles += 16;
+        } else if (op == 0xCB) {
+            if ((b1 & 7) == 6) {
+                if (b1 < 0x40 || b1 >= 0x80 || !idle_read_hl(&body, &regs)) {
+                    return (struct idle_body){ 0 }; // only BIT n,(HL) leaves memory alone
+                }
+                cycles += 12;
+            } else {
+                if (b1 < 0x40 || b1 >= 0x80) {
+                    idle_clobber(&regs, b1 & 7);
+                }
+                cycles += 8;
+            }
+        } else if (op == 0x18 || op == 0x20 || op == 0x28 || op == 0x30 || op == 0x38) { // JR
+            if ((uint16_t)(next + (int8_t)b1) != head) {
+                return (struct idle_body){ 0 };
+            }
+            body.cycles = cycles + 12;
+            return body;
+        } else if (op == 0xC3 || op == 0xC2 || op == 0xCA || op == 0xD2 || op == 0xDA) { // JP
+            if (nn != head) {
+                return (struct idle_body){ 0 };
+            }
+            body.cycles = cycles + 16;
+            return body;
+        } else {
+            return (struct idle_body){ 0 }; // writes, stack ops, other branches, HALT, DI/EI, ...
+        }
+        pc = next;
+    }
+    return (struct idle_body){ 0 };
+}
+
+// Count `cycles` of `source` from now rather than from where it was last stepped to
+static uint32_t idle_from_now(struct CPU *cpu, enum sched_source source, uint32_t cycles) {
+    uint64_t behind = cpu->sched.now - cpu->sched.slot[source].synced;
+    if (cycles == UINT32_MAX) {
+        return cycles;
+    }
+    return cycles > behind ? cycles - behind : 0;
+}
+
+// Cycles until the timer or GPU next do more than count, at least 1
+static uint32_t idle_horizon(struct CPU *cpu, struct GPU *gpu, bool div, bool tima) {
+    uint32_t gpu_cycles = idle_from_now(cpu, SCHED_PPU, gpu_cycles_to_event(gpu));
+    uint32_t timer_cycles = idle_from_now(cpu, SCHED_TIMER, timer_cycles_to_event(cpu, div, tima));
+    uint32_t cycles = gpu_cycles < timer_cycles ? gpu_cycles : timer_cycles;
+    return cycles ? cycles : 1;
+}
+
+// Cycles until something the loop at PC reads may change
+static uint32_t idle_horizon_read(struct CPU *cpu, struct GPU *gpu) {
+    struct idle_loop *idle = &cpu->idle;
+    uint32_t cycles = UINT32_MAX;
+    if (idle->reads_gpu || idle->reads_if) {
+        cycles = idle_from_now(cpu, SCHED_PPU, gpu_cycles_to_event(gpu));
+    }
+    if (idle->reads_if || idle->reads_div || idle->reads_tima) {
+        uint32_t timer_cycles = timer_cycles_to_event(cpu, idle->reads_div, idle->reads_tima);
+        timer_cycles = idle_from_now(cpu, SCHED_TIMER, timer_cycles);
+        if (timer_cycles < cycles) {
+            cycles = timer_cycles;
+        }
+    }
+    return cycles;
+}
+
+// Nothing can interrupt the loop before the next event
+static inline bool idle_quiet(struct CPU *cpu) {
+    return !cpu->ime_pending && !(cpu->ime && (cpu->bus.io.iflag & cpu->bus.ie & 0x1F));
+}
+
+uint32_t idle_visit(struct CPU *cpu, struct GPU *gpu, uint32_t left) {
+    struct idle_loop *idle = &cpu->idle;
+    uint32_t skip = 0;
+    if (idle->off) {
+        return 0;
+    }
+    uint16_t head = cpu->pc;
+    uint16_t bank = head >= 0x4000 ? cpu->bus.current_rom_bank : 0;
+    if (head != idle->pc || bank != idle->bank) {
+        struct idle_body body = { 0 };
+        if (head < 0x8000 && !cpu->bootrom_enabled) {
+            body = idle_decode(cpu);
+        }
+        idle->pc = head;
+        idle->bank = bank;
+        idle->cycles = body.cycles;
+        idle->misses = 0;
+        idle->reads_gpu = body.reads_gpu;
+        idle->reads_if = body.reads_if;
+        idle->reads_div = body.reads_div;
+        idle->reads_tima = body.reads_tima;
+        if (!idle->cycles) {
+            return 0;
+        }
+    } else if (idle->ran == idle->cycles && idle_quiet(cpu)) {
+        // the iteration since the last visit ran through the loop and nothing interrupted it
+        if (idle->unchanged > idle->ran && idle->af == GET_AF(cpu) && idle->bc == cpu->regs.bc &&
+            idle->de == cpu->regs.de && idle->hl == cpu->regs.hl && idle->sp == cpu->sp) {
+            // the iterations up to the next event would all do the same. The
+            // cycles of the jump back are added on top by the caller, which
+            // takes it into the iteration the event falls into
+            uint32_t horizon = idle_horizon(cpu, gpu, idle->reads_div, idle->reads_tima);
+            skip = (horizon - 1) / idle->ran * idle->ran;
+            if (skip > left) {
+                skip = left / idle->ran * idle->ran; // stop where an unskipped run would
+            }
+            idle->misses = 0;
+        } else if (++idle->misses >= IDLE_MAX_MISSES) {
+            idle->cycles = 0; // keeps counting, try again once it is left
+            return 0;
+        }
+    }
+
+    idle->ran = 0;
+    idle->unchanged = idle_horizon_read(cpu, gpu) - skip; // counted from after the skip
+    idle->af = GET_AF(cpu);
+    idle->bc = cpu->regs.bc;
+    idle->de = cpu->regs.de;
+    idle->hl = cpu->regs.hl;
+    idle->sp = cpu->sp;
+    return skip;
+}
+
+#endif
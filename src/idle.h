@@ -0,0 +1,70 @@
+#ifndef _IDLE_H
+#define _IDLE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Idle loop fast-forward
+   Games spend much of a frame halted or spinning in a tight loop that polls
+   LY, STAT or a flag in WRAM. cpu_run_cycles() sleeps through halts up to
+   the next point where something can change (a PPU mode change, a timer
+   overflow, ...), and idle_skip() (cpu.h) recognizes polling loops so they
+   can be moved forward to there as well instead of running every iteration.
+
+   - A loop qualifies if its body only reads memory and ends in a jump back
+     to its first instruction: no writes, stack ops or other branches.
+   - Each time the loop gets back to its first instruction, the iteration
+     just run is compared with the one before. If it took the loop's cycles,
+     nothing it reads changed under it and it left every register as it found
+     it, the iterations up to the next event would all do the same, so only
+     their cycles are passed on to the timer and GPU.
+   - The iteration an event falls into is run normally, so
+     interrupts are taken and registers change exactly where they would
+     without skipping. Nor does a skip go past the end of the
+     cpu_run_cycles() budget, so runs end at the same point either way. Build with -DNO_IDLE_SKIP to compare, or set
+     cpu->idle.off after cpu_init() to do so at run time.
+*/
+#ifndef NO_IDLE_SKIP
+#define IDLE_SKIP
+#endif
+
+struct CPU;
+struct GPU;
+
+#ifdef IDLE_SKIP
+
+#define IDLE_MAX_BYTES 16 // longest loop body looked at
+#define IDLE_MAX_INSTS 8
+#define IDLE_MAX_MISSES 4 // iterations in a row that changed registers before a loop is given up on
+#define IDLE_LEFT 0x80000000u // idle_loop.ran once PC left the loop
+
+struct idle_loop {
+	uint16_t pc;        // first instruction of the loop being watched
+	uint16_t bank;      // ROM bank it was decoded from
+	uint8_t cycles;     // cycles of one iteration, 0 if the loop can't be skipped
+	uint8_t misses;     // iterations in a row that couldn't be skipped from
+	bool reads_gpu;     // reads STAT, LY, VRAM or OAM
+	bool reads_if;      // reads IF
+	bool reads_div;     // reads DIV
+	bool reads_tima;    // reads TIMA
+	uint32_t ran;       // cycles since PC was last at the loop, IDLE_LEFT if it went elsewhere
+	uint32_t unchanged; // cycles what the loop reads stayed the same for from there
+	uint16_t af, bc, de, hl, sp; // registers at that point
+	bool off;           // never skip, to run loops in full and compare (checks/gbemu --idle)
+};
+
+/* PC just got back to a loop's first instruction
+   Decodes the loop if it is a new one, otherwise works out how many
+   iterations up to the next event can be skipped if the last one could have
+   been left out.
+   @param cpu Pointer to the CPU structure.
+   @param gpu Pointer to the GPU structure.
+   @param left Cycles left of the cpu_run_cycles() budget, which the skip
+               doesn't go past.
+   @return cycles of the skipped iterations, 0 if none
+*/
+uint32_t idle_visit(struct CPU *cpu, struct GPU *gpu, uint32_t left);
+
+#endif
+
+#endif
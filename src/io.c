@@ -0,0 +1,183 @@
+#include "io.h"
+#include "cpu.h"
+#include <stdio.h>
+
+// Step a scheduler source up to now before one of its registers changes
+static void io_touch(struct CPU *cpu, enum sched_source source) {
+    if (cpu->sched.gpu) {
+        sched_touch(cpu, source);
+    }
+}
+
+static uint8_t io_read_p1(struct CPU *cpu, uint16_t addr) {
+#ifdef ALLOW_ROM_WRITES
+    return cpu->bus.io.raw[addr - 0xFF00];
+#endif
+    (void)addr;
+    return read_joypad(cpu);
+}
+
+// DIV and TIMA count up between events
+static uint8_t io_read_timer(struct CPU *cpu, uint16_t addr) {
+    if (cpu->sched.slot[SCHED_TIMER].synced != cpu->sched.now) {
+        sched_sync(cpu, SCHED_TIMER);
+    }
+    return cpu->bus.io.raw[addr - 0xFF00];
+}
+
+static void io_write_p1(struct CPU *cpu, uint16_t addr, uint8_t value) {
+    (void)addr;
+#ifdef ALLOW_ROM_WRITES
+    cpu->bus.io.p1 = value;
+    return;
+#endif
+    cpu->bus.io.p1 = (cpu->bus.io.p1 & 0xCF) | (value & 0x30); // only the select lines
+}
+
+static void io_write_div(struct CPU *cpu, uint16_t addr, uint8_t value) {
+    (void)addr;
+    io_touch(cpu, SCHED_TIMER);
+    cpu->bus.io.div = 0; // any write resets it
+    cpu->divider_cycles = 0;
+#ifdef ALLOW_ROM_WRITES
+    cpu->bus.io.div = value;
+#endif
+    (void)value;
+}
+
+// TIMA, TMA, TAC
+static void io_write_timer(struct CPU *cpu, uint16_t addr, uint8_t value) {
+    io_touch(cpu, SCHED_TIMER);
+    cpu->bus.io.raw[addr - 0xFF00] = value;
+}
+
+static void io_write_if(struct CPU *cpu, uint16_t addr, uint8_t value) {
+    (void)addr;
+#ifdef ALLOW_ROM_WRITES
+    cpu->bus.io.iflag = value;
+    return;
+#endif
+    cpu->bus.io.iflag = value | 0xE0; // only the lower 5 bits are used
+}
+
+static void io_write_lcdc(struct CPU *cpu, uint16_t addr, uint8_t value) {
+    (void)addr;
+    io_touch(cpu, SCHED_PPU);
+    uint8_t lcdc = cpu->bus.io.lcdc;
+    cpu->bus.io.lcdc = value;
+#ifndef ALLOW_ROM_WRITES
+    if ((lcdc & 0x80) && !(value & 0x80)) {
+        // LCD off: LY back to 0 and VRAM/OAM open at once, not at the PPU's next step
+        cpu->bus.io.ly = 0;
+        cpu->bus.io.stat &= ~0x03;
+        memory_map_video(cpu);
+    }
+#endif
+    (void)lcdc;
+}
+
+static void io_write_stat(struct CPU *cpu, uint16_t addr, uint8_t value) {
+    (void)addr;
+    io_touch(cpu, SCHED_PPU);
+#ifdef ALLOW_ROM_WRITES
+    cpu->bus.io.stat = value;
+    return;
+#endif
+    // the mode and coincidence bits belong to the PPU, only the interrupt selects are written
+    cpu->bus.io.stat = 0x80 | (value & 0x78) | (cpu->bus.io.stat & 0x07);
+    memory_map_video(cpu);
+}
+
+// SCY, SCX
+static void io_write_scroll(struct CPU *cpu, uint16_t addr, uint8_t value) {
+    io_touch(cpu, SCHED_PPU);
+#ifndef ALLOW_ROM_WRITES
+    if ((cpu->bus.io.stat & 0x03) == 0x03) {
+        return; // ignored during pixel transfer
+    }
+#endif
+    cpu->bus.io.raw[addr - 0xFF00] = value;
+}
+
+// LY, LYC, palettes, window position
+static void io_write_ppu(struct CPU *cpu, uint16_t addr, uint8_t value) {
+    io_touch(cpu, SCHED_PPU);
+    cpu->bus.io.raw[addr - 0xFF00] = value;
+}
+
+static void io_write_dma(struct CPU *cpu, uint16_t addr, uint8_t value) {
+    (void)addr;
+    io_touch(cpu, SCHED_PPU);
+    dma_transfer(cpu, value);
+    cpu->bus.io.dma = value;
+}
+
+static void io_write_boot(struct CPU *cpu, uint16_t addr, uint8_t value) {
+    (void)addr;
+    if (cpu->bootrom_enabled) {
+        printf("Boot ROM disabled by write to 0xFF50 with value 0x%02X\n", value);
+    }
+    cpu->bootrom_enabled = false; // any write disables it for good
+    cpu->bus.io.boot = value;
+    memory_map_update(cpu); // boot ROM unmapped
+}
+
+// Read masks are for the DMG: unused and CGB-only addresses read 0xFF
+const struct io_reg io_table[0x80] = {
+    [0x00] = { io_read_p1, io_write_p1, 0xC0 },       // P1
+    [0x02] = { NULL, NULL, 0x7E },                    // SC
+    [0x03] = { NULL, NULL, 0xFF },
+    [0x04] = { io_read_timer, io_write_div, 0x00 },   // DIV
+    [0x05] = { io_read_timer, io_write_timer, 0x00 }, // TIMA
+    [0x06] = { NULL, io_write_timer, 0x00 },          // TMA
+    [0x07] = { NULL, io_write_timer, 0xF8 },          // TAC
+    [0x08 ... 0x0E] = { NULL, NULL, 0xFF },
+    [0x0F] = { NULL, io_write_if, 0xE0 },             // IF
+    [0x10] = { NULL, NULL, 0x80 },                    // NR10
+    [0x11] = { NULL, NULL, 0x3F },                    // NR11, length is write-only
+    [0x13] = { NULL, NULL, 0xFF },                    // NR13
+    [0x14] = { NULL, NULL, 0xBF },                    // NR14
+    [0x15] = { NULL, NULL, 0xFF },
+    [0x16] = { NULL, NULL, 0x3F },                    // NR21
+    [0x18] = { NULL, NULL, 0xFF },                    // NR23
+    [0x19] = { NULL, NULL, 0xBF },                    // NR24
+    [0x1A] = { NULL, NULL, 0x7F },                    // NR30
+    [0x1B] = { NULL, NULL, 0xFF },                    // NR31
+    [0x1C] = { NULL, NULL, 0x9F },                    // NR32
+    [0x1D] = { NULL, NULL, 0xFF },                    // NR33
+    [0x1E] = { NULL, NULL, 0xBF },                    // NR34
+    [0x1F] = { NULL, NULL, 0xFF },
+    [0x20] = { NULL, NULL, 0xFF },                    // NR41
+    [0x23] = { NULL, NULL, 0xBF },                    // NR44
+    [0x26] = { NULL, NULL, 0x70 },                    // NR52
+    [0x27 ... 0x2F] = { NULL, NULL, 0xFF },
+    [0x40] = { NULL, io_write_lcdc, 0x00 },           // LCDC
+    [0x41] = { NULL, io_write_stat, 0x80 },           // STAT
+    [0x42] = { NULL, io_write_scroll, 0x00 },         // SCY
+    [0x43] = { NULL, io_write_scroll, 0x00 },         // SCX
+    [0x44] = { NULL, io_write_ppu, 0x00 },            // LY
+    [0x45] = { NULL, io_write_ppu, 0x00 },            // LYC
+    [0x46] = { NULL, io_write_dma, 0x00 },            // DMA
+    [0x47 ... 0x4B] = { NULL, io_write_ppu, 0x00 },   // BGP, OBP0, OBP1, WY, WX
+    [0x4C ... 0x4F] = { NULL, io_write_ppu, 0xFF },
+    [0x50] = { NULL, io_write_boot, 0xFF },           // boot ROM off
+    [0x51 ... 0x7F] = { NULL, NULL, 0xFF },
+};
+
+uint8_t io_read(struct CPU *cpu, uint16_t addr) {
+    const struct io_reg *reg = &io_table[addr - 0xFF00];
+    uint8_t value = reg->read ? reg->read(cpu, addr) : cpu->bus.io.raw[addr - 0xFF00];
+#ifdef ALLOW_ROM_WRITES
+    return value; // the sm83 tester reads back what it wrote
+#endif
+    return value | reg->read_mask;
+}
+
+void io_write(struct CPU *cpu, uint16_t addr, uint8_t value) {
+    const struct io_reg *reg = &io_table[addr - 0xFF00];
+    if (reg->write) {
+        reg->write(cpu, addr, value);
+    } else {
+        cpu->bus.io.raw[addr - 0xFF00] = value;
+    }
+}
@@ -0,0 +1,49 @@
+#ifndef _IO_H
+#define _IO_H
+
+#include <stdint.h>
+
+/* I/O register dispatch
+   Reads and writes of 0xFF00-0xFF7F look their register up in a 128-entry
+   table (io_table) instead of comparing the address against each special
+   case in turn. Each entry has:
+
+   - a read mask, the bits that always read back as 1 (unused bits,
+     write-only registers, unmapped addresses), ORed into bus.io;
+   - a read handler for the registers worked out on read: the joypad
+     lines, and DIV and TIMA catching up with the scheduler;
+   - a write handler for the registers with side effects: DIV reset, TIMA
+     and the LCD registers stepping their scheduler source first, OAM DMA,
+     STAT and IF keeping their fixed bits, LCD off resetting LY, the joypad
+     select lines and the boot ROM switch.
+
+   A register without a handler is a plain store into bus.io. The sm83
+   tester build (ALLOW_ROM_WRITES) reads back what it wrote, without masks.
+*/
+
+struct CPU;
+
+struct io_reg {
+	uint8_t (*read)(struct CPU *cpu, uint16_t addr);             // NULL to read bus.io as stored
+	void (*write)(struct CPU *cpu, uint16_t addr, uint8_t value); // NULL to store into bus.io
+	uint8_t read_mask;                                            // bits that read as 1
+};
+
+extern const struct io_reg io_table[0x80];
+
+/* Read an I/O register
+   @param cpu Pointer to the CPU structure.
+   @param addr Address, 0xFF00-0xFF7F.
+   @return the byte
+*/
+uint8_t io_read(struct CPU *cpu, uint16_t addr);
+
+/* Write an I/O register, with its side effects
+   @param cpu Pointer to the CPU structure.
+   @param addr Address, 0xFF00-0xFF7F.
+   @param value Byte to write.
+   @return void
+*/
+void io_write(struct CPU *cpu, uint16_t addr, uint8_t value);
+
+#endif
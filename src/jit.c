@@ -0,0 +1,1108 @@
+#include "jit.h"
+#include "cpu.h"
+
+#ifdef JIT
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+/* Host register use while translated code runs:
+     rbx  struct CPU *
+     r12d F, packed
+     r13  struct jit *
+     r14d cycles run since entering from C
+     r15d cycle budget, a block is only chained to if it fits
+   GB registers stay in struct CPU and are loaded and stored around every
+   instruction. rax, rcx, rdx, rsi and rdi are scratch.
+*/
+enum { RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8, R9, R10, R11, R12, R13, R14, R15 };
+
+// x86 condition codes
+#define CC_C 0x2
+#define CC_NC 0x3
+#define CC_E 0x4
+#define CC_NE 0x5
+#define CC_A 0x7
+#define CC_S 0x8
+
+// x86 group 1 opcode extensions
+#define X86_ADD 0
+#define X86_OR 1
+#define X86_AND 4
+#define X86_XOR 6
+
+#define OFF(member) ((int32_t)offsetof(struct CPU, member))
+
+static const int32_t reg_offset[8] = { // B, C, D, E, H, L, (HL), A
+    OFF(regs.b), OFF(regs.c), OFF(regs.d), OFF(regs.e),
+    OFF(regs.h), OFF(regs.l), -1, OFF(regs.a)
+};
+
+static const int32_t pair_offset[4] = { // BC, DE, HL, SP
+    OFF(regs.bc), OFF(regs.de), OFF(regs.hl), OFF(sp)
+};
+
+// 8-bit ALU ops by bits 3-5 of the opcode: ADD ADC SUB SBC AND XOR OR CP
+static const uint8_t alu_reg_opcode[8] = { 0x00, 0x10, 0x28, 0x18, 0x20, 0x30, 0x08, 0x38 }; // op al, cl
+static const uint8_t alu_imm_opcode[8] = { 0x04, 0x14, 0x2C, 0x1C, 0x24, 0x34, 0x0C, 0x3C }; // op al, imm8
+
+struct side_exit {
+    uint8_t *site;   // rel32 to point at the exit
+    uint16_t pc;     // PC to leave with
+    uint32_t cycles; // cycles of the block up to here
+};
+
+struct emitter {
+    uint8_t *p;
+    struct side_exit exits[JIT_MAX_BLOCK_INSTS * 2];
+    int num_exits;
+    struct jit_link links[2]; // at most a taken and a not-taken exit
+    int num_links;
+    uint32_t max_cycles; // most cycles any exit emitted so far leaves with
+};
+
+static void emit8(struct emitter *e, uint8_t value) {
+    *e->p++ = value;
+}
+
+static void emit16(struct emitter *e, uint16_t value) {
+    memcpy(e->p, &value, 2);
+    e->p += 2;
+}
+
+static void emit32(struct emitter *e, uint32_t value) {
+    memcpy(e->p, &value, 4);
+    e->p += 4;
+}
+
+static void emit64(struct emitter *e, uint64_t value) {
+    memcpy(e->p, &value, 8);
+    e->p += 8;
+}
+
+static void patch8(uint8_t *site, const uint8_t *target) {
+    *site = (uint8_t)(int8_t)(target - (site + 1));
+}
+
+static void patch32(uint8_t *site, const uint8_t *target) {
+    int32_t rel = (int32_t)(target - (site + 4));
+    memcpy(site, &rel, 4);
+}
+
+// REX prefix for a reg/rm pair, left out when nothing needs it
+static void emit_rex(struct emitter *e, bool wide, int reg, int rm) {
+    uint8_t rex = 0x40 | (wide ? 0x08 : 0) | ((reg & 8) >> 1) | ((rm & 8) >> 3);
+    if (rex != 0x40) {
+        emit8(e, rex);
+    }
+}
+
+// ModRM for [base + disp], base must not be rsp or r12
+static void emit_mem(struct emitter *e, int reg, int base, int32_t disp) {
+    if (disp >= -128 && disp <= 127) {
+        emit8(e, 0x40 | (reg & 7) << 3 | (base & 7));
+        emit8(e, (uint8_t)disp);
+    } else {
+        emit8(e, 0x80 | (reg & 7) << 3 | (base & 7));
+        emit32(e, (uint32_t)disp);
+    }
+}
+
+// movzx reg, byte [base + disp]
+static void emit_load8(struct emitter *e, int reg, int base, int32_t disp) {
+    emit_rex(e, false, reg, base);
+    emit8(e, 0x0F);
+    emit8(e, 0xB6);
+    emit_mem(e, reg, base, disp);
+}
+
+// movzx reg, word [base + disp]
+static void emit_load16(struct emitter *e, int reg, int base, int32_t disp) {
+    emit_rex(e, false, reg, base);
+    emit8(e, 0x0F);
+    emit8(e, 0xB7);
+    emit_mem(e, reg, base, disp);
+}
+
+// mov byte [base + disp], reg (al, cl, dl or r8b-r15b)
+static void emit_store8(struct emitter *e, int reg, int base, int32_t disp) {
+    emit_rex(e, false, reg, base);
+    emit8(e, 0x88);
+    emit_mem(e, reg, base, disp);
+}
+
+// mov byte [rbx + disp], imm8
+static void emit_store8_imm(struct emitter *e, int32_t disp, uint8_t value) {
+    emit8(e, 0xC6);
+    emit_mem(e, 0, RBX, disp);
+    emit8(e, value);
+}
+
+// mov word [rbx + disp], imm16
+static void emit_store16_imm(struct emitter *e, int32_t disp, uint16_t value) {
+    emit8(e, 0x66);
+    emit8(e, 0xC7);
+    emit_mem(e, 0, RBX, disp);
+    emit16(e, value);
+}
+
+// inc/dec word [rbx + disp]
+static void emit_step16(struct emitter *e, int32_t disp, bool decrement) {
+    emit8(e, 0x66);
+    emit8(e, 0xFF);
+    emit_mem(e, decrement ? 1 : 0, RBX, disp);
+}
+
+// mov reg, imm32
+static void emit_mov_imm(struct emitter *e, int reg, uint32_t value) {
+    emit_rex(e, false, 0, reg);
+    emit8(e, 0xB8 + (reg & 7));
+    emit32(e, value);
+}
+
+// add/or/and/xor reg, imm
+static void emit_alu_imm(struct emitter *e, int ext, int reg, int32_t value) {
+    emit_rex(e, false, 0, reg);
+    if (value >= -128 && value <= 127) {
+        emit8(e, 0x83);
+        emit8(e, 0xC0 | ext << 3 | (reg & 7));
+        emit8(e, (uint8_t)value);
+    } else {
+        emit8(e, 0x81);
+        emit8(e, 0xC0 | ext << 3 | (reg & 7));
+        emit32(e, (uint32_t)value);
+    }
+}
+
+// 32-bit `opcode dst, src` between registers (mov 0x89, or 0x09, test 0x85, cmp 0x39)
+static void emit_reg_reg(struct emitter *e, uint8_t opcode, int dst, int src) {
+    emit_rex(e, false, src, dst);
+    emit8(e, opcode);
+    emit8(e, 0xC0 | (src & 7) << 3 | (dst & 7));
+}
+
+// bt r12d, bit: copies a GB flag into the host carry
+static void emit_test_flag(struct emitter *e, uint8_t bit) {
+    emit8(e, 0x41);
+    emit8(e, 0x0F);
+    emit8(e, 0xBA);
+    emit8(e, 0xE4);
+    emit8(e, bit);
+}
+
+static uint8_t *emit_jcc8(struct emitter *e, uint8_t cc) {
+    emit8(e, 0x70 | cc);
+    emit8(e, 0);
+    return e->p - 1;
+}
+
+static uint8_t *emit_jmp8(struct emitter *e) {
+    emit8(e, 0xEB);
+    emit8(e, 0);
+    return e->p - 1;
+}
+
+static uint8_t *emit_jcc32(struct emitter *e, uint8_t cc) {
+    emit8(e, 0x0F);
+    emit8(e, 0x80 | cc);
+    emit32(e, 0);
+    return e->p - 4;
+}
+
+static uint8_t *emit_jmp32(struct emitter *e) {
+    emit8(e, 0xE9);
+    emit32(e, 0);
+    return e->p - 4;
+}
+
+// call fn(cpu, esi, edx)
+static void emit_call(struct emitter *e, const void *fn) {
+    emit8(e, 0x48); // mov rdi, rbx
+    emit8(e, 0x89);
+    emit8(e, 0xDF);
+    emit8(e, 0x48); // mov rax, fn
+    emit8(e, 0xB8);
+    emit64(e, (uint64_t)(uintptr_t)fn);
+    emit8(e, 0xFF); // call rax
+    emit8(e, 0xD0);
+}
+
+/* Leave the block through `site` with PC and the cycles run so far
+   The exit code itself is emitted after the block, see emit_side_exits(). */
+static void add_side_exit(struct emitter *e, uint8_t *site, uint16_t pc, uint32_t cycles) {
+    struct side_exit *exit = &e->exits[e->num_exits++];
+    exit->site = site;
+    exit->pc = pc;
+    exit->cycles = cycles;
+}
+
+// add r14d, cycles; mov word [rbx + pc], pc
+static void emit_leave(struct emitter *e, uint16_t pc, uint32_t cycles) {
+    if (cycles > e->max_cycles) {
+        e->max_cycles = cycles;
+    }
+    if (cycles) {
+        emit8(e, 0x41);
+        emit8(e, 0x81);
+        emit8(e, 0xC6);
+        emit32(e, cycles);
+    }
+    emit_store16_imm(e, OFF(pc), pc);
+}
+
+/* End the block with a jump to `pc`
+   @param link_key Key of the block to chain to, -1 to always go back to C
+*/
+static void emit_exit(struct jit *jit, struct emitter *e, int64_t link_key, uint16_t pc, uint32_t cycles) {
+    emit_leave(e, pc, cycles);
+    if (link_key >= 0) {
+        // back to C unless the whole target block fits in the budget left
+        emit8(e, 0x41); // lea eax, [r14 + target cycles], patched with the jmp
+        emit8(e, 0x8D);
+        emit8(e, 0x86);
+        uint8_t *cycles_site = e->p;
+        emit32(e, 0);
+        emit_reg_reg(e, 0x39, RAX, R15); // cmp eax, r15d
+        patch32(emit_jcc32(e, CC_A), jit->epilogue);
+        uint8_t *site = emit_jmp32(e);
+        patch32(site, jit->epilogue);
+        struct jit_link *link = &e->links[e->num_links++];
+        link->key = (uint32_t)link_key;
+        link->site = site;
+        link->cycles_site = cycles_site;
+    } else {
+        patch32(emit_jmp32(e), jit->epilogue);
+    }
+}
+
+static void emit_side_exits(struct jit *jit, struct emitter *e) {
+    for (int i = 0; i < e->num_exits; i++) {
+        patch32(e->exits[i].site, e->p);
+        emit_leave(e, e->exits[i].pc, e->exits[i].cycles);
+        patch32(emit_jmp32(e), jit->epilogue);
+    }
+}
+
+/* Set F from the host flags of the last 8-bit operation
+   @param keep F bits the instruction leaves alone
+   @param from_host Z/H/C bits taken from the host flags
+   @param set F bits that are always set
+*/
+static void emit_flags(struct emitter *e, uint8_t keep, uint8_t from_host, uint8_t set) {
+    emit8(e, 0x9F); // lahf
+    emit8(e, 0x0F); // movzx edx, ah
+    emit8(e, 0xB6);
+    emit8(e, 0xD4);
+    emit8(e, 0x41); // movzx edx, byte [r13 + rdx + flag_lut]
+    emit8(e, 0x0F);
+    emit8(e, 0xB6);
+    emit8(e, 0x54);
+    emit8(e, 0x15);
+    emit8(e, (uint8_t)offsetof(struct jit, flag_lut));
+    if (from_host != (FLAG_ZERO | FLAG_HALF_CARRY | FLAG_CARRY)) {
+        emit_alu_imm(e, X86_AND, RDX, from_host);
+    }
+    if (set) {
+        emit_alu_imm(e, X86_OR, RDX, set);
+    }
+    if (keep) {
+        emit_alu_imm(e, X86_AND, R12, keep);
+        emit_reg_reg(e, 0x09, R12, RDX);
+    } else {
+        emit_reg_reg(e, 0x89, R12, RDX);
+    }
+}
+
+/* Memory access helpers called from translated code
+   Only memory whose behaviour does not depend on the GPU or timer is
+   handled here. Everything else returns -1 and the interpreter redoes the
+   instruction, with the peripherals caught up.
+*/
+static int jit_read(struct CPU *cpu, uint32_t addr) {
+    if (addr < 0x8000 || (addr >= 0xA000 && addr < 0xE000) || (addr >= 0xFF80 && addr < 0xFFFF)) {
+        return READ_BYTE(cpu, addr);
+    }
+    return -1;
+}
+
+// @return -1 if not written, 1 if the write dropped translated code, 0 otherwise
+static int jit_write(struct CPU *cpu, uint32_t addr, uint32_t value) {
+    if ((addr >= 0xA000 && addr < 0xE000) || (addr >= 0xFF80 && addr < 0xFFFF)) {
+        uint32_t invalidations = cpu->jit->invalidations;
+        WRITE_BYTE(cpu, addr, value);
+        return cpu->jit->invalidations != invalidations;
+    }
+    return -1;
+}
+
+static bool is_plain_ram(uint16_t addr) {
+    return (addr >= 0xC000 && addr < 0xE000) || (addr >= 0xFF80 && addr < 0xFFFF);
+}
+
+#ifdef FASTMEM
+/* Fastmem window (fastmem.h)
+   Translated code reads and writes the pages the window takes straight
+   through it, after testing the page's bit, and calls jit_read()/jit_write()
+   for the rest as without it. Of the pages the window reads, only those
+   jit_read() would take anyway (ROM and WRAM, not VRAM or echo RAM) are
+   used; it only ever takes writes to WRAM.
+*/
+#define JIT_WINDOW_READ 0x30FF // 0000-7FFF and C000-DFFF, bit n for n * 0x1000
+
+_Static_assert(sizeof(struct decoded_inst) == 4, "icache entries are cleared with dword stores");
+
+// Carry = bit (esi >> 12) of the word at [rbx + disp], and-ed with `mask` (0 for none)
+static void emit_window_test(struct emitter *e, int32_t disp, int32_t mask) {
+    emit_reg_reg(e, 0x89, RAX, RSI); // mov eax, esi
+    emit8(e, 0xC1); // shr eax, 12
+    emit8(e, 0xE8);
+    emit8(e, 12);
+    emit_load16(e, RCX, RBX, disp);
+    if (mask) {
+        emit_alu_imm(e, X86_AND, RCX, mask);
+    }
+    emit8(e, 0x0F); // bt ecx, eax
+    emit8(e, 0xA3);
+    emit8(e, 0xC1);
+}
+
+// mov reg, [rbx + fastmem.window]
+static void emit_load_window(struct emitter *e, int reg) {
+    emit_rex(e, true, reg, RBX);
+    emit8(e, 0x8B);
+    emit_mem(e, reg, RBX, OFF(fastmem.window));
+}
+#endif
+
+// eax = byte at esi, leaving the block before the instruction at `pc` if it can't be read here
+static void emit_read(struct emitter *e, uint16_t pc, uint32_t cycles) {
+#ifdef FASTMEM
+    emit_window_test(e, OFF(fastmem.read), JIT_WINDOW_READ);
+    uint8_t *miss = emit_jcc8(e, CC_NC);
+    emit_load_window(e, RAX);
+    emit8(e, 0x0F); // movzx eax, byte [rax + rsi]
+    emit8(e, 0xB6);
+    emit8(e, 0x04);
+    emit8(e, 0x30);
+    uint8_t *hit = emit_jmp8(e);
+    patch8(miss, e->p);
+#endif
+    emit8(e, 0x8D); // lea eax, [rsi - 0xC000]
+    emit8(e, 0x86);
+    emit32(e, (uint32_t)-0xC000);
+    emit8(e, 0x3D); // cmp eax, 0x1FFF
+    emit32(e, 0x1FFF);
+    uint8_t *slow = emit_jcc8(e, CC_A);
+    emit8(e, 0x0F); // movzx eax, byte [rbx + rsi + bus.wram - 0xC000], WRAM
+    emit8(e, 0xB6);
+    emit8(e, 0x84);
+    emit8(e, 0x33);
+    emit32(e, (uint32_t)(OFF(bus.wram) - 0xC000));
+    uint8_t *done = emit_jmp8(e);
+    patch8(slow, e->p);
+    emit_call(e, (const void *)jit_read);
+    emit_reg_reg(e, 0x85, RAX, RAX);
+    add_side_exit(e, emit_jcc32(e, CC_S), pc, cycles);
+    patch8(done, e->p);
+#ifdef FASTMEM
+    patch8(hit, e->p);
+#endif
+}
+
+/* eax = byte at a fixed address that is_plain_ram() or ROM/cart RAM
+   WRAM and HRAM are read from struct CPU directly; under FASTMEM bus.wram
+   is the window's own memfd mapping, so that is the window at a fixed
+   offset, without a page to test. */
+static void emit_read_fixed(struct emitter *e, uint16_t addr, uint16_t pc, uint32_t cycles) {
+    if (is_plain_ram(addr)) {
+        int32_t offset = addr >= 0xFF00 ? OFF(bus.high) + (addr - 0xFF00) : OFF(bus.wram) + (addr - 0xC000);
+        emit_load8(e, RAX, RBX, offset);
+        return;
+    }
+#ifdef FASTMEM
+    uint8_t *hit = NULL;
+    if (JIT_WINDOW_READ >> (addr >> 12) & 1) {
+        emit8(e, 0x66); // test word [rbx + fastmem.read], page bit
+        emit8(e, 0xF7);
+        emit_mem(e, 0, RBX, OFF(fastmem.read));
+        emit16(e, (uint16_t)(1u << (addr >> 12)));
+        uint8_t *miss = emit_jcc8(e, CC_E);
+        emit_load_window(e, RAX);
+        emit_load8(e, RAX, RAX, addr);
+        hit = emit_jmp8(e);
+        patch8(miss, e->p);
+    }
+#endif
+    emit_mov_imm(e, RSI, addr);
+    emit_call(e, (const void *)jit_read);
+    emit_reg_reg(e, 0x85, RAX, RAX);
+    add_side_exit(e, emit_jcc32(e, CC_S), pc, cycles);
+#ifdef FASTMEM
+    if (hit) {
+        patch8(hit, e->p);
+    }
+#endif
+}
+
+// write dl to esi, leaving the block before the instruction at `pc` if it can't be written here
+static void emit_write(struct emitter *e, uint16_t pc, uint32_t cycles) {
+#ifdef FASTMEM
+    // through the window unless the byte is in a block, which jit_write() drops
+    uint8_t *miss[3];
+    int misses = 0;
+    emit_window_test(e, OFF(fastmem.write), 0);
+    miss[misses++] = emit_jcc8(e, CC_NC);
+    emit8(e, 0x8D); // lea eax, [rsi - 0xC000], the WRAM index
+    emit8(e, 0x86);
+    emit32(e, (uint32_t)-0xC000);
+    emit8(e, 0x41); // cmp byte [r13 + rax + ram_code], 0
+    emit8(e, 0x80);
+    emit8(e, 0xBC);
+    emit8(e, 0x05);
+    emit32(e, (uint32_t)offsetof(struct jit, ram_code));
+    emit8(e, 0);
+    miss[misses++] = emit_jcc8(e, CC_NE);
+#ifdef ICACHE
+    // icache_invalidate(), the predecoded instructions that may cover the byte
+    emit8(e, 0x83); // cmp eax, 2
+    emit8(e, 0xF8);
+    emit8(e, 2);
+    miss[misses++] = emit_jcc8(e, CC_C);
+    for (int back = 0; back <= 2; back++) {
+        emit8(e, 0xC7); // mov dword [rbx + rax * 4 + icache.ram - back * 4], 0
+        emit8(e, 0x84);
+        emit8(e, 0x83);
+        emit32(e, (uint32_t)(OFF(icache.ram) + ICACHE_WRAM * 4 - back * 4));
+        emit32(e, 0);
+    }
+#endif
+    emit_load_window(e, RCX);
+    emit8(e, 0x88); // mov [rcx + rsi], dl
+    emit8(e, 0x14);
+    emit8(e, 0x31);
+    emit_reg_reg(e, 0x31, RAX, RAX); // xor eax, eax: no code dropped, for emit_write_done()
+    uint8_t *hit = emit_jmp8(e);
+    for (int i = 0; i < misses; i++) {
+        patch8(miss[i], e->p);
+    }
+#endif
+    emit_call(e, (const void *)jit_write);
+    emit_reg_reg(e, 0x85, RAX, RAX);
+    add_side_exit(e, emit_jcc32(e, CC_S), pc, cycles);
+#ifdef FASTMEM
+    patch8(hit, e->p);
+#endif
+}
+
+// leave for `next_pc` if the write emitted last overwrote translated code
+static void emit_write_done(struct emitter *e, uint16_t next_pc, uint32_t cycles) {
+    emit_reg_reg(e, 0x85, RAX, RAX);
+    add_side_exit(e, emit_jcc32(e, CC_NE), next_pc, cycles);
+}
+
+/* Block a jump from the block `key` to `target` can be chained to
+   Jumps out of the fixed bank into the switchable one, and any jump from or
+   to RAM, go back through C so the target is looked up again.
+   @return its key, or -1
+*/
+static int64_t link_key(uint32_t key, uint16_t target) {
+    uint32_t bank = key >> 16;
+    if (bank == JIT_RAM_BANK) {
+        return -1;
+    }
+    if (target < 0x4000) {
+        return target;
+    }
+    if (target < 0x8000 && bank != 0) {
+        return (int64_t)bank << 16 | target;
+    }
+    return -1;
+}
+
+/* Translate one instruction
+   @param pc Address of the instruction
+   @param cycles Cycles of the block before it
+   @param ended Set when the instruction ends the block (jumps)
+   @return its cycles, -1 if it has to be left to the interpreter (nothing
+           is emitted then)
+*/
+static int emit_inst(struct jit *jit, struct emitter *e, uint32_t key, uint16_t pc, uint8_t opcode,
+                     uint16_t imm, uint32_t cycles, bool *ended) {
+    uint16_t next = pc + inst_length[opcode];
+    switch (opcode) {
+    case 0x00: // NOP
+        return 4;
+
+    case 0x01: case 0x11: case 0x21: case 0x31: // LD rr,nn
+        emit_store16_imm(e, pair_offset[opcode >> 4], imm);
+        return 12;
+
+    case 0x03: case 0x13: case 0x23: case 0x33: // INC rr
+    case 0x0B: case 0x1B: case 0x2B: case 0x3B: // DEC rr
+        emit_step16(e, pair_offset[opcode >> 4], opcode & 0x08);
+        return 8;
+
+    case 0x04: case 0x0C: case 0x14: case 0x1C: case 0x24: case 0x2C: case 0x3C: // INC r
+    case 0x05: case 0x0D: case 0x15: case 0x1D: case 0x25: case 0x2D: case 0x3D: // DEC r
+        {
+            int32_t reg = reg_offset[(opcode >> 3) & 7];
+            bool dec = opcode & 1;
+            emit_load8(e, RAX, RBX, reg);
+            emit8(e, 0xFE); // inc al / dec al
+            emit8(e, dec ? 0xC8 : 0xC0);
+            emit_flags(e, FLAG_CARRY, FLAG_ZERO | FLAG_HALF_CARRY, dec ? FLAG_SUBTRACTION : 0);
+            emit_store8(e, RAX, RBX, reg);
+            return 4;
+        }
+
+    case 0x06: case 0x0E: case 0x16: case 0x1E: case 0x26: case 0x2E: case 0x3E: // LD r,n
+        emit_store8_imm(e, reg_offset[(opcode >> 3) & 7], (uint8_t)imm);
+        return 8;
+
+    case 0x36: // LD (HL),n
+        emit_load16(e, RSI, RBX, OFF(regs.hl));
+        emit_mov_imm(e, RDX, (uint8_t)imm);
+        emit_write(e, pc, cycles);
+        emit_write_done(e, next, cycles + 12);
+        return 12;
+
+    case 0x02: case 0x12: // LD (BC),A / LD (DE),A
+        emit_load16(e, RSI, RBX, pair_offset[opcode >> 4]);
+        emit_load8(e, RDX, RBX, OFF(regs.a));
+        emit_write(e, pc, cycles);
+        emit_write_done(e, next, cycles + 8);
+        return 8;
+
+    case 0x0A: case 0x1A: // LD A,(BC) / LD A,(DE)
+        emit_load16(e, RSI, RBX, pair_offset[opcode >> 4]);
+        emit_read(e, pc, cycles);
+        emit_store8(e, RAX, RBX, OFF(regs.a));
+        return 8;
+
+    case 0x22: case 0x32: // LD (HL+),A / LD (HL-),A
+        emit_load16(e, RSI, RBX, OFF(regs.hl));
+        emit_load8(e, RDX, RBX, OFF(regs.a));
+        emit_write(e, pc, cycles);
+        emit_step16(e, OFF(regs.hl), opcode == 0x32);
+        emit_write_done(e, next, cycles + 8);
+        return 8;
+
+    case 0x2A: case 0x3A: // LD A,(HL+) / LD A,(HL-)
+        emit_load16(e, RSI, RBX, OFF(regs.hl));
+        emit_read(e, pc, cycles);
+        emit_store8(e, RAX, RBX, OFF(regs.a));
+        emit_step16(e, OFF(regs.hl), opcode == 0x3A);
+        return 8;
+
+    case 0x2F: // CPL
+        emit8(e, 0x80); // xor byte [rbx + a], 0xFF
+        emit_mem(e, 6, RBX, OFF(regs.a));
+        emit8(e, 0xFF);
+        emit_alu_imm(e, X86_OR, R12, FLAG_SUBTRACTION | FLAG_HALF_CARRY);
+        return 4;
+
+    case 0x37: // SCF
+        emit_alu_imm(e, X86_AND, R12, FLAG_ZERO);
+        emit_alu_imm(e, X86_OR, R12, FLAG_CARRY);
+        return 4;
+
+    case 0x3F: // CCF
+        emit_alu_imm(e, X86_AND, R12, FLAG_ZERO | FLAG_CARRY);
+        emit_alu_imm(e, X86_XOR, R12, FLAG_CARRY);
+        return 4;
+
+    case 0x18: // JR e
+        emit_exit(jit, e, link_key(key, next + (int8_t)imm), next + (int8_t)imm, cycles + 12);
+        *ended = true;
+        return 12;
+
+    case 0xC3: // JP nn
+        emit_exit(jit, e, link_key(key, imm), imm, cycles + 16);
+        *ended = true;
+        return 16;
+
+    case 0x20: case 0x28: case 0x30: case 0x38: // JR cc,e
+    case 0xC2: case 0xCA: case 0xD2: case 0xDA: // JP cc,nn
+        {
+            bool jr = opcode < 0x40;
+            uint16_t target = jr ? next + (int8_t)imm : imm;
+            uint8_t cc = (opcode >> 3) & 3; // NZ, Z, NC, C
+            emit_test_flag(e, cc < 2 ? 7 : 4);
+            uint8_t *taken = emit_jcc32(e, cc & 1 ? CC_C : CC_NC);
+            emit_exit(jit, e, link_key(key, next), next, cycles + (jr ? 8 : 12));
+            patch32(taken, e->p);
+            emit_exit(jit, e, link_key(key, target), target, cycles + (jr ? 12 : 16));
+            *ended = true;
+            return jr ? 12 : 16;
+        }
+
+    default:
+        break;
+    }
+
+    if (opcode >= 0x40 && opcode < 0x80 && opcode != 0x76) { // LD r,r'
+        int dst = (opcode >> 3) & 7;
+        int src = opcode & 7;
+        if (dst == 6) {
+            emit_load16(e, RSI, RBX, OFF(regs.hl));
+            emit_load8(e, RDX, RBX, reg_offset[src]);
+            emit_write(e, pc, cycles);
+            emit_write_done(e, next, cycles + 8);
+            return 8;
+        }
+        if (src == 6) {
+            emit_load16(e, RSI, RBX, OFF(regs.hl));
+            emit_read(e, pc, cycles);
+        } else if (src != dst) {
+            emit_load8(e, RAX, RBX, reg_offset[src]);
+        }
+        if (src != dst) {
+            emit_store8(e, RAX, RBX, reg_offset[dst]);
+        }
+        return src == 6 ? 8 : 4;
+    }
+
+    bool alu_reg = opcode >= 0x80 && opcode < 0xC0;
+    bool alu_imm = opcode >= 0xC0 && (opcode & 0x07) == 0x06;
+    if (alu_reg || alu_imm) {
+        int op = (opcode >> 3) & 7;
+        int src = opcode & 7;
+        if (alu_reg && src == 6) {
+            emit_load16(e, RSI, RBX, OFF(regs.hl));
+            emit_read(e, pc, cycles);
+            emit_reg_reg(e, 0x89, RCX, RAX);
+        } else if (alu_reg) {
+            emit_load8(e, RCX, RBX, reg_offset[src]);
+        }
+        emit_load8(e, RAX, RBX, OFF(regs.a));
+        if (op == 1 || op == 3) { // ADC/SBC take the carry in
+            emit_test_flag(e, 4);
+        }
+        if (alu_reg) {
+            emit8(e, alu_reg_opcode[op]);
+            emit8(e, 0xC8);
+        } else {
+            emit8(e, alu_imm_opcode[op]);
+            emit8(e, (uint8_t)imm);
+        }
+        switch (op) {
+        case 0: case 1: // ADD, ADC
+            emit_flags(e, 0, FLAG_ZERO | FLAG_HALF_CARRY | FLAG_CARRY, 0);
+            break;
+        case 2: case 3: case 7: // SUB, SBC, CP
+            emit_flags(e, 0, FLAG_ZERO | FLAG_HALF_CARRY | FLAG_CARRY, FLAG_SUBTRACTION);
+            break;
+        case 4: // AND
+            emit_flags(e, 0, FLAG_ZERO, FLAG_HALF_CARRY);
+            break;
+        default: // XOR, OR
+            emit_flags(e, 0, FLAG_ZERO, 0);
+            break;
+        }
+        if (op != 7) {
+            emit_store8(e, RAX, RBX, OFF(regs.a));
+        }
+        return (alu_reg && src != 6) ? 4 : 8;
+    }
+
+    switch (opcode) {
+    case 0xE0: case 0xEA: // LDH (n),A / LD (nn),A
+        {
+            uint16_t addr = opcode == 0xE0 ? 0xFF00 | (uint8_t)imm : imm;
+            if (!is_plain_ram(addr) && !(addr >= 0xA000 && addr < 0xC000)) {
+                return -1; // I/O and MBC registers are left to the interpreter
+            }
+            emit_mov_imm(e, RSI, addr);
+            emit_load8(e, RDX, RBX, OFF(regs.a));
+            emit_write(e, pc, cycles);
+            emit_write_done(e, next, cycles + 12);
+            return 12;
+        }
+
+    case 0xF0: case 0xFA: // LDH A,(n) / LD A,(nn)
+        {
+            uint16_t addr = opcode == 0xF0 ? 0xFF00 | (uint8_t)imm : imm;
+            if (!is_plain_ram(addr) && addr >= 0x8000 && !(addr >= 0xA000 && addr < 0xC000)) {
+                return -1;
+            }
+            emit_read_fixed(e, addr, pc, cycles);
+            emit_store8(e, RAX, RBX, OFF(regs.a));
+            return opcode == 0xF0 ? 12 : 16;
+        }
+
+    case 0xE2: // LD (C),A
+        emit_load8(e, RSI, RBX, OFF(regs.c));
+        emit_alu_imm(e, X86_OR, RSI, 0xFF00);
+        emit_load8(e, RDX, RBX, OFF(regs.a));
+        emit_write(e, pc, cycles);
+        emit_write_done(e, next, cycles + 8);
+        return 8;
+
+    case 0xF2: // LD A,(C)
+        emit_load8(e, RSI, RBX, OFF(regs.c));
+        emit_alu_imm(e, X86_OR, RSI, 0xFF00);
+        emit_read(e, pc, cycles);
+        emit_store8(e, RAX, RBX, OFF(regs.a));
+        return 8;
+    }
+    return -1;
+}
+
+static inline uint32_t jit_hash(uint32_t key) {
+    return (key * 2654435761u) >> (32 - JIT_HASH_BITS);
+}
+
+static struct jit_block *jit_lookup(struct jit *jit, uint32_t key) {
+    for (int32_t i = jit->buckets[jit_hash(key)]; i >= 0; i = jit->blocks[i].next) {
+        if (jit->blocks[i].key == key) {
+            return &jit->blocks[i];
+        }
+    }
+    return NULL;
+}
+
+static inline uint16_t ram_index(uint16_t addr) {
+    return addr >= 0xFF80 ? ICACHE_HRAM + (addr - 0xFF80) : ICACHE_WRAM + (addr - 0xC000);
+}
+
+/* Key of the code at `pc` with the current banking
+   @param last Set to the last address a block starting at `pc` may cover.
+   @return false if code at `pc` is never translated
+*/
+static bool jit_key(struct CPU *cpu, uint16_t pc, uint32_t *key, uint16_t *last) {
+    if (pc < 0x4000) {
+        *key = pc;
+        *last = 0x3FFF;
+        return true;
+    }
+    if (pc < 0x8000) {
+        uint32_t bank = cpu->bus.current_rom_bank;
+        if (bank == 0) {
+            return false;
+        }
+        *key = bank << 16 | pc;
+        *last = 0x7FFF;
+        return true;
+    }
+    if (is_plain_ram(pc)) {
+        *key = (uint32_t)JIT_RAM_BANK << 16 | pc;
+        *last = pc < 0xE000 ? 0xDFFF : 0xFFFE;
+        return true;
+    }
+    return false;
+}
+
+// Point the chained jump `link` at `target`, with the cycles its budget check needs
+static void jit_patch_link(const struct jit_link *link, const struct jit_block *target) {
+    memcpy(link->cycles_site, &target->cycles, 4);
+    patch32(link->site, target->code);
+}
+
+/* Flip the arena between writable and executable, it is never both
+   @return false if the kernel refused
+*/
+static bool jit_protect(struct jit *jit, bool writable) {
+    return mprotect(jit->code, JIT_CODE_SIZE, writable ? PROT_READ | PROT_WRITE : PROT_READ | PROT_EXEC) == 0;
+}
+
+// Patch the chained jump `link`, or remember it until its target is translated
+static void jit_link(struct jit *jit, const struct jit_link *link) {
+    struct jit_block *target = jit_lookup(jit, link->key);
+    if (target) {
+        if (target->code) {
+            jit_patch_link(link, target);
+        }
+    } else if (jit->num_links < JIT_MAX_LINKS) {
+        jit->links[jit->num_links++] = *link;
+    }
+}
+
+/* Translate the block at `key`
+   @param last Last address the block may cover.
+   @param max_insts Most instructions to put in the block.
+   @return the new block, its code is NULL if nothing could be translated.
+           NULL if the arena could not be made writable or executable again.
+*/
+static struct jit_block *jit_compile(struct CPU *cpu, uint32_t key, uint16_t last, int max_insts) {
+    struct jit *jit = cpu->jit;
+    if (jit->num_blocks == JIT_MAX_BLOCKS ||
+        jit->code + JIT_CODE_SIZE - jit->code_end < JIT_MAX_BLOCK_BYTES) {
+        jit_flush(cpu);
+    }
+    // emitting and link patching below both write into the arena
+    if (!jit_protect(jit, true)) {
+        return NULL;
+    }
+
+    struct emitter e = { .p = jit->code_end };
+    uint16_t start = key & 0xFFFF;
+    uint16_t pc = start;
+    uint32_t cycles = 0;
+    int count = 0;
+    bool ended = false;
+    while (!ended && count < max_insts && cycles < JIT_MAX_BLOCK_CYCLES) {
+        uint8_t opcode = READ_BYTE(cpu, pc);
+        uint8_t length = inst_length[opcode];
+        if (pc + length - 1 > last) {
+            break;
+        }
+        uint16_t imm = length == 3 ? READ_WORD(cpu, pc + 1) : length == 2 ? READ_BYTE(cpu, pc + 1) : 0;
+        int inst_cycles = emit_inst(jit, &e, key, pc, opcode, imm, cycles, &ended);
+        if (inst_cycles < 0) {
+            break;
+        }
+        cycles += inst_cycles;
+        pc += length;
+        count++;
+    }
+
+    struct jit_block *block = &jit->blocks[jit->num_blocks];
+    block->key = key;
+    block->start = start;
+    block->end = count ? pc - 1 : start;
+    block->code = NULL;
+    if (count) {
+        if (!ended) {
+            emit_exit(jit, &e, link_key(key, pc), pc, cycles);
+        }
+        emit_side_exits(jit, &e);
+        block->code = jit->code_end;
+        block->cycles = e.max_cycles;
+        jit->code_end = e.p;
+    }
+
+    uint32_t bucket = jit_hash(key);
+    block->next = jit->buckets[bucket];
+    jit->buckets[bucket] = jit->num_blocks++;
+
+    if (key >> 16 == JIT_RAM_BANK) {
+        memset(&jit->ram_code[ram_index(block->start)], 1, block->end - block->start + 1);
+    }
+    if (block->code) {
+        for (int i = 0; i < e.num_links; i++) {
+            jit_link(jit, &e.links[i]);
+        }
+    }
+    for (int32_t i = 0; i < jit->num_links;) {
+        if (jit->links[i].key == key) {
+            if (block->code) {
+                jit_patch_link(&jit->links[i], block);
+            }
+            jit->links[i] = jit->links[--jit->num_links];
+        } else {
+            i++;
+        }
+    }
+    if (!jit_protect(jit, false)) {
+        jit_flush(cpu); // nothing in the arena may run while it is writable
+        return NULL;
+    }
+    return block;
+}
+
+static const struct jit_block *jit_find(struct CPU *cpu) {
+    struct jit *jit = cpu->jit;
+    uint32_t key;
+    uint16_t last;
+    if (!jit_key(cpu, cpu->pc, &key, &last)) {
+        return NULL;
+    }
+    struct jit_block *block = jit_lookup(jit, key);
+    if (!block) {
+        uint8_t *heat = &jit->heat[jit_hash(key)];
+        if (*heat < JIT_HOT_THRESHOLD) {
+            (*heat)++;
+            return NULL;
+        }
+        block = jit_compile(cpu, key, last, JIT_MAX_BLOCK_INSTS);
+    }
+    return block && block->code ? block : NULL;
+}
+
+uint32_t jit_run(struct CPU *cpu, uint32_t budget) {
+    struct jit *jit = cpu->jit;
+    if (cpu->bootrom_enabled) {
+        return 0;
+    }
+    // a pending interrupt is taken after the next instruction, not the next block
+    if (cpu->ime && (cpu->bus.io.iflag & cpu->bus.ie & 0x1F)) {
+        return 0;
+    }
+
+    uint32_t elapsed = 0;
+    bool entered = false;
+    while (elapsed < budget) {
+        const struct jit_block *block = jit_find(cpu);
+        if (!block || elapsed + block->cycles > budget) {
+            break; // the interpreter runs what is left up to the budget
+        }
+        if (!entered) {
+            jit->f = PACK_FLAGS(cpu);
+            entered = true;
+        }
+        uint32_t cycles = jit->enter(cpu, jit, block->code, budget - elapsed);
+        if (!cycles) {
+            break; // left before its first instruction
+        }
+        elapsed += cycles;
+    }
+    if (entered) {
+        UNPACK_FLAGS(cpu, jit->f);
+    }
+    return elapsed;
+}
+
+uint32_t jit_run_inst(struct CPU *cpu) {
+    struct jit *jit = cpu->jit;
+    uint32_t key;
+    uint16_t last;
+    if (cpu->bootrom_enabled || !jit_key(cpu, cpu->pc, &key, &last)) {
+        return 0;
+    }
+    jit_flush(cpu);
+    const struct jit_block *block = jit_compile(cpu, key, last, 1);
+    if (!block || !block->code) {
+        return 0;
+    }
+    jit->f = PACK_FLAGS(cpu);
+    uint32_t cycles = jit->enter(cpu, jit, block->code, 1);
+    UNPACK_FLAGS(cpu, jit->f);
+    if (cycles) {
+        cpu->cycles = cycles;
+    }
+    return cycles;
+}
+
+void jit_exec(struct CPU *cpu) {
+    struct scheduler *sched = &cpu->sched;
+    uint32_t budget = JIT_STEP_CYCLES;
+    if (sched->gpu) {
+        // up to the next timer or GPU event, which cpu_run_cycles() handles before the next step
+        uint64_t left = sched->next - sched->now;
+        budget = left < UINT32_MAX ? (uint32_t)left : UINT32_MAX;
+    }
+    uint32_t cycles = jit_run(cpu, budget);
+    if (cycles) {
+        cpu->cycles = cycles;
+        return;
+    }
+    exec_next(cpu);
+}
+
+void jit_invalidate(struct CPU *cpu, uint16_t index) {
+    struct jit *jit = cpu->jit;
+    uint16_t addr = index >= ICACHE_HRAM ? 0xFF80 + (index - ICACHE_HRAM) : 0xC000 + (index - ICACHE_WRAM);
+    for (int32_t i = 0; i < jit->num_blocks; i++) {
+        struct jit_block *block = &jit->blocks[i];
+        if (block->key >> 16 != JIT_RAM_BANK || addr < block->start || addr > block->end) {
+            continue;
+        }
+        // unhook it from its bucket, the code stays in the arena until the next flush
+        int32_t *prev = &jit->buckets[jit_hash(block->key)];
+        while (*prev != i) {
+            prev = &jit->blocks[*prev].next;
+        }
+        *prev = block->next;
+        block->key = UINT32_MAX;
+        memset(&jit->ram_code[ram_index(block->start)], 0, block->end - block->start + 1);
+    }
+    // blocks may overlap, so re-mark whatever is still covered
+    for (int32_t i = 0; i < jit->num_blocks; i++) {
+        struct jit_block *block = &jit->blocks[i];
+        if (block->key >> 16 == JIT_RAM_BANK) {
+            memset(&jit->ram_code[ram_index(block->start)], 1, block->end - block->start + 1);
+        }
+    }
+    jit->invalidations++;
+}
+
+void jit_flush(struct CPU *cpu) {
+    struct jit *jit = cpu->jit;
+    jit->code_end = jit->block_code;
+    jit->num_blocks = 0;
+    jit->num_links = 0;
+    memset(jit->buckets, 0xFF, sizeof(jit->buckets));
+    memset(jit->heat, 0, sizeof(jit->heat));
+    memset(jit->ram_code, 0, sizeof(jit->ram_code));
+    jit->invalidations++;
+}
+
+int jit_init(struct CPU *cpu) {
+    struct jit *jit = calloc(1, sizeof(struct jit));
+    if (!jit) {
+        return -1;
+    }
+    // writable until the stubs below are in, then executable; see jit_protect()
+    jit->code = mmap(NULL, JIT_CODE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (jit->code == MAP_FAILED) {
+        free(jit);
+        return -1;
+    }
+    for (int i = 0; i < 256; i++) {
+        // LAHF puts ZF in bit 6, AF in bit 4 and CF in bit 0
+        jit->flag_lut[i] = (i & 0x40 ? FLAG_ZERO : 0) | (i & 0x10 ? FLAG_HALF_CARRY : 0) |
+                           (i & 0x01 ? FLAG_CARRY : 0);
+    }
+
+    // enter(cpu, jit, code, budget)
+    struct emitter e = { .p = jit->code };
+    jit->enter = (uint32_t (*)(struct CPU *, struct jit *, const uint8_t *, uint32_t))(void *)e.p;
+    emit8(&e, 0x53); // push rbx, r12-r15
+    emit8(&e, 0x41);
+    emit8(&e, 0x54);
+    emit8(&e, 0x41);
+    emit8(&e, 0x55);
+    emit8(&e, 0x41);
+    emit8(&e, 0x56);
+    emit8(&e, 0x41);
+    emit8(&e, 0x57);
+    emit8(&e, 0x48); // mov rbx, rdi
+    emit8(&e, 0x89);
+    emit8(&e, 0xFB);
+    emit8(&e, 0x49); // mov r13, rsi
+    emit8(&e, 0x89);
+    emit8(&e, 0xF5);
+    emit_reg_reg(&e, 0x89, R15, RCX);
+    emit8(&e, 0x45); // xor r14d, r14d
+    emit8(&e, 0x31);
+    emit8(&e, 0xF6);
+    emit_load8(&e, R12, R13, offsetof(struct jit, f));
+    emit8(&e, 0xFF); // jmp rdx
+    emit8(&e, 0xE2);
+
+    jit->epilogue = e.p;
+    emit_store8(&e, R12, R13, offsetof(struct jit, f));
+    emit_reg_reg(&e, 0x89, RAX, R14);
+    emit8(&e, 0x41); // pop r15-r12, rbx
+    emit8(&e, 0x5F);
+    emit8(&e, 0x41);
+    emit8(&e, 0x5E);
+    emit8(&e, 0x41);
+    emit8(&e, 0x5D);
+    emit8(&e, 0x41);
+    emit8(&e, 0x5C);
+    emit8(&e, 0x5B);
+    emit8(&e, 0xC3); // ret
+    jit->block_code = e.p;
+    if (!jit_protect(jit, false)) {
+        munmap(jit->code, JIT_CODE_SIZE);
+        free(jit);
+        return -1;
+    }
+
+    cpu->jit = jit;
+    jit_flush(cpu);
+    return 0;
+}
+
+void jit_free(struct CPU *cpu) {
+    if (!cpu->jit) {
+        return;
+    }
+    munmap(cpu->jit->code, JIT_CODE_SIZE);
+    free(cpu->jit);
+    cpu->jit = NULL;
+}
+
+#endif
@@ -0,0 +1,138 @@
+#ifndef _JIT_H
+#define _JIT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* x86-64 dynamic recompiler
+   Built with -DJIT. Hot basic blocks of ROM, WRAM and HRAM code are
+   translated to native code and run in place of exec_inst(). Anything the
+   translator does not handle (CB ops, stack ops, I/O accesses, ...) ends
+   the block, and the interpreter takes over at that instruction.
+
+   - Each block exit adds the cycles of the path taken, so a run returns the
+     same cycle count the interpreter would have produced.
+   - Blocks jump straight into each other (block linking) as long as the
+     whole of the next block fits in the cycle budget. Under
+     cpu_run_cycles() the budget ends at the scheduler's next event, so the
+     timer and GPU raise their interrupts between the same two instructions
+     as when interpreted; the interpreter runs the instructions left before
+     the event. Interrupts are checked whenever control is back in C;
+     translated code never touches IF, IE or IME.
+   - ROM blocks are keyed by bank and PC like the predecoded instruction
+     cache. WRAM and HRAM blocks are dropped when something writes over
+     them, see jit_invalidate().
+   - The code arena is never writable and executable at once. It is
+     mapped read+write, then switched to read+exec, and only made writable
+     again while a block is emitted and the jumps into it are patched.
+*/
+#if defined(JIT) && (!defined(__x86_64__) || defined(_WIN32))
+#undef JIT // the emitter only knows the x86-64 System V ABI
+#endif
+
+#ifdef JIT
+
+struct CPU;
+
+#define JIT_CODE_SIZE (1 << 20)     // bytes of native code per CPU
+#define JIT_MAX_BLOCK_BYTES 4096    // worst case for one translated block
+#define JIT_MAX_BLOCKS 4096
+#define JIT_MAX_LINKS 4096
+#define JIT_HASH_BITS 12
+#define JIT_HOT_THRESHOLD 8         // lookups of a PC before it is translated
+#define JIT_MAX_BLOCK_INSTS 24
+#define JIT_MAX_BLOCK_CYCLES 64     // stop translating once a block gets this long
+#define JIT_STEP_CYCLES 128         // budget of one step_cpu() call outside cpu_run_cycles(), see jit_exec()
+#define JIT_RAM_BANK 0x1000         // bank number used in keys of WRAM/HRAM blocks
+#define JIT_RAM_SIZE 0x2080         // WRAM C000-DFFF + HRAM FF80-FFFF, same layout as the icache
+
+struct jit_block {
+	uint32_t key;        // bank << 16 | PC
+	uint16_t start;      // first byte of the block
+	uint16_t end;        // last byte of the block
+	const uint8_t *code; // NULL if the first instruction can't be translated
+	uint32_t cycles;     // most cycles a run through the block takes, whichever way it leaves
+	int32_t next;        // next block in the same hash bucket, -1 ends the chain
+};
+
+struct jit_link {
+	uint32_t key;   // block the jump wants to reach
+	uint8_t *site;  // rel32 of the jmp to patch
+	uint8_t *cycles_site; // imm32 of the budget check before it, the target's cycles
+};
+
+struct jit {
+	uint8_t flag_lut[256];          // LAHF result -> Z/H/C in F layout
+	uint8_t f;                      // packed F while translated code runs
+	uint8_t *code;                  // arena, read+exec except while a block is emitted
+	uint8_t *block_code;            // where blocks start, after enter/epilogue
+	uint8_t *code_end;              // first free byte in the arena
+	uint8_t *epilogue;              // shared exit path back to C
+	uint32_t (*enter)(struct CPU *cpu, struct jit *jit, const uint8_t *code, uint32_t budget);
+	int32_t buckets[1 << JIT_HASH_BITS];
+	uint8_t heat[1 << JIT_HASH_BITS];
+	struct jit_block blocks[JIT_MAX_BLOCKS];
+	int32_t num_blocks;
+	struct jit_link links[JIT_MAX_LINKS]; // jumps waiting for their target to be translated
+	int32_t num_links;
+	uint8_t ram_code[JIT_RAM_SIZE]; // nonzero where a WRAM/HRAM byte belongs to a block
+	uint32_t invalidations;         // bumped whenever RAM blocks are dropped
+};
+
+/* Set up the JIT for a CPU
+   step_cpu() and exec_block() use translated code from then on.
+   @param cpu Pointer to the CPU structure.
+   @return 0 on success, -1 if no executable memory could be mapped
+*/
+int jit_init(struct CPU *cpu);
+
+/* Release the JIT of a CPU, the interpreter is used again afterwards
+   @param cpu Pointer to the CPU structure.
+   @return void
+*/
+void jit_free(struct CPU *cpu);
+
+/* Throw away all translated code
+   Needed after memory was changed behind WRITE_BYTE's back.
+   @param cpu Pointer to the CPU structure.
+   @return void
+*/
+void jit_flush(struct CPU *cpu);
+
+/* Run translated code from PC
+   Only enters a block, from C or from another block, if all of it fits in
+   what is left of `budget`. Stops before one that doesn't, or where the
+   interpreter has to take over.
+   @param cpu Pointer to the CPU structure.
+   @param budget Cycles to run for.
+   @return cycles run, 0 if the instruction at PC has to be interpreted
+*/
+uint32_t jit_run(struct CPU *cpu, uint32_t budget);
+
+/* Translate and run only the instruction at PC, ignoring how hot it is
+   Used to check the translator against the interpreter one instruction at
+   a time.
+   @param cpu Pointer to the CPU structure.
+   @return its cycles, 0 if the instruction was not run
+*/
+uint32_t jit_run_inst(struct CPU *cpu);
+
+/* Execute the next piece of code for step_cpu()
+   Runs translated code up to the scheduler's next event (JIT_STEP_CYCLES
+   outside cpu_run_cycles()) and leaves the total in cpu->cycles, or
+   interprets one instruction.
+   @param cpu Pointer to the CPU structure.
+   @return void
+*/
+void jit_exec(struct CPU *cpu);
+
+/* Drop the WRAM/HRAM blocks that contain a byte being written
+   @param cpu Pointer to the CPU structure.
+   @param index Offset into the WRAM/HRAM code map (ICACHE_WRAM/ICACHE_HRAM based)
+   @return void
+*/
+void jit_invalidate(struct CPU *cpu, uint16_t index);
+
+#endif
+
+#endif
@@ -0,0 +1,346 @@
+#include "mbc.h"
+#include "cpu.h"
+#include <stdio.h>
+
+/* Map ROM bank `bank` at 0x4000, wrapping around the banks the cartridge has
+   @return host address of the bank's first byte
+*/
+static uint8_t *mbc_rom_bank(struct MemoryBus *bus, unsigned bank) {
+    if (bus->num_rom_banks) {
+        bank %= bus->num_rom_banks;
+    }
+    bus->current_rom_bank = bank;
+    if (!bank) {
+        return bus->rom0; // bank 0, MBC5 can map it here too
+    }
+    return bus->rom_banks ? bus->rom_banks + (bank - 1) * 0x4000 : NULL;
+}
+
+// 8KB RAM bank `bank` at 0xA000 if it is enabled and all there, else NULL
+static uint8_t *mbc_ram_bank(struct MemoryBus *bus, unsigned bank) {
+    if (!bus->ram_enabled || !bus->cart_ram || (bank + 1) * 0x2000 > bus->ram_size) {
+        return NULL;
+    }
+    return bus->cart_ram + bank * 0x2000;
+}
+
+// Cartridge RAM at `offset`, 0xFF outside of it or while it is disabled
+static uint8_t mbc_ram_read(struct MemoryBus *bus, size_t offset) {
+    if (!bus->ram_enabled || !bus->cart_ram || offset >= bus->ram_size) {
+        return 0xFF;
+    }
+    return bus->cart_ram[offset];
+}
+
+static void mbc_ram_write(struct MemoryBus *bus, size_t offset, uint8_t value) {
+    if (bus->ram_enabled && bus->cart_ram && offset < bus->ram_size) {
+        bus->cart_ram[offset] = value;
+    }
+}
+
+// The registers every mapper keeps in the bus, in a fixed order
+static size_t mbc_serialize(struct CPU *cpu, uint8_t *out) {
+    if (out) {
+        out[0] = cpu->bus.rom_bank_lo;
+        out[1] = cpu->bus.rom_bank_hi;
+        out[2] = cpu->bus.mbc1_mode;
+        out[3] = cpu->bus.current_ram_bank;
+        out[4] = cpu->bus.ram_enabled;
+        out[5] = cpu->rtc.latch;
+    }
+    return 6;
+}
+
+static void mbc_deserialize(struct CPU *cpu, const uint8_t *in) {
+    cpu->bus.rom_bank_lo = in[0];
+    cpu->bus.rom_bank_hi = in[1];
+    cpu->bus.mbc1_mode = in[2];
+    cpu->bus.current_ram_bank = in[3];
+    cpu->bus.ram_enabled = in[4];
+    cpu->rtc.latch = in[5];
+    cpu->bus.mbc->banks(cpu);
+    memory_map_cart(cpu);
+}
+
+// No MBC: bank 1 at 0x4000 for good, RAM (if any) always on
+static void none_banks(struct CPU *cpu) {
+    struct MemoryBus *bus = &cpu->bus;
+    bus->romx = mbc_rom_bank(bus, 1);
+    bus->sram = bus->cart_ram && bus->ram_size >= 0x2000 ? bus->cart_ram : NULL;
+}
+
+static void none_write(struct CPU *cpu, uint16_t addr, uint8_t value) {
+#ifdef ALLOW_ROM_WRITES
+    // the sm83 tester uses the whole address space as RAM
+    if (addr < 0x4000) {
+        cpu->bus.rom0[addr] = value; // the tester's own buffer, see its main.c
+    } else if (cpu->bus.romx) {
+        cpu->bus.romx[addr - 0x4000] = value;
+    }
+#else
+    (void)cpu;
+    (void)addr;
+    (void)value;
+#endif
+}
+
+static uint8_t none_read_ram(struct CPU *cpu, uint16_t addr) {
+    if (!cpu->bus.cart_ram || (size_t)(addr - 0xA000) >= cpu->bus.ram_size) {
+        return 0xFF;
+    }
+    return cpu->bus.cart_ram[addr - 0xA000];
+}
+
+static void none_write_ram(struct CPU *cpu, uint16_t addr, uint8_t value) {
+    if (cpu->bus.cart_ram && (size_t)(addr - 0xA000) < cpu->bus.ram_size) {
+        cpu->bus.cart_ram[addr - 0xA000] = value;
+    }
+}
+
+static const struct mbc mbc_none = {
+    .name = "none",
+    .write = none_write,
+    .read_ram = none_read_ram,
+    .write_ram = none_write_ram,
+    .banks = none_banks,
+    .serialize = mbc_serialize,
+    .deserialize = mbc_deserialize,
+};
+
+/* MBC1: 5 low ROM bank bits, 2 bits that extend either the ROM bank (mode 0)
+   or select the RAM bank (mode 1). Like before, mode 1 drops the upper ROM
+   bits instead of applying them to 0x0000-0x3FFF. */
+static void mbc1_banks(struct CPU *cpu) {
+    struct MemoryBus *bus = &cpu->bus;
+    if (bus->mbc1_mode == 0) {
+        bus->romx = mbc_rom_bank(bus, bus->rom_bank_hi << 5 | bus->rom_bank_lo);
+        bus->current_ram_bank = 0;
+    } else {
+        bus->romx = mbc_rom_bank(bus, bus->rom_bank_lo);
+        bus->current_ram_bank = bus->rom_bank_hi;
+    }
+    if (bus->ram_size < 0x2000) {
+        bus->sram = NULL; // 2KB wraps around, see mbc1_read_ram()
+    } else {
+        bus->sram = mbc_ram_bank(bus, bus->ram_size >= 0x8000 ? bus->current_ram_bank : 0);
+    }
+}
+
+static void mbc1_write(struct CPU *cpu, uint16_t addr, uint8_t value) {
+    struct MemoryBus *bus = &cpu->bus;
+    if (addr < 0x2000) {
+        bus->ram_enabled = (value & 0x0F) == 0x0A;
+    } else if (addr < 0x4000) {
+        bus->rom_bank_lo = value & 0x1F;
+        if (bus->rom_bank_lo == 0) {
+            bus->rom_bank_lo = 1; // only if lower bits are 0
+        }
+    } else if (addr < 0x6000) {
+        bus->rom_bank_hi = value & 0x03;
+    } else {
+        bus->mbc1_mode = value & 0x01;
+    }
+    mbc1_banks(cpu);
+}
+
+static uint8_t mbc1_read_ram(struct CPU *cpu, uint16_t addr) {
+    struct MemoryBus *bus = &cpu->bus;
+    if (!bus->ram_size) {
+        return 0xFF;
+    }
+    return mbc_ram_read(bus, (addr - 0xA000) % bus->ram_size);
+}
+
+static void mbc1_write_ram(struct CPU *cpu, uint16_t addr, uint8_t value) {
+    struct MemoryBus *bus = &cpu->bus;
+    if (bus->ram_size) {
+        mbc_ram_write(bus, (addr - 0xA000) % bus->ram_size, value);
+    }
+}
+
+static const struct mbc mbc_mbc1 = {
+    .name = "MBC1",
+    .write = mbc1_write,
+    .read_ram = mbc1_read_ram,
+    .write_ram = mbc1_write_ram,
+    .banks = mbc1_banks,
+    .serialize = mbc_serialize,
+    .deserialize = mbc_deserialize,
+};
+
+/* MBC2: 4-bit ROM bank, 512 4-bit cells of built-in RAM repeated over
+   0xA000-0xBFFF. Address bit 8 tells the two registers apart. */
+static void mbc2_banks(struct CPU *cpu) {
+    cpu->bus.romx = mbc_rom_bank(&cpu->bus, cpu->bus.rom_bank_lo);
+    cpu->bus.sram = NULL; // only the low nibble of each cell exists
+}
+
+static void mbc2_write(struct CPU *cpu, uint16_t addr, uint8_t value) {
+    if (addr >= 0x4000) {
+        return;
+    }
+    if (addr & 0x0100) {
+        cpu->bus.rom_bank_lo = value & 0x0F;
+        if (cpu->bus.rom_bank_lo == 0) {
+            cpu->bus.rom_bank_lo = 1;
+        }
+    } else {
+        cpu->bus.ram_enabled = (value & 0x0F) == 0x0A;
+    }
+    mbc2_banks(cpu);
+}
+
+static uint8_t mbc2_read_ram(struct CPU *cpu, uint16_t addr) {
+    struct MemoryBus *bus = &cpu->bus;
+    if (!bus->ram_enabled || !bus->cart_ram || bus->ram_size < 0x200) {
+        return 0xFF;
+    }
+    return bus->cart_ram[addr & 0x1FF] | 0xF0;
+}
+
+static void mbc2_write_ram(struct CPU *cpu, uint16_t addr, uint8_t value) {
+    struct MemoryBus *bus = &cpu->bus;
+    if (bus->ram_enabled && bus->cart_ram && bus->ram_size >= 0x200) {
+        bus->cart_ram[addr & 0x1FF] = value & 0x0F;
+    }
+}
+
+static const struct mbc mbc_mbc2 = {
+    .name = "MBC2",
+    .write = mbc2_write,
+    .read_ram = mbc2_read_ram,
+    .write_ram = mbc2_write_ram,
+    .banks = mbc2_banks,
+    .serialize = mbc_serialize,
+    .deserialize = mbc_deserialize,
+};
+
+/* MBC3: 7-bit ROM bank, RAM banks 0-3 or RTC registers 0x08-0x0C at 0xA000 */
+static void mbc3_banks(struct CPU *cpu) {
+    struct MemoryBus *bus = &cpu->bus;
+    bus->romx = mbc_rom_bank(bus, bus->rom_bank_lo);
+    if (bus->current_rom_bank == 0) {
+        bus->romx = mbc_rom_bank(bus, 1); // wrapped around to 0
+    }
+    bus->sram = bus->current_ram_bank < 0x08 ? mbc_ram_bank(bus, bus->current_ram_bank) : NULL;
+}
+
+static void mbc3_write(struct CPU *cpu, uint16_t addr, uint8_t value) {
+    struct MemoryBus *bus = &cpu->bus;
+    if (addr < 0x2000) { /* RAM/RTC enable (0x0A to enable, any other value to disable) */
+        bus->ram_enabled = (value & 0x0F) == 0x0A;
+    } else if (addr < 0x4000) { /* ROM bank select, 1-127 */
+        bus->rom_bank_lo = value & 0x7F;
+        if (bus->rom_bank_lo == 0) {
+            bus->rom_bank_lo = 1;
+        }
+    } else if (addr < 0x6000) { /* RAM bank or RTC register select */
+        bus->current_ram_bank = value; // 0-3 for RAM banks, 8-12 for RTC registers
+    } else { /* RTC latch, on a 0 then 1 */
+        rtc_latch(cpu, value);
+        save_rtc(cpu);
+        return; // no bank changes
+    }
+    mbc3_banks(cpu);
+}
+
+static uint8_t mbc3_read_ram(struct CPU *cpu, uint16_t addr) {
+    struct MemoryBus *bus = &cpu->bus;
+    if (bus->current_ram_bank >= 0x08) {
+        return bus->ram_enabled ? rtc_read(cpu, bus->current_ram_bank) : 0xFF;
+    }
+    return mbc_ram_read(bus, bus->current_ram_bank * 0x2000 + (addr - 0xA000));
+}
+
+static void mbc3_write_ram(struct CPU *cpu, uint16_t addr, uint8_t value) {
+    struct MemoryBus *bus = &cpu->bus;
+    if (bus->current_ram_bank >= 0x08) {
+        if (bus->ram_enabled) {
+            rtc_write(cpu, bus->current_ram_bank, value);
+            save_rtc(cpu);
+        }
+        return;
+    }
+    mbc_ram_write(bus, bus->current_ram_bank * 0x2000 + (addr - 0xA000), value);
+}
+
+// The common registers, then the clock
+static size_t mbc3_serialize(struct CPU *cpu, uint8_t *out) {
+    size_t size = mbc_serialize(cpu, out);
+    if (out) {
+        rtc_serialize(cpu, out + size);
+    }
+    return size + RTC_STATE_SIZE;
+}
+
+static void mbc3_deserialize(struct CPU *cpu, const uint8_t *in) {
+    rtc_deserialize(cpu, in + mbc_serialize(cpu, NULL));
+    mbc_deserialize(cpu, in);
+}
+
+static const struct mbc mbc_mbc3 = {
+    .name = "MBC3",
+    .write = mbc3_write,
+    .read_ram = mbc3_read_ram,
+    .write_ram = mbc3_write_ram,
+    .banks = mbc3_banks,
+    .serialize = mbc3_serialize,
+    .deserialize = mbc3_deserialize,
+};
+
+/* MBC5: 9-bit ROM bank (low 8 bits, then bit 8), bank 0 included, 4-bit RAM bank */
+static void mbc5_banks(struct CPU *cpu) {
+    struct MemoryBus *bus = &cpu->bus;
+    bus->romx = mbc_rom_bank(bus, (bus->rom_bank_hi & 0x01) << 8 | bus->rom_bank_lo);
+    bus->sram = mbc_ram_bank(bus, bus->current_ram_bank);
+}
+
+static void mbc5_write(struct CPU *cpu, uint16_t addr, uint8_t value) {
+    struct MemoryBus *bus = &cpu->bus;
+    if (addr < 0x2000) {
+        bus->ram_enabled = (value & 0x0F) == 0x0A;
+    } else if (addr < 0x3000) {
+        bus->rom_bank_lo = value;
+    } else if (addr < 0x4000) {
+        bus->rom_bank_hi = value & 0x01;
+    } else if (addr < 0x6000) {
+        bus->current_ram_bank = value & 0x0F;
+    }
+    mbc5_banks(cpu);
+}
+
+static uint8_t mbc5_read_ram(struct CPU *cpu, uint16_t addr) {
+    return mbc_ram_read(&cpu->bus, cpu->bus.current_ram_bank * 0x2000 + (addr - 0xA000));
+}
+
+static void mbc5_write_ram(struct CPU *cpu, uint16_t addr, uint8_t value) {
+    mbc_ram_write(&cpu->bus, cpu->bus.current_ram_bank * 0x2000 + (addr - 0xA000), value);
+}
+
+static const struct mbc mbc_mbc5 = {
+    .name = "MBC5",
+    .write = mbc5_write,
+    .read_ram = mbc5_read_ram,
+    .write_ram = mbc5_write_ram,
+    .banks = mbc5_banks,
+    .serialize = mbc_serialize,
+    .deserialize = mbc_deserialize,
+};
+
+void mbc_init(struct CPU *cpu) {
+    struct MemoryBus *bus = &cpu->bus;
+    switch (bus->mbc_type) {
+        case 1: bus->mbc = &mbc_mbc1; break;
+        case 2: bus->mbc = &mbc_mbc2; break;
+        case 3: bus->mbc = &mbc_mbc3; break;
+        case 5: bus->mbc = &mbc_mbc5; break;
+        default: bus->mbc = &mbc_none; break; // ROM only and types without a mapper yet
+    }
+    bus->rom_bank_lo = 1;
+    bus->rom_bank_hi = 0;
+    bus->mbc1_mode = 0;
+    bus->current_ram_bank = 0;
+    bus->ram_enabled = false;
+    rtc_reset(cpu);
+    bus->mbc->banks(cpu);
+}
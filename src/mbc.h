@@ -0,0 +1,47 @@
+#ifndef _MBC_H
+#define _MBC_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Cartridge mappers
+   Each memory bank controller is a `struct mbc` of callbacks, picked once by
+   mbc_init() from bus.mbc_type (rom_init(), header byte 0x147). Nothing on
+   the generic access path looks at the MBC type:
+
+   - A write below 0x8000 goes to the mapper's write(), which updates its
+     registers and calls its banks() to work out bus.current_rom_bank and
+     the host pointers bus.romx (0x4000) and bus.sram (0xA000). READ_BYTE
+     and the page tables (memmap.h) use those pointers as they are.
+   - Cartridge RAM that isn't one plain 8KB block at 0xA000 (disabled RAM,
+     RAM smaller than a bank, MBC2's 4-bit cells, MBC3 RTC registers) has
+     bus.sram NULL and goes through read_ram()/write_ram().
+   - serialize()/deserialize() save and restore the registers, for save
+     files and states.
+
+   Supported: none (ROM only, ROM+RAM), MBC1, MBC2, MBC3 and MBC5 with its
+   9-bit ROM bank. A new mapper is a new `struct mbc` and a case in
+   mbc_init().
+*/
+
+struct CPU;
+
+struct mbc {
+	const char *name;
+	void (*write)(struct CPU *cpu, uint16_t addr, uint8_t value);     // MBC registers, 0x0000-0x7FFF
+	uint8_t (*read_ram)(struct CPU *cpu, uint16_t addr);              // 0xA000-0xBFFF while bus.sram is NULL
+	void (*write_ram)(struct CPU *cpu, uint16_t addr, uint8_t value); // 0xA000-0xBFFF while bus.sram is NULL
+	void (*banks)(struct CPU *cpu);                                   // current banks from the registers
+	size_t (*serialize)(struct CPU *cpu, uint8_t *out);               // bytes written, or needed if `out` is NULL
+	void (*deserialize)(struct CPU *cpu, const uint8_t *in);          // registers back, banks remapped
+};
+
+/* Pick the mapper for bus.mbc_type and reset its registers
+   Called by load_rom(). Frontends that set up the bus by hand call it
+   after setting rom_banks, cart_ram and their sizes.
+   @param cpu Pointer to the CPU structure.
+   @return void
+*/
+void mbc_init(struct CPU *cpu);
+
+#endif
@@ -0,0 +1,218 @@
+#include "memmap.h"
+#include "cpu.h"
+#include "io.h"
+#include <string.h>
+
+void memory_map_cart(struct CPU *cpu) {
+    struct memory_map *map = &cpu->map;
+    struct MemoryBus *bus = &cpu->bus;
+#ifdef ALLOW_ROM_WRITES
+    (void)map;
+    (void)bus;
+    return;
+#else
+    // the mapper worked both out when the bank last changed, see mbc.h
+    uint8_t *rom = bus->romx;
+    uint8_t *ram = bus->sram;
+    for (int page = 0x40; page < 0x80; page++) {
+        map->read[page] = rom ? rom + (page - 0x40) * 0x100 : NULL;
+    }
+    for (int page = 0xA0; page < 0xC0; page++) {
+        map->read[page] = ram ? ram + (page - 0xA0) * 0x100 : NULL;
+        map->write[page] = map->read[page];
+    }
+#ifdef FASTMEM
+    fastmem_sync(cpu, 0x4, 0xB);
+#endif
+#endif
+}
+
+void memory_map_video(struct CPU *cpu) {
+    struct memory_map *map = &cpu->map;
+#ifdef ALLOW_ROM_WRITES
+    (void)map;
+    return;
+#else
+    uint8_t mode = cpu->bus.io.stat & 0x03;
+    bool vram = mode != 0x03;
+#ifdef FASTMEM
+    bool was_vram = map->read[0x80] != NULL;
+#endif
+    bool oam = mode != 0x02 && mode != 0x03;
+    for (int page = 0x80; page < 0xA0; page++) {
+        uint8_t *host = cpu->bus.vram + (page - 0x80) * 0x100;
+        map->read[page] = vram ? host : NULL;
+        // the boot ROM's own VRAM writes go through write_byte_slow()'s special case,
+        // tile data writes through it to mark the tile for decoding, all of them for a render worker
+        map->write[page] = vram && !cpu->bootrom_enabled && !cpu->bus.vram_watched && page >= 0x98 ? host : NULL;
+    }
+    // OAM, FEA0-FEFF is plain memory as well; writes mark the sprites for indexing
+    map->read[0xFE] = oam ? cpu->bus.oam : NULL;
+#ifdef FASTMEM
+    if (vram != was_vram) {
+        fastmem_sync(cpu, 0x8, 0x9); // tile data is never written through the window, only reads change
+    }
+#endif
+#endif
+}
+
+void memory_map_update(struct CPU *cpu) {
+    struct memory_map *map = &cpu->map;
+    memset(map, 0, sizeof(*map));
+#ifndef ALLOW_ROM_WRITES
+    uint8_t *rom = cpu->bus.rom0;
+    for (int page = 0x00; page < 0x40; page++) {
+        map->read[page] = rom + page * 0x100;
+    }
+    if (cpu->bootrom_enabled) {
+        map->read[0x00] = cpu->bootrom;
+    }
+    for (int page = 0xC0; page < 0xE0; page++) {
+        map->read[page] = cpu->bus.wram + (page - 0xC0) * 0x100;
+        map->write[page] = cpu->bus.wram + (page - 0xC0) * 0x100;
+    }
+    for (int page = 0xE0; page < 0xFE; page++) {
+        map->read[page] = cpu->bus.wram + (page - 0xE0) * 0x100; // echo of WRAM
+    }
+    memory_map_cart(cpu);
+    memory_map_video(cpu);
+#ifdef FASTMEM
+    fastmem_sync(cpu, 0x0, 0xF);
+#endif
+#endif
+}
+
+uint8_t read_byte_slow(struct CPU *cpu, uint16_t addr) {
+    struct MemoryBus *bus = &cpu->bus;
+    if (cpu->bootrom_enabled && addr < 0x0100) {
+        return *(cpu->bootrom + addr);
+    }
+    if (addr < 0x4000) {
+        return bus->rom0[addr];
+    }
+    if (addr < 0x8000) {
+        return bus->romx ? bus->romx[addr - 0x4000] : 0xFF; // no cartridge
+    }
+    if (0xA000 <= addr && addr < 0xC000) {
+        if (bus->sram) {
+            return bus->sram[addr - 0xA000];
+        }
+        return bus->mbc->read_ram(cpu, addr);
+    }
+
+    if (addr < 0xA000) { // VRAM
+        if (cpu->dma_transfer) {
+            return bus->vram[addr - 0x8000];
+        }
+        if ((bus->io.stat & 0x03) == 0x03) { // blocked in mode 3
+            return 0xFF; // Return dummy value if VRAM is blocked
+        }
+        return bus->vram[addr - 0x8000]; // Read from VRAM
+    }
+    if (addr < 0xE000) { // WRAM
+        return bus->wram[addr - 0xC000];
+    }
+    if (addr < 0xFE00) { // Echo RAM
+        #ifdef ALLOW_ROM_WRITES
+        return bus->echo[addr - 0xE000];
+        #endif
+        return bus->wram[addr - 0xE000]; // Read from echo RAM
+    }
+    if (addr < 0xFEA0) { // OAM
+        if (cpu->dma_transfer == true) {
+            return bus->oam[addr - 0xFE00];
+        }
+        uint8_t stat_mode = bus->io.stat & 0x03;
+        if (stat_mode == 0x02 || stat_mode == 0x03) {
+            return 0xFF; // Block reads in mode 2 and 3
+        }
+        return bus->oam[addr - 0xFE00]; // Read from OAM
+    }
+    if (addr < 0xFF00) {
+        return bus->oam[addr - 0xFE00];
+    }
+    if (addr < 0xFF80) {
+        return io_read(cpu, addr); // see io.h
+    }
+    return bus->high[addr - 0xFF00]; // HRAM, IE
+}
+
+static void memory_write(struct CPU *cpu, uint16_t addr, uint8_t value) {
+    struct MemoryBus *bus = &cpu->bus;
+    if (cpu->bootrom_enabled && (addr < 0x0100 || (addr >= 0x8000 && addr < 0xA000))) {
+        if (0x8000 <= addr && addr < 0xA000) {
+            // Allow bootrom to write to VRAM
+            bus->vram[addr - 0x8000] = value;
+            vram_written(bus, addr);
+        } else {
+            *(cpu->bootrom + addr) = value; // bootrom is only 256 bytes
+        }
+        return;
+    } else if (addr < 0x8000) {
+        bus->mbc->write(cpu, addr, value); // MBC registers
+    } else if (addr < 0xA000) {
+        if (cpu->dma_transfer) {
+            bus->vram[addr - 0x8000] = value;
+            vram_written(bus, addr);
+        }
+        if ((bus->io.stat & 0x03) == 0x03) { // blocked in mode 3
+            return; // Return dummy value if VRAM is blocked
+        }
+        bus->vram[addr - 0x8000] = value;
+        vram_written(bus, addr);
+    } else if (addr < 0xC000) {
+        if (bus->sram) {
+            bus->sram[addr - 0xA000] = value;
+        } else {
+            bus->mbc->write_ram(cpu, addr, value);
+        }
+    } else if (addr < 0xE000) { // WRAM
+        bus->wram[addr - 0xC000] = value; // Write to WRAM
+        icache_invalidate(cpu, ICACHE_WRAM + (addr - 0xC000));
+    } else if (addr < 0xFE00) { // Echo RAM (0xE000-0xFDFF)
+        #ifdef ALLOW_ROM_WRITES
+        bus->echo[addr - 0xE000] = value;
+        return;
+        #endif
+        bus->wram[addr - 0xE000] = value;
+        icache_invalidate(cpu, ICACHE_WRAM + (addr - 0xE000));
+    } else if (addr < 0xFEA0) { // OAM
+        
+        if (cpu->dma_transfer == true) {
+            bus->oam[addr - 0xFE00] = value;
+            bus->oam_dirty = true;
+            return;
+        }
+        uint8_t stat_mode = bus->io.stat & 0x03;
+        if (stat_mode == 0x02 || stat_mode == 0x03) {
+            // Block writes in mode 2 and 3
+            return;
+        }
+        bus->oam[addr - 0xFE00] = value;
+        bus->oam_dirty = true;
+    } else if (addr < 0xFF00) {
+        bus->oam[addr - 0xFE00] = value;
+    } else if (addr < 0xFF80) {
+        io_write(cpu, addr, value); // see io.h
+    } else {
+        // HRAM, IE
+        bus->high[addr - 0xFF00] = value;
+        if (addr < 0xFFFF) {
+            icache_invalidate(cpu, ICACHE_HRAM + (addr - 0xFF80));
+        }
+    }
+}
+
+void write_byte_slow(struct CPU *cpu, uint16_t addr, uint8_t value) {
+    if (addr < 0x8000) {
+        // MBC register, games often write the bank they are already in
+        uint8_t *romx = cpu->bus.romx;
+        uint8_t *sram = cpu->bus.sram;
+        memory_write(cpu, addr, value);
+        if (cpu->bus.romx != romx || cpu->bus.sram != sram) {
+            memory_map_cart(cpu);
+        }
+        return;
+    }
+    memory_write(cpu, addr, value);
+}
@@ -0,0 +1,71 @@
+#ifndef _MEMMAP_H
+#define _MEMMAP_H
+
+#include <stdint.h>
+
+/* Page-table memory map
+   READ_BYTE and WRITE_BYTE (cpu.h) look the 256-byte page of an address up
+   in a table of host pointers and access plain memory through it with one
+   load and an add. Pages that need more than that have no pointer and go
+   through read_byte_slow()/write_byte_slow(), the full address decode.
+
+   - Mapped for reading: ROM bank 0 (the boot ROM over page 0 while it is
+     on), the switchable ROM bank, VRAM outside mode 3, enabled cartridge
+     RAM, WRAM, echo RAM and OAM outside modes 2 and 3.
+   - Mapped for writing: the VRAM tile maps (9800-9FFF) likewise, unless a
+     render worker (worker.h) is running, cartridge RAM and WRAM. Tile data
+     (8000-97FF) and OAM are written through the slow path, which marks the
+     tile for the GPU to decode or the sprites for it to index again
+     (graphics.h).
+     ROM (MBC registers), echo RAM, I/O and HRAM always take the slow path,
+     where I/O registers are dispatched through a table (io.h).
+   - The tables only change on an MBC register write (bank switch, RAM
+     enable, RTC select), when the boot ROM is unmapped and when the STAT
+     mode changes, which sched_sync() passes on. Code that changes the bus
+     or STAT directly calls memory_map_update() afterwards. Under -DFASTMEM
+     every rebuild is passed on to the fastmem window as well (fastmem.h).
+   - The sm83 tester build (ALLOW_ROM_WRITES) treats memory as flat RAM with
+     quirks of its own and leaves every page on the slow path.
+*/
+
+struct CPU;
+
+struct memory_map {
+	uint8_t *read[256];  // host address of each page, NULL to use read_byte_slow()
+	uint8_t *write[256]; // host address of each page, NULL to use write_byte_slow()
+};
+
+/* Rebuild the whole map from the bus state
+   @param cpu Pointer to the CPU structure.
+   @return void
+*/
+void memory_map_update(struct CPU *cpu);
+
+/* Rebuild the pages of the switchable ROM bank and cartridge RAM
+   @param cpu Pointer to the CPU structure.
+   @return void
+*/
+void memory_map_cart(struct CPU *cpu);
+
+/* Rebuild the VRAM and OAM pages for the current STAT mode
+   @param cpu Pointer to the CPU structure.
+   @return void
+*/
+void memory_map_video(struct CPU *cpu);
+
+/* Read a byte through the full address decode
+   @param cpu Pointer to the CPU structure.
+   @param addr Address to read.
+   @return the byte
+*/
+uint8_t read_byte_slow(struct CPU *cpu, uint16_t addr);
+
+/* Write a byte through the full address decode, with its side effects
+   @param cpu Pointer to the CPU structure.
+   @param addr Address to write.
+   @param value Byte to write.
+   @return void
+*/
+void write_byte_slow(struct CPU *cpu, uint16_t addr, uint8_t value);
+
+#endif
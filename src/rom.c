@@ -2,6 +2,13 @@
 #include "rom.h"
 #include <stdio.h>
 #include <string.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
 
 /* Generate a save file name based on the ROM filename 
  * Must be freed by the caller
@@ -9,7 +16,7 @@
  */
 char *save_file_name(struct CPU *cpu, const char *filename) {
     // Cartridge type is at 0x147 in the ROM header
-    uint8_t cart_type = cpu->bus.rom[0x147];
+    uint8_t cart_type = cpu->bus.rom0[0x147];
 
     // Cartridge types that support save (SRAM or battery-backed RAM)
     // This list includes common battery-backed cartridges:
@@ -54,7 +61,7 @@ char *save_file_name(struct CPU *cpu, const char *filename) {
 }
 uint8_t rom_init(struct MemoryBus *bus) {
 
-    uint8_t type = bus->rom[0x147];
+    uint8_t type = bus->rom0[0x147];
 
     switch (type) {
         case 0x00:
@@ -109,7 +116,7 @@ uint16_t rom_size(uint8_t *rom) {
 }
 
 int ram_size(struct MemoryBus *bus) {
-    uint8_t ram_type = bus->rom[0x0149];
+    uint8_t ram_type = bus->rom0[0x0149];
     switch (ram_type) {
         case 0x00: // No RAM
             return 0;
@@ -129,40 +136,240 @@ int ram_size(struct MemoryBus *bus) {
 
 
 
+// Loaded images, shared by every CPU running the same ROM
+static struct rom_image *rom_images;
+static pthread_mutex_t rom_images_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// A file an image was loaded from, opening it again skips the hash
+struct rom_file {
+    dev_t dev;
+    ino_t ino;
+    struct timespec mtime; // to the nanosecond where the file system keeps it
+    size_t size;
+    struct rom_image *image;
+    struct rom_file *next;
+};
+static struct rom_file *rom_files;
+
+static struct timespec rom_mtime(const struct stat *st) {
+#if defined(_WIN32)
+    return (struct timespec){ .tv_sec = st->st_mtime };
+#elif defined(__APPLE__)
+    return st->st_mtimespec;
+#else
+    return st->st_mtim;
+#endif
+}
+
+// Same contents as an image's, apart from the header checksum rom_patch() rewrote
+static bool rom_same(const struct rom_image *image, const uint8_t *data, size_t size) {
+    return image->size == size && memcmp(image->data, data, 0x14D) == 0 &&
+           memcmp(image->data + 0x14E, data + 0x14E, size - 0x14E) == 0;
+}
+
+static uint64_t rom_hash(const uint8_t *data, size_t size) {
+    uint64_t hash = 14695981039346656037ull; // FNV-1a
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ data[i]) * 1099511628211ull;
+    }
+    return hash;
+}
+
+// Map `size` bytes of `fd` read-only, NULL on failure
+static uint8_t *rom_map(int fd, size_t size) {
+#ifdef _WIN32
+    uint8_t *data = malloc(size); // no mmap(), every instance still shares it
+    if (data && (lseek(fd, 0, SEEK_SET) != 0 || read(fd, data, size) != (ssize_t)size)) {
+        free(data);
+        data = NULL;
+    }
+    return data;
+#else
+    uint8_t *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    return data == MAP_FAILED ? NULL : data;
+#endif
+}
+
+static void rom_unmap(uint8_t *data, size_t size) {
+#ifdef _WIN32
+    (void)size;
+    free(data);
+#else
+    munmap(data, size);
+#endif
+}
+
+// Patch the header checksum once for every instance, the page is copied on write
+static void rom_patch(struct rom_image *image) {
+#ifndef _WIN32
+    if (mprotect(image->data, 0x1000, PROT_READ | PROT_WRITE) != 0) {
+        return;
+    }
+#endif
+    patch_checksum(image->data);
+#ifndef _WIN32
+    mprotect(image->data, 0x1000, PROT_READ);
+#endif
+}
+
+// Image loaded from the same file before, NULL if none; rom_images_lock held
+static struct rom_image *rom_file_find(const struct stat *st, size_t size, struct timespec mtime) {
+    for (struct rom_file *file = rom_files; file; file = file->next) {
+        if (file->dev == st->st_dev && file->ino == st->st_ino && file->size == size &&
+            file->mtime.tv_sec == mtime.tv_sec && file->mtime.tv_nsec == mtime.tv_nsec) {
+            return file->image;
+        }
+    }
+    return NULL;
+}
+
+/* Get the shared image of the ROM in `fd`
+   Looks the file up by identity, then by contents, and keeps its own
+   mapping only if neither is loaded yet. The mapping is read and hashed
+   without holding rom_images_lock, so other ROMs load meanwhile.
+   @return the image with a reference taken, NULL on failure
+*/
+static struct rom_image *rom_image_open(int fd) {
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < 0x8000) {
+        return NULL;
+    }
+    size_t size = st.st_size;
+    struct timespec mtime = rom_mtime(&st);
+    pthread_mutex_lock(&rom_images_lock);
+    struct rom_image *image = rom_file_find(&st, size, mtime);
+    if (image) {
+        image->refs++; // the same file again, nothing to read
+    }
+    pthread_mutex_unlock(&rom_images_lock);
+    if (image) {
+        return image;
+    }
+
+    uint8_t *data = rom_map(fd, size);
+    if (!data) {
+        return NULL;
+    }
+    uint64_t hash = rom_hash(data, size);
+    pthread_mutex_lock(&rom_images_lock);
+    image = rom_file_find(&st, size, mtime); // opened by another CPU while hashing
+    if (!image) {
+        for (image = rom_images; image; image = image->next) {
+            if (image->hash == hash && rom_same(image, data, size)) {
+                break; // a copy of a ROM already loaded
+            }
+        }
+        if (!image && (image = calloc(1, sizeof(struct rom_image)))) {
+            image->data = data;
+            image->size = size;
+            image->hash = hash;
+#ifdef FASTMEM
+            image->fd = dup(fd);
+#endif
+            rom_patch(image);
+            image->next = rom_images;
+            rom_images = image;
+            data = NULL;
+        }
+        struct rom_file *file = image ? malloc(sizeof(struct rom_file)) : NULL;
+        if (file) {
+            *file = (struct rom_file){ .dev = st.st_dev, .ino = st.st_ino, .mtime = mtime,
+                                       .size = size, .image = image, .next = rom_files };
+            rom_files = file;
+        }
+    }
+    if (image) {
+        image->refs++;
+    }
+    pthread_mutex_unlock(&rom_images_lock);
+    if (data) {
+        rom_unmap(data, size); // already loaded, or out of memory
+    }
+    return image;
+}
+
+#ifdef ICACHE
+struct decoded_inst *rom_decoded(struct rom_image *image, unsigned bank) {
+    struct decoded_inst *table = __atomic_load_n(&image->decoded[bank], __ATOMIC_ACQUIRE);
+    if (table) {
+        return table;
+    }
+    struct decoded_inst *fresh = calloc(ICACHE_BANK_SIZE, sizeof(struct decoded_inst));
+    if (!fresh) {
+        return NULL;
+    }
+    if (!__atomic_compare_exchange_n(&image->decoded[bank], &table, fresh, false,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        free(fresh); // another CPU allocated it first
+        return table;
+    }
+    return fresh;
+}
+#endif
+
+// Drop a reference, unmapping the image once nobody uses it
+static void rom_image_release(struct rom_image *image) {
+    pthread_mutex_lock(&rom_images_lock);
+    if (--image->refs == 0) {
+        struct rom_image **link = &rom_images;
+        while (*link != image) {
+            link = &(*link)->next;
+        }
+        *link = image->next;
+        for (struct rom_file **file = &rom_files; *file;) {
+            struct rom_file *next = (*file)->next;
+            if ((*file)->image == image) {
+                free(*file);
+                *file = next;
+            } else {
+                file = &(*file)->next;
+            }
+        }
+        rom_unmap(image->data, image->size);
+#ifdef FASTMEM
+        if (image->fd >= 0) {
+            close(image->fd);
+        }
+#endif
+#ifdef ICACHE
+        for (int bank = 0; bank < ICACHE_ROM_BANKS; bank++) {
+            free(image->decoded[bank]);
+        }
+#endif
+        free(image);
+    }
+    pthread_mutex_unlock(&rom_images_lock);
+}
+
 int load_rom(struct CPU *cpu, const char *filename) {
-    FILE *file = fopen(filename, "rb");
-    if (!file) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
         perror("Failed to open ROM file");
         return -1;
     }
-    // bank 0
-    if (fread(cpu->bus.rom, 0x4000,1, file) != 1) {
+    struct rom_image *image = rom_image_open(fd);
+    close(fd); // the mapping stays
+    if (!image) {
         fprintf(stderr, "Failed to read ROM data\n");
-        fclose(file);
         return -1;
     }
+    // bank 0 and the banked window both point into the image
+    uint8_t *rom0 = cpu->bus.rom0;
+    cpu->bus.rom0 = image->data;
     cpu->bus.mbc_type = rom_init(&cpu->bus);
 
-    int num_banks = rom_size(cpu->bus.rom); // Number of 16KB ROM banks
-    // return if rom is only 32KB
-    cpu->bus.num_rom_banks = num_banks;
-
-    // bank 01 - nn
-    cpu->bus.rom_banks = malloc((num_banks - 1) * 0x4000); //when reading from ram account for 0x4000 missing (16KB)
-    if (!cpu->bus.rom_banks) {
-        fprintf(stderr, "Failed to allocate memory for ROM BANKS\n");
-        fclose(file);
-        return -1;
-    }
-    if (fread(cpu->bus.rom_banks, 1, (num_banks - 1) * 0x4000, file) != (num_banks - 1) * 0x4000) {
+    int num_banks = rom_size(cpu->bus.rom0); // Number of 16KB ROM banks
+    if (num_banks < 2 || (size_t)num_banks * 0x4000 > image->size) {
         LOG(stderr, "Failed to read ROM BANKS data\n");
-        free(cpu->bus.rom_banks);
-        fclose(file);
+        cpu->bus.rom0 = rom0;
+        rom_image_release(image);
         return -1;
     }
+    cpu->bus.num_rom_banks = num_banks;
+    cpu->bus.image = image;
+    cpu->bus.rom_banks = image->data + 0x4000; // read-only, bank 1 on
     cpu->bus.rom_size = num_banks * 0x4000;
     cpu->bus.rom_banking_toggle = true; // Enable banking for MBCs that support it
-    cpu->bus.current_rom_bank = 1;
 
     LOG("ROM loaded: %s, type: 0x%02X, size: %d banks (%d KB)\n",
         filename, cpu->bus.mbc_type, num_banks, num_banks * 16);
@@ -177,7 +384,7 @@ int load_rom(struct CPU *cpu, const char *filename) {
         64 * 1024  // 0x05: 64 KB
     };
 
-    uint8_t ram_size = cpu->bus.rom[0x149]; // RAM size code from header
+    uint8_t ram_size = cpu->bus.rom0[0x149]; // RAM size code from header
     size_t cart_ram_size = 0;
 
 
@@ -186,6 +393,9 @@ int load_rom(struct CPU *cpu, const char *filename) {
     } else {
         cart_ram_size = 0; // unknown or no RAM
     }
+    if (cpu->bus.mbc_type == 2) {
+        cart_ram_size = 512; // built into MBC2, 4 bits each, the header says none
+    }
 
     cpu->bus.cart_ram = NULL;
     cpu->bus.ram_size = cart_ram_size;
@@ -203,10 +413,36 @@ int load_rom(struct CPU *cpu, const char *filename) {
         }
     }
 
-    fclose(file);
+    mbc_init(cpu);
+    memory_map_update(cpu);
+#ifdef HLE
+    int routines = hle_scan(cpu);
+    LOG("Library routines recognized: %d\n", routines);
+    (void)routines;
+#endif
     return 0;
 }
 
+void unload_rom(struct CPU *cpu) {
+    if (cpu->bus.image) {
+        rom_image_release(cpu->bus.image);
+        cpu->bus.image = NULL;
+    }
+    if (!cpu->save) {
+        free(cpu->bus.cart_ram); // else still the mapped .sav, see save_unmap()
+    }
+    cpu->bus.cart_ram = NULL;
+    cpu->bus.ram_size = 0;
+    cpu->bus.rom_banks = NULL;
+    cpu->bus.rom0 = (uint8_t *)no_cartridge;
+    cpu->bus.num_rom_banks = 0;
+    mbc_init(cpu);
+    memory_map_update(cpu);
+#ifdef HLE
+    hle_scan(cpu); // nothing left to find
+#endif
+}
+
 int load_bootrom(struct CPU *cpu, const char *filename) {
     FILE *file = fopen(filename, "rb");
     if (!file) {
@@ -227,6 +463,7 @@ int load_bootrom(struct CPU *cpu, const char *filename) {
 
     cpu->bootrom_enabled = true;  // Enable boot ROM overlay
     cpu->pc = 0x0000;             // Start execution at boot ROM
+    memory_map_update(cpu);
     return 0;
 }
 
@@ -238,18 +475,26 @@ void patch_checksum(uint8_t *rom) {
     rom[0x014D] = checksum; // Overwrite the checksum byte
 }
 
-/* Load save file data into cartridge RAM
+// MBC3 with a clock, saved in a footer after the cartridge RAM (rtc.h)
+bool save_has_rtc(struct CPU *cpu) {
+    uint8_t cart_type = cpu->bus.rom0[0x147];
+    return cart_type == MBC3_TIMER_BATTERY || cart_type == MBC3_TIMER_RAM_BATTERY;
+}
+
+/* Load save file data into cartridge RAM, and the clock footer if the cartridge has an RTC
  * Returns 0 on success, -1 on failure (file not found is not considered failure)
  */
 int load_save_file(struct CPU *cpu, const char *save_path) {
     LOG("load_save_file called with path: %s\n", save_path ? save_path : "NULL");
     LOG("  cart_ram: %p, ram_size: %zu\n", cpu->bus.cart_ram, cpu->bus.ram_size);
+    bool rtc = save_has_rtc(cpu);
     
-    if (!save_path || !cpu->bus.cart_ram || cpu->bus.ram_size == 0) {
+    if (!save_path || ((!cpu->bus.cart_ram || cpu->bus.ram_size == 0) && !rtc)) {
         LOG("  Skipping load: save_path=%p, cart_ram=%p, ram_size=%zu\n", 
             save_path, cpu->bus.cart_ram, cpu->bus.ram_size);
         return 0; // No save path or no RAM to load into
     }
+    size_t ram_size = cpu->bus.cart_ram ? cpu->bus.ram_size : 0;
 
     FILE *file = fopen(save_path, "rb");
     if (!file) {
@@ -262,21 +507,28 @@ int load_save_file(struct CPU *cpu, const char *save_path) {
     long file_size = ftell(file);
     fseek(file, 0, SEEK_SET);
 
-    // Verify file size matches expected RAM size
-    if (file_size != (long)cpu->bus.ram_size) {
+    // Verify file size matches expected RAM size, plus the clock footer if there is one
+    size_t footer = file_size > (long)ram_size ? (size_t)file_size - ram_size : 0;
+    if (file_size < (long)ram_size ||
+        (footer && (!rtc || (footer != RTC_FOOTER_SIZE && footer != RTC_FOOTER_SIZE_32)))) {
         LOG("Warning: Save file size (%ld) doesn't match expected RAM size (%zu)\n", 
-            file_size, cpu->bus.ram_size);
+            file_size, ram_size);
         fclose(file);
         return -1;
     }
 
     // Load save data into cart RAM
-    size_t bytes_read = fread(cpu->bus.cart_ram, 1, cpu->bus.ram_size, file);
+    size_t bytes_read = fread(cpu->bus.cart_ram, 1, ram_size, file);
+    uint8_t rtc_footer[RTC_FOOTER_SIZE];
+    if (footer && bytes_read == ram_size && fread(rtc_footer, 1, footer, file) == footer) {
+        rtc_load(cpu, rtc_footer, footer);
+        bytes_read += footer;
+    }
     fclose(file);
 
-    if (bytes_read != cpu->bus.ram_size) {
+    if (bytes_read != ram_size + footer) {
         LOG("Error: Failed to read complete save file (read %zu of %zu bytes)\n", 
-            bytes_read, cpu->bus.ram_size);
+            bytes_read, ram_size + footer);
         return -1;
     }
 
@@ -285,13 +537,16 @@ int load_save_file(struct CPU *cpu, const char *save_path) {
     return 0;
 }
 
-/* Write save file data from cartridge RAM
+/* Write save file data from cartridge RAM, then the clock footer if the cartridge has an RTC
  * Returns 0 on success, -1 on failure
  */
 int write_save_file(struct CPU *cpu, const char *save_path) {
-    if (!save_path || !cpu->bus.cart_ram || cpu->bus.ram_size == 0) {
+    bool rtc = save_has_rtc(cpu);
+    if (!save_path || ((!cpu->bus.cart_ram || cpu->bus.ram_size == 0) && !rtc)) {
         return 0; // No save path or no RAM to save
     }
+    size_t ram_size = cpu->bus.cart_ram ? cpu->bus.ram_size : 0;
+    size_t footer = rtc ? RTC_FOOTER_SIZE : 0;
 
     FILE *file = fopen(save_path, "wb");
     if (!file) {
@@ -300,12 +555,17 @@ int write_save_file(struct CPU *cpu, const char *save_path) {
     }
 
     // Write all cartridge RAM to file
-    size_t bytes_written = fwrite(cpu->bus.cart_ram, 1, cpu->bus.ram_size, file);
+    size_t bytes_written = fwrite(cpu->bus.cart_ram, 1, ram_size, file);
+    if (rtc) {
+        uint8_t rtc_footer[RTC_FOOTER_SIZE];
+        rtc_save(cpu, rtc_footer);
+        bytes_written += fwrite(rtc_footer, 1, footer, file);
+    }
     fclose(file);
 
-    if (bytes_written != cpu->bus.ram_size) {
+    if (bytes_written != ram_size + footer) {
         LOG("Error: Failed to write complete save file (wrote %zu of %zu bytes)\n", 
-            bytes_written, cpu->bus.ram_size);
+            bytes_written, ram_size + footer);
         return -1;
     }
 
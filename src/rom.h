@@ -51,15 +51,53 @@
 #define SIZE_1_2MB 0x53
 #define SIZE_1_5MB 0x54
 
+/* Shared ROM images
+   load_rom() maps the ROM file read-only instead of reading it into the
+   bus: bus.rom0 and bus.rom_banks point into the mapping. CPUs loading the
+   same ROM in one process share one image, found by file identity or else
+   by a hash of the contents, and unload_rom() drops the reference. The
+   header checksum is patched once per image, in a copy-on-write page.
+   Loading a file not seen before reads all of it for the hash, so every
+   page of the mapping is faulted in at startup rather than when the game
+   first reaches it; hashing takes a few milliseconds per MB, some 20 ms
+   for an 8 MB ROM. Loading the same file again skips that.
+*/
+struct rom_image {
+	uint8_t *data;          // the whole file, mapped read-only
+	size_t size;            // bytes mapped
+	uint64_t hash;          // FNV-1a of the contents as loaded
+	int refs;               // CPUs using it
+	struct rom_image *next; // next loaded image
+#ifdef FASTMEM
+	int fd;                 // the file, kept open for fastmem windows to map banks from, -1 if not
+#endif
+#ifdef ICACHE
+	struct decoded_inst *decoded[ICACHE_ROM_BANKS]; // predecoded banks, [0] is the fixed one, see rom_decoded()
+#endif
+};
+
+#ifdef ICACHE
+/* Predecoded instructions of one bank of an image
+   Allocated on first use and kept until the image is unmapped; CPUs sharing
+   the image fill it in together (cpu.h).
+   @param image Shared ROM image.
+   @param bank ROM bank, below ICACHE_ROM_BANKS.
+   @return ICACHE_BANK_SIZE entries, NULL if out of memory
+*/
+struct decoded_inst *rom_decoded(struct rom_image *image, unsigned bank);
+#endif
+
 uint8_t rom_init(struct MemoryBus *bus);
 uint16_t rom_size(uint8_t *rom);
 int ram_size(struct MemoryBus *bus);
 int load_rom(struct CPU *cpu, const char *filename);
+void unload_rom(struct CPU *cpu);
 int load_bootrom(struct CPU *cpu, const char *filename);
 void patch_checksum(uint8_t *rom);
 char *save_file_name(struct CPU *cpu, const char *filename);
 int load_save_file(struct CPU *cpu, const char *save_path);
 int write_save_file(struct CPU *cpu, const char *save_path);
+bool save_has_rtc(struct CPU *cpu);
 
 
 #endif // _ROM_H
\ No newline at end of file
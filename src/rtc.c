@@ -0,0 +1,137 @@
+#include "rtc.h"
+#include "cpu.h"
+#include <string.h>
+#include <time.h>
+
+// Bits of each register that exist, the rest read as 0
+static const uint8_t rtc_mask[RTC_REGISTERS] = { 0x3F, 0x3F, 0x1F, 0xFF, 0xC1 };
+
+static uint64_t rtc_now(struct CPU *cpu) {
+    return cpu->rtc.emulated ? cpu->sched.now : (uint64_t)time(NULL);
+}
+
+// Move the registers on by the whole seconds since `base`
+static void rtc_update(struct CPU *cpu) {
+    struct rtc *rtc = &cpu->rtc;
+    uint64_t now = rtc_now(cpu);
+    uint64_t rate = rtc->emulated ? RTC_HZ : 1;
+    if ((rtc->reg[RTC_DH] & 0x40) || now < rtc->base) {
+        rtc->base = now; // halted, or the wall clock was set back
+        return;
+    }
+    uint64_t elapsed = (now - rtc->base) / rate;
+    if (!elapsed) {
+        return;
+    }
+    rtc->base += elapsed * rate; // the second in progress carries on
+
+    uint64_t s = rtc->reg[RTC_S] + elapsed;
+    uint64_t m = rtc->reg[RTC_M] + s / 60;
+    uint64_t h = rtc->reg[RTC_H] + m / 60;
+    uint64_t d = ((rtc->reg[RTC_DH] & 0x01) << 8 | rtc->reg[RTC_DL]) + h / 24;
+    if (d >= 512) {
+        rtc->reg[RTC_DH] |= 0x80; // stays set until the game clears it
+    }
+    rtc->reg[RTC_S] = s % 60;
+    rtc->reg[RTC_M] = m % 60;
+    rtc->reg[RTC_H] = h % 24;
+    rtc->reg[RTC_DL] = d & 0xFF;
+    rtc->reg[RTC_DH] = (rtc->reg[RTC_DH] & 0xC0) | (d >> 8 & 0x01);
+}
+
+void rtc_reset(struct CPU *cpu) {
+    struct rtc *rtc = &cpu->rtc;
+    memset(rtc->reg, 0, sizeof(rtc->reg));
+    memset(rtc->latched, 0, sizeof(rtc->latched));
+    rtc->latch = 0;
+    rtc->base = rtc_now(cpu);
+}
+
+void rtc_set_emulated(struct CPU *cpu, bool emulated) {
+    rtc_update(cpu);
+    cpu->rtc.emulated = emulated;
+    cpu->rtc.base = rtc_now(cpu);
+}
+
+void rtc_latch(struct CPU *cpu, uint8_t value) {
+    struct rtc *rtc = &cpu->rtc;
+    if (rtc->latch == 0x00 && value == 0x01) {
+        rtc_update(cpu);
+        memcpy(rtc->latched, rtc->reg, sizeof(rtc->latched));
+    }
+    rtc->latch = value;
+}
+
+uint8_t rtc_read(struct CPU *cpu, uint8_t reg) {
+    if (reg < 0x08 || reg - 0x08 >= RTC_REGISTERS) {
+        return 0xFF;
+    }
+    return cpu->rtc.latched[reg - 0x08];
+}
+
+void rtc_write(struct CPU *cpu, uint8_t reg, uint8_t value) {
+    struct rtc *rtc = &cpu->rtc;
+    if (reg < 0x08 || reg - 0x08 >= RTC_REGISTERS) {
+        return;
+    }
+    rtc_update(cpu);
+    reg -= 0x08;
+    rtc->reg[reg] = rtc->latched[reg] = value & rtc_mask[reg];
+    if (reg == RTC_S) {
+        rtc->base = rtc_now(cpu);
+    }
+}
+
+static void rtc_put32(uint8_t *out, uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+        out[i] = value >> (8 * i);
+    }
+}
+
+static uint64_t rtc_get(const uint8_t *in, int bytes) {
+    uint64_t value = 0;
+    for (int i = 0; i < bytes; i++) {
+        value |= (uint64_t)in[i] << (8 * i);
+    }
+    return value;
+}
+
+void rtc_save(struct CPU *cpu, uint8_t *out) {
+    struct rtc *rtc = &cpu->rtc;
+    rtc_update(cpu);
+    for (int i = 0; i < RTC_REGISTERS; i++) {
+        rtc_put32(out + 4 * i, rtc->reg[i]);
+        rtc_put32(out + 4 * (RTC_REGISTERS + i), rtc->latched[i]);
+    }
+    uint64_t saved = (uint64_t)time(NULL);
+    rtc_put32(out + 40, (uint32_t)saved);
+    rtc_put32(out + 44, (uint32_t)(saved >> 32));
+}
+
+void rtc_load(struct CPU *cpu, const uint8_t *in, size_t size) {
+    struct rtc *rtc = &cpu->rtc;
+    for (int i = 0; i < RTC_REGISTERS; i++) {
+        rtc->reg[i] = rtc_get(in + 4 * i, 4) & rtc_mask[i];
+        rtc->latched[i] = rtc_get(in + 4 * (RTC_REGISTERS + i), 4) & rtc_mask[i];
+    }
+    uint64_t saved = rtc_get(in + 40, size >= RTC_FOOTER_SIZE ? 8 : 4);
+    // wall-clock time catches up on the next latch, emulated time starts from here
+    rtc->base = rtc->emulated ? rtc_now(cpu) : saved;
+}
+
+void rtc_serialize(struct CPU *cpu, uint8_t *out) {
+    struct rtc *rtc = &cpu->rtc;
+    memcpy(out, rtc->reg, RTC_REGISTERS);
+    memcpy(out + RTC_REGISTERS, rtc->latched, RTC_REGISTERS);
+    out[2 * RTC_REGISTERS] = rtc->latch;
+    rtc_put32(out + 2 * RTC_REGISTERS + 1, (uint32_t)rtc->base);
+    rtc_put32(out + 2 * RTC_REGISTERS + 5, (uint32_t)(rtc->base >> 32));
+}
+
+void rtc_deserialize(struct CPU *cpu, const uint8_t *in) {
+    struct rtc *rtc = &cpu->rtc;
+    memcpy(rtc->reg, in, RTC_REGISTERS);
+    memcpy(rtc->latched, in + RTC_REGISTERS, RTC_REGISTERS);
+    rtc->latch = in[2 * RTC_REGISTERS];
+    rtc->base = rtc_get(in + 2 * RTC_REGISTERS + 1, 8);
+}
@@ -0,0 +1,115 @@
+#ifndef _RTC_H
+#define _RTC_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/* MBC3 real-time clock
+   The clock isn't ticked: it keeps the five registers as they were at a
+   base time and works out how far they have moved on only when the game
+   latches them (0 then 1 written to 0x6000-0x7FFF), writes one, or the
+   clock is saved. Reads of 0xA000 with RAM bank 0x08-0x0C selected return
+   the latched copy.
+
+   Time is wall-clock seconds (time()) by default. In emulated time it is
+   sched.now at 4194304 cycles per second instead, so a replay of the same
+   input latches the same values; the clock then doesn't move while the
+   emulator isn't running.
+
+   The clock persists in the footer most emulators append to the .sav file:
+   the five registers and the five latched registers as little-endian 32-bit
+   words, then the wall-clock time they were saved at as a 64-bit word (48
+   bytes; the older 44-byte footer with a 32-bit time is also read).
+*/
+
+struct CPU;
+
+enum rtc_register {
+	RTC_S,  // seconds, 0-59
+	RTC_M,  // minutes, 0-59
+	RTC_H,  // hours, 0-23
+	RTC_DL, // low 8 bits of the day counter
+	RTC_DH, // bit 0 day counter bit 8, bit 6 halt, bit 7 day counter carry
+	RTC_REGISTERS
+};
+
+#define RTC_HZ 4194304 // cycles per second in emulated time
+#define RTC_FOOTER_SIZE 48
+#define RTC_FOOTER_SIZE_32 44 // footer with a 32-bit timestamp
+#define RTC_STATE_SIZE (2 * RTC_REGISTERS + 1 + 8) // rtc_serialize()
+
+struct rtc {
+	uint8_t reg[RTC_REGISTERS];     // counting registers as of `base`
+	uint8_t latched[RTC_REGISTERS]; // copy the game reads, from the last latch
+	uint8_t latch;                  // last byte written to 0x6000-0x7FFF
+	bool emulated;                  // count sched.now cycles instead of wall-clock seconds
+	uint64_t base;                  // time reg[] was brought up to, seconds or cycles
+};
+
+/* Stop the clock at zero and start it from now
+   Keeps the time mode. Called by mbc_init().
+   @param cpu Pointer to the CPU structure.
+   @return void
+*/
+void rtc_reset(struct CPU *cpu);
+
+/* Switch between wall-clock and emulated time
+   The registers are brought up to now in the old mode first, so the clock
+   carries on from the same values.
+   @param cpu Pointer to the CPU structure.
+   @param emulated true to count sched.now cycles, false for wall-clock seconds.
+   @return void
+*/
+void rtc_set_emulated(struct CPU *cpu, bool emulated);
+
+/* Write the latch register, 0x6000-0x7FFF
+   0 then 1 copies the registers, brought up to now, into the latched copy.
+   @param cpu Pointer to the CPU structure.
+   @param value Byte written.
+   @return void
+*/
+void rtc_latch(struct CPU *cpu, uint8_t value);
+
+/* Read a latched register
+   @param cpu Pointer to the CPU structure.
+   @param reg RAM bank selected, 0x08-0x0C.
+   @return the latched value, 0xFF for a bank past 0x0C
+*/
+uint8_t rtc_read(struct CPU *cpu, uint8_t reg);
+
+/* Write a register
+   Sets both the counting and the latched value. Writing the seconds
+   restarts the second in progress.
+   @param cpu Pointer to the CPU structure.
+   @param reg RAM bank selected, 0x08-0x0C.
+   @param value Byte written.
+   @return void
+*/
+void rtc_write(struct CPU *cpu, uint8_t reg, uint8_t value);
+
+/* Write the .sav footer
+   @param cpu Pointer to the CPU structure.
+   @param out RTC_FOOTER_SIZE bytes.
+   @return void
+*/
+void rtc_save(struct CPU *cpu, uint8_t *out);
+
+/* Read a .sav footer
+   In wall-clock time the clock moves on by the time since it was saved;
+   in emulated time it carries on from the saved values.
+   @param cpu Pointer to the CPU structure.
+   @param in The footer.
+   @param size RTC_FOOTER_SIZE or RTC_FOOTER_SIZE_32.
+   @return void
+*/
+void rtc_load(struct CPU *cpu, const uint8_t *in, size_t size);
+
+/* Save and restore the clock for a state, RTC_STATE_SIZE bytes
+   Unlike the footer this keeps `base` as it is, so emulated time restores
+   exactly.
+*/
+void rtc_serialize(struct CPU *cpu, uint8_t *out);
+void rtc_deserialize(struct CPU *cpu, const uint8_t *in);
+
+#endif
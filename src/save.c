@@ -0,0 +1,192 @@
+#include "save.h"
+#include "cpu.h"
+#include "rom.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#ifndef _WIN32
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#endif
+
+#ifndef _WIN32
+
+struct save_map {
+    uint8_t *data;         // the mapped file: cartridge RAM, then the RTC footer if any
+    size_t size;           // bytes mapped
+    size_t ram_size;       // bytes of cartridge RAM at the start
+    int fd;                // the .sav file
+    pthread_t flusher;     // background thread
+    pthread_mutex_t lock;  // guards stop, for the flusher's timed wait
+    pthread_cond_t wake;   // signalled by save_unmap()
+    bool stop;             // flusher exits
+};
+
+// Sync the mapping every SAVE_FLUSH_MS, the kernel writes only the pages the game or the clock dirtied
+static void *save_flusher(void *arg) {
+    struct save_map *save = arg;
+    pthread_mutex_lock(&save->lock);
+    while (!save->stop) {
+        struct timespec until;
+        clock_gettime(CLOCK_REALTIME, &until);
+        until.tv_sec += SAVE_FLUSH_MS / 1000;
+        until.tv_nsec += (SAVE_FLUSH_MS % 1000) * 1000000L;
+        if (until.tv_nsec >= 1000000000L) {
+            until.tv_sec++;
+            until.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait(&save->wake, &save->lock, &until);
+        if (save->stop) {
+            break;
+        }
+        pthread_mutex_unlock(&save->lock);
+        // nothing here reads the RAM, the game's stores only dirty pages for the next msync()
+        msync(save->data, save->size, MS_SYNC);
+        pthread_mutex_lock(&save->lock);
+    }
+    pthread_mutex_unlock(&save->lock);
+    return NULL;
+}
+
+int save_map(struct CPU *cpu, const char *save_path) {
+    struct MemoryBus *bus = &cpu->bus;
+    bool rtc = save_has_rtc(cpu);
+    size_t ram_size = bus->cart_ram ? bus->ram_size : 0;
+    if (!save_path || cpu->save || (!ram_size && !rtc)) {
+        return -1;
+    }
+    size_t size = ram_size + (rtc ? RTC_FOOTER_SIZE : 0);
+
+    int fd = open(save_path, O_RDWR | O_CREAT, 0644);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+    // an existing file is the RAM, maybe with a clock footer, as load_save_file() reads it
+    size_t old_size = st.st_size;
+    size_t footer = old_size > ram_size ? old_size - ram_size : 0;
+    if ((old_size && old_size < ram_size) ||
+        (footer && (!rtc || (footer != RTC_FOOTER_SIZE && footer != RTC_FOOTER_SIZE_32)))) {
+        LOG("Warning: Save file size (%zu) doesn't match expected RAM size (%zu)\n", old_size, ram_size);
+        close(fd);
+        return -1;
+    }
+    uint8_t rtc_footer[RTC_FOOTER_SIZE];
+    if (footer && pread(fd, rtc_footer, footer, ram_size) != (ssize_t)footer) {
+        footer = 0;
+    }
+
+    struct save_map *save = calloc(1, sizeof(struct save_map));
+    uint8_t *data = MAP_FAILED;
+    if (save && (old_size == size || ftruncate(fd, size) == 0)) {
+        data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    if (data == MAP_FAILED) {
+        goto fail;
+    }
+    save->data = data;
+    save->size = size;
+    save->ram_size = ram_size;
+    save->fd = fd;
+    pthread_mutex_init(&save->lock, NULL);
+    pthread_cond_init(&save->wake, NULL);
+
+    if (!old_size) {
+        memcpy(data, bus->cart_ram, ram_size); // new file
+    }
+    if (footer) {
+        rtc_load(cpu, rtc_footer, footer);
+    }
+    if (rtc) {
+        rtc_save(cpu, data + ram_size); // a 44-byte footer becomes the 48-byte one
+    }
+    if (pthread_create(&save->flusher, NULL, save_flusher, save) != 0) {
+        pthread_mutex_destroy(&save->lock);
+        pthread_cond_destroy(&save->wake);
+        munmap(data, size);
+        goto fail;
+    }
+
+    free(bus->cart_ram);
+    bus->cart_ram = ram_size ? data : NULL;
+    cpu->save = save;
+    cpu->save_loaded = true;
+    LOG("Save file mapped: %s (%zu bytes)\n", save_path, size);
+    bus->mbc->banks(cpu); // the RAM banks' new host addresses
+    memory_map_update(cpu);
+    return 0;
+
+fail:
+    free(save);
+    close(fd);
+    return -1;
+}
+
+void save_rtc(struct CPU *cpu) {
+    struct save_map *save = cpu->save;
+    if (save && save->size > save->ram_size) {
+        rtc_save(cpu, save->data + save->ram_size);
+    }
+}
+
+int save_unmap(struct CPU *cpu) {
+    struct save_map *save = cpu->save;
+    struct MemoryBus *bus = &cpu->bus;
+    if (!save) {
+        return 0;
+    }
+    save_rtc(cpu);
+    msync(save->data, save->size, MS_SYNC);
+    // back to plain heap memory, which unload_rom() frees
+    uint8_t *cart_ram = NULL;
+    if (save->ram_size && !(cart_ram = malloc(save->ram_size))) {
+        fprintf(stderr, "Out of memory moving the save off its file, it stays mapped\n");
+        return -1;
+    }
+
+    pthread_mutex_lock(&save->lock);
+    save->stop = true;
+    pthread_cond_signal(&save->wake);
+    pthread_mutex_unlock(&save->lock);
+    pthread_join(save->flusher, NULL);
+
+    if (cart_ram) {
+        memcpy(cart_ram, save->data, save->ram_size);
+        bus->cart_ram = cart_ram;
+    }
+    munmap(save->data, save->size);
+    close(save->fd);
+    pthread_mutex_destroy(&save->lock);
+    pthread_cond_destroy(&save->wake);
+    free(save);
+    cpu->save = NULL;
+    bus->mbc->banks(cpu);
+    memory_map_update(cpu);
+    return 0;
+}
+
+#else
+
+int save_map(struct CPU *cpu, const char *save_path) {
+    (void)cpu;
+    (void)save_path;
+    return -1; // no mmap(), the frontend writes the file on exit
+}
+
+void save_rtc(struct CPU *cpu) {
+    (void)cpu;
+}
+
+int save_unmap(struct CPU *cpu) {
+    (void)cpu;
+    return 0;
+}
+
+#endif
@@ -0,0 +1,65 @@
+#ifndef _SAVE_H
+#define _SAVE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/* Battery saves mapped from the .sav file
+   save_map() maps the save file MAP_SHARED and makes it the cartridge RAM,
+   so a game's writes land in the page cache as they happen, through the
+   same page tables (memmap.h) as before. Nothing is written from the
+   emulation thread and the save survives the emulator crashing.
+
+   A background thread wakes every SAVE_FLUSH_MS and msync()s the mapping,
+   whether or not anything changed, so it reaches the disk as well. It
+   never reads the RAM: the kernel writes back only the pages the game
+   dirtied, so an unchanged save costs a system call a second. The file is
+   updated in place, with no temporary file and rename, and there is no
+   flush after a number of writes; a file that doesn't exist yet is created
+   at the cartridge's RAM size.
+
+   Cartridges with a clock have the RTC footer (rtc.h) after the RAM. It is
+   read by save_map() and rewritten in the mapping whenever the game writes
+   or latches the clock (save_rtc()), so after a crash the clock carries on
+   from the last time the game looked at it.
+
+   Not available on Windows: save_map() fails and the frontend keeps using
+   load_save_file() and write_save_file().
+*/
+
+struct CPU;
+
+#define SAVE_FLUSH_MS 1000 // how often the flusher syncs the file
+
+struct save_map; // the mapping and its flusher thread, in save.c
+
+/* Map the save file as cartridge RAM and start the flusher
+   Call after load_rom(), instead of load_save_file(). The file's contents
+   replace the RAM; a new file gets the RAM as it is.
+   @param cpu Pointer to the CPU structure, with the ROM loaded.
+   @param save_path Path of the .sav file.
+   @return 0 on success, -1 if the file couldn't be mapped or has the wrong
+           size (the CPU is left as it was)
+*/
+int save_map(struct CPU *cpu, const char *save_path);
+
+/* The game wrote or latched the clock
+   Writes the RTC footer into the mapping, for the flusher to sync. Called
+   by the MBC3 mapper; does nothing if the save isn't mapped or has no clock.
+   @param cpu Pointer to the CPU structure.
+   @return void
+*/
+void save_rtc(struct CPU *cpu);
+
+/* Write the RTC footer, sync the file and stop the flusher
+   Cartridge RAM goes back into malloc()ed memory. Call before
+   unload_rom(); does nothing if the save isn't mapped.
+   @param cpu Pointer to the CPU structure.
+   @return 0 on success, -1 if there was no memory for the RAM: the file is
+           synced but stays mapped as cartridge RAM, and unload_rom() leaves
+           it alone
+*/
+int save_unmap(struct CPU *cpu);
+
+#endif
@@ -0,0 +1,61 @@
+#include "sched.h"
+#include "cpu.h"
+#include "graphics.h"
+#include "timer.h"
+
+// Earliest due of all sources
+static void sched_update_next(struct scheduler *sched) {
+    uint64_t next = SCHED_NEVER;
+    for (int i = 0; i < SCHED_SOURCES; i++) {
+        if (sched->slot[i].due < next) {
+            next = sched->slot[i].due;
+        }
+    }
+    sched->next = next;
+}
+
+// Time `cycles` from now, SCHED_NEVER for UINT32_MAX
+static uint64_t sched_after(struct scheduler *sched, uint32_t cycles) {
+    return cycles == UINT32_MAX ? SCHED_NEVER : sched->now + cycles;
+}
+
+void sched_sync(struct CPU *cpu, enum sched_source source) {
+    struct scheduler *sched = &cpu->sched;
+    struct sched_slot *slot = &sched->slot[source];
+    if (!sched->gpu) {
+        return;
+    }
+    uint32_t cycles = (uint32_t)(sched->now - slot->synced);
+    slot->synced = sched->now; // the source's own register accesses don't come back here
+
+    switch (source) {
+        case SCHED_TIMER:
+            timer_advance(cpu, cycles);
+            slot->due = sched_after(sched, timer_cycles_to_event(cpu, false, false));
+            break;
+        case SCHED_PPU:
+            step_gpu(sched->gpu, cycles);
+            memory_map_video(cpu); // VRAM and OAM open and close with the mode
+            slot->due = sched_after(sched, gpu_cycles_to_event(sched->gpu));
+            break;
+        default:
+            break;
+    }
+    sched_update_next(sched);
+}
+
+void sched_run_due(struct CPU *cpu) {
+    struct scheduler *sched = &cpu->sched;
+    // the timer before the GPU, in the order the frontends used to step them
+    for (int i = 0; i < SCHED_SOURCES; i++) {
+        if (sched->slot[i].due <= sched->now) {
+            sched_sync(cpu, i);
+        }
+    }
+}
+
+void sched_sync_all(struct CPU *cpu) {
+    for (int i = 0; i < SCHED_SOURCES; i++) {
+        sched_sync(cpu, i);
+    }
+}
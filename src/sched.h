@@ -0,0 +1,68 @@
+#ifndef _SCHED_H
+#define _SCHED_H
+
+#include <stdint.h>
+
+/* Event scheduler
+   Time is a 64-bit count of cycles since power on (sched.now), moved along
+   by cpu_run_cycles() after every instruction. Each device that is stepped
+   lazily is a source with the time it has been stepped up to and the time
+   it next has to be, e.g. its next PPU mode change or TIMA overflow. The
+   interpreter runs instructions back to back up to the earliest of those
+   (or a register write that makes a source due) and the run loop then only
+   steps the sources that are due.
+
+   - A source is also stepped when the CPU reads a register it keeps
+     counting (DIV, TIMA) or is about to write one that changes how it
+     counts (TAC, LCDC, ...). After such a write it is due again at once, so
+     it works out its next event with the new value.
+   - LY, STAT, LYC coincidence and IF only change at a source's events, so
+     reading them needs no stepping.
+   - OAM DMA is done in one go when FF46 is written and there is no serial
+     port yet, so neither has a source. New devices add theirs to
+     enum sched_source.
+*/
+
+struct CPU;
+struct GPU;
+
+enum sched_source {
+	SCHED_TIMER, // DIV/TIMA, due at the next TIMA overflow
+	SCHED_PPU,   // due at the next mode change, LY increment or forced frame
+	SCHED_SOURCES
+};
+
+#define SCHED_NEVER UINT64_MAX
+
+struct sched_slot {
+	uint64_t synced; // time the source has been stepped up to
+	uint64_t due;    // time it next has to be stepped, SCHED_NEVER if it has nothing coming
+};
+
+struct scheduler {
+	uint64_t now;  // master clock, cycles since power on
+	uint64_t next; // earliest due of all sources
+	struct sched_slot slot[SCHED_SOURCES];
+	struct GPU *gpu; // GPU being run, NULL outside cpu_run_cycles()
+};
+
+/* Step a source up to now and schedule its next event
+   @param cpu Pointer to the CPU structure.
+   @param source Source to step.
+   @return void
+*/
+void sched_sync(struct CPU *cpu, enum sched_source source);
+
+/* Step every source whose event is due
+   @param cpu Pointer to the CPU structure.
+   @return void
+*/
+void sched_run_due(struct CPU *cpu);
+
+/* Step every source up to now
+   @param cpu Pointer to the CPU structure.
+   @return void
+*/
+void sched_sync_all(struct CPU *cpu);
+
+#endif
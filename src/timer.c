@@ -2,28 +2,34 @@
 #include "cpu.h"
 #include <stdint.h>
 
+// Cycles per TIMA increment for the clock select bits of TAC
+static uint16_t timer_period(uint8_t tac) {
+    switch (tac & 0x03) {
+        case 0: return 1024;    // 4096 Hz
+        case 1: return 16;      // 262144 Hz
+        case 2: return 64;      // 65536 Hz
+        default: return 256;    // 16384 Hz
+    }
+}
+
 void step_timer(struct CPU *cpu) {
+    timer_advance(cpu, cpu->cycles);
+}
+
+void timer_advance(struct CPU *cpu, uint32_t cycles) {
     // Update DIV register every 256 cycles (16384 Hz)
-    cpu->divider_cycles += cpu->cycles;
-    while (cpu->divider_cycles >= 256) {
-        cpu->divider_cycles -= 256;
-        cpu->bus.rom[0xFF04]++;
-    }
+    uint32_t divider = cpu->divider_cycles + cycles;
+    cpu->bus.io.div += divider / 256;
+    cpu->divider_cycles = divider % 256;
 
     // Timer control register
     uint8_t tac = READ_BYTE(cpu, 0xFF07);
     if (tac & 0x04) {  // Timer enabled
-        uint16_t freq;
-        switch (tac & 0x03) {
-            case 0: freq = 1024; break;     // 4096 Hz
-            case 1: freq = 16; break;       // 262144 Hz
-            case 2: freq = 64; break;       // 65536 Hz
-            case 3: freq = 256; break;     // 16384 Hz
-        }
+        uint16_t freq = timer_period(tac);
 
-        cpu->tima_counter += cpu->cycles;
-        while (cpu->tima_counter >= freq) {
-            cpu->tima_counter -= freq;
+        uint32_t counter = cpu->tima_counter + cycles;
+        while (counter >= freq) {
+            counter -= freq;
             uint8_t tima = READ_BYTE(cpu, 0xFF05);
             if (tima == 0xFF) {
                 WRITE_BYTE(cpu, 0xFF05, READ_BYTE(cpu, 0xFF06)); // Reload with TMA
@@ -32,8 +38,28 @@ void step_timer(struct CPU *cpu) {
                 WRITE_BYTE(cpu, 0xFF05, tima + 1);
             }
         }
+        cpu->tima_counter = counter;
     } else {
         // Reset tima_cycles when timer is disabled
         cpu->tima_counter = 0;
     }
-}
\ No newline at end of file
+}
+
+uint32_t timer_cycles_to_event(struct CPU *cpu, bool div, bool tima) {
+    uint32_t cycles = UINT32_MAX;
+    if (div) {
+        cycles = 256 - cpu->divider_cycles;
+    }
+    uint8_t tac = cpu->bus.io.tac;
+    if (tac & 0x04) {
+        uint16_t freq = timer_period(tac);
+        uint32_t next = freq - cpu->tima_counter; // next increment
+        if (!tima) {
+            next += (0xFF - cpu->bus.io.tima) * freq; // the one that overflows
+        }
+        if (next < cycles) {
+            cycles = next;
+        }
+    }
+    return cycles;
+}
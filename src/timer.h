@@ -18,5 +18,24 @@ struct Timer {
 
 void step_timer(struct CPU *cpu);
 
+/* Step the timer by any number of cycles
+   Same as calling step_timer() for each instruction they add up to, as long
+   as nothing writes the timer registers in between.
+   @param cpu Pointer to the CPU structure.
+   @param cycles Cycles to step by.
+   @return void
+*/
+void timer_advance(struct CPU *cpu, uint32_t cycles);
+
+/* Cycles until step_timer() next raises the timer interrupt
+   Stepping fewer cycles than this, in any number of calls, only counts DIV
+   and TIMA up. Used to fast-forward idle loops.
+   @param cpu Pointer to the CPU structure.
+   @param div Also stop at the next DIV increment.
+   @param tima Also stop at the next TIMA increment.
+   @return cycles until then, UINT32_MAX if the timer is off and neither is asked for
+*/
+uint32_t timer_cycles_to_event(struct CPU *cpu, bool div, bool tima);
+
 
 #endif
\ No newline at end of file
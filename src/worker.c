@@ -0,0 +1,332 @@
+#include "worker.h"
+#include "graphics.h"
+#include <stdlib.h>
+#include <string.h>
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
+#ifndef _WIN32
+
+#define OAM_BLOCK 512 // block numbers from here on are OAM, 16 bytes each
+#define OAM_BLOCKS 10 // FE00-FE9F
+
+// What render_scanline() reads for a line, besides VRAM and OAM
+struct line_record {
+    uint8_t ly;
+    uint8_t lcdc;
+    uint8_t scy;
+    uint8_t scx;
+    uint8_t bgp;
+    uint8_t obp0;
+    uint8_t obp1;
+    uint8_t wy;
+    uint8_t wx;
+    uint8_t window_line;
+    uint32_t blocks_end; // blocks[] up to here are copied in before the line is drawn
+};
+
+struct vram_block {
+    uint16_t index;   // 16-byte block of VRAM, or of OAM from OAM_BLOCK on
+    uint8_t data[16]; // its contents when the line was recorded
+};
+
+struct frame_record {
+    struct line_record *lines;
+    uint32_t line_count;
+    uint32_t line_capacity;
+    struct vram_block *blocks;
+    uint32_t block_count;
+    uint32_t block_capacity;
+};
+
+struct render_worker {
+    struct frame_record records[2];
+    struct frame_record *filling; // recorded into by step_gpu()
+    struct frame_record *drawing; // handed to the thread, NULL once drawn
+    struct GPU *gpu;              // the thread's own, drawing into its own framebuffer
+    struct MemoryBus *bus;        // its VRAM, OAM and LCD registers
+    pthread_t thread;
+    pthread_mutex_t lock;         // guards drawing and stop
+    pthread_cond_t wake;          // a frame was handed over, or stop
+    pthread_cond_t done;          // the frame handed over is drawn
+    bool stop;                    // thread exits
+};
+
+// Copy a line's blocks in, set its registers and draw it
+static void worker_draw(struct render_worker *worker, const struct frame_record *record) {
+    struct GPU *gpu = worker->gpu;
+    struct MemoryBus *bus = worker->bus;
+    uint32_t block = 0;
+    for (uint32_t i = 0; i < record->line_count; i++) {
+        const struct line_record *line = &record->lines[i];
+        for (; block < line->blocks_end; block++) {
+            const struct vram_block *copy = &record->blocks[block];
+            if (copy->index < OAM_BLOCK) {
+                memcpy(bus->vram + copy->index * 16, copy->data, 16);
+                vram_written(bus, 0x8000 + copy->index * 16);
+            } else {
+                memcpy(bus->oam + (copy->index - OAM_BLOCK) * 16, copy->data, 16);
+                bus->oam_dirty = true;
+            }
+        }
+        bus->io.ly = line->ly;
+        bus->io.lcdc = line->lcdc;
+        bus->io.scy = line->scy;
+        bus->io.scx = line->scx;
+        bus->io.bgp = line->bgp;
+        bus->io.obp0 = line->obp0;
+        bus->io.obp1 = line->obp1;
+        bus->io.wy = line->wy;
+        bus->io.wx = line->wx;
+        gpu->window_line = line->window_line;
+        render_scanline(gpu, line->ly);
+    }
+}
+
+static void *worker_thread(void *arg) {
+    struct render_worker *worker = arg;
+    pthread_mutex_lock(&worker->lock);
+    while (true) {
+        while (!worker->drawing && !worker->stop) {
+            pthread_cond_wait(&worker->wake, &worker->lock);
+        }
+        if (!worker->drawing) {
+            break; // stopped, with nothing left to draw
+        }
+        struct frame_record *record = worker->drawing;
+        pthread_mutex_unlock(&worker->lock);
+        worker_draw(worker, record);
+        pthread_mutex_lock(&worker->lock);
+        worker->drawing = NULL;
+        pthread_cond_signal(&worker->done);
+    }
+    pthread_mutex_unlock(&worker->lock);
+    return NULL;
+}
+
+// Wait for the frame handed over last to be drawn
+static void worker_wait(struct render_worker *worker) {
+    pthread_mutex_lock(&worker->lock);
+    while (worker->drawing) {
+        pthread_cond_wait(&worker->done, &worker->lock);
+    }
+    pthread_mutex_unlock(&worker->lock);
+}
+
+// Hand the recorded lines to the thread and start recording into the other record
+static void worker_submit(struct render_worker *worker) {
+    struct frame_record *record = worker->filling;
+    if (!record->line_count) {
+        return; // nothing to draw, blocks are only copied with a line
+    }
+    pthread_mutex_lock(&worker->lock);
+    worker->drawing = record;
+    pthread_cond_signal(&worker->wake);
+    pthread_mutex_unlock(&worker->lock);
+    worker->filling = record == &worker->records[0] ? &worker->records[1] : &worker->records[0];
+    worker->filling->line_count = 0;
+    worker->filling->block_count = 0;
+}
+
+// Room for one more line and `blocks` more blocks
+static bool record_reserve(struct frame_record *record, uint32_t blocks) {
+    if (record->line_count == record->line_capacity) {
+        // the LCD was switched off and on again without a frame ending
+        uint32_t capacity = record->line_capacity * 2;
+        struct line_record *lines = realloc(record->lines, capacity * sizeof(struct line_record));
+        if (!lines) {
+            return false;
+        }
+        record->lines = lines;
+        record->line_capacity = capacity;
+    }
+    if (record->block_count + blocks > record->block_capacity) {
+        uint32_t capacity = record->block_capacity * 2;
+        while (capacity < record->block_count + blocks) {
+            capacity *= 2;
+        }
+        struct vram_block *copies = realloc(record->blocks, capacity * sizeof(struct vram_block));
+        if (!copies) {
+            return false;
+        }
+        record->blocks = copies;
+        record->block_capacity = capacity;
+    }
+    return true;
+}
+
+void worker_record_line(struct GPU *gpu) {
+    struct render_worker *worker = gpu->worker;
+    struct frame_record *record = worker->filling;
+    struct MemoryBus *bus = gpu->bus;
+    if (bus->io.ly >= SCREEN_HEIGHT) {
+        return; // render_scanline() neither draws it nor moves the window on; blocks go with the next line
+    }
+
+    uint32_t blocks = bus->oam_dirty ? OAM_BLOCKS : 0;
+    for (int word = 0; word < 8; word++) {
+        blocks += __builtin_popcountll(bus->vram_dirty[word]);
+    }
+    if (!record_reserve(record, blocks)) {
+        LOG("Render worker out of memory, line %d not drawn\n", bus->io.ly);
+        return; // the blocks stay marked and go with the next line
+    }
+    for (int word = 0; word < 8; word++) {
+        while (bus->vram_dirty[word]) {
+            int index = word * 64 + __builtin_ctzll(bus->vram_dirty[word]);
+            bus->vram_dirty[word] &= bus->vram_dirty[word] - 1;
+            struct vram_block *copy = &record->blocks[record->block_count++];
+            copy->index = index;
+            memcpy(copy->data, bus->vram + index * 16, 16);
+        }
+    }
+    if (bus->oam_dirty) {
+        bus->oam_dirty = false; // the GPU doesn't index sprites while the worker draws
+        for (int index = 0; index < OAM_BLOCKS; index++) {
+            struct vram_block *copy = &record->blocks[record->block_count++];
+            copy->index = OAM_BLOCK + index;
+            memcpy(copy->data, bus->oam + index * 16, 16);
+        }
+    }
+
+    const union io_regs *io = &bus->io;
+    record->lines[record->line_count++] = (struct line_record){
+        .ly = io->ly,
+        .lcdc = io->lcdc,
+        .scy = io->scy,
+        .scx = io->scx,
+        .bgp = io->bgp,
+        .obp0 = io->obp0,
+        .obp1 = io->obp1,
+        .wy = io->wy,
+        .wx = io->wx,
+        .window_line = gpu->window_line,
+        .blocks_end = record->block_count,
+    };
+    if (gpu_window_on_line(io->lcdc, io->ly, io->wy)) {
+        gpu->window_line++;
+    }
+}
+
+void worker_end_frame(struct GPU *gpu) {
+    struct render_worker *worker = gpu->worker;
+    worker_wait(worker);
+    memcpy(gpu->framebuffer, worker->gpu->framebuffer, sizeof(gpu->framebuffer));
+    worker_submit(worker);
+}
+
+static void worker_free(struct render_worker *worker) {
+    for (int i = 0; i < 2; i++) {
+        free(worker->records[i].lines);
+        free(worker->records[i].blocks);
+    }
+    free(worker->gpu);
+    free(worker->bus);
+    free(worker);
+}
+
+int gpu_start_worker(struct CPU *cpu, struct GPU *gpu) {
+    if (gpu->worker) {
+        return -1;
+    }
+    struct render_worker *worker = calloc(1, sizeof(struct render_worker));
+    if (!worker) {
+        return -1;
+    }
+    worker->gpu = calloc(1, sizeof(struct GPU));
+    worker->bus = aligned_alloc(BUS_ALIGN, sizeof(struct MemoryBus));
+    bool allocated = worker->gpu && worker->bus;
+    for (int i = 0; i < 2; i++) {
+        struct frame_record *record = &worker->records[i];
+        record->line_capacity = SCREEN_HEIGHT;
+        record->lines = malloc(record->line_capacity * sizeof(struct line_record));
+        record->block_capacity = 1024;
+        record->blocks = malloc(record->block_capacity * sizeof(struct vram_block));
+        allocated = allocated && record->lines && record->blocks;
+    }
+    if (!allocated) {
+        worker_free(worker);
+        return -1;
+    }
+
+    // the thread starts from VRAM, OAM and the screen as they are now
+    struct MemoryBus *bus = gpu->bus;
+    memset(worker->bus, 0, sizeof(struct MemoryBus));
+    memcpy(worker->bus->vram, bus->vram, sizeof(bus->vram));
+    memcpy(worker->bus->oam, bus->oam, sizeof(bus->oam));
+    memset(worker->bus->tile_dirty, 0xFF, sizeof(worker->bus->tile_dirty));
+    worker->bus->oam_dirty = true;
+    worker->gpu->bus = worker->bus;
+    memcpy(worker->gpu->framebuffer, gpu->framebuffer, sizeof(gpu->framebuffer));
+    worker->filling = &worker->records[0];
+
+    pthread_mutex_init(&worker->lock, NULL);
+    pthread_cond_init(&worker->wake, NULL);
+    pthread_cond_init(&worker->done, NULL);
+    if (pthread_create(&worker->thread, NULL, worker_thread, worker) != 0) {
+        pthread_mutex_destroy(&worker->lock);
+        pthread_cond_destroy(&worker->wake);
+        pthread_cond_destroy(&worker->done);
+        worker_free(worker);
+        return -1;
+    }
+    memset(bus->vram_dirty, 0, sizeof(bus->vram_dirty));
+    bus->oam_dirty = false;
+    bus->vram_watched = true;
+    gpu->worker = worker;
+    memory_map_update(cpu); // tile map writes mark their blocks
+    return 0;
+}
+
+void gpu_stop_worker(struct CPU *cpu, struct GPU *gpu) {
+    struct render_worker *worker = gpu->worker;
+    if (!worker) {
+        return;
+    }
+    // the lines of the frame in progress as well
+    worker_wait(worker);
+    worker_submit(worker);
+    worker_wait(worker);
+    memcpy(gpu->framebuffer, worker->gpu->framebuffer, sizeof(gpu->framebuffer));
+
+    pthread_mutex_lock(&worker->lock);
+    worker->stop = true;
+    pthread_cond_signal(&worker->wake);
+    pthread_mutex_unlock(&worker->lock);
+    pthread_join(worker->thread, NULL);
+    pthread_mutex_destroy(&worker->lock);
+    pthread_cond_destroy(&worker->wake);
+    pthread_cond_destroy(&worker->done);
+    worker_free(worker);
+    gpu->worker = NULL;
+
+    // the GPU's decoded tiles and sprite index are from before the worker
+    memset(gpu->bus->tile_dirty, 0xFF, sizeof(gpu->bus->tile_dirty));
+    gpu->bus->oam_dirty = true;
+    gpu->bus->vram_watched = false;
+    memory_map_update(cpu);
+}
+
+#else
+
+int gpu_start_worker(struct CPU *cpu, struct GPU *gpu) {
+    (void)cpu;
+    (void)gpu;
+    return -1; // no threads, the GPU draws inline
+}
+
+void gpu_stop_worker(struct CPU *cpu, struct GPU *gpu) {
+    (void)cpu;
+    (void)gpu;
+}
+
+void worker_record_line(struct GPU *gpu) {
+    (void)gpu;
+}
+
+void worker_end_frame(struct GPU *gpu) {
+    (void)gpu;
+}
+
+#endif
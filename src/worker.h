@@ -0,0 +1,69 @@
+#ifndef _WORKER_H
+#define _WORKER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Deferred rendering on a worker thread
+   With a worker started, step_gpu() doesn't draw: at the end of each line's
+   pixel transfer it records what render_scanline() would have read, and a
+   second thread draws the frame from that record while the CPU runs the
+   next one.
+
+   A line's record is the registers the renderer reads (LCDC, SCY, SCX, BGP,
+   OBP0, OBP1, WY, WX), the window line counter, and a copy of the VRAM
+   blocks (16 bytes, see vram_written()) and OAM written since the line
+   before. The worker keeps its own VRAM, OAM and GPU, applies each line's
+   copies and draws it with render_scanline() as it is, so mid-frame palette,
+   scroll, window and VRAM changes come out the same.
+
+   There are two records: the CPU fills one while the worker draws the
+   other. Where step_gpu() sets should_render, the frame in flight is waited
+   for and copied to gpu->framebuffer, and the one just recorded is handed
+   over. The framebuffer thus shows the frame before the one just finished,
+   exactly as it would have been drawn; everything else (LY, STAT,
+   interrupts, the render policy) is as without the worker.
+
+   Not available on Windows: gpu_start_worker() fails and the GPU draws
+   inline.
+*/
+
+struct CPU;
+struct GPU;
+
+struct render_worker; // the records and the thread, in worker.c
+
+/* Start drawing on a worker thread
+   Takes a copy of VRAM, OAM and the framebuffer as they are now. The VRAM
+   tile maps come off the page table (memmap.h), so every VRAM write is
+   seen.
+   @param cpu Pointer to the CPU structure.
+   @param gpu Pointer to the GPU structure, drawing for the CPU's bus.
+   @return 0 on success, -1 if the thread couldn't be started (the GPU
+           keeps drawing inline)
+*/
+int gpu_start_worker(struct CPU *cpu, struct GPU *gpu);
+
+/* Draw what is recorded, stop the worker and draw inline again
+   gpu->framebuffer ends up as inline drawing would have left it. Does
+   nothing if no worker is running.
+   @param cpu Pointer to the CPU structure.
+   @param gpu Pointer to the GPU structure.
+   @return void
+*/
+void gpu_stop_worker(struct CPU *cpu, struct GPU *gpu);
+
+/* Record the line in pixel transfer, in place of render_scanline()
+   @param gpu Pointer to the GPU structure.
+   @return void
+*/
+void worker_record_line(struct GPU *gpu);
+
+/* Collect the frame drawn last and hand over the one recorded
+   Called by step_gpu() as it sets should_render.
+   @param gpu Pointer to the GPU structure.
+   @return void
+*/
+void worker_end_frame(struct GPU *gpu);
+
+#endif